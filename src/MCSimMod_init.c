@@ -1,4 +1,5 @@
 #include <stdlib.h> // for NULL
+#include <Rinternals.h>
 #include <R_ext/Rdynload.h>
 
 /* FIXME: 
@@ -13,8 +14,20 @@ static const R_CMethodDef CEntries[] = {
     {NULL, NULL, 0}
 };
 
+/* .Call calls */
+extern SEXP c_runEnsemble(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP c_translate(SEXP, SEXP, SEXP);
+extern SEXP c_translateModels(SEXP, SEXP, SEXP, SEXP);
+
+static const R_CallMethodDef CallEntries[] = {
+    {"c_runEnsemble",     (DL_FUNC) &c_runEnsemble,     7},
+    {"c_translate",       (DL_FUNC) &c_translate,       3},
+    {"c_translateModels", (DL_FUNC) &c_translateModels, 4},
+    {NULL, NULL, 0}
+};
+
 void R_init_MCSimMod(DllInfo *dll)
 {
-    R_registerRoutines(dll, CEntries, NULL, NULL, NULL);
+    R_registerRoutines(dll, CEntries, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
 }
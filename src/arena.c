@@ -0,0 +1,129 @@
+/* arena.c
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Memory arenas: allocations are taken in turn from large blocks and
+   are never freed one by one; FreeArena() releases them all. The
+   translator keeps everything a model is read into in an arena, so
+   that the nodes of a list lie close together and cleaning up is one
+   call.
+*/
+#define R_NO_REMAP
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* ---------------------------------------------------------------------------
+   InitArena, FreeArena
+*/
+void InitArena(PARENA parena) {
+  parena->pabFirst = NULL;
+  parena->cbTotal = 0;
+
+} /* InitArena */
+
+void FreeArena(PARENA parena) {
+  PARENABLOCK pab;
+
+  while ((pab = parena->pabFirst)) {
+    parena->pabFirst = pab->pabNext;
+    free(pab);
+  }
+  parena->cbTotal = 0;
+
+} /* FreeArena */
+
+/* ---------------------------------------------------------------------------
+   ArenaAlloc
+
+   Returns cb bytes of uninitialized memory from the arena, or NULL if
+   out of memory. Requests larger than a block get a block of their own,
+   put behind the current one so that its free space is not lost.
+*/
+PVOID ArenaAlloc(PARENA parena, size_t cb) {
+  PARENABLOCK pab = parena->pabFirst;
+  size_t cbHead = (sizeof(ARENABLOCK) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  PVOID pv;
+
+  cb = (cb + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (!cb) {
+    cb = ARENA_ALIGN;
+  }
+
+  if (!pab || pab->cbSize - pab->cbUsed < cb) {
+    size_t cbSize = (cb > ARENA_BLOCKSIZE - cbHead ? cb : ARENA_BLOCKSIZE - cbHead);
+
+    if (!(pab = (PARENABLOCK)malloc(cbHead + cbSize))) {
+      return (NULL);
+    }
+    pab->cbSize = cbSize;
+    pab->cbUsed = 0;
+
+    if (parena->pabFirst && cbSize > ARENA_BLOCKSIZE - cbHead) { /* Oversized */
+      pab->pabNext = parena->pabFirst->pabNext;
+      parena->pabFirst->pabNext = pab;
+    } else {
+      pab->pabNext = parena->pabFirst;
+      parena->pabFirst = pab;
+    }
+  } /* if */
+
+  pv = (PVOID)((char *)pab + cbHead + pab->cbUsed);
+  pab->cbUsed += cb;
+  parena->cbTotal += cb;
+
+  return (pv);
+
+} /* ArenaAlloc */
+
+/* ---------------------------------------------------------------------------
+   ArenaCalloc
+
+   Same as ArenaAlloc(), with the memory zeroed.
+*/
+PVOID ArenaCalloc(PARENA parena, size_t cb) {
+  PVOID pv = ArenaAlloc(parena, cb);
+
+  if (pv) {
+    memset(pv, 0, cb);
+  }
+  return (pv);
+
+} /* ArenaCalloc */
+
+/* ---------------------------------------------------------------------------
+   ArenaCopyString
+
+   Returns a copy of sz in the arena, or NULL if out of memory.
+*/
+PSTR ArenaCopyString(PARENA parena, PSTR sz) {
+  size_t cb = strlen(sz) + 1;
+  PSTR szCopy = (PSTR)ArenaAlloc(parena, cb);
+
+  if (szCopy) {
+    memcpy(szCopy, sz, cb);
+  }
+  return (szCopy);
+
+} /* ArenaCopyString */
+
+/* End */
@@ -0,0 +1,69 @@
+/* arena.h
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Header file for the memory arenas of arena.c
+*/
+
+#ifndef ARENA_H_DEFINED
+
+/* ---------------------------------------------------------------------------
+   Inclusions  */
+
+#include <stddef.h>
+
+#include "hungtype.h"
+
+/* ---------------------------------------------------------------------------
+   Constants  */
+
+#define ARENA_BLOCKSIZE 65536L /* Bytes of a block, unless more are needed */
+#define ARENA_ALIGN 16          /* Alignment of allocations */
+
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* A block of an arena, followed by its memory */
+typedef struct tagARENABLOCK {
+  struct tagARENABLOCK *pabNext;
+  size_t cbSize;
+  size_t cbUsed;
+
+} ARENABLOCK, *PARENABLOCK; /* tagARENABLOCK */
+
+/* Memory allocated by bumping a pointer, and released all at once.
+   A zeroed ARENA is empty and ready for use. */
+typedef struct tagARENA {
+  PARENABLOCK pabFirst; /* Current block, at the head */
+  size_t cbTotal;       /* Bytes handed out */
+
+} ARENA, *PARENA; /* tagARENA */
+
+/* ---------------------------------------------------------------------------
+   Prototypes */
+
+PVOID ArenaAlloc(PARENA parena, size_t cb);
+PVOID ArenaCalloc(PARENA parena, size_t cb);
+PSTR ArenaCopyString(PARENA parena, PSTR sz);
+void FreeArena(PARENA parena);
+void InitArena(PARENA parena);
+
+#define ARENA_H_DEFINED
+#endif
+
+/* End */
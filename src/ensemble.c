@@ -0,0 +1,1050 @@
+/* ensemble.c
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Runs a compiled model over many parameter sets in native code.
+
+   Each run gets its own model context (see Write_R_Decls() in modo.c)
+   and its own integrator, so runs are independent and are spread over
+   OpenMP threads. Runs are handed out one at a time (dynamic schedule)
+   because their costs can differ by orders of magnitude.
+
+   If the model has a lane-batched kernel (derivs_batch), each thread
+   instead integrates BATCH_W runs in lockstep, one per lane, with
+   per-lane step control; a lane that finishes its run takes the next
+   one right away.
+
+   Runs are integrated with Dormand-Prince 5(4), which tests whether the
+   problem has become stiff. By default (EM_AUTO) a run found stiff goes
+   on with the Rosenbrock method, with the Jacobian derived from the
+   model's Dynamics if it has one, else by finite differences; a lane
+   found stiff ends its run, which is then run again from the start, one
+   at a time. EM_ROSENBROCK uses that method throughout, one run at a
+   time, and EM_DOPRI5 stops stiff runs with ODE_STIFF.
+
+   Inputs defined in the model (PerDose() etc.) jump at times the model
+   gives through getInputTimes_ctx(). The integrator stops at each jump
+   and starts afresh after it, as it would at an output time, so that no
+   step straddles one. The doses of the model's Doses section are listed
+   among these times, and given there by doses_ctx(); at an output time,
+   after the output is stored, as deSolve does with events.
+
+   All R objects are allocated before the parallel region; the threads
+   only read the inputs and write into the result array.
+*/
+#define R_NO_REMAP
+#include <R.h>
+#include <Rinternals.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "ensemble.h"
+#include "odesolve.h"
+
+/* Per thread state, passed to EnsembleRhs() through the solver */
+typedef struct tagRUNNER {
+  PVOID pctx;        /* Model context */
+  PDOUBLE rgdForc;   /* The context's forcing values */
+  PFORCING rgforc;   /* Forcing functions of the current run */
+  int nInputs;
+  PFN_DERIVS_CTX pfnDerivs;
+  PFN_OUTPUTS_CTX pfnOutputs;
+  PDOUBLE rgdYout;   /* Outputs at the last output time */
+  PDOUBLE rgdYdot;   /* Scratch derivatives */
+  PDOUBLE rgdY;      /* Current state */
+  PFN_INPUTTIMES_CTX pfnInputTimes; /* NULL if the inputs do not jump */
+  PFN_DOSES_CTX pfnDoses;           /* NULL if nothing is dosed */
+  TCRIT tc;          /* Jumps of the current run's inputs, and doses */
+  PFN_JAC_CTX pfnJac; /* NULL for finite differences */
+  PFN_HISTSTORE_CTX pfnHistStore; /* NULL if nothing is delayed */
+  int nStates;
+  int iMethod;       /* EM_* */
+  BOOL bStiff;       /* The current run is integrated with the Rosenbrock method */
+  BOOL bHistLost;    /* Its delays read before the history kept */
+
+} RUNNER, *PRUNNER; /* tagRUNNER */
+
+/* Per thread state of the lane-batched path. Arrays are [variable][lane]. */
+typedef struct tagBATCHRUNNER {
+  PVOID pbctx;         /* Lane-batched model context */
+  PDOUBLE rgdParms;    /* Its parameters */
+  PDOUBLE rgdForc;     /* Its forcing values */
+  PFORCING *rgpforc;   /* Forcing functions of each lane's run */
+  int nInputs;
+  int nLanes;
+  PFN_DERIVS_BATCH pfnDerivs;
+  PFN_OUTPUTS_BATCH pfnOutputs;
+  PFN_HOIST_BATCH pfnHoist;
+  PDOUBLE rgdYout;     /* Outputs at the lanes' last output times */
+  PDOUBLE rgdYdot;     /* Scratch derivatives */
+  int *rgiRun;         /* Run in each lane, -1 if none */
+  int *rgiTime;        /* Index of the next output time of each lane */
+  int *rgbPending;     /* Lane has reached an output time not yet stored */
+  int *rgiStatus;
+  int nStates;
+  PFN_INPUTTIMES_CTX pfnInputTimes; /* NULL if the inputs do not jump */
+  PFN_DOSES_CTX pfnDoses;           /* NULL if nothing is dosed */
+  PBYTE rgbCtx;        /* Model context of each lane's run, giving its jumps and doses */
+  size_t cbCtx;
+  PFN_CTXFIELD pfnGetCtxParms;
+  PFN_HOIST_CTX pfnHoistCtx;
+  PTCRIT rgtc;         /* Jumps of each lane's run, NULL if none */
+  PDOUBLE rgdTrhs;     /* Lane times passed to derivs_batch */
+  PDOUBLE rgdYlane;    /* State of one lane, dosed */
+  BOOL bNoMem;
+
+} BATCHRUNNER, *PBATCHRUNNER; /* tagBATCHRUNNER */
+
+/* Inputs shared by all threads */
+typedef struct tagENSEMBLE {
+  int nStates, nOutputs, nParms, nInputs, nTimes, nRuns, nVars, nSets;
+  PDOUBLE rgdTimes, rgdParms, rgdY0, rgdOut;
+  int *rgiIstate;
+  PFORCING rgforc;
+  int iNextRun; /* Next run to hand out */
+
+} ENSEMBLE, *PENSEMBLE; /* tagENSEMBLE */
+
+/* ----------------------------------------------------------------------------
+   InterpForcing
+
+   Linear interpolation in a forcing time series; values are held constant
+   outside of its time range.
+*/
+double InterpForcing(PFORCING pforc, double dT) {
+  int iLo = 0, iHi = pforc->nPts - 1, iMid;
+  PDOUBLE rgdT = pforc->rgdT;
+
+  if (dT <= rgdT[0]) {
+    return (pforc->rgdVal[0]);
+  }
+  if (dT >= rgdT[iHi]) {
+    return (pforc->rgdVal[iHi]);
+  }
+
+  while (iHi - iLo > 1) {
+    iMid = (iLo + iHi) / 2;
+    if (rgdT[iMid] <= dT) {
+      iLo = iMid;
+    } else {
+      iHi = iMid;
+    }
+  }
+
+  return (pforc->rgdVal[iLo] +
+          (pforc->rgdVal[iHi] - pforc->rgdVal[iLo]) * (dT - rgdT[iLo]) / (rgdT[iHi] - rgdT[iLo]));
+
+} /* InterpForcing */
+
+/* ----------------------------------------------------------------------------
+   GetInputJumps
+
+   Fills ptc with the times from dT0 up to dT1 at which the inputs of
+   the run set up in pctx jump or its doses are given. Returns FALSE,
+   leaving ptc empty, if out of memory.
+*/
+static BOOL GetInputJumps(PFN_INPUTTIMES_CTX pfnInputTimes, PVOID pctx, PTCRIT ptc, double dT0, double dT1) {
+  int n;
+  PDOUBLE rgdT;
+
+  ptc->nT = ptc->iNext = 0;
+  n = (*pfnInputTimes)(pctx, dT0, dT1, ptc->rgdT, ptc->nMax);
+  if (n > ptc->nMax) {
+    rgdT = (PDOUBLE)realloc(ptc->rgdT, n * sizeof(double));
+    if (!rgdT) {
+      return (FALSE);
+    }
+    ptc->rgdT = rgdT;
+    ptc->nMax = n;
+    n = (*pfnInputTimes)(pctx, dT0, dT1, ptc->rgdT, ptc->nMax);
+  }
+  ptc->nT = n;
+
+  return (TRUE);
+
+} /* GetInputJumps */
+
+/* ----------------------------------------------------------------------------
+   NextJump
+
+   Returns the next jump not reached yet, INFINITY if there is none.
+*/
+static double NextJump(PTCRIT ptc) {
+  return (ptc->iNext < ptc->nT ? ptc->rgdT[ptc->iNext] : INFINITY);
+
+} /* NextJump */
+
+/* ----------------------------------------------------------------------------
+   PassJumps
+
+   Moves past the jumps at or before dT. Returns TRUE if there were any,
+   in which case the integrator must start afresh.
+*/
+static BOOL PassJumps(PTCRIT ptc, double dT) {
+  BOOL bPassed = FALSE;
+
+  while (ptc->iNext < ptc->nT && ptc->rgdT[ptc->iNext] <= dT) {
+    ptc->iNext++;
+    bPassed = TRUE;
+  }
+
+  return (bPassed);
+
+} /* PassJumps */
+
+/* ----------------------------------------------------------------------------
+   SetForcings
+
+   Sets the context's forcing values at dT.
+*/
+static void SetForcings(PRUNNER prun, double dT) {
+  int i;
+
+  for (i = 0; i < prun->nInputs; i++) {
+    prun->rgdForc[i] = InterpForcing(&prun->rgforc[i], dT);
+  }
+
+} /* SetForcings */
+
+/* ----------------------------------------------------------------------------
+   PassStops
+
+   Moves the run past the jumps at or before dT, where the integrator
+   stands, giving the doses due there and starting the integrator afresh.
+   The history of delayed variables gets the point past them.
+*/
+static void PassStops(PRUNNER prun, PODESOLVER psolv, double dT) {
+  if (PassJumps(&prun->tc, dT)) {
+    if (prun->pfnDoses) {
+      (*prun->pfnDoses)(prun->pctx, dT, prun->rgdY);
+    }
+    if (prun->pfnHistStore) {
+      SetForcings(prun, dT);
+      prun->bHistLost |= (*prun->pfnHistStore)(prun->pctx, dT, prun->rgdY, NULL);
+    }
+    psolv->dH = 0.0;
+  }
+
+} /* PassStops */
+
+/* ----------------------------------------------------------------------------
+   EnsembleRhs
+
+   Right hand side for the integrator: sets the forcings at dT and calls
+   the model's derivs_ctx(). The integrator stops at the next jump of the
+   inputs, where they take the values just before it.
+*/
+static void EnsembleRhs(PVOID pData, double dT, PDOUBLE rgdY, PDOUBLE rgdYdot) {
+  PRUNNER prun = (PRUNNER)pData;
+  double dTjump = NextJump(&prun->tc);
+
+  if (dT >= dTjump) {
+    dT = nextafter(dTjump, -INFINITY);
+  }
+  SetForcings(prun, dT);
+  (*prun->pfnDerivs)(prun->pctx, &dT, rgdY, rgdYdot, prun->rgdYout);
+
+} /* EnsembleRhs */
+
+/* ----------------------------------------------------------------------------
+   EnsembleStep
+
+   Accepted point of the integrator: stores it in the history of the
+   delayed variables. EnsembleRhs() has just set the forcings there.
+*/
+static void EnsembleStep(PVOID pData, double dT, PDOUBLE rgdY, PDOUBLE rgdYdot) {
+  PRUNNER prun = (PRUNNER)pData;
+
+  prun->bHistLost |= (*prun->pfnHistStore)(prun->pctx, dT, rgdY, rgdYdot);
+
+} /* EnsembleStep */
+
+/* ----------------------------------------------------------------------------
+   EnsembleJac
+
+   Jacobian for the Rosenbrock method: calls the model's jac_ctx() with
+   the forcings at dT, as EnsembleRhs() calls derivs_ctx().
+*/
+static void EnsembleJac(PVOID pData, double dT, PDOUBLE rgdY, PDOUBLE rgdJac) {
+  PRUNNER prun = (PRUNNER)pData;
+  double dTjump = NextJump(&prun->tc);
+  int nEq = prun->nStates, nBand = 0;
+
+  if (dT >= dTjump) {
+    dT = nextafter(dTjump, -INFINITY);
+  }
+  SetForcings(prun, dT);
+  memset(rgdJac, 0, (size_t)nEq * nEq * sizeof(double));
+  (*prun->pfnJac)(prun->pctx, &nEq, &dT, rgdY, &nBand, &nBand, rgdJac, &nEq, prun->rgdYout);
+
+} /* EnsembleJac */
+
+/* ----------------------------------------------------------------------------
+   SetBatchForcings
+
+   Sets each lane's forcing values at its own time.
+*/
+static void SetBatchForcings(PBATCHRUNNER pbr, PDOUBLE rgdT) {
+  int i, w;
+
+  for (w = 0; w < pbr->nLanes; w++) {
+    if (pbr->rgpforc[w]) {
+      for (i = 0; i < pbr->nInputs; i++) {
+        pbr->rgdForc[i * pbr->nLanes + w] = InterpForcing(&pbr->rgpforc[w][i], rgdT[w]);
+      }
+    }
+  }
+
+} /* SetBatchForcings */
+
+/* ----------------------------------------------------------------------------
+   EnsembleBatchRhs
+
+   Lane-batched right hand side: sets the forcings and calls the model's
+   derivs_batch(). Lanes at the next jump of their inputs get the values
+   just before it, as in EnsembleRhs().
+*/
+static void EnsembleBatchRhs(PVOID pData, PDOUBLE rgdT, PDOUBLE rgdY, PDOUBLE rgdYdot) {
+  PBATCHRUNNER pbr = (PBATCHRUNNER)pData;
+  int w;
+  double dTjump;
+
+  if (pbr->rgtc) {
+    for (w = 0; w < pbr->nLanes; w++) {
+      dTjump = NextJump(&pbr->rgtc[w]);
+      pbr->rgdTrhs[w] = (rgdT[w] >= dTjump ? nextafter(dTjump, -INFINITY) : rgdT[w]);
+    }
+    rgdT = pbr->rgdTrhs;
+  }
+  SetBatchForcings(pbr, rgdT);
+  (*pbr->pfnDerivs)(pbr->pbctx, rgdT, rgdY, rgdYdot, pbr->rgdYout);
+
+} /* EnsembleBatchRhs */
+
+/* ----------------------------------------------------------------------------
+   GetForcings
+
+   Checks the forcing sets passed from R and points FORCING structures at
+   their data. sForcs is a list of zero, one (shared) or nRuns lists of
+   nInputs two-column matrices (time, value).
+*/
+static PFORCING GetForcings(SEXP sForcs, int nInputs, int nRuns, int *pnSets) {
+  int iSet, i, nSets = (Rf_isNull(sForcs) ? 0 : LENGTH(sForcs));
+  PFORCING rgforc;
+  SEXP sSet, sMat;
+
+  *pnSets = nSets;
+  if (nInputs == 0) {
+    return (NULL);
+  }
+
+  if (nSets != 1 && nSets != nRuns) {
+    Rf_error("forcings must be given once or once per run");
+  }
+
+  rgforc = (PFORCING)R_alloc(nSets * nInputs, sizeof(FORCING));
+  for (iSet = 0; iSet < nSets; iSet++) {
+    sSet = VECTOR_ELT(sForcs, iSet);
+    if (!Rf_isNewList(sSet) || LENGTH(sSet) != nInputs) {
+      Rf_error("each forcing set must be a list of %d time series", nInputs);
+    }
+
+    for (i = 0; i < nInputs; i++) {
+      sMat = VECTOR_ELT(sSet, i);
+      if (!Rf_isReal(sMat) || !Rf_isMatrix(sMat) || Rf_ncols(sMat) != 2 || Rf_nrows(sMat) < 1) {
+        Rf_error("forcing time series must be numeric two-column matrices");
+      }
+      rgforc[iSet * nInputs + i].nPts = Rf_nrows(sMat);
+      rgforc[iSet * nInputs + i].rgdT = REAL(sMat);
+      rgforc[iSet * nInputs + i].rgdVal = REAL(sMat) + Rf_nrows(sMat);
+    }
+  }
+
+  return (rgforc);
+
+} /* GetForcings */
+
+/* ----------------------------------------------------------------------------
+   WriteRow
+
+   Stores time, states and outputs at output time iTime of run iRun.
+*/
+static void WriteRow(PRUNNER prun, double dT, PDOUBLE rgdOut, int iTime, int nTimes, int nStates, int nOutputs) {
+  int j;
+
+  SetForcings(prun, dT);
+  (*prun->pfnOutputs)(prun->pctx, &dT, prun->rgdY, prun->rgdYout);
+
+  rgdOut[iTime] = dT;
+  for (j = 0; j < nStates; j++) {
+    rgdOut[iTime + (R_xlen_t)nTimes * (1 + j)] = prun->rgdY[j];
+  }
+  for (j = 0; j < nOutputs; j++) {
+    rgdOut[iTime + (R_xlen_t)nTimes * (1 + nStates + j)] = prun->rgdYout[j];
+  }
+
+} /* WriteRow */
+
+/* ----------------------------------------------------------------------------
+   Advance
+
+   Integrates the run from *pdT to dTout with its method. Under EM_AUTO,
+   a run found stiff goes on with the Rosenbrock method from the point
+   where it was found so.
+*/
+static int Advance(PRUNNER prun, PODESOLVER psolv, PDOUBLE pdT, double dTout) {
+  int iRet;
+
+  if (prun->bStiff) {
+    return (RosenbrockAdvance(psolv, pdT, dTout, prun->rgdY));
+  }
+
+  iRet = Dopri5Advance(psolv, pdT, dTout, prun->rgdY);
+  if (iRet == ODE_STIFF && prun->iMethod == EM_AUTO) {
+    prun->bStiff = TRUE;
+    iRet = RosenbrockAdvance(psolv, pdT, dTout, prun->rgdY);
+  }
+
+  return (iRet);
+
+} /* Advance */
+
+/* ----------------------------------------------------------------------------
+   RunOne
+
+   Integrates one run over the output times, stopping at the jumps of
+   its inputs and its doses on the way. rgdOut points at the nTimes x
+   nVars slab of this run. Returns the integrator's status, or
+   EN_HISTLOST once its delays have read before the history kept by the
+   model; on failure the remaining rows are set to NA.
+*/
+static int RunOne(PRUNNER prun, PODESOLVER psolv, PDOUBLE rgdTimes, int nTimes, PDOUBLE rgdOut, int nStates,
+                  int nOutputs) {
+  int iTime, j, iRet = ODE_SUCCESS;
+  double dT = rgdTimes[0];
+
+  psolv->dH = 0.0;
+  psolv->nStiff = psolv->nNonStiff = 0;
+  prun->bStiff = (prun->iMethod == EM_ROSENBROCK);
+  prun->bHistLost = FALSE;
+  if (prun->pfnHistStore) {
+    SetForcings(prun, dT);
+    (*prun->pfnHistStore)(prun->pctx, dT, prun->rgdY, NULL);
+  }
+  WriteRow(prun, dT, rgdOut, 0, nTimes, nStates, nOutputs);
+  PassStops(prun, psolv, dT);
+
+  for (iTime = 1; iTime < nTimes; iTime++) {
+    while (iRet == ODE_SUCCESS && NextJump(&prun->tc) < rgdTimes[iTime]) {
+      iRet = Advance(prun, psolv, &dT, NextJump(&prun->tc));
+      if (iRet == ODE_SUCCESS) {
+        PassStops(prun, psolv, dT);
+      }
+    }
+    if (iRet == ODE_SUCCESS) {
+      iRet = Advance(prun, psolv, &dT, rgdTimes[iTime]);
+    }
+    if (iRet == ODE_SUCCESS && prun->bHistLost) {
+      iRet = EN_HISTLOST;
+    }
+    if (iRet != ODE_SUCCESS) {
+      break;
+    }
+    WriteRow(prun, dT, rgdOut, iTime, nTimes, nStates, nOutputs);
+    PassStops(prun, psolv, dT);
+  }
+
+  for (; iTime < nTimes; iTime++) {
+    rgdOut[iTime] = rgdTimes[iTime];
+    for (j = 0; j < nStates + nOutputs; j++) {
+      rgdOut[iTime + (R_xlen_t)nTimes * (1 + j)] = NA_REAL;
+    }
+  }
+
+  return (iRet);
+
+} /* RunOne */
+
+/* ----------------------------------------------------------------------------
+   NextRun
+
+   Hands out the next run index, shared by all threads; nRuns when none
+   are left.
+*/
+static int NextRun(PENSEMBLE pens) {
+  int iRun;
+
+#ifdef _OPENMP
+#pragma omp atomic capture
+#endif
+  iRun = pens->iNextRun++;
+
+  return (iRun < pens->nRuns ? iRun : pens->nRuns);
+
+} /* NextRun */
+
+/* ----------------------------------------------------------------------------
+   LaneTarget
+
+   Returns where lane w integrates to on its way to output time dTout:
+   the next jump of its inputs if that comes first.
+*/
+static double LaneTarget(PBATCHRUNNER pbr, int w, double dTout) {
+  return (pbr->rgtc ? fmin(NextJump(&pbr->rgtc[w]), dTout) : dTout);
+
+} /* LaneTarget */
+
+/* ----------------------------------------------------------------------------
+   LaneStops
+
+   Moves lane w past the jumps at or before its time, as PassStops()
+   does: gives the doses due there, in the lane's own context, and starts
+   the lane afresh.
+*/
+static void LaneStops(PBATCHRUNNER pbr, PODEBATCH pob, int w) {
+  int i, W = pbr->nLanes;
+
+  if (!pbr->rgtc || !PassJumps(&pbr->rgtc[w], pob->rgdT[w])) {
+    return;
+  }
+
+  if (pbr->pfnDoses) {
+    for (i = 0; i < pbr->nStates; i++) {
+      pbr->rgdYlane[i] = pob->rgdY[i * W + w];
+    }
+    (*pbr->pfnDoses)(pbr->rgbCtx + w * pbr->cbCtx, pob->rgdT[w], pbr->rgdYlane);
+    for (i = 0; i < pbr->nStates; i++) {
+      pob->rgdY[i * W + w] = pbr->rgdYlane[i];
+    }
+  }
+  pob->rgbFresh[w] = TRUE;
+  pob->rgdH[w] = 0.0;
+
+} /* LaneStops */
+
+/* ----------------------------------------------------------------------------
+   LoadLane
+
+   Starts the next run in lane w, or leaves the lane idle if there is none.
+   The initial point is marked as pending output.
+*/
+static void LoadLane(PENSEMBLE pens, PBATCHRUNNER pbr, PODEBATCH pob, int w) {
+  int i, W = pbr->nLanes, iRun = NextRun(pens);
+  PVOID pctx;
+
+  pbr->rgbPending[w] = FALSE;
+  if (pbr->rgtc) {
+    pbr->rgtc[w].nT = 0;
+  }
+  if (iRun >= pens->nRuns) {
+    pbr->rgiRun[w] = -1;
+    pob->rgdTout[w] = pob->rgdT[w]; /* Idle */
+    return;
+  }
+
+  pbr->rgiRun[w] = iRun;
+  for (i = 0; i < pens->nParms; i++) {
+    pbr->rgdParms[i * W + w] = pens->rgdParms[(R_xlen_t)pens->nParms * iRun + i];
+  }
+  (*pbr->pfnHoist)(pbr->pbctx, w);
+  if (pbr->rgtc) {
+    pctx = pbr->rgbCtx + w * pbr->cbCtx;
+    memcpy((*pbr->pfnGetCtxParms)(pctx), pens->rgdParms + (R_xlen_t)pens->nParms * iRun,
+           pens->nParms * sizeof(double));
+    (*pbr->pfnHoistCtx)(pctx);
+    if (!GetInputJumps(pbr->pfnInputTimes, pctx, &pbr->rgtc[w], pens->rgdTimes[0],
+                       pens->rgdTimes[pens->nTimes - 1])) {
+      pbr->bNoMem = TRUE;
+    }
+  }
+  pbr->rgpforc[w] = (pens->rgforc ? pens->rgforc + (pens->nSets == 1 ? 0 : (R_xlen_t)pens->nInputs * iRun) : NULL);
+  for (i = 0; i < pens->nStates; i++) {
+    pob->rgdY[i * W + w] = pens->rgdY0[(R_xlen_t)pens->nStates * iRun + i];
+  }
+
+  pob->rgdT[w] = pob->rgdTout[w] = pens->rgdTimes[0];
+  pob->rgdH[w] = 0.0;
+  pob->rgnSteps[w] = 0;
+  pob->rgbFresh[w] = TRUE;
+  pob->rgnStiff[w] = pob->rgnNonStiff[w] = 0;
+  pbr->rgiTime[w] = 0;
+  pbr->rgbPending[w] = TRUE;
+
+} /* LoadLane */
+
+/* ----------------------------------------------------------------------------
+   FinishLane
+
+   Ends the run in lane w with status iStatus, setting rows not reached to
+   NA, and loads the next run.
+*/
+static void FinishLane(PENSEMBLE pens, PBATCHRUNNER pbr, PODEBATCH pob, int w, int iStatus) {
+  int iTime, j;
+  PDOUBLE rgdOut = pens->rgdOut + (R_xlen_t)pens->nTimes * pens->nVars * pbr->rgiRun[w];
+
+  for (iTime = pbr->rgiTime[w]; iTime < pens->nTimes; iTime++) {
+    rgdOut[iTime] = pens->rgdTimes[iTime];
+    for (j = 1; j < pens->nVars; j++) {
+      rgdOut[iTime + (R_xlen_t)pens->nTimes * j] = NA_REAL;
+    }
+  }
+  pens->rgiIstate[pbr->rgiRun[w]] = iStatus;
+
+  LoadLane(pens, pbr, pob, w);
+
+} /* FinishLane */
+
+/* ----------------------------------------------------------------------------
+   RunBatched
+
+   Integrates runs lane-batched until none are left: stores pending output
+   rows, moves lanes on to their next output time (or next run), and takes
+   one lockstep step. A lane reaching a jump of its inputs or a dose before
+   its output time restarts there and moves on; one at its output time,
+   once the output is stored.
+*/
+static void RunBatched(PENSEMBLE pens, PBATCHRUNNER pbr, PODEBATCH pob) {
+  int w, j, W = pbr->nLanes, nT = pens->nTimes;
+  BOOL bPending, bBusy;
+  PDOUBLE rgdOut;
+
+  for (w = 0; w < W; w++) {
+    pob->rgdT[w] = pob->rgdTout[w] = 0.0;
+    pbr->rgpforc[w] = NULL;
+    LoadLane(pens, pbr, pob, w);
+  }
+
+  for (;;) {
+    /* Store outputs of lanes sitting on an output time; loading new runs
+       can make more lanes pending */
+    do {
+      bPending = FALSE;
+      for (w = 0; w < W; w++) {
+        bPending = bPending || pbr->rgbPending[w];
+      }
+      if (!bPending) {
+        break;
+      }
+
+      SetBatchForcings(pbr, pob->rgdT);
+      (*pbr->pfnOutputs)(pbr->pbctx, pob->rgdT, pob->rgdY, pbr->rgdYout);
+      for (w = 0; w < W; w++) {
+        if (!pbr->rgbPending[w]) {
+          continue;
+        }
+
+        pbr->rgbPending[w] = FALSE;
+        rgdOut = pens->rgdOut + (R_xlen_t)nT * pens->nVars * pbr->rgiRun[w] + pbr->rgiTime[w];
+        rgdOut[0] = pob->rgdT[w];
+        for (j = 0; j < pens->nStates; j++) {
+          rgdOut[(R_xlen_t)nT * (1 + j)] = pob->rgdY[j * W + w];
+        }
+        for (j = 0; j < pens->nOutputs; j++) {
+          rgdOut[(R_xlen_t)nT * (1 + pens->nStates + j)] = pbr->rgdYout[j * W + w];
+        }
+
+        LaneStops(pbr, pob, w);
+        if (++pbr->rgiTime[w] >= nT) {
+          FinishLane(pens, pbr, pob, w, ODE_SUCCESS);
+        } else {
+          pob->rgdTout[w] = LaneTarget(pbr, w, pens->rgdTimes[pbr->rgiTime[w]]);
+          pob->rgnSteps[w] = 0;
+        }
+      } /* for w */
+    } while (bPending);
+
+    bBusy = FALSE;
+    for (w = 0; w < W; w++) {
+      bBusy = bBusy || (pbr->rgiRun[w] >= 0);
+    }
+    if (!bBusy) {
+      break;
+    }
+
+    Dopri5BatchStep(pob, pbr->rgiStatus);
+
+    for (w = 0; w < W; w++) {
+      if (pbr->rgiRun[w] < 0) {
+        continue;
+      }
+      if (pbr->rgiStatus[w] == ODE_SUCCESS) {
+        if (pob->rgdT[w] < pens->rgdTimes[pbr->rgiTime[w]]) { /* At a jump */
+          LaneStops(pbr, pob, w);
+          pob->rgdTout[w] = LaneTarget(pbr, w, pens->rgdTimes[pbr->rgiTime[w]]);
+          pob->rgnSteps[w] = 0;
+        } else {
+          pbr->rgbPending[w] = TRUE;
+        }
+      } else if (pbr->rgiStatus[w] < 0) {
+        FinishLane(pens, pbr, pob, w, pbr->rgiStatus[w]);
+      }
+    }
+  } /* for */
+
+} /* RunBatched */
+
+/* ----------------------------------------------------------------------------
+   c_runEnsemble
+
+   .Call entry point.
+
+   sFuncs: native symbols of derivs_ctx, initCtx, getCtxParms, getCtxForc,
+           outputs_ctx, hoist_ctx, getInputTimes_ctx, doses_ctx and
+           jac_ctx (NULL if the model has none; jac_ctx is used only if
+           it is derived from the Dynamics), hist_store_ctx (NULL if
+           nothing is delayed) and, if the model has them, derivs_batch,
+           getBatchParms, getBatchForc, outputs_batch, hoist_batch
+   sInfo:  the model's getModelInfo() vector
+   sTimes: output times, increasing
+   sParms: nParms x nRuns matrix of complete parameter vectors
+   sY0:    nStates x nRuns matrix of initial states
+   sForcs: forcing sets, see GetForcings()
+   sOpts:  rtol, atol, hmax, maxsteps, threads (0 for the OpenMP default),
+           method (EM_*)
+
+   Returns an nTimes x (1 + nStates + nOutputs) x nRuns array with the
+   integrator status of each run in attribute "istate".
+*/
+SEXP c_runEnsemble(SEXP sFuncs, SEXP sInfo, SEXP sTimes, SEXP sParms, SEXP sY0, SEXP sForcs, SEXP sOpts) {
+  int *rgiInfo, *rgiIstate, *rgiRuns = NULL;
+  int nStates, nOutputs, nParms, nInputs, nTimes, nRuns, nVars, nSets, nThreads, nLanes, iMethod, nOneAtATime, k;
+  size_t cbCtx, cbBatchCtx;
+  BOOL bNoMem = FALSE;
+  ENSEMBLE ens;
+  PDOUBLE rgdOut, rgdOpts, rgdTimes, rgdParms, rgdY0;
+  PFORCING rgforc;
+  PFN_DERIVS_CTX pfnDerivs;
+  PFN_INITCTX pfnInitCtx;
+  PFN_CTXFIELD pfnGetParms, pfnGetForc;
+  PFN_OUTPUTS_CTX pfnOutputs;
+  PFN_HOIST_CTX pfnHoist;
+  PFN_DERIVS_BATCH pfnDerivsBatch = NULL;
+  PFN_OUTPUTS_BATCH pfnOutputsBatch = NULL;
+  PFN_HOIST_BATCH pfnHoistBatch = NULL;
+  PFN_CTXFIELD pfnGetBatchParms = NULL, pfnGetBatchForc = NULL;
+  PFN_INPUTTIMES_CTX pfnInputTimes = NULL;
+  PFN_DOSES_CTX pfnDoses = NULL;
+  PFN_JAC_CTX pfnJac = NULL;
+  PFN_HISTSTORE_CTX pfnHistStore = NULL;
+  SEXP sOut, sIstate, sDim;
+
+  if (LENGTH(sInfo) < MI_LENGTH || LENGTH(sOpts) < EO_LENGTH || LENGTH(sFuncs) < 10) {
+    Rf_error("invalid arguments to c_runEnsemble");
+  }
+
+  rgiInfo = INTEGER(sInfo);
+  nStates = rgiInfo[MI_STATES];
+  nOutputs = rgiInfo[MI_OUTPUTS];
+  nParms = rgiInfo[MI_PARMS];
+  nInputs = rgiInfo[MI_INPUTS];
+  cbCtx = (size_t)rgiInfo[MI_CTXSIZE];
+  nLanes = rgiInfo[MI_LANES];
+  cbBatchCtx = (size_t)rgiInfo[MI_BATCHSIZE];
+  nVars = 1 + nStates + nOutputs;
+
+  if (rgiInfo[MI_ROOTS]) {
+    Rf_error("models with roots cannot be run as an ensemble");
+  }
+
+  nTimes = LENGTH(sTimes);
+  nRuns = Rf_ncols(sParms);
+  if (nTimes < 1 || Rf_nrows(sParms) != nParms || Rf_nrows(sY0) != nStates || Rf_ncols(sY0) != nRuns) {
+    Rf_error("parameter or initial state matrix does not match the model");
+  }
+
+  pfnDerivs = (PFN_DERIVS_CTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 0));
+  pfnInitCtx = (PFN_INITCTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 1));
+  pfnGetParms = (PFN_CTXFIELD)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 2));
+  pfnGetForc = (PFN_CTXFIELD)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 3));
+  pfnOutputs = (PFN_OUTPUTS_CTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 4));
+  pfnHoist = (PFN_HOIST_CTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 5));
+  if (!pfnDerivs || !pfnInitCtx || !pfnGetParms || !pfnGetForc || !pfnOutputs || !pfnHoist) {
+    Rf_error("model entry points not found; recompile the model");
+  }
+
+  if (rgiInfo[MI_INPUTTIMES] && TYPEOF(VECTOR_ELT(sFuncs, 6)) == EXTPTRSXP) {
+    pfnInputTimes = (PFN_INPUTTIMES_CTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 6));
+  }
+  if (rgiInfo[MI_DOSES] && TYPEOF(VECTOR_ELT(sFuncs, 7)) == EXTPTRSXP) {
+    pfnDoses = (PFN_DOSES_CTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 7));
+  }
+  if ((rgiInfo[MI_INPUTTIMES] && !pfnInputTimes) || (rgiInfo[MI_DOSES] && !pfnDoses)) {
+    Rf_error("model entry points not found; recompile the model");
+  }
+
+  /* That of a Jacobian section is written by hand, as for runModel */
+  if (rgiInfo[MI_JACOBIAN] == 1 && TYPEOF(VECTOR_ELT(sFuncs, 8)) == EXTPTRSXP) {
+    pfnJac = (PFN_JAC_CTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 8));
+  }
+
+  if (rgiInfo[MI_DELAYS]) {
+    if (TYPEOF(VECTOR_ELT(sFuncs, 9)) == EXTPTRSXP) {
+      pfnHistStore = (PFN_HISTSTORE_CTX)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 9));
+    }
+    if (!pfnHistStore) {
+      Rf_error("model entry points not found; recompile the model");
+    }
+  }
+
+  iMethod = (int)REAL(sOpts)[EO_METHOD];
+  if (iMethod != EM_AUTO && iMethod != EM_DOPRI5 && iMethod != EM_ROSENBROCK) {
+    Rf_error("invalid integration method");
+  }
+
+  if (nLanes > 0 && LENGTH(sFuncs) >= 15) {
+    pfnDerivsBatch = (PFN_DERIVS_BATCH)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 10));
+    pfnGetBatchParms = (PFN_CTXFIELD)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 11));
+    pfnGetBatchForc = (PFN_CTXFIELD)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 12));
+    pfnOutputsBatch = (PFN_OUTPUTS_BATCH)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 13));
+    pfnHoistBatch = (PFN_HOIST_BATCH)R_ExternalPtrAddrFn(VECTOR_ELT(sFuncs, 14));
+  }
+  if (!pfnDerivsBatch || !pfnGetBatchParms || !pfnGetBatchForc || !pfnOutputsBatch || !pfnHoistBatch ||
+      iMethod == EM_ROSENBROCK) {
+    nLanes = 0; /* Run one at a time */
+  }
+
+  rgforc = GetForcings(sForcs, nInputs, nRuns, &nSets);
+
+  rgdOpts = REAL(sOpts);
+  rgdTimes = REAL(sTimes);
+  rgdParms = REAL(sParms);
+  rgdY0 = REAL(sY0);
+
+  sOut = PROTECT(Rf_allocVector(REALSXP, (R_xlen_t)nTimes * nVars * nRuns));
+  sIstate = PROTECT(Rf_allocVector(INTSXP, nRuns));
+  rgdOut = REAL(sOut);
+  rgiIstate = INTEGER(sIstate);
+
+  nThreads = (int)rgdOpts[EO_THREADS];
+#ifdef _OPENMP
+  if (nThreads <= 0) {
+    nThreads = omp_get_max_threads();
+  }
+#else
+  nThreads = 1;
+#endif
+
+  ens.nStates = nStates;
+  ens.nOutputs = nOutputs;
+  ens.nParms = nParms;
+  ens.nInputs = nInputs;
+  ens.nTimes = nTimes;
+  ens.nRuns = nRuns;
+  ens.nVars = nVars;
+  ens.nSets = nSets;
+  ens.rgdTimes = rgdTimes;
+  ens.rgdParms = rgdParms;
+  ens.rgdY0 = rgdY0;
+  ens.rgdOut = rgdOut;
+  ens.rgiIstate = rgiIstate;
+  ens.rgforc = rgforc;
+  ens.iNextRun = 0;
+
+  nOneAtATime = nRuns; /* Runs left to run one at a time, all unless batched */
+  if (nLanes > 0) {
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThreads)
+#endif
+    {
+      BATCHRUNNER br;
+      ODEBATCH ob;
+      BOOL bOK;
+      int w;
+
+      br.nInputs = nInputs;
+      br.nLanes = nLanes;
+      br.pfnDerivs = pfnDerivsBatch;
+      br.pfnOutputs = pfnOutputsBatch;
+      br.pfnHoist = pfnHoistBatch;
+      br.pbctx = calloc(1, cbBatchCtx); /* Idle lanes compute on zeros */
+      br.rgpforc = (PFORCING *)malloc(nLanes * sizeof(PFORCING));
+      br.rgdYout = (PDOUBLE)malloc((nOutputs > 0 ? nOutputs : 1) * nLanes * sizeof(double));
+      br.rgdYdot = (PDOUBLE)malloc((nStates > 0 ? nStates : 1) * nLanes * sizeof(double));
+      br.rgiRun = (int *)malloc(4 * nLanes * sizeof(int));
+      br.nStates = nStates;
+      br.pfnInputTimes = pfnInputTimes;
+      br.pfnDoses = pfnDoses;
+      br.cbCtx = cbCtx;
+      br.pfnGetCtxParms = pfnGetParms;
+      br.pfnHoistCtx = pfnHoist;
+      br.rgbCtx = (pfnInputTimes ? (PBYTE)malloc(nLanes * cbCtx) : NULL);
+      br.rgtc = (pfnInputTimes ? (PTCRIT)calloc(nLanes, sizeof(TCRIT)) : NULL);
+      br.rgdTrhs = (PDOUBLE)malloc(nLanes * sizeof(double));
+      br.rgdYlane = (PDOUBLE)malloc((nStates > 0 ? nStates : 1) * sizeof(double));
+      br.bNoMem = FALSE;
+      bOK = (br.pbctx && br.rgpforc && br.rgdYout && br.rgdYdot && br.rgiRun && br.rgdTrhs && br.rgdYlane &&
+             (!pfnInputTimes || (br.rgbCtx && br.rgtc)) &&
+             !InitOdeBatch(&ob, nStates, nLanes, &EnsembleBatchRhs, &br));
+
+      if (bOK) {
+        br.rgiTime = br.rgiRun + nLanes;
+        br.rgbPending = br.rgiTime + nLanes;
+        br.rgiStatus = br.rgbPending + nLanes;
+        br.rgdParms = (*pfnGetBatchParms)(br.pbctx);
+        br.rgdForc = (*pfnGetBatchForc)(br.pbctx);
+        for (w = 0; br.rgbCtx && w < nLanes; w++) {
+          (*pfnInitCtx)(br.rgbCtx + w * cbCtx);
+        }
+        ob.dRtol = rgdOpts[EO_RTOL];
+        ob.dAtol = rgdOpts[EO_ATOL];
+        ob.dHmax = rgdOpts[EO_HMAX];
+        ob.nMaxSteps = (long)rgdOpts[EO_MAXSTEPS];
+        ob.bStiffTest = TRUE;
+
+        RunBatched(&ens, &br, &ob);
+        FreeOdeBatch(&ob);
+      }
+      if (!bOK || br.bNoMem) {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+        bNoMem = TRUE;
+      }
+
+      free(br.pbctx);
+      free(br.rgpforc);
+      free(br.rgdYout);
+      free(br.rgdYdot);
+      free(br.rgiRun);
+      free(br.rgbCtx);
+      if (br.rgtc) {
+        for (w = 0; w < nLanes; w++) {
+          free(br.rgtc[w].rgdT);
+        }
+      }
+      free(br.rgtc);
+      free(br.rgdTrhs);
+      free(br.rgdYlane);
+    } /* parallel */
+
+    /* Lanes found stiff ended their runs: these start over, one at a time,
+       with the Rosenbrock method */
+    nOneAtATime = 0;
+    if (iMethod == EM_AUTO) {
+      rgiRuns = (int *)R_alloc(nRuns, sizeof(int));
+      for (k = 0; k < nRuns; k++) {
+        if (rgiIstate[k] == ODE_STIFF) {
+          rgiRuns[nOneAtATime++] = k;
+        }
+      }
+      iMethod = EM_ROSENBROCK;
+    }
+  }
+
+  if (nOneAtATime > 0) {
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThreads)
+#endif
+    {
+      RUNNER run;
+      ODESOLVER solv;
+      int iRun, i;
+      BOOL bOK;
+
+      run.nInputs = nInputs;
+      run.pfnDerivs = pfnDerivs;
+      run.pfnOutputs = pfnOutputs;
+      run.pfnInputTimes = pfnInputTimes;
+      run.pfnDoses = pfnDoses;
+      run.pfnJac = pfnJac;
+      run.pfnHistStore = pfnHistStore;
+      run.nStates = nStates;
+      run.iMethod = iMethod;
+      memset(&run.tc, 0, sizeof(TCRIT));
+      memset(&solv, 0, sizeof(ODESOLVER));
+      run.pctx = malloc(cbCtx);
+      run.rgdYout = (PDOUBLE)malloc((nOutputs > 0 ? nOutputs : 1) * sizeof(double));
+      run.rgdYdot = (PDOUBLE)malloc((nStates > 0 ? nStates : 1) * sizeof(double));
+      run.rgdY = (PDOUBLE)malloc((nStates > 0 ? nStates : 1) * sizeof(double));
+      bOK = (run.pctx && run.rgdYout && run.rgdYdot && run.rgdY && !InitOdeSolver(&solv, nStates, &EnsembleRhs, &run) &&
+             (iMethod == EM_DOPRI5 || !InitRosenbrock(&solv, (pfnJac ? &EnsembleJac : NULL))));
+
+      if (bOK) {
+        solv.pfnStep = (pfnHistStore ? &EnsembleStep : NULL);
+        solv.dRtol = rgdOpts[EO_RTOL];
+        solv.dAtol = rgdOpts[EO_ATOL];
+        solv.dHmax = rgdOpts[EO_HMAX];
+        solv.nMaxSteps = (long)rgdOpts[EO_MAXSTEPS];
+        solv.bStiffTest = (iMethod != EM_ROSENBROCK);
+      } else {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+        bNoMem = TRUE;
+      }
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+      for (i = 0; i < nOneAtATime; i++) {
+        if (!bOK) {
+          continue;
+        }
+
+        iRun = (rgiRuns ? rgiRuns[i] : i);
+
+        (*pfnInitCtx)(run.pctx);
+        memcpy((*pfnGetParms)(run.pctx), rgdParms + (R_xlen_t)nParms * iRun, nParms * sizeof(double));
+        (*pfnHoist)(run.pctx);
+        run.rgdForc = (*pfnGetForc)(run.pctx);
+        run.rgforc = (rgforc ? rgforc + (nSets == 1 ? 0 : (R_xlen_t)nInputs * iRun) : NULL);
+        memcpy(run.rgdY, rgdY0 + (R_xlen_t)nStates * iRun, nStates * sizeof(double));
+        if (pfnInputTimes && !GetInputJumps(pfnInputTimes, run.pctx, &run.tc, rgdTimes[0], rgdTimes[nTimes - 1])) {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+          bNoMem = TRUE;
+        }
+
+        rgiIstate[iRun] = RunOne(&run, &solv, rgdTimes, nTimes, rgdOut + (R_xlen_t)nTimes * nVars * iRun, nStates,
+                                 nOutputs);
+      } /* for */
+
+      FreeOdeSolver(&solv);
+      free(run.pctx);
+      free(run.rgdYout);
+      free(run.rgdYdot);
+      free(run.rgdY);
+      free(run.tc.rgdT);
+    } /* parallel */
+  }
+
+  if (bNoMem) {
+    UNPROTECT(2);
+    Rf_error("out of memory in c_runEnsemble");
+  }
+
+  sDim = PROTECT(Rf_allocVector(INTSXP, 3));
+  INTEGER(sDim)[0] = nTimes;
+  INTEGER(sDim)[1] = nVars;
+  INTEGER(sDim)[2] = nRuns;
+  Rf_setAttrib(sOut, R_DimSymbol, sDim);
+  Rf_setAttrib(sOut, Rf_install("istate"), sIstate);
+
+  UNPROTECT(3);
+  return (sOut);
+
+} /* c_runEnsemble */
+
+/* End */
@@ -0,0 +1,124 @@
+/* ensemble.h
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Header file for the ensemble runner of ensemble.c
+*/
+
+#ifndef ENSEMBLE_H_DEFINED
+
+/* ---------------------------------------------------------------------------
+   Inclusions  */
+
+#include <Rinternals.h>
+
+#include "hungtype.h"
+
+/* ---------------------------------------------------------------------------
+   Constants  */
+
+/* Layout of the integer vector filled by a model's getModelInfo() (see
+   Write_R_ModelInfo() in modo.c), whose fields R names by .modelInfoNames
+   in R/modelInfo.R: the three must change together. */
+#define MI_STATES 0
+#define MI_OUTPUTS 1
+#define MI_PARMS 2
+#define MI_INPUTS 3 /* Inputs passed as forcings */
+#define MI_DELAYS 4 /* hist_store_ctx keeps the history of the delayed variables: 1 states, 2 outputs too */
+#define MI_CTXSIZE 5
+#define MI_LANES 6 /* Lanes of derivs_batch, 0 if there is none */
+#define MI_BATCHSIZE 7
+#define MI_LEANDERIVS 8 /* derivs does not compute all outputs */
+#define MI_JACOBIAN 9   /* jac computes the Jacobian: 1 derived, 2 of the Jacobian section */
+#define MI_JACNONZERO 10 /* Nonzeros of getJacobPattern, 0 if there is none */
+#define MI_JACVEC 11     /* jacvec computes Jacobian columns */
+#define MI_INPUTTIMES 12 /* getInputTimes_ctx gives the jumps of the inputs and doses */
+#define MI_DOSES 13      /* Doses given by doses_ctx */
+#define MI_ROOTS 14      /* Root functions of root; the ensemble rejects models with any */
+#define MI_EVENTS 15     /* event gives the Events section at roots */
+#define MI_LENGTH 16
+
+/* Layout of the options vector passed to c_runEnsemble() */
+#define EO_RTOL 0
+#define EO_ATOL 1
+#define EO_HMAX 2
+#define EO_MAXSTEPS 3
+#define EO_THREADS 4
+#define EO_METHOD 5
+#define EO_LENGTH 6
+
+/* Integration methods, option EO_METHOD */
+#define EM_AUTO 0       /* Dopri5, switching a run to Rosenbrock once it is stiff */
+#define EM_DOPRI5 1     /* Dopri5; a run that is stiff stops with ODE_STIFF */
+#define EM_ROSENBROCK 2
+
+/* Status of a run whose delays read before the history kept by the
+   model, besides the ODE_ codes of odesolve.h */
+#define EN_HISTLOST (-5)
+
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* Entry points of a generated model, see Write_R_Decls() and
+   Write_R_CalcDeriv() in modo.c. The outputs functions compute the
+   outputs at one point; the derivs functions need not. The hoist functions
+   must be called after the parameters are set, see Write_R_Hoist(). jac_ctx()
+   is that of Write_R_CalcJacob(), hist_store_ctx() that of Write_R_History(). */
+typedef void (*PFN_DERIVS_CTX)(PVOID pctx, PDOUBLE pdTime, PDOUBLE y, PDOUBLE ydot, PDOUBLE yout);
+typedef void (*PFN_INITCTX)(PVOID pctx);
+typedef PDOUBLE (*PFN_CTXFIELD)(PVOID pctx);
+typedef void (*PFN_OUTPUTS_CTX)(PVOID pctx, PDOUBLE pdTime, PDOUBLE y, PDOUBLE yout);
+typedef void (*PFN_DERIVS_BATCH)(PVOID pbctx, PDOUBLE rgdTime, PDOUBLE y, PDOUBLE ydot, PDOUBLE yout);
+typedef void (*PFN_OUTPUTS_BATCH)(PVOID pbctx, PDOUBLE rgdTime, PDOUBLE y, PDOUBLE yout);
+typedef void (*PFN_HOIST_CTX)(PVOID pctx);
+typedef void (*PFN_HOIST_BATCH)(PVOID pbctx, int iLane);
+typedef int (*PFN_INPUTTIMES_CTX)(PVOID pctx, double dT0, double dT1, PDOUBLE rgdTimes, int nMax);
+typedef void (*PFN_DOSES_CTX)(PVOID pctx, double dT, PDOUBLE rgdY);
+typedef int (*PFN_HISTSTORE_CTX)(PVOID pctx, double dT, PDOUBLE y, PDOUBLE ydot);
+typedef void (*PFN_JAC_CTX)(PVOID pctx, PINT pnEq, PDOUBLE pdTime, PDOUBLE y, PINT pnML, PINT pnMU, PDOUBLE pd,
+                            PINT pnRowPD, PDOUBLE yout);
+
+/* One forcing function: a time series interpolated linearly */
+typedef struct tagFORCING {
+  int nPts;
+  PDOUBLE rgdT;
+  PDOUBLE rgdVal;
+
+} FORCING, *PFORCING; /* tagFORCING */
+
+/* Times at which the inputs defined in a run's model jump or its doses
+   are given, see Write_R_InputTimes() in modo.c. The integrator stops at
+   each of them. */
+typedef struct tagTCRIT {
+  PDOUBLE rgdT; /* Increasing */
+  int nT;
+  int nMax;     /* Allocated */
+  int iNext;    /* First not reached yet */
+
+} TCRIT, *PTCRIT; /* tagTCRIT */
+
+/* ---------------------------------------------------------------------------
+   Prototypes */
+
+SEXP c_runEnsemble(SEXP sFuncs, SEXP sInfo, SEXP sTimes, SEXP sParms, SEXP sY0, SEXP sForcs, SEXP sOpts);
+double InterpForcing(PFORCING pforc, double dT);
+
+#define ENSEMBLE_H_DEFINED
+#endif
+
+/* End */
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "lex.h"
 #include "lexerr.h"
@@ -81,29 +82,6 @@ void InitINPUTBUF(PINPUTBUF pibIn) {
   pibIn->pTempInfo = NULL;
 }
 
-/* ----------------------------------------------------------------------------
-   CountChars
-
-   Count the number of characters of a stream (which must be already open)
-   and reset the stream.
-*/
-long CountChars(PFILE pFileIn) {
-  long nChars = 0;
-  char c;
-
-  /* keep reading as long as we have not reached eof */
-  while ((c = getc(pFileIn)) != EOF) {
-    nChars++;
-  }
-
-  rewind(pFileIn);
-
-  /* Rprintf ("mod:countchars: nChars = %ld\n",nChars); */
-
-  return (nChars);
-
-} /* CountChars */
-
 /* ---------------------------------------------------------------------------
    ENextLex
 
@@ -369,10 +347,9 @@ void GetToken(PSTR *szExp, PSTR szToken, PINT piType) {
    Initializes the input buffer whose address is pibIn with the
    file given by szFullPathname, and fills the buffer array with the
    first data to be processed.
-   If a negative buffer size is given the buffer size is set to the
-   length of the given input file.
-   Close the input file if the given size is -1 (it has been all read in).
-   Leave it open otherwise.
+   If a negative buffer size is given the whole file is read in at
+   once, see ReadWholeFile(), and the file is closed. Otherwise the
+   buffer has the given size and the file is left open to refill it.
 
    Returns 0 on error, negative  on exit error, positive non-zero on success.
 */
@@ -385,17 +362,6 @@ BOOL InitBuffer(PINPUTBUF pibIn, long lSize, PSTR szFileIn) {
     return FALSE;
   }
 
-  if (lSize < 0) {
-    if ((pibIn->pfileIn = fopen(szFileIn, "r"))) {
-      pibIn->lBufSize = CountChars(pibIn->pfileIn);
-      fclose(pibIn->pfileIn);
-    } else {
-      PROPAGATE_EXIT(ReportError(NULL, RE_FILENOTFOUND | RE_FATAL, szFileIn, NULL));
-    }
-  } else {
-    pibIn->lBufSize = lSize;
-  }
-
   pibIn->iLineNum = 1;
   pibIn->iLNPrev = 0;
   pibIn->cErrors = 0;
@@ -403,6 +369,12 @@ BOOL InitBuffer(PINPUTBUF pibIn, long lSize, PSTR szFileIn) {
   pibIn->pTempInfo = NULL;
   pibIn->pbufCur = NULL;
 
+  if (lSize < 0) {
+    return (ReadWholeFile(pibIn, szFileIn));
+  }
+
+  pibIn->lBufSize = lSize;
+
   if ((pibIn->pfileIn = fopen(szFileIn, "r"))) {
     if ((pibIn->pbufOrg = (PBUF)malloc(pibIn->lBufSize))) {
       bReturn = PROPAGATE_EXIT_OR_RETURN_RESULT(FillBuffer(pibIn, pibIn->lBufSize));
@@ -413,16 +385,106 @@ BOOL InitBuffer(PINPUTBUF pibIn, long lSize, PSTR szFileIn) {
     PROPAGATE_EXIT(ReportError(pibIn, RE_FILENOTFOUND | RE_FATAL, szFileIn, NULL));
   }
 
-  /* close input file eventually */
-  if (lSize < 0) {
-    // Rprintf(" closing file %s\n", szFileIn);
-    fclose(pibIn->pfileIn);
-  }
   // Rprintf(" init buffer done returning bReturn = %d\n", bReturn);
   return (bReturn);
 
 } /* InitBuffer */
 
+/* ---------------------------------------------------------------------------
+   ReadWholeFile
+
+   Reads the file szFileIn into the buffer of pibIn with a single
+   fread, the size being known from stat(), and closes it. The text
+   is terminated by a NULL, and the buffer is then used as a string
+   buffer (no file to refill it from), like those of InitStringBuffer().
+   Text mode may make the text shorter than the file; a file growing
+   meanwhile, or one with no size, is read on in larger chunks.
+
+   Returns 0 on error, negative on exit error, positive non-zero on success.
+*/
+BOOL ReadWholeFile(PINPUTBUF pibIn, PSTR szFileIn) {
+  struct stat statFile;
+  PFILE pfile;
+  PBUF pbuf;
+  long lMax, lRead = 0;
+  size_t nRead;
+
+  lMax = (!stat(szFileIn, &statFile) && statFile.st_size > 0 ? (long)statFile.st_size : BUFFER_SIZE);
+
+  if (!(pfile = fopen(szFileIn, "r"))) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_FILENOTFOUND | RE_FATAL, szFileIn, NULL));
+  }
+
+  if (!(pibIn->pbufOrg = (PBUF)malloc(lMax + 1))) {
+    fclose(pfile);
+    PROPAGATE_EXIT(ReportError(pibIn, RE_OUTOFMEM | RE_FATAL, "ReadWholeFile", NULL));
+  }
+
+  while ((nRead = fread(pibIn->pbufOrg + lRead, 1, lMax - lRead, pfile)) > 0) {
+    lRead += (long)nRead;
+    if (lRead < lMax) {
+      continue; /* Short read, fread tells at the next call */
+    }
+
+    if (!(pbuf = (PBUF)realloc(pibIn->pbufOrg, 2 * lMax + 1))) {
+      fclose(pfile);
+      free(pibIn->pbufOrg);
+      pibIn->pbufOrg = NULL;
+      PROPAGATE_EXIT(ReportError(pibIn, RE_OUTOFMEM | RE_FATAL, "ReadWholeFile", NULL));
+    }
+    pibIn->pbufOrg = pbuf;
+    lMax *= 2;
+  } /* while */
+
+  if (ferror(pfile)) {
+    fclose(pfile);
+    free(pibIn->pbufOrg);
+    pibIn->pbufOrg = NULL;
+    PROPAGATE_EXIT(ReportError(pibIn, RE_FATAL, szFileIn, "Error reading file."));
+  }
+  fclose(pfile);
+
+  pibIn->pbufOrg[lRead] = '\0';
+  pibIn->pbufCur = pibIn->pbufOrg;
+  pibIn->pfileIn = NULL;
+  pibIn->lBufSize = lRead + 1;
+
+  return TRUE;
+
+} /* ReadWholeFile */
+
+/* ---------------------------------------------------------------------------
+   InitStringBuffer
+
+   Initializes the input buffer whose address is pibIn with a copy of
+   the text szText, as InitBuffer() does with a whole file. There is
+   no file to refill the buffer from.
+
+   Returns 0 on error, negative on exit error, positive non-zero on success.
+*/
+BOOL InitStringBuffer(PINPUTBUF pibIn, PSTR szText) {
+  if (!pibIn || !szText) {
+    return FALSE;
+  }
+
+  pibIn->pfileIn = NULL;
+  pibIn->lBufSize = (long)strlen(szText) + 1;
+  pibIn->iLineNum = 1;
+  pibIn->iLNPrev = 0;
+  pibIn->cErrors = 0;
+  pibIn->pInfo = NULL;
+  pibIn->pTempInfo = NULL;
+
+  if (!(pibIn->pbufOrg = (PBUF)malloc(pibIn->lBufSize))) {
+    PROPAGATE_EXIT(ReportError(pibIn, RE_OUTOFMEM | RE_FATAL, "InitStringBuffer", NULL));
+  }
+  memcpy(pibIn->pbufOrg, szText, pibIn->lBufSize);
+  pibIn->pbufCur = pibIn->pbufOrg;
+
+  return TRUE;
+
+} /* InitStringBuffer */
+
 /* ---------------------------------------------------------------------------
    MakeStringBuffer
 
@@ -432,6 +494,7 @@ BOOL InitBuffer(PINPUTBUF pibIn, long lSize, PSTR szFileIn) {
 void MakeStringBuffer(PINPUTBUF pBuf, PINPUTBUF pbufStr, PSTR sz) {
   pbufStr->pfileIn = NULL; /* Flags that is not file buffer */
   pbufStr->pbufCur = pbufStr->pbufOrg = sz;
+  pbufStr->lBufSize = 0; /* Not a whole model */
   pbufStr->iLineNum = 0; /* Multiline eqn formatting in modo */
   pbufStr->iLNPrev = 0;
   pbufStr->pInfo = (pBuf ? pBuf->pInfo : NULL);
@@ -447,9 +510,9 @@ void FlushBuffer(PINPUTBUF pibIn) {
   PBUF pbuf = pibIn->pbufOrg;
 
   while (*pbuf) {
-    Rprintf("%c", *pbuf++);
+    ConsolePrintf("%c", *pbuf++);
   }
-  Rprintf("");
+  ConsolePrintf("");
 
 } /* FlushBuffer */
 
@@ -521,8 +584,8 @@ int GetaString(PINPUTBUF pibIn, PSTR szLex) {
   } /* if */
 
   if (i == MAX_LEX - 1) {
-    Rprintf("\n***Error: max string length MAX_LEX exceeded in: %s\n", szLex);
-    Rprintf("Exiting...\n\n");
+    ConsolePrintf("\n***Error: max string length MAX_LEX exceeded in: %s\n", szLex);
+    ConsolePrintf("Exiting...\n\n");
     return EXIT_ERROR;
   }
 
@@ -582,7 +645,8 @@ BOOL GetFuncArgs(PINPUTBUF pibIn, int nArgs, int rgiArgTypes[], PSTR szArgs, lon
   } /* for i */
 
   /* try to get closing parenthesis if not already gotten */
-  if (!(bOK = (szPunct[0] == CH_RPAREN || PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_RPAREN))))) {
+  if (!(szPunct[0] == CH_RPAREN || PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_RPAREN)))) {
+    bOK = FALSE;
     szPunct[1] = CH_RPAREN;
     PROPAGATE_EXIT(ReportError(pibIn, RE_EXPECTED, szPunct, NULL));
   }
@@ -911,7 +975,7 @@ int SkipComment(PINPUTBUF pibIn) {
 
   while (*pibIn->pbufCur++ != CH_EOLN) { /* Eat 1 line comment */
     if (!*pibIn->pbufCur) {
-      if (PROPAGATE_EXIT_OR_RETURN_RESULT(FillBuffer(pibIn, BUFFER_SIZE))) {
+      if (!pibIn->pfileIn || PROPAGATE_EXIT_OR_RETURN_RESULT(FillBuffer(pibIn, BUFFER_SIZE))) {
         break;
       }
     }
@@ -1037,20 +1101,21 @@ int EatStatement(PINPUTBUF pib) {
    is otherwise unprocessed. Syntactical validity will be checked
    later.
 
-   The buffer szStmt is assumed to be of type PSTREQN of size MAX_EQN.
+   The statement replaces the contents of psbStmt, whatever its length.
 */
 
-int GetStatement(PINPUTBUF pibIn, PSTR szStmt, int iKWCode) {
-  int i = 0;
+int GetStatement(PINPUTBUF pibIn, PSTRBUF psbStmt, int iKWCode) {
   int fDone = 0;
   int iParCount = 0;     /* parentheses counter */
   BOOL bParOpen = FALSE; /* True if a parenthesis is still open */
   BOOL bEscaped = FALSE;
+  char c;
 
-  if (!pibIn || !szStmt) {
+  if (!pibIn || !psbStmt) {
     return 0;
   }
 
+  ClearStrBuf(psbStmt);
   PROPAGATE_EXIT(SkipWhitespace(pibIn));
 
   if (!EOB(pibIn)) {
@@ -1081,26 +1146,20 @@ int GetStatement(PINPUTBUF pibIn, PSTR szStmt, int iKWCode) {
             if (bEscaped) {
               bEscaped = FALSE; /* reset it */
             }
-            if (i < MAX_EQN - 2) {
-              if ((szStmt[i++] = *pibIn->pbufCur++) == CH_EOLN) {
-                pibIn->iLineNum++;
-              }
-              if ((char)szStmt[i - 1] == '(') {
-                iParCount++;
-                bParOpen = TRUE;
-              }
-              if ((char)szStmt[i - 1] == ')') {
-                iParCount--;
-              }
-              if ((iParCount == 0) && bParOpen) {
-                bParOpen = FALSE;
-              }
-            } else {
-              if (bParOpen) {
-                PROPAGATE_EXIT(ReportError(pibIn, RE_UNBALPAR | RE_FATAL, NULL, NULL));
-              } else {
-                PROPAGATE_EXIT(ReportError(pibIn, RE_EQNTOOLONG | RE_FATAL, NULL, NULL));
-              }
+            c = *pibIn->pbufCur++;
+            PROPAGATE_EXIT(StrBufCat(pibIn, psbStmt, &c, 1));
+            if (c == CH_EOLN) {
+              pibIn->iLineNum++;
+            }
+            if (c == '(') {
+              iParCount++;
+              bParOpen = TRUE;
+            }
+            if (c == ')') {
+              iParCount--;
+            }
+            if ((iParCount == 0) && bParOpen) {
+              bParOpen = FALSE;
             }
           }
         } else { /* statement terminator ';' found */
@@ -1115,15 +1174,13 @@ int GetStatement(PINPUTBUF pibIn, PSTR szStmt, int iKWCode) {
     } /* while */
 
     /* remove white spaces going backward - FB 28/2/98 */
-    while (isspace(szStmt[i - 1])) {
-      i = i - 1;
+    while (psbStmt->cch && isspace(psbStmt->sz[psbStmt->cch - 1])) {
+      psbStmt->sz[--psbStmt->cch] = '\0';
     }
 
-    szStmt[i] = '\0';
-
   } /* if */
 
-  if (!i) {
+  if (!psbStmt->cch) {
     PROPAGATE_EXIT(ReportError(pibIn, RE_LEXEXPECTED | RE_FATAL, "rvalue to assignment", NULL));
   }
   return 0;
@@ -1204,81 +1261,130 @@ int SkipWhitespace(PINPUTBUF pibIn) {
 
 } /* SkipWhitespace */
 
+/* ---------------------------------------------------------------------------
+   InitStrBuf
+
+   Sets up psb empty, to grow in parena.
+*/
+
+void InitStrBuf(PSTRBUF psb, PARENA parena) {
+  static char szEmpty[1] = "";
+
+  psb->parena = parena;
+  psb->sz = szEmpty;
+  psb->cch = psb->cb = 0;
+
+} /* InitStrBuf */
+
+/* ---------------------------------------------------------------------------
+   ClearStrBuf
+
+   Empties psb, keeping its memory for the next string.
+*/
+
+void ClearStrBuf(PSTRBUF psb) {
+  if (psb->cb) {
+    psb->sz[0] = '\0';
+  }
+  psb->cch = 0;
+
+} /* ClearStrBuf */
+
+/* ---------------------------------------------------------------------------
+   StrBufCat
+
+   Appends the cch characters at pch to psb, growing it as needed. The
+   old memory stays in the arena until it is freed, so growth doubles the
+   size to keep the waste below what is used.
+*/
+
+int StrBufCat(PINPUTBUF pibIn, PSTRBUF psb, const char *pch, size_t cch) {
+  size_t cbNew;
+  PSTR szNew;
+
+  if (psb->cch + cch + 1 > psb->cb) {
+    cbNew = (psb->cb < 128 ? 256 : 2 * psb->cb);
+    if (cbNew < psb->cch + cch + 1) {
+      cbNew = psb->cch + cch + 1;
+    }
+    if (!(szNew = (PSTR)ArenaAlloc(psb->parena, cbNew))) {
+      PROPAGATE_EXIT(ReportError(pibIn, RE_OUTOFMEM | RE_FATAL, "StrBufCat", NULL));
+    }
+    memcpy(szNew, psb->sz, psb->cch + 1);
+    psb->sz = szNew;
+    psb->cb = cbNew;
+  }
+
+  memcpy(psb->sz + psb->cch, pch, cch);
+  psb->cch += cch;
+  psb->sz[psb->cch] = '\0';
+  return 0;
+
+} /* StrBufCat */
+
 /* ---------------------------------------------------------------------------
    UnrollEquation
 
-   Copy szEqn in szEqnU, replacing bracketed expressions evaluating in
-   <number> by _number. Expressions can be composed of integers, the
-   4 basic arithmetic operators, parentheses and 'i' which stands for the
-   argument index passed to the routine.
+   Sets *pszEqnU to szEqn with bracketed expressions evaluating in
+   <number> replaced by _number. Expressions can be composed of integers,
+   the 4 basic arithmetic operators, parentheses and 'i' which stands for
+   the argument index passed to the routine.
    Examples:
    y[0] -> y_0
    y[1 + 1] -> y_2
    y[i * 2] -> y_4 if index = 2
+
+   Only an equation with brackets is copied, into psbEqnU; *pszEqnU is
+   szEqn itself otherwise.
 */
 
-int UnrollEquation(PINPUTBUF pibIn, long index, PSTR szEqn, PSTR szEqnU) {
-  int j = 0, k = 0, m;
-  BOOL bExpress = FALSE;
+int UnrollEquation(PINPUTBUF pibIn, long index, PSTR szEqn, PSTRBUF psbEqnU, PSTR *pszEqnU) {
+  PSTR pch, pchEnd;
+  size_t cch;
   PSTRLEX szExpression;
 
-  while ((szEqn[j] != '\0') && (k < MAX_EQN - 1)) {
-    if (bExpress) { /* bracketed expressions found: scan it up to ] included */
-      /* copy the expression to a temporary string */
-      m = 0;
-      while ((szEqn[j] != '\0') && (szEqn[j] != ']') && (m < MAX_EQN - 1)) {
-        szExpression[m] = szEqn[j];
-        j++;
-        m++;
-      }
-      if (szEqn[j] == ']') { /* skip and exit expression parsing mode */
-        j++;
-        bExpress = FALSE;
-      }
-      if ((szEqn[j] != '\0') && (m == MAX_EQN - 1)) {
-        PROPAGATE_EXIT(ReportError(pibIn, RE_EQNTOOLONG | RE_FATAL, NULL, "(Occured while unrolling a loop)"));
-      }
-      szExpression[m] = '\0'; /* terminate szExpression */
-
-      /* compute expression and put back the result in szExpression */
-      long expression_result = PROPAGATE_EXIT_OR_RETURN_RESULT(EvaluateExpression(pibIn, index, szExpression));
-      snprintf(szExpression, MAX_LEX, "%ld", expression_result);
-
-      /* copy szExpression into szEqnU */
-      m = 0;
-      while ((szExpression[m] != '\0') && (m < MAX_EQN - 1)) {
-        szEqnU[k] = szExpression[m];
-        k++;
-        m++;
-      }
-    } /* end if bExpress */
-    else {
-      switch (szEqn[j]) {
-      case '[': /* replace by _ and enter expression parsing mode */
-        szEqnU[k] = '_';
-        j++;
-        k++;
-        bExpress = TRUE;
-        break;
+  if (!(pch = strchr(szEqn, '['))) {
+    if ((pchEnd = strchr(szEqn, ']'))) {
+      PROPAGATE_EXIT(ReportError(pibIn, RE_UNEXPECTED | RE_FATAL, "]", "(Could be nested brackets)"));
+    }
+    *pszEqnU = szEqn;
+    return 0;
+  }
 
-      case ']': /* should have been eaten in expression parsing mode */
-        PROPAGATE_EXIT(ReportError(pibIn, RE_UNEXPECTED | RE_FATAL, "]", "(Could be nested brackets)"));
+  ClearStrBuf(psbEqnU);
+  while (*szEqn) {
+    /* copy up to the next [, replaced by _ */
+    cch = strcspn(szEqn, "[]");
+    PROPAGATE_EXIT(StrBufCat(pibIn, psbEqnU, szEqn, cch));
+    szEqn += cch;
+    if (*szEqn == ']') { /* should have been eaten with its expression */
+      PROPAGATE_EXIT(ReportError(pibIn, RE_UNEXPECTED | RE_FATAL, "]", "(Could be nested brackets)"));
+    }
+    if (!*szEqn) {
+      break;
+    }
+    PROPAGATE_EXIT(StrBufCat(pibIn, psbEqnU, "_", 1));
+    szEqn++;
 
-      default: /* copy and advance */
-        szEqnU[k] = szEqn[j];
-        j++;
-        k++;
-        break;
-      }
+    /* copy the expression, up to ] excluded, to a temporary string */
+    cch = strcspn(szEqn, "]");
+    if (cch >= MAX_LEX) {
+      PROPAGATE_EXIT(ReportError(pibIn, RE_EQNTOOLONG | RE_FATAL, NULL, "(Occured while unrolling a loop)"));
+    }
+    memcpy(szExpression, szEqn, cch);
+    szExpression[cch] = '\0';
+    szEqn += cch;
+    if (*szEqn == ']') { /* skip and exit expression parsing mode */
+      szEqn++;
     }
-  } /* while */
-  if ((szEqn[j] != '\0') && (k == MAX_EQN - 1)) {
-    PROPAGATE_EXIT(ReportError(pibIn, RE_EQNTOOLONG | RE_FATAL, NULL, "(Occured in UnrollEquation)"));
-  }
 
-  /* terminate szEqnU */
-  szEqnU[k] = '\0';
+    /* compute expression and append the result */
+    long expression_result = PROPAGATE_EXIT_OR_RETURN_RESULT(EvaluateExpression(pibIn, index, szExpression));
+    snprintf(szExpression, MAX_LEX, "%ld", expression_result);
+    PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqnU, szExpression));
+  } /* while */
 
+  *pszEqnU = psbEqnU->sz;
   return 0;
 } /* UnrollEquation */
 
@@ -25,6 +25,7 @@
 /* ---------------------------------------------------------------------------
    Inclusions  */
 
+#include "arena.h"
 #include "hungtype.h"
 #include <stdint.h>
 
@@ -33,7 +34,6 @@
 
 #define BUFFER_SIZE 0x1000 /* Size of input data buffer */
 #define MAX_LEX 0x03FF     /* Max size of Lexical Element */
-#define MAX_EQN 0x13FF     /* Max size of a string eqn */
 #define MAX_NAME 80        /* Max size of a name */
 
 /* ---------------------------------------------------------------------------
@@ -105,6 +105,8 @@
 #define RE_NOOUTPUTEQN (RE_MODERROR + 13) /* Missing dyn eqn for szMsg */
 #define RE_DUPSECT (RE_MODERROR + 14)     /* Duplicated section szMsg */
 #define RE_NOEND (RE_MODERROR + 15)       /* Missing End keyword */
+#define RE_NOMODEL (RE_MODERROR + 16)     /* Nothing to translate */
+#define RE_TOOLARGE (RE_MODERROR + 17)    /* szMsg left out for size */
 
 #define RE_SIMERROR 0x0200 /* Simulation error prefix */
 
@@ -115,7 +117,7 @@
   {                                                                                                                    \
     int ret = (func);                                                                                                  \
     if (ret == EXIT_NOERROR || ret == EXIT_ERROR) {                                                                    \
-      Rprintf("PROPAGATE_EXIT at line %d in file %s\n", __LINE__, __FILE__);                                           \
+      ConsolePrintf("PROPAGATE_EXIT at line %d in file %s\n", __LINE__, __FILE__);                                     \
       return ret;                                                                                                      \
     }                                                                                                                  \
   }
@@ -124,7 +126,7 @@
   __extension__({                                                                                                      \
     int ret = (func);                                                                                                  \
     if (ret == EXIT_NOERROR || ret == EXIT_ERROR) {                                                                    \
-      Rprintf("PROPAGATE_EXIT_OR_RETURN_RESULT at line %d in file %s\n", __LINE__, __FILE__);                          \
+      ConsolePrintf("PROPAGATE_EXIT_OR_RETURN_RESULT at line %d in file %s\n", __LINE__, __FILE__);                    \
       return ret;                                                                                                      \
     }                                                                                                                  \
     ret;                                                                                                               \
@@ -135,7 +137,7 @@
     int ret = (func);                                                                                                  \
     if (ret == EXIT_NOERROR || ret == EXIT_ERROR) {                                                                    \
       (cleanup);                                                                                                       \
-      Rprintf("PROPAGATE_EXIT at line %d in file %s\n", __LINE__, __FILE__);                                           \
+      ConsolePrintf("PROPAGATE_EXIT at line %d in file %s\n", __LINE__, __FILE__);                                     \
       return ret;                                                                                                      \
     }                                                                                                                  \
   }
@@ -145,7 +147,7 @@
     int ret = (func);                                                                                                  \
     if (ret == EXIT_NOERROR || ret == EXIT_ERROR) {                                                                    \
       (cleanup);                                                                                                       \
-      Rprintf("PROPAGATE_EXIT_OR_RETURN_RESULT at line %d in file %s\n", __LINE__, __FILE__);                          \
+      ConsolePrintf("PROPAGATE_EXIT_OR_RETURN_RESULT at line %d in file %s\n", __LINE__, __FILE__);                    \
       return ret;                                                                                                      \
     }                                                                                                                  \
     ret;                                                                                                               \
@@ -174,7 +176,17 @@ typedef struct tagINPUTBUF {
 void InitINPUTBUF(PINPUTBUF pibIn);
 
 typedef char PSTRLEX[MAX_LEX]; /* String of a lexical element */
-typedef char PSTREQN[MAX_EQN]; /* String of an equation */
+
+/* A string of any length, such as an equation, grown as needed in an
+   arena: an error that ends the translation leaves nothing to free. Set
+   up by InitStrBuf(), it is best reused from one string to the next. */
+typedef struct tagSTRBUF {
+  PARENA parena; /* Where it grows */
+  PSTR sz;       /* The string, always terminated */
+  size_t cch;    /* Its length */
+  size_t cb;     /* Bytes at sz, 0 until something is put in */
+
+} STRBUF, *PSTRBUF; /* tagSTRBUF */
 
 /* ---------------------------------------------------------------------------
    Public Macros */
@@ -188,12 +200,18 @@ typedef char PSTREQN[MAX_EQN]; /* String of an equation */
 #define IsComment(szLex) ((szLex) ? (*(szLex) == CH_COMMENT) : (0))
 #define IsString(szLex) ((szLex) ? (*(szLex) == CH_STRDELIM) : (0))
 
+#define StrBufCatSz(pibIn, psb, sz) StrBufCat((pibIn), (psb), (sz), strlen(sz))
+
 #define ErrorsReported(pib) ((pib)->cErrors)
 #define ClearErrors(pib) ((pib) ? (pib)->cErrors = 0 : 0)
 
 /* ---------------------------------------------------------------------------
    Prototypes */
 
+void ConsolePrintf(const char *szFmt, ...); /* In lexerr.c */
+
+void ClearStrBuf(PSTRBUF psb);
+
 __attribute__((warn_unused_result)) int EatStatement(PINPUTBUF pib);
 __attribute__((warn_unused_result)) int EGetPunct(PINPUTBUF pibIn, PSTR szLex, char chPunct);
 __attribute__((warn_unused_result)) BOOL ENextLex(PINPUTBUF, PSTRLEX, int);
@@ -216,10 +234,13 @@ void GetInteger(PINPUTBUF pibIn, PSTR szLex, PINT piLexType);
 void GetNumber(PINPUTBUF pibIn, PSTR szLex, PINT piLexType);
 __attribute__((warn_unused_result)) int GetOptPunct(PINPUTBUF, PSTR, char);
 __attribute__((warn_unused_result)) int GetPunct(PINPUTBUF pibIn, PSTR szLex, char chPunct);
-__attribute__((warn_unused_result)) int GetStatement(PINPUTBUF pibIn, PSTR szStmt, int iKWCode);
+__attribute__((warn_unused_result)) int GetStatement(PINPUTBUF pibIn, PSTRBUF psbStmt, int iKWCode);
 void GetToken(PSTR *szExpress, PSTR szToken, PINT piType);
 
 __attribute__((warn_unused_result)) BOOL InitBuffer(PINPUTBUF pibIn, long lBuffer_size, PSTR szFullPathname);
+__attribute__((warn_unused_result)) BOOL InitStringBuffer(PINPUTBUF pibIn, PSTR szText);
+
+void InitStrBuf(PSTRBUF psb, PARENA parena);
 
 void MakeStringBuffer(PINPUTBUF pBuf, PINPUTBUF pStrBuf, PSTR sz);
 
@@ -229,10 +250,14 @@ __attribute__((warn_unused_result)) int NextListItem(PINPUTBUF, PSTR, int, int,
 
 void PreventLexSplit(PINPUTBUF pibIn, int iOffset);
 
+__attribute__((warn_unused_result)) BOOL ReadWholeFile(PINPUTBUF pibIn, PSTR szFileIn);
+
 __attribute__((warn_unused_result)) int SkipComment(PINPUTBUF);
 __attribute__((warn_unused_result)) int SkipWhitespace(PINPUTBUF pibIn);
+__attribute__((warn_unused_result)) int StrBufCat(PINPUTBUF pibIn, PSTRBUF psb, const char *pch, size_t cch);
 
-__attribute__((warn_unused_result)) int UnrollEquation(PINPUTBUF pibIn, long index, PSTR szEqn, PSTR szEqnU);
+__attribute__((warn_unused_result)) int UnrollEquation(PINPUTBUF pibIn, long index, PSTR szEqn, PSTRBUF psbEqnU,
+                                                       PSTR *pszEqnU);
 
 #define LEX_H_DEFINED
 #endif
@@ -23,11 +23,156 @@
 #include <R.h>
 #include <Rinternals.h>
 
+#include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "lexerr.h"
+#include "modctx.h"
+
+/* Messages are captured in the translation context, if any, see
+   CaptureErrors(); otherwise they are printed */
+#define CAPTURING() (vptrans && vptrans->ppemTail)
+
+/* ---------------------------------------------------------------------------
+   ErrPrintf
+
+   Prints to the console, or appends to the message being captured.
+*/
+
+static void ErrPrintf(const char *szFmt, ...) {
+  va_list ap;
+
+  va_start(ap, szFmt);
+  if (CAPTURING()) {
+    if (vptrans->cchMsg < MAX_ERRMSG - 1) {
+      int cch = vsnprintf(vptrans->szMsg + vptrans->cchMsg, MAX_ERRMSG - vptrans->cchMsg, szFmt, ap);
+      if (cch > 0) {
+        vptrans->cchMsg += cch;
+        if (vptrans->cchMsg > MAX_ERRMSG - 1) {
+          vptrans->cchMsg = MAX_ERRMSG - 1;
+        }
+      }
+    }
+  } else {
+    Rvprintf(szFmt, ap);
+  }
+  va_end(ap);
+
+} /* ErrPrintf */
+
+/* ---------------------------------------------------------------------------
+   ConsolePrintf
+
+   Prints what the translator has to say outside of ReportError(), such
+   as progress and traces of the errors propagated. While capturing it
+   is kept in the translation context instead, to be printed by the
+   caller: R's console must not be written to from parallel threads.
+   Text that cannot be kept for lack of memory is dropped.
+*/
+
+void ConsolePrintf(const char *szFmt, ...) {
+  va_list ap, apSize;
+  int cch;
+
+  va_start(ap, szFmt);
+  if (CAPTURING()) {
+    va_copy(apSize, ap);
+    cch = vsnprintf(NULL, 0, szFmt, apSize);
+    va_end(apSize);
+
+    if (cch > 0 && vptrans->cchConsole + cch + 1 > vptrans->cbConsole) {
+      size_t cbNew = 2 * vptrans->cbConsole + cch + 1;
+      PSTR szNew = (PSTR)realloc(vptrans->szConsole, cbNew);
+      if (szNew) {
+        vptrans->szConsole = szNew;
+        vptrans->cbConsole = cbNew;
+      }
+    }
+    if (cch > 0 && vptrans->cchConsole + cch + 1 <= vptrans->cbConsole) {
+      vsnprintf(vptrans->szConsole + vptrans->cchConsole, cch + 1, szFmt, ap);
+      vptrans->cchConsole += cch;
+    }
+  } else {
+    Rvprintf(szFmt, ap);
+  }
+  va_end(ap);
+
+} /* ConsolePrintf */
+
+/* ---------------------------------------------------------------------------
+   KeepError
+
+   Appends the message written by ReportError() to the captured list.
+   Messages that cannot be kept for lack of memory are printed.
+*/
+
+static void KeepError(BOOL bWarning, int iLine) {
+  PSTR szMsg = vptrans->szMsg;
+  PERRMSG pem;
+
+  while (vptrans->cchMsg > 0 && isspace(vptrans->szMsg[vptrans->cchMsg - 1])) {
+    vptrans->szMsg[--vptrans->cchMsg] = '\0';
+  }
+  while (isspace(*szMsg)) {
+    szMsg++;
+  }
+  if (!*szMsg) { /* Nothing to say, e.g. aborting after earlier errors */
+    return;
+  }
+
+  pem = (PERRMSG)malloc(sizeof(ERRMSG));
+  if (!pem || !(pem->szMsg = strdup(szMsg))) {
+    free(pem);
+    ConsolePrintf("%s\n", szMsg);
+    return;
+  }
+
+  pem->bWarning = bWarning;
+  pem->iLine = iLine;
+  pem->pemNext = NULL;
+  *vptrans->ppemTail = pem;
+  vptrans->ppemTail = &pem->pemNext;
+
+} /* KeepError */
+
+/* ---------------------------------------------------------------------------
+   CaptureErrors
+
+   Starts keeping the messages of ReportError() in the list *ppemList,
+   which must be empty, instead of printing them. Stops if ppemList
+   is NULL. The caller frees the list with FreeErrors(). Messages are
+   kept per translation context, see BindTranslation(): without one
+   bound, they are always printed.
+*/
+
+void CaptureErrors(PERRMSG *ppemList) {
+  if (vptrans) {
+    vptrans->ppemTail = ppemList;
+  }
+  if (ppemList) {
+    *ppemList = NULL;
+  }
+
+} /* CaptureErrors */
+
+/* ---------------------------------------------------------------------------
+   FreeErrors
+*/
+
+void FreeErrors(PERRMSG pem) {
+  PERRMSG pemNext;
+
+  while (pem) {
+    pemNext = pem->pemNext;
+    free(pem->szMsg);
+    free(pem);
+    pem = pemNext;
+  }
+
+} /* FreeErrors */
 
 /* ---------------------------------------------------------------------------
 ReportError
@@ -40,6 +185,7 @@ int ReportError(PINPUTBUF pibIn, WORD wCode, PSTR szMsg, PSTR szAltMsg) {
   char cNull = '\0';
   BOOL bFatal = wCode & RE_FATAL;
   BOOL bWarning = wCode & RE_WARNING;
+  int iLine = 0;
 
   wCode &= ~(RE_FATAL | RE_WARNING);
 
@@ -47,23 +193,31 @@ int ReportError(PINPUTBUF pibIn, WORD wCode, PSTR szMsg, PSTR szAltMsg) {
     szMsg = &cNull;
   }
 
+  if (CAPTURING()) {
+    vptrans->cchMsg = 0;
+    vptrans->szMsg[0] = '\0';
+  }
+
   if (wCode) {
-    if (bWarning) {
-      Rprintf("*** Warning: ");
-    } else {
-      Rprintf("*** Error: ");
+    if (!bWarning) {
       bFatal |= (pibIn && (pibIn->cErrors++ > MAX_ERRORS));
-    } /* else */
+    }
+    if (!CAPTURING()) {
+      Rprintf(bWarning ? "*** Warning: " : "*** Error: ");
+    }
   } /* if */
 
   if (pibIn) {
-    if (pibIn->pfileIn || pibIn->iLNPrev) { /* Line number is valid */
-      Rprintf("line %d: ", pibIn->iLineNum);
+    if (pibIn->pfileIn || pibIn->iLNPrev || pibIn->lBufSize) { /* Line number is valid */
+      iLine = pibIn->iLineNum;
+      if (!CAPTURING()) {
+        Rprintf("line %d: ", iLine);
+      }
     } else {
       if (wCode != RE_FILENOTFOUND) { /* Dummy pibIn, show buffer */
         PSTRLEX szTmp;
         szTmp[MAX_LEX - 1] = '\0';
-        Rprintf("'%s'...\n  ", strncpy(szTmp, pibIn->pbufOrg, MAX_LEX - 1));
+        ErrPrintf("'%s'...\n  ", strncpy(szTmp, pibIn->pbufOrg, MAX_LEX - 1));
       } /* if */
     }
   }
@@ -74,40 +228,40 @@ int ReportError(PINPUTBUF pibIn, WORD wCode, PSTR szMsg, PSTR szAltMsg) {
     break;
 
   default:
-    Rprintf("Unknown error code %x: %s", wCode, szMsg);
+    ErrPrintf("Unknown error code %x: %s", wCode, szMsg);
 
   case RE_INIT:
-    Rprintf("Initialization error.");
+    ErrPrintf("Initialization error.");
     break;
 
   case RE_FILENOTFOUND:
-    Rprintf("File not found \"%s\".", szMsg);
+    ErrPrintf("File not found \"%s\".", szMsg);
     break;
 
   case RE_CANNOTOPEN:
-    Rprintf("Cannot open file \"%s\".", szMsg);
+    ErrPrintf("Cannot open file \"%s\".", szMsg);
     break;
 
   case RE_UNEXPECTED:
-    Rprintf("Unexpected character '%c' in input file.", *szMsg);
+    ErrPrintf("Unexpected character '%c' in input file.", *szMsg);
     break;
 
   case RE_UNEXPESCAPE:
-    Rprintf("Unexpected escape sequence '%s' in input file.", szMsg);
+    ErrPrintf("Unexpected escape sequence '%s' in input file.", szMsg);
     break;
 
   case RE_UNEXPNUMBER:
-    Rprintf("Unexpected number %s in input file.", szMsg);
+    ErrPrintf("Unexpected number %s in input file.", szMsg);
     break;
 
   case RE_EXPECTED:
-    Rprintf("Expected '%c' before '%c'.", szMsg[1], szMsg[0]);
+    ErrPrintf("Expected '%c' before '%c'.", szMsg[1], szMsg[0]);
     break;
 
   case RE_LEXEXPECTED:
-    Rprintf("Expected <%s>", szMsg);
+    ErrPrintf("Expected <%s>", szMsg);
     if (szAltMsg) {
-      Rprintf(" before '%s'", szAltMsg);
+      ErrPrintf(" before '%s'", szAltMsg);
     }
     break;
 
@@ -116,78 +270,93 @@ int ReportError(PINPUTBUF pibIn, WORD wCode, PSTR szMsg, PSTR szAltMsg) {
     /* Model generator errors */
 
   case RE_BADCONTEXT:
-    Rprintf("'%s' used in invalid context.", szMsg);
+    ErrPrintf("'%s' used in invalid context.", szMsg);
     break;
 
   case RE_DUPDECL:
-    Rprintf("Duplicate declaration of model variable '%s'.", szMsg);
+    ErrPrintf("Duplicate declaration of model variable '%s'.", szMsg);
     break;
 
   case RE_DUPSECT:
-    Rprintf("Only one '%s' section is allowed.", szMsg);
+    ErrPrintf("Only one '%s' section is allowed.", szMsg);
     break;
 
   case RE_OUTOFMEM:
-    Rprintf("Out of memory in %s() !", szMsg);
+    ErrPrintf("Out of memory in %s() !", szMsg);
     break;
 
   case RE_REDEF:
-    Rprintf("'%s' redefined.", szMsg);
+    ErrPrintf("'%s' redefined.", szMsg);
     break;
 
   case RE_EQNTOOLONG:
-    Rprintf("Equation is too long.  Possibly missing terminator.");
+    ErrPrintf("Equation is too long.  Possibly missing terminator.");
     break;
 
   case RE_BADSTATE:
-    Rprintf("Invalid state identifier '%s'.", szMsg);
+    ErrPrintf("Invalid state identifier '%s'.", szMsg);
     break;
 
   case RE_UNDEFINED:
-    Rprintf("Undefined identifier '%s'.", szMsg);
+    ErrPrintf("Undefined identifier '%s'.", szMsg);
     break;
 
   case RE_NOINPDEF:
-    Rprintf("Input '%s' is not initialized.", szMsg);
+    ErrPrintf("Input '%s' is not initialized.", szMsg);
     break;
 
   case RE_NODYNEQN:
-    Rprintf("State variable '%s' has no dynamics.", szMsg);
+    ErrPrintf("State variable '%s' has no dynamics.", szMsg);
     break;
 
   case RE_NOOUTPUTEQN:
-    Rprintf("Output variable '%s' is not computed anywhere.", szMsg);
+    ErrPrintf("Output variable '%s' is not computed anywhere.", szMsg);
     break;
 
   case RE_TOOMANYVARS:
-    Rprintf("Too many %s declarations. Limit is %d.", szMsg, *(PINT)szAltMsg);
+    ErrPrintf("Too many %s declarations. Limit is %d.", szMsg, *(PINT)szAltMsg);
     break;
 
   case RE_POSITIVE:
-    Rprintf("Positive number expected.");
+    ErrPrintf("Positive number expected.");
     break;
 
   case RE_NAMETOOLONG:
-    Rprintf("Name %s exceed %d characters.", szMsg, MAX_NAME);
+    ErrPrintf("Name %s exceed %d characters.", szMsg, MAX_NAME);
     break;
 
   case RE_UNBALPAR:
-    Rprintf("Unbalanced () or equation too long at this line or above.");
+    ErrPrintf("Unbalanced () or equation too long at this line or above.");
     break;
 
   case RE_NOEND:
-    Rprintf("End keyword is missing in file %s.", szMsg);
+    ErrPrintf("End keyword is missing in file %s.", szMsg);
+    break;
+
+  case RE_NOMODEL:
+    ErrPrintf("No Dynamics, outputs or global variables defined.");
+    break;
+
+  case RE_TOOLARGE:
+    ErrPrintf("%s is too large and is left out.", szMsg);
     break;
 
   } /* switch */
 
-  Rprintf("\n");
   if (szAltMsg && wCode != RE_LEXEXPECTED) {
-    Rprintf("%s\n", szAltMsg);
+    ErrPrintf("\n%s", szAltMsg);
+  }
+
+  if (CAPTURING()) {
+    KeepError(bWarning && !bFatal, iLine);
+  } else {
+    Rprintf("\n");
   }
 
   if (bFatal) {
-    Rprintf("One or more fatal errors: Exiting...\n\n");
+    if (!CAPTURING()) {
+      Rprintf("One or more fatal errors: Exiting...\n\n");
+    }
     return EXIT_ERROR;
   } /* if */
   return 0;
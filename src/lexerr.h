@@ -28,9 +28,23 @@
 #include "hungtype.h"
 #include "lex.h"
 
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* A message of ReportError(), kept instead of printed while capturing */
+typedef struct tagERRMSG {
+  BOOL bWarning;
+  int iLine; /* Line in the model, 0 if unknown */
+  PSTR szMsg;
+  struct tagERRMSG *pemNext;
+
+} ERRMSG, *PERRMSG; /* tagERRMSG */
+
 /* ---------------------------------------------------------------------------
    Prototypes */
 
+void CaptureErrors(PERRMSG *ppemList);
+void FreeErrors(PERRMSG pem);
 __attribute__((warn_unused_result)) int ReportError(PINPUTBUF, WORD, PSTR, PSTR);
 
 #define LEXERR_H_DEFINED
@@ -40,15 +40,15 @@
 #include "strutil.h"
 
 #include "mod.h"
+#include "modd.h"
 
 /* Macros */
 
 #define IsIdentifier(sz) ((sz) ? isalpha(*(sz)) || *(sz) == '_' : FALSE)
 
 HANDLE CalculateVarHandle(PVMMAPSTRCT pvm, PSTR sz);
-static PVMMAPSTRCT vpvmGlo; /* Global symbol table (yech) */
 
-#define GetParmHandle(sz) (CalculateVarHandle(vpvmGlo, (sz)))
+#define GetParmHandle(pvmGlo, sz) (CalculateVarHandle((pvmGlo), (sz)))
 
 /* Keyword Map Structure */
 
@@ -70,6 +70,32 @@ IFM vrgifmMap[] = {
 
 }; /* vrgifnMap[] = */
 
+/* Slots of the input functions, see WORDHASH */
+static const short vrgiInputFnSlots[16] = {
+    0, 0, 0, 0, 1, 0, 4, 0, 2, 0, 0, 3, 0, 0, 0, 0
+};
+
+WH_CHECK_WORDS(WH_INPUTFNS_CHECK, vrgifmMap, 4);
+static const WORDHASH vwhInputFns = {vrgifmMap, sizeof(IFM), 4, 4u, 16, vrgiInputFnSlots};
+
+IFM vrgdfmMap[] = {
+    /* Dosing function map */
+
+    {"Add", DFN_ADD},
+    {"Replace", DFN_REPLACE},
+    {"Multiply", DFN_MULTIPLY},
+    {"", DFN_NULL} /* End flag */
+
+}; /* vrgdfmMap[] = */
+
+/* Slots of the dosing functions, see WORDHASH */
+static const short vrgiDoseFnSlots[16] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 1, 0, 2, 0, 0
+};
+
+WH_CHECK_WORDS(WH_DOSEFNS_CHECK, vrgdfmMap, 3);
+static const WORDHASH vwhDoseFns = {vrgdfmMap, sizeof(IFM), 3, 1u, 16, vrgiDoseFnSlots};
+
 /* ----------------------------------------------------------------------------
  GetFnType
 
@@ -78,11 +104,7 @@ IFM vrgifmMap[] = {
 */
 
 int GetFnType(PSTR szName) {
-  PIFM pifm = &vrgifmMap[0];
-
-  while (*pifm->szName && MyStrcmp(szName, pifm->szName)) {
-    pifm++;
-  }
+  PIFM pifm = &vrgifmMap[LookupWord(&vwhInputFns, szName)];
 
   return (pifm->iIFNType); /* Return Keyword Code or 0 */
 
@@ -119,8 +141,9 @@ void InitIFN(PIFN pifn) {
 /* ----------------------------------------------------------------------------
    DefDepParm
 
-   Defines a parameter or a handle to a model parameter on which the
-   parameter is dependent.  Returns TRUE on success.
+   Defines a parameter or a handle to a model parameter, of the global
+   variables pvmGlo, on which the parameter is dependent.  Returns TRUE
+   on success.
 
    NOTE: The call to GetParmHandle() is actually a macro.
 
@@ -130,12 +153,12 @@ void InitIFN(PIFN pifn) {
    been created and so we actually have to calculate what the
    handle will be.
 */
-BOOL DefDepParm(PSTR szLex, PDOUBLE pdValue, HANDLE *phvar) {
+BOOL DefDepParm(PVMMAPSTRCT pvmGlo, PSTR szLex, PDOUBLE pdValue, HANDLE *phvar) {
   BOOL bReturn = TRUE;
 
   if (IsIdentifier(szLex)) { /* Define handle to model parameter */
 
-    if (!(*phvar = (HANDLE)GetParmHandle(szLex))) {
+    if (!(*phvar = (HANDLE)GetParmHandle(pvmGlo, szLex))) {
       bReturn = FALSE;
       PROPAGATE_EXIT(ReportError(NULL, RE_UNDEFINED, szLex, NULL));
     } /* if */
@@ -166,6 +189,7 @@ BOOL GetInputArgs(PINPUTBUF pibIn, PIFN pifn) {
   int rgiTypes[4], i;
   long rgiLowerB[4], rgiUpperB[4];
   BOOL bReturn = FALSE;
+  PVMMAPSTRCT pvmGlo = ((PINPUTINFO)pibIn->pInfo)->pvmGloVars;
 
   for (i = 0; i < 4; i++) {
     rgiTypes[i] = LX_INTEGER | LX_FLOAT | LX_IDENTIFIER;
@@ -182,14 +206,14 @@ BOOL GetInputArgs(PINPUTBUF pibIn, PIFN pifn) {
 
     /* Try to get each parm to show all errors */
     bReturn = TRUE;
-    bReturn &= DefDepParm(rgszLex[0], &pifn->dMag, &pifn->hMag);
-    bReturn &= DefDepParm(rgszLex[1], &pifn->dTper, &pifn->hTper);
-    bReturn &= DefDepParm(rgszLex[2], &pifn->dT0, &pifn->hT0);
+    bReturn &= DefDepParm(pvmGlo, rgszLex[0], &pifn->dMag, &pifn->hMag);
+    bReturn &= DefDepParm(pvmGlo, rgszLex[1], &pifn->dTper, &pifn->hTper);
+    bReturn &= DefDepParm(pvmGlo, rgszLex[2], &pifn->dT0, &pifn->hT0);
 
     if (pifn->iType == IFN_PEREXP) {
-      bReturn &= DefDepParm(rgszLex[3], &pifn->dDecay, &pifn->hDecay);
+      bReturn &= DefDepParm(pvmGlo, rgszLex[3], &pifn->dDecay, &pifn->hDecay);
     } else {
-      bReturn &= DefDepParm(rgszLex[3], &pifn->dTexp, &pifn->hTexp);
+      bReturn &= DefDepParm(pvmGlo, rgszLex[3], &pifn->dTexp, &pifn->hTexp);
     }
 
     if (!bReturn) {
@@ -223,19 +247,11 @@ BOOL GetNNumbers(PINPUTBUF pibIn, PSTR szLex, int nNumbers, PDOUBLE rgd) {
 
 } /* GetNNumbers */
 
+/* The dose lists belong to the model arena, see ModelAlloc() */
 void GetNDosesCleanUp(PIFN pifn) {
-  if (pifn->rgT0s) {
-    free(pifn->rgT0s);
-    pifn->rgT0s = NULL;
-  }
-  if (pifn->rgTexps) {
-    free(pifn->rgTexps);
-    pifn->rgTexps = NULL;
-  }
-  if (pifn->rgMags) {
-    free(pifn->rgMags);
-    pifn->rgMags = NULL;
-  }
+  pifn->rgT0s = NULL;
+  pifn->rgTexps = NULL;
+  pifn->rgMags = NULL;
 }
 
 /* ----------------------------------------------------------------------------
@@ -263,9 +279,9 @@ BOOL GetNDoses(PINPUTBUF pibIn, PSTR szLex, PIFN pifn) {
     goto Exit_GetNDoses;
   } /* if */
 
-  if (!(pifn->rgT0s = (PDOUBLE)malloc(pifn->nDoses * sizeof(double))) ||
-      !(pifn->rgTexps = (PDOUBLE)malloc(pifn->nDoses * sizeof(double))) ||
-      !(pifn->rgMags = (PDOUBLE)malloc(pifn->nDoses * sizeof(double)))) {
+  if (!(pifn->rgT0s = (PDOUBLE)ModelAlloc(pifn->nDoses * sizeof(double))) ||
+      !(pifn->rgTexps = (PDOUBLE)ModelAlloc(pifn->nDoses * sizeof(double))) ||
+      !(pifn->rgMags = (PDOUBLE)ModelAlloc(pifn->nDoses * sizeof(double)))) {
     CLEANUP_AND_PROPAGATE_EXIT(GetNDosesCleanUp(pifn), ReportError(pibIn, RE_OUTOFMEM | RE_FATAL, "GetNDoses", NULL));
   }
 
@@ -292,8 +308,8 @@ BOOL GetNDoses(PINPUTBUF pibIn, PSTR szLex, PIFN pifn) {
 Exit_GetNDoses:
 
   if (bErr) {
-    REprintf("Syntax: GetNDoses (nDoses, <n Magnitudes>, "
-             "<n T0's>, <n Texposure's>)\n");
+    ConsolePrintf("Syntax: GetNDoses (nDoses, <n Magnitudes>, "
+                  "<n T0's>, <n Texposure's>)\n");
     GetNDosesCleanUp(pifn);
   }
 
@@ -320,13 +336,6 @@ BOOL GetInputFn(PINPUTBUF pibIn, PSTR sz, PIFN pifn) {
     return (FALSE);
   }
 
-  /* Define global variable map (yech) */
-  {
-    PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
-
-    vpvmGlo = pinfo->pvmGloVars;
-  } /* block */
-
   if (sz) {
     MakeStringBuffer(pibIn, pibDum, sz);
   } else {
@@ -380,3 +389,63 @@ BOOL GetInputFn(PINPUTBUF pibIn, PSTR sz, PIFN pifn) {
   return (bReturn);
 
 } /* GetInputFn */
+
+/* ----------------------------------------------------------------------------
+   GetDoseFn
+
+   Attempts to define the DFN structure pdfn according to the dosing
+   spec in sz, e.g. Add(Dose, 12, 0, 5). Each argument is a number or
+   a model parameter, as for input functions. Returns TRUE if the
+   structure is defined.
+*/
+BOOL GetDoseFn(PINPUTBUF pibIn, PSTR sz, PDFN pdfn) {
+  INPUTBUF ibDummy;
+  PINPUTBUF pibDum = &ibDummy;
+  InitINPUTBUF(pibDum);
+  PSTRLEX szLex;
+  PSTRLEX rgszLex[4];
+  int rgiTypes[4], iType, i;
+  long rgiLowerB[4], rgiUpperB[4];
+  BOOL bReturn = FALSE;
+  PVMMAPSTRCT pvmGlo = ((PINPUTINFO)pibIn->pInfo)->pvmGloVars;
+
+  memset(pdfn, 0, sizeof(DFN));
+  MakeStringBuffer(pibIn, pibDum, sz);
+
+  PROPAGATE_EXIT(NextLex(pibDum, szLex, &iType));
+  if (iType == LX_IDENTIFIER) {
+    pdfn->iType = vrgdfmMap[LookupWord(&vwhDoseFns, szLex)].iIFNType;
+  }
+  if (pdfn->iType == DFN_NULL) {
+    PROPAGATE_EXIT(ReportError(pibIn, RE_LEXEXPECTED, "dose-spec", szLex));
+    return (FALSE);
+  }
+
+  for (i = 0; i < 4; i++) {
+    rgiTypes[i] = LX_INTEGER | LX_FLOAT | LX_IDENTIFIER;
+  }
+
+  if (PROPAGATE_EXIT_OR_RETURN_RESULT(GetFuncArgs(pibDum, 4, rgiTypes, rgszLex[0], rgiLowerB, rgiUpperB))) {
+
+    for (i = 0; i < 4; i++) {
+      if ((rgiLowerB[i] != -1) || (rgiUpperB[i] != -1)) {
+        PROPAGATE_EXIT(ReportError(pibIn, RE_BADCONTEXT | RE_FATAL, "array bounds",
+                                   "Arrays cannot be used as dosing function parameters"));
+      }
+    }
+
+    /* Try to get each parm to show all errors */
+    bReturn = TRUE;
+    bReturn &= DefDepParm(pvmGlo, rgszLex[0], &pdfn->dVal, &pdfn->hVal);
+    bReturn &= DefDepParm(pvmGlo, rgszLex[1], &pdfn->dTper, &pdfn->hTper);
+    bReturn &= DefDepParm(pvmGlo, rgszLex[2], &pdfn->dT0, &pdfn->hT0);
+    bReturn &= DefDepParm(pvmGlo, rgszLex[3], &pdfn->dN, &pdfn->hN);
+
+    if (!bReturn) {
+      PROPAGATE_EXIT(ReportError(pibIn, RE_LEXEXPECTED, "dose-spec", NULL));
+    }
+  } /* if */
+
+  return (bReturn);
+
+} /* GetDoseFn */
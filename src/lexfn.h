@@ -25,6 +25,7 @@
 /* ----- Inclusions  */
 
 #include "lex.h"
+#include "mod.h"
 
 /* ----- Constants  */
 
@@ -39,6 +40,13 @@
 #define IFN_PEREXP 4
 #define IFN_NDOSES 5
 
+/* Dosing function constants */
+
+#define DFN_NULL 0
+#define DFN_ADD 1      /* The dose is added to the state */
+#define DFN_REPLACE 2  /* The state is set to the dose */
+#define DFN_MULTIPLY 3 /* The state is multiplied by the dose */
+
 /* ----- Enumerations  */
 
 /* ----- Typedefs  */
@@ -79,6 +87,25 @@ typedef struct tagIFN { /* Input Function struct */
 
 } IFN, *PIFN; /* struct tagIFN */
 
+/* A dose given to a state, Add(Val, Tper, T0, N) and the like: at T0
+   and then every Tper, N times. A single dose if Tper is 0, no limit
+   if N is 0. */
+
+typedef struct tagDFN { /* Dosing Function struct */
+  int iType;            /* DFN_ */
+
+  double dVal;  /* Dose */
+  double dTper; /* Dosing interval */
+  double dT0;   /* Time of the first dose */
+  double dN;    /* Number of doses */
+
+  HANDLE hVal; /* Handles to the parameters giving them */
+  HANDLE hTper;
+  HANDLE hT0;
+  HANDLE hN;
+
+} DFN, *PDFN; /* struct tagDFN */
+
 /* ----- Macros  */
 
 /* ----- Globals/Externals  */
@@ -87,7 +114,8 @@ typedef struct tagIFN { /* Input Function struct */
 
 int GetFnType(PSTR szName);
 void InitIFN(PIFN pifn);
-__attribute__((warn_unused_result)) BOOL DefDepParm(PSTR szLex, PDOUBLE pdValue, HANDLE *phvar);
+__attribute__((warn_unused_result)) BOOL DefDepParm(PVMMAPSTRCT pvmGlo, PSTR szLex, PDOUBLE pdValue, HANDLE *phvar);
+__attribute__((warn_unused_result)) BOOL GetDoseFn(PINPUTBUF pibIn, PSTR sz, PDFN pdfn);
 __attribute__((warn_unused_result)) BOOL GetInputArgs(PINPUTBUF pibIn, PIFN pifn);
 __attribute__((warn_unused_result)) BOOL GetNNumbers(PINPUTBUF pibIn, PSTR szLex, int nNumbers, PDOUBLE rgd);
 __attribute__((warn_unused_result)) BOOL GetNDoses(PINPUTBUF pibIn, PSTR szLex, PIFN pifn);
@@ -50,19 +50,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "getopt.h"
 #include "lexerr.h"
 #include "mod.h"
+#include "modctx.h"
+#include "modd.h"
 #include "modi.h"
 #include "modiSBML.h"
 #include "modo.h"
 #include "strutil.h"
 
+/* Name of a model given as text, in messages and the generated code */
+#define VSZ_MODELTEXT "model text"
+
+/* A stream writing to memory, see OpenMemStream() */
+typedef struct tagMEMSTREAM {
+  PFILE pfile;
+  PSTR szBuf;
+  size_t cbBuf;
+
+} MEMSTREAM, *PMEMSTREAM; /* tagMEMSTREAM */
+
+/* The result of TranslateModel() */
+typedef struct tagTRANSRESULT {
+  PSTR szC;         /* C code, NULL on errors */
+  PSTR szInits;     /* R initialization code */
+  PERRMSG pemList;  /* Messages */
+  PSTR szConsole;   /* What the translator printed, or NULL */
+  BOOL bErrors;
+  double dSeconds;  /* Time taken */
+
+} TRANSRESULT, *PTRANSRESULT; /* tagTRANSRESULT */
+
 /* Globals */
 static char vszOptions[] = "hHDRG";
 static char vszFilenameDefault[] = "model.c";
-char szFileWithExt[MAX_FILENAMESIZE];
 
 /* ----------------------------------------------------------------------------
    AnnounceProgram
@@ -287,6 +315,7 @@ void InitInfo(PINPUTINFO pinfo, PSTR szModGenName) {
   pinfo->wContext = CN_GLOBAL;
   pinfo->bDelays = FALSE;
   pinfo->bforR = FALSE;
+  pinfo->bOptimize = TRUE;
   pinfo->bTemplateInUse = FALSE;
   pinfo->szModGenName = szModGenName;
 
@@ -309,6 +338,7 @@ void InitInfo(PINPUTINFO pinfo, PSTR szModGenName) {
   pinfo->pvmCalcOutEqns = NULL;
   pinfo->pvmEventEqns = NULL;
   pinfo->pvmRootEqns = NULL;
+  pinfo->pvmDoseEqns = NULL;
 
   pinfo->pvmCpts = NULL;
   pinfo->pvmLocalCpts = NULL;
@@ -318,137 +348,25 @@ void InitInfo(PINPUTINFO pinfo, PSTR szModGenName) {
 /* ----------------------------------------------------------------------------
    Cleanup
 
-   deallocate memory.
+   deallocate memory. The lists of pinfo, and those of any other
+   INPUTINFO read along with it (templates), are all in the model
+   arena of the translation context bound, see ModelAlloc(), which is
+   freed with everything else of the translation.
 */
 
 void Cleanup(PINPUTINFO pinfo) {
-  PVMMAPSTRCT next;
-
-  while (pinfo->pvmGloVars) {
-    next = pinfo->pvmGloVars->pvmNextVar;
-    if (pinfo->pvmGloVars->szName) {
-      free(pinfo->pvmGloVars->szName);
-    }
-    if (pinfo->pvmGloVars->szEqn) {
-      free(pinfo->pvmGloVars->szEqn);
-    }
-    if (pinfo->pvmGloVars) {
-      free(pinfo->pvmGloVars);
-    }
-    pinfo->pvmGloVars = next;
-  }
-
-  while (pinfo->pvmDynEqns) {
-    next = pinfo->pvmDynEqns->pvmNextVar;
-    if (pinfo->pvmDynEqns->szName) {
-      free(pinfo->pvmDynEqns->szName);
-    }
-    if (pinfo->pvmDynEqns->szEqn) {
-      free(pinfo->pvmDynEqns->szEqn);
-    }
-    if (pinfo->pvmDynEqns) {
-      free(pinfo->pvmDynEqns);
-    }
-    pinfo->pvmDynEqns = next;
-  }
-
-  while (pinfo->pvmScaleEqns) {
-    next = pinfo->pvmScaleEqns->pvmNextVar;
-    if (pinfo->pvmScaleEqns->szName) {
-      free(pinfo->pvmScaleEqns->szName);
-    }
-    if (pinfo->pvmScaleEqns->szEqn) {
-      free(pinfo->pvmScaleEqns->szEqn);
-    }
-    if (pinfo->pvmScaleEqns) {
-      free(pinfo->pvmScaleEqns);
-    }
-    pinfo->pvmScaleEqns = next;
-  }
-
-  while (pinfo->pvmJacobEqns) {
-    next = pinfo->pvmJacobEqns->pvmNextVar;
-    if (pinfo->pvmJacobEqns->szName) {
-      free(pinfo->pvmJacobEqns->szName);
-    }
-    if (pinfo->pvmJacobEqns->szEqn) {
-      free(pinfo->pvmJacobEqns->szEqn);
-    }
-    if (pinfo->pvmJacobEqns) {
-      free(pinfo->pvmJacobEqns);
-    }
-    pinfo->pvmJacobEqns = next;
-  }
-
-  while (pinfo->pvmCalcOutEqns) {
-    next = pinfo->pvmCalcOutEqns->pvmNextVar;
-    if (pinfo->pvmCalcOutEqns->szName) {
-      free(pinfo->pvmCalcOutEqns->szName);
-    }
-    if (pinfo->pvmCalcOutEqns->szEqn) {
-      free(pinfo->pvmCalcOutEqns->szEqn);
-    }
-    if (pinfo->pvmCalcOutEqns) {
-      free(pinfo->pvmCalcOutEqns);
-    }
-    pinfo->pvmCalcOutEqns = next;
-  }
-
-  while (pinfo->pvmEventEqns) {
-    next = pinfo->pvmEventEqns->pvmNextVar;
-    if (pinfo->pvmEventEqns->szName) {
-      free(pinfo->pvmEventEqns->szName);
-    }
-    if (pinfo->pvmEventEqns->szEqn) {
-      free(pinfo->pvmEventEqns->szEqn);
-    }
-    if (pinfo->pvmEventEqns) {
-      free(pinfo->pvmEventEqns);
-    }
-    pinfo->pvmEventEqns = next;
-  }
-
-  while (pinfo->pvmRootEqns) {
-    next = pinfo->pvmRootEqns->pvmNextVar;
-    if (pinfo->pvmRootEqns->szName) {
-      free(pinfo->pvmRootEqns->szName);
-    }
-    if (pinfo->pvmRootEqns->szEqn) {
-      free(pinfo->pvmRootEqns->szEqn);
-    }
-    if (pinfo->pvmRootEqns) {
-      free(pinfo->pvmRootEqns);
-    }
-    pinfo->pvmRootEqns = next;
-  }
-
-  while (pinfo->pvmCpts) {
-    next = pinfo->pvmCpts->pvmNextVar;
-    if (pinfo->pvmCpts->szName) {
-      free(pinfo->pvmCpts->szName);
-    }
-    if (pinfo->pvmCpts->szEqn) {
-      free(pinfo->pvmCpts->szEqn);
-    }
-    if (pinfo->pvmCpts) {
-      free(pinfo->pvmCpts);
-    }
-    pinfo->pvmCpts = next;
-  }
+  pinfo->pvmGloVars = NULL;
+  pinfo->pvmDynEqns = NULL;
+  pinfo->pvmScaleEqns = NULL;
+  pinfo->pvmJacobEqns = NULL;
+  pinfo->pvmCalcOutEqns = NULL;
+  pinfo->pvmEventEqns = NULL;
+  pinfo->pvmRootEqns = NULL;
+  pinfo->pvmDoseEqns = NULL;
+  pinfo->pvmCpts = NULL;
+  pinfo->pvmLocalCpts = NULL;
 
-  while (pinfo->pvmLocalCpts) {
-    next = pinfo->pvmJacobEqns->pvmNextVar;
-    if (pinfo->pvmLocalCpts->szName) {
-      free(pinfo->pvmLocalCpts->szName);
-    }
-    if (pinfo->pvmLocalCpts->szEqn) {
-      free(pinfo->pvmLocalCpts->szEqn);
-    }
-    if (pinfo->pvmLocalCpts) {
-      free(pinfo->pvmLocalCpts);
-    }
-    pinfo->pvmLocalCpts = next;
-  }
+  FreeTranslation(vptrans);
 } /* Cleanup */
 
 /* ----------------------------------------------------------------------------
@@ -470,10 +388,15 @@ int c_mod(char **modelNamePtr, char **outputNamePtr) {
 
   INPUTINFO info;
   INPUTINFO tempinfo;
+  TRANSLATION trans;
+  PTRANSLATION ptransOld;
   PSTR szFileIn, szFileOut;
 
   AnnounceProgram();
 
+  InitTranslation(&trans);
+  ptransOld = BindTranslation(&trans);
+
   InitInfo(&info, rgszArg[0]);
   InitInfo(&tempinfo, rgszArg[0]);
 
@@ -483,6 +406,7 @@ int c_mod(char **modelNamePtr, char **outputNamePtr) {
     free(szFileIn);
     free(szFileOut);
     Cleanup(&info);
+    BindTranslation(ptransOld);
     return -1;
   }
 
@@ -492,6 +416,7 @@ int c_mod(char **modelNamePtr, char **outputNamePtr) {
     free(szFileIn);
     free(szFileOut);
     Cleanup(&info);
+    BindTranslation(ptransOld);
     return -1;
   }
 
@@ -508,11 +433,358 @@ int c_mod(char **modelNamePtr, char **outputNamePtr) {
     free(szFileIn);
     free(szFileOut);
     Cleanup(&info);
+    BindTranslation(ptransOld);
     return -1;
   }
   free(szFileIn);
   free(szFileOut);
   Cleanup(&info);
+  BindTranslation(ptransOld);
 
   return 0;
 }
+
+/* ----------------------------------------------------------------------------
+   OpenMemStream
+
+   Opens a stream collecting what is written to it in memory, with
+   open_memstream() or, on Windows which lacks it, an anonymous
+   temporary file. Returns FALSE on error.
+*/
+BOOL OpenMemStream(PMEMSTREAM pms) {
+  pms->szBuf = NULL;
+  pms->cbBuf = 0;
+#ifdef _WIN32
+  pms->pfile = tmpfile();
+#else
+  pms->pfile = open_memstream(&pms->szBuf, &pms->cbBuf);
+#endif
+  return (pms->pfile != NULL);
+
+} /* OpenMemStream */
+
+/* ----------------------------------------------------------------------------
+   CloseMemStream
+
+   Closes the stream of OpenMemStream() and returns what was written to
+   it as an allocated string, or NULL on error.
+*/
+PSTR CloseMemStream(PMEMSTREAM pms) {
+#ifdef _WIN32
+  long cb;
+
+  if (fflush(pms->pfile) || fseek(pms->pfile, 0, SEEK_END) || (cb = ftell(pms->pfile)) < 0) {
+    fclose(pms->pfile);
+    return NULL;
+  }
+  rewind(pms->pfile);
+  if ((pms->szBuf = (PSTR)malloc(cb + 1))) {
+    pms->cbBuf = fread(pms->szBuf, 1, cb, pms->pfile);
+    pms->szBuf[pms->cbBuf] = '\0';
+  }
+  fclose(pms->pfile);
+#else
+  if (fclose(pms->pfile)) {
+    free(pms->szBuf);
+    pms->szBuf = NULL;
+  }
+#endif
+  pms->pfile = NULL;
+  return pms->szBuf;
+
+} /* CloseMemStream */
+
+/* ----------------------------------------------------------------------------
+   MakeMessages
+
+   Returns the list of "severity", "line" and "message" vectors of the
+   messages pemList of the translator.
+*/
+SEXP MakeMessages(PERRMSG pemList) {
+  SEXP sMsgs, sSeverity, sLine, sText, sNames;
+  PERRMSG pem;
+  int i, nMsgs = 0;
+
+  for (pem = pemList; pem; pem = pem->pemNext) {
+    nMsgs++;
+  }
+
+  PROTECT(sMsgs = Rf_allocVector(VECSXP, 3));
+  sSeverity = SET_VECTOR_ELT(sMsgs, 0, Rf_allocVector(STRSXP, nMsgs));
+  sLine = SET_VECTOR_ELT(sMsgs, 1, Rf_allocVector(INTSXP, nMsgs));
+  sText = SET_VECTOR_ELT(sMsgs, 2, Rf_allocVector(STRSXP, nMsgs));
+
+  for (pem = pemList, i = 0; pem; pem = pem->pemNext, i++) {
+    SET_STRING_ELT(sSeverity, i, Rf_mkChar(pem->bWarning ? "warning" : "error"));
+    INTEGER(sLine)[i] = (pem->iLine > 0 ? pem->iLine : NA_INTEGER);
+    SET_STRING_ELT(sText, i, Rf_mkChar(pem->szMsg));
+  }
+
+  sNames = Rf_allocVector(STRSXP, 3);
+  Rf_setAttrib(sMsgs, R_NamesSymbol, sNames);
+  SET_STRING_ELT(sNames, 0, Rf_mkChar("severity"));
+  SET_STRING_ELT(sNames, 1, Rf_mkChar("line"));
+  SET_STRING_ELT(sNames, 2, Rf_mkChar("message"));
+
+  UNPROTECT(1);
+  return sMsgs;
+
+} /* MakeMessages */
+
+/* ----------------------------------------------------------------------------
+   WallSeconds
+
+   Returns a wall clock time in seconds, to time translations.
+*/
+double WallSeconds(void) {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return ((double)clock() / CLOCKS_PER_SEC);
+#endif
+
+} /* WallSeconds */
+
+/* ----------------------------------------------------------------------------
+   TranslateModel
+
+   Translates szModel, the text of a model definition or, if bFromFile
+   is TRUE, the name of its file, into ptr; if bOptimize is FALSE,
+   without OptimizeDynamics() nor the sharing of Jacobian
+   subexpressions. The translation has a context of its own, bound to
+   the running thread while it lasts, and while it runs nothing of R is
+   called: messages are kept in
+   ptr->pemList, and what would be printed in ptr->szConsole. Several
+   models can thus be translated in parallel threads. szModel may be
+   changed. ptr is freed with FreeTransResult().
+*/
+void TranslateModel(PSTR szModel, BOOL bFromFile, BOOL bOptimize, PTRANSRESULT ptr) {
+  INPUTINFO info;
+  INPUTINFO tempinfo;
+  TRANSLATION trans;
+  PTRANSLATION ptransOld;
+  MEMSTREAM msC, msR;
+  PERRMSG pem;
+  PSTR szName;
+  double dStart = WallSeconds();
+  int ret;
+
+  ptr->szC = ptr->szInits = ptr->szConsole = NULL;
+  ptr->pemList = NULL;
+
+  InitInfo(&info, "MCSIMMOD");
+  InitInfo(&tempinfo, "MCSIMMOD");
+  info.bforR = TRUE;
+  info.bOptimize = bOptimize;
+
+  szName = (bFromFile ? szModel : VSZ_MODELTEXT);
+#ifdef _WIN32
+  /* avoid compiler errors because of invalid escapes
+     when the path is presented in source */
+  PSTR pStr = strchr(szName, '\\');
+  while (pStr) {
+    *pStr = '/';
+    pStr = strchr(pStr + 1, '\\');
+  }
+#endif /* _WIN32 */
+  info.szInputFilename = szName;
+
+  InitTranslation(&trans);
+  ptransOld = BindTranslation(&trans);
+  CaptureErrors(&ptr->pemList);
+
+  if (bFromFile) {
+    ret = ReadModel(&info, &tempinfo, szModel);
+  } else {
+    ret = ReadModelText(&info, &tempinfo, szModel, VSZ_MODELTEXT);
+  }
+
+  if (ret != EXIT_ERROR && ret != EXIT_NOERROR) {
+    if (OpenMemStream(&msC)) {
+      if (OpenMemStream(&msR)) {
+        ret = Write_R_ModelStreams(&info, msC.pfile, msR.pfile, szName);
+        ptr->szInits = CloseMemStream(&msR);
+      } else {
+        ret = ReportError(NULL, RE_CANNOTOPEN | RE_FATAL, "memory stream", "in TranslateModel ()");
+      }
+      ptr->szC = CloseMemStream(&msC);
+    } else {
+      ret = ReportError(NULL, RE_CANNOTOPEN | RE_FATAL, "memory stream", "in TranslateModel ()");
+    }
+  }
+
+  CaptureErrors(NULL);
+
+  /* The console text outlives the context */
+  ptr->szConsole = trans.szConsole;
+  trans.szConsole = NULL;
+  Cleanup(&info);
+  BindTranslation(ptransOld);
+
+  /* Non-fatal errors let the translation go on to report more */
+  ptr->bErrors = (ret == EXIT_ERROR || ret == EXIT_NOERROR || !ptr->szC || !ptr->szInits);
+  for (pem = ptr->pemList; pem; pem = pem->pemNext) {
+    ptr->bErrors |= !pem->bWarning;
+  }
+  ptr->dSeconds = WallSeconds() - dStart;
+
+} /* TranslateModel */
+
+/* ----------------------------------------------------------------------------
+   FreeTransResult
+*/
+void FreeTransResult(PTRANSRESULT ptr) {
+  free(ptr->szC);
+  free(ptr->szInits);
+  free(ptr->szConsole);
+  FreeErrors(ptr->pemList);
+  ptr->szC = ptr->szInits = ptr->szConsole = NULL;
+  ptr->pemList = NULL;
+
+} /* FreeTransResult */
+
+/* ----------------------------------------------------------------------------
+   MakeTranslation
+
+   Prints what the translation of ptr would have printed, and returns the
+   list of its C code ("c") and R initialization code ("inits"), both
+   NULL if there were errors, of its messages ("messages", see
+   MakeMessages()) and, if bSeconds, of the time it took ("seconds").
+*/
+SEXP MakeTranslation(PTRANSRESULT ptr, BOOL bSeconds) {
+  SEXP sRet, sNames;
+  int nElts = (bSeconds ? 4 : 3);
+
+  if (ptr->szConsole) {
+    Rprintf("%s", ptr->szConsole);
+  }
+
+  PROTECT(sRet = Rf_allocVector(VECSXP, nElts));
+  if (!ptr->bErrors) {
+    SET_VECTOR_ELT(sRet, 0, Rf_mkString(ptr->szC));
+    SET_VECTOR_ELT(sRet, 1, Rf_mkString(ptr->szInits));
+  }
+  SET_VECTOR_ELT(sRet, 2, MakeMessages(ptr->pemList));
+  if (bSeconds) {
+    SET_VECTOR_ELT(sRet, 3, Rf_ScalarReal(ptr->dSeconds));
+  }
+
+  sNames = Rf_allocVector(STRSXP, nElts);
+  Rf_setAttrib(sRet, R_NamesSymbol, sNames);
+  SET_STRING_ELT(sNames, 0, Rf_mkChar("c"));
+  SET_STRING_ELT(sNames, 1, Rf_mkChar("inits"));
+  SET_STRING_ELT(sNames, 2, Rf_mkChar("messages"));
+  if (bSeconds) {
+    SET_STRING_ELT(sNames, 3, Rf_mkChar("seconds"));
+  }
+
+  UNPROTECT(1);
+  return sRet;
+
+} /* MakeTranslation */
+
+/* ----------------------------------------------------------------------------
+   c_translate -- Entry point translating a model in memory
+
+   sModel is the text of the model definition or, if sFromFile is TRUE,
+   the name of its file. The Dynamics and the Jacobian are optimized
+   unless sOptimize is FALSE, see TranslateModel(). Returns the list of
+   the C code ("c") and the R initialization code ("inits") of the
+   model, both NULL if there were errors, and of the messages of the
+   translator ("messages", see MakeMessages()). Writes no file, and the
+   messages are returned instead of printed.
+*/
+SEXP c_translate(SEXP sModel, SEXP sFromFile, SEXP sOptimize) {
+  TRANSRESULT tr;
+  PSTR szModel;
+  SEXP sRet;
+
+  if (!Rf_isString(sModel) || LENGTH(sModel) != 1 || STRING_ELT(sModel, 0) == NA_STRING) {
+    Rf_error("the model must be a character string");
+  }
+
+  if (!(szModel = strdup(CHAR(STRING_ELT(sModel, 0))))) {
+    Rf_error("out of memory in c_translate()");
+  }
+
+  TranslateModel(szModel, (Rf_asLogical(sFromFile) == TRUE), (Rf_asLogical(sOptimize) != FALSE), &tr);
+  free(szModel);
+
+  sRet = MakeTranslation(&tr, FALSE);
+  FreeTransResult(&tr);
+  return sRet;
+
+} /* c_translate */
+
+/* ----------------------------------------------------------------------------
+   c_translateModels -- Entry point translating models in parallel
+
+   sModels are the texts of model definitions or, if sFromFile is TRUE,
+   the names of their files, optimized unless sOptimize is FALSE. They
+   are translated over sThreads threads (all cores if sThreads <= 0),
+   see TranslateModel(). Returns the list of their translations, as
+   c_translate() would return them, with the time each took
+   ("seconds").
+*/
+SEXP c_translateModels(SEXP sModels, SEXP sFromFile, SEXP sOptimize, SEXP sThreads) {
+  BOOL bFromFile = (Rf_asLogical(sFromFile) == TRUE);
+  BOOL bOptimize = (Rf_asLogical(sOptimize) != FALSE);
+  int nThreads = Rf_asInteger(sThreads);
+  long i, nModels;
+  PSTR *rgszModel;
+  PTRANSRESULT rgtr;
+  SEXP sRet;
+
+  if (!Rf_isString(sModels)) {
+    Rf_error("the models must be a character vector");
+  }
+  nModels = (long)XLENGTH(sModels);
+  for (i = 0; i < nModels; i++) {
+    if (STRING_ELT(sModels, i) == NA_STRING) {
+      Rf_error("the models must not be NA");
+    }
+  }
+
+  rgszModel = (PSTR *)calloc(nModels + 1, sizeof(PSTR));
+  rgtr = (PTRANSRESULT)calloc(nModels + 1, sizeof(TRANSRESULT));
+  for (i = 0; rgszModel && rgtr && i < nModels; i++) {
+    if (!(rgszModel[i] = strdup(CHAR(STRING_ELT(sModels, i))))) {
+      break;
+    }
+  }
+  if (!rgszModel || !rgtr || i < nModels) {
+    for (i = 0; rgszModel && i < nModels; i++) {
+      free(rgszModel[i]);
+    }
+    free(rgszModel);
+    free(rgtr);
+    Rf_error("out of memory in c_translateModels()");
+  }
+
+#ifdef _OPENMP
+  if (nThreads <= 0) {
+    nThreads = omp_get_max_threads();
+  }
+#else
+  nThreads = 1;
+#endif
+
+  /* Nothing of R is called until all the models are translated */
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nThreads)
+  for (i = 0; i < nModels; i++) {
+    TranslateModel(rgszModel[i], bFromFile, bOptimize, &rgtr[i]);
+  }
+
+  PROTECT(sRet = Rf_allocVector(VECSXP, nModels));
+  for (i = 0; i < nModels; i++) {
+    SET_VECTOR_ELT(sRet, i, MakeTranslation(&rgtr[i], TRUE));
+    FreeTransResult(&rgtr[i]);
+    free(rgszModel[i]);
+  }
+  free(rgszModel);
+  free(rgtr);
+
+  UNPROTECT(1);
+  return sRet;
+
+} /* c_translateModels */
@@ -22,6 +22,8 @@
 
 /* ----- Inclusions  */
 
+#include <Rinternals.h>
+
 #include "config.h"
 #include "hungtype.h"
 #include "lex.h"
@@ -51,6 +53,7 @@
 #define KM_CALCOUTPUTS 7
 #define KM_EVENTS 8
 #define KM_ROOTS 9
+#define KM_DOSES 10
 #define KM_DXDT 20
 #define KM_INLINE 30
 #define KM_SBMLMODELS 40
@@ -75,36 +78,40 @@
 #define CN_CALCOUTPUTS 0x0005
 #define CN_EVENTS 0x0006
 #define CN_ROOTS 0x0007
+#define CN_DOSES 0x0008
 #define CN_INPUTDEF 0x0100
 #define CN_TEMPLATE_DEFINED 0x0200
 #define CN_END 0x4000
 
 #define CN_ALL 0xFFFF /* All Contexts */
 
-/* Identifier Types -- Stored as upper nybble so that the variable
-   can be indexed in modo.c to create a handle to the variable
+/* Identifier Types -- Stored in the upper bits of a handle so that the
+   variable can be indexed in modo.c to create a handle to the variable.
+   The type, the flag and the index are separate fields: the index can
+   take all of its bits whatever the type and the flag.
 */
 
-#define ID_TYPEMASK 0xF0000     /* Allow up to 15 variable types */
-#define ID_SPACEFLAG 0x0F000    /* To flag for formatting eqns */
-#define ID_INDEXMASK 0x07FFF    /* Index for symbol table */
-#define MAX_VARS (ID_SPACEFLAG) /* Max number of vars of a type */
-
-#define ID_NULL 0x00000
-#define ID_STATE 0x10000        /* Model state variables -- dynamics */
-#define ID_INPUT 0x20000        /* Model input -- type IFN */
-#define ID_OUTPUT 0x30000       /* Model output -- for observation only */
-#define ID_PARM 0x40000         /* Global parameters */
-#define ID_LOCALDYN 0x50000     /* Local variables in Dynamics */
-#define ID_LOCALSCALE 0x60000   /* Local variables in Scale    */
-#define ID_LOCALJACOB 0x70000   /* Local variables in Jacobian */
-#define ID_LOCALEVENT 0x70300   /* Local variables in Events */
-#define ID_LOCALROOT 0x70600    /* Local variables in Roots */
-#define ID_LOCALCALCOUT 0x80000 /* Local variables in CalcOutputs */
-#define ID_DERIV 0x90000        /* Derivative eqn in CalcDeriv */
-#define ID_INLINE 0xA0000       /* Inline statement */
-#define ID_COMPARTMENT 0xB0000  /* Model compartment (for SBML processing) */
-#define ID_FUNCTION 0xC0000     /* Function definition (for SBML processing) */
+#define ID_TYPESHIFT 24             /* First bit of the type */
+#define ID_TYPEMASK 0x0F000000      /* Allow up to 15 variable types */
+#define ID_SPACEFLAG 0x00800000     /* To flag for formatting eqns */
+#define ID_INDEXMASK 0x007FFFFF     /* Index for symbol table */
+#define MAX_VARS (ID_INDEXMASK + 1) /* Max number of indexed vars */
+
+#define ID_NULL 0x00000000
+#define ID_STATE 0x01000000        /* Model state variables -- dynamics */
+#define ID_INPUT 0x02000000        /* Model input -- type IFN */
+#define ID_OUTPUT 0x03000000       /* Model output -- for observation only */
+#define ID_PARM 0x04000000         /* Global parameters */
+#define ID_LOCALDYN 0x05000000     /* Local variables in Dynamics */
+#define ID_LOCALSCALE 0x06000000   /* Local variables in Scale    */
+#define ID_LOCALJACOB 0x07000000   /* Local variables in Jacobian, Events and Roots */
+#define ID_LOCALCALCOUT 0x08000000 /* Local variables in CalcOutputs */
+#define ID_DERIV 0x09000000        /* Derivative eqn in CalcDeriv */
+#define ID_INLINE 0x0A000000       /* Inline statement */
+#define ID_COMPARTMENT 0x0B000000  /* Model compartment (for SBML processing) */
+#define ID_FUNCTION 0x0C000000     /* Function definition (for SBML processing) */
+#define ID_LOCALEVENT 0x0D000000   /* Local variables in Events */
+#define ID_LOCALROOT 0x0E000000    /* Local variables in Roots */
 
 /* ---------------------------------------------------------------------------
    Public Typedefs */
@@ -115,20 +122,45 @@
 typedef HANDLE HVAR;
 
 typedef struct tagVM {
-  PSTR szName;  /* Identifier */
-  PSTR szEqn;   /* Def'ing eqn to be created and copied */
-  HANDLE hType; /* ID_type of identifier */
+  PSTR szName;              /* Identifier */
+  PSTR szEqn;               /* Def'ing eqn to be created and copied */
+  HANDLE hType;             /* ID_type of identifier */
+  struct tagEQN *peqn;      /* szEqn as read, see ReadEqn() in modexpr.c */
+  struct tagARRAYEQN *parr; /* Array statement defining it, or NULL */
 
   struct tagVM *pvmNextVar; /* Var list is a stack */
 
 } VMMAPSTRCT, *PVMMAPSTRCT; /* Variable Map */
 
+/* An array statement of the Dynamics or CalcOutputs, x[lb-ub] = ... or
+   dt(x[lb-ub]) = ...
+   It is unrolled into one equation per element as before; the equations,
+   and the locals it declares, point to it so that the equations can be
+   written back as one loop, see PlanArrayLoops() in modo.c. */
+typedef struct tagARRAYEQN {
+  PSTR szName;   /* Name of the array */
+  long iLB, iUB; /* Elements iLB to iUB - 1 */
+  WORD wContext; /* Section, CN_DYNAMICS or CN_CALCOUTPUTS */
+
+  struct tagARRAYEQN *parrBase; /* First statement on the array */
+  BOOL bStored;                 /* Of parrBase: locals in a C array... */
+  long iMin, iMax;              /* ... from element iMin to iMax */
+
+  PVMMAPSTRCT pvmFirst; /* Equation of element iLB */
+  BOOL bLoop;           /* The equations are written as one loop */
+  long lStride;         /* Step of the assigned variable per element */
+  long *rglStride;      /* Same for each lexeme, 0 if it does not vary */
+
+  struct tagARRAYEQN *parrNext;
+
+} ARRAYEQN, *PARRAYEQN; /* tagARRAYEQN */
+
 typedef struct tagINPUTINFO {
   WORD wContext;
   BOOL bDelays;
   BOOL bforR;
+  BOOL bOptimize; /* Fold, hoist and share subexpressions, see OptimizeDynamics() */
   BOOL bTemplateInUse;
-  BOOL bClearState;
   PSTR szInputFilename;
   PSTR szModGenName;
 
@@ -141,6 +173,7 @@ typedef struct tagINPUTINFO {
   PVMMAPSTRCT pvmCalcOutEqns;
   PVMMAPSTRCT pvmEventEqns;
   PVMMAPSTRCT pvmRootEqns;
+  PVMMAPSTRCT pvmDoseEqns; /* Doses of the states, szEqn is a PDFN */
 
   PVMMAPSTRCT pvmCpts;
   PVMMAPSTRCT pvmLocalCpts;
@@ -159,6 +192,7 @@ typedef struct tagINPUTINFO {
    : (kmCode) == KM_DYNAMICS  ? CN_DYNAMICS                                                                            \
    : (kmCode) == KM_EVENTS    ? CN_EVENTS                                                                              \
    : (kmCode) == KM_ROOTS     ? CN_ROOTS                                                                               \
+   : (kmCode) == KM_DOSES     ? CN_DOSES                                                                               \
                               : 0)
 
 /* ---------------------------------------------------------------------------
@@ -166,6 +200,8 @@ typedef struct tagINPUTINFO {
 
 void InitInfo(PINPUTINFO pinfo, PSTR szModGenName);
 extern int c_mod(char **modelNamePtr, char **outputNamePtr);
+SEXP c_translate(SEXP sModel, SEXP sFromFile, SEXP sOptimize);
+SEXP c_translateModels(SEXP sModels, SEXP sFromFile, SEXP sOptimize, SEXP sThreads);
 
 #define MOD_DEFINED
 #endif
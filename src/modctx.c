@@ -0,0 +1,92 @@
+/* modctx.c
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Translation contexts: everything the translator changes while
+   reading and writing one model. An entry point sets up a context on
+   its stack, binds it to the running thread with BindTranslation() and
+   frees it with FreeTranslation() once done, also after an error. The
+   routines of the translator find the context bound in vptrans, so that
+   it need not be passed through every callback of ForAllVar() and
+   every routine of the lexer.
+*/
+#define R_NO_REMAP
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "modctx.h"
+#include "modo.h"
+
+/* Context of the translation running in this thread */
+THREAD_LOCAL PTRANSLATION vptrans = NULL;
+
+/* ---------------------------------------------------------------------------
+   InitTranslation
+*/
+void InitTranslation(PTRANSLATION ptrans) {
+  memset(ptrans, 0, sizeof(TRANSLATION));
+
+  InitVarIndex(&ptrans->vxGlo);
+  InitArena(&ptrans->arenaModel);
+  InitStrBuf(&ptrans->sbUnroll, &ptrans->arenaModel);
+  InitExprPool(&ptrans->poolJacob);
+  InitExprPool(&ptrans->poolHoist);
+  InitExprPool(&ptrans->poolEqn);
+
+} /* InitTranslation */
+
+/* ---------------------------------------------------------------------------
+   BindTranslation
+
+   Makes ptrans the context of the translations of the running thread,
+   none if ptrans is NULL. Returns the context bound before, to be bound
+   again when done.
+*/
+PTRANSLATION BindTranslation(PTRANSLATION ptrans) {
+  PTRANSLATION ptransOld = vptrans;
+
+  vptrans = ptrans;
+  return ptransOld;
+
+} /* BindTranslation */
+
+/* ---------------------------------------------------------------------------
+   FreeTranslation
+
+   Frees what the translation ptrans allocated, wherever it stopped.
+   The lists of the INPUTINFO read in it must not be used afterwards.
+*/
+void FreeTranslation(PTRANSLATION ptrans) {
+  PTRANSLATION ptransOld = BindTranslation(ptrans);
+
+  Free_R_Model();
+  FreeVarIndex(&ptrans->vxGlo);
+  FreeModelArena();
+  FreeExprPool(&ptrans->poolEqn);
+  free(ptrans->szConsole);
+  ptrans->szConsole = NULL;
+  ptrans->cchConsole = ptrans->cbConsole = 0;
+
+  BindTranslation(ptransOld);
+
+} /* FreeTranslation */
+
+/* End */
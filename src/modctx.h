@@ -0,0 +1,168 @@
+/* modctx.h
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Header file for the translation contexts of modctx.c
+*/
+
+#ifndef MODCTX_H_DEFINED
+
+/* ---------------------------------------------------------------------------
+   Inclusions  */
+
+#include "arena.h"
+#include "hungtype.h"
+#include "lex.h"
+#include "lexerr.h"
+#include "mod.h"
+#include "modd.h"
+#include "modexpr.h"
+
+/* ---------------------------------------------------------------------------
+   Constants  */
+
+#define MAX_ERRMSG 1024 /* Longest message kept by ReportError() */
+
+/* Storage class of the binding of BindTranslation(): one per thread */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* Everything the translator changes while reading and writing one model.
+   Nothing outside of it is written, so that models can be translated in
+   parallel threads, each with its own context, and an aborted translation
+   leaves nothing behind for the next one. */
+typedef struct tagTRANSLATION {
+
+  /* Reading, see modi.c: the sections seen, in the model and its template */
+  BOOL bCalcOutputsDefined;
+  BOOL bDynamicsDefined;
+  BOOL bInitializeDefined;
+  BOOL bJacobianDefined;
+
+  /* Variable maps, see modd.c */
+  VARINDEX vxGlo;   /* Index of the global variable list being read */
+  ARENA arenaModel; /* Memory of the variable maps, see ModelAlloc() */
+
+  /* Equations as read, see ReadEqn() */
+  EXPRPOOL poolEqn;
+  PSTR szEqnRead; /* Equation being defined by DefineVariable()... */
+  PEQN peqnRead;  /* ... and as read, for AddEquation() */
+
+  /* Array statements of the Dynamics, see ProcessIdentifier() */
+  PARRAYEQN parrList; /* All of them, last read first */
+  PARRAYEQN parrRead; /* Statement being unrolled, for AddEquation() */
+  int nSums;          /* Arrays of partial sums made by ExpandSums() */
+  STRBUF sbUnroll;    /* Equations unrolled by UnrollEquation(), each used before the next */
+
+  /* Writing, see modo.c */
+  PSTR szModelFilename;
+  PSTR szModGenName;
+  PVMMAPSTRCT pvmGloVarList;
+  int nStates, nOutputs, nInputs, nParms, nModelVars;
+  int nInputFns; /* Inputs defined in the model, computed by inputs_ctx() */
+  int nRoots;    /* Root functions gout[] of the Roots section, see CountRoots() */
+
+  BOOL bForR;
+  BOOL bForInits;
+  BOOL bOptimize;      /* Fold, hoist and share subexpressions */
+  BOOL bDelay;        /* Model reads delayed states from deSolve's history */
+  BOOL bForBatch;     /* Writing the lane-batched derivs kernel */
+  BOOL bBatchKernel;  /* Model gets a lane-batched derivs kernel */
+  BOOL bLeanDerivs;   /* derivs leaves the outputs to outputs_ctx */
+  BOOL *rgbDerivEqn;  /* Dynamics equations that derivs needs */
+  BOOL *rgbOutputEqn; /* Dynamics equations that the outputs need */
+
+  /* Variables delayed by CalcDelay(), states first, and its calls, from
+     CollectDelays() */
+  PVMMAPSTRCT *rgpvmHist;
+  int nHistVars, nHistStates, nHistLags;
+
+  /* Array statements written as loops, from PlanArrayLoops() */
+  BOOL bArrayLoops;   /* There are some */
+  BOOL bStoredArrays; /* Some Dynamics or CalcOutputs locals are in C arrays */
+  PARRAYEQN parrLoop; /* Statement being written as a loop, or NULL */
+
+  long iStates, iOutputs;         /* Counters of WriteOne_R_SODefine() */
+  long *rglInputSlot;             /* Element of forc[] of each input, from Index_R_Inputs() */
+  PSTRLEX szVarName;              /* Returned by GetName() */
+  PSTRLEX szGen;                  /* Prefix of the generated identifiers, from ChooseGenPrefix() */
+
+  /* Symbolic Jacobian, one per nonzero of the pattern, from BuildSymJacob() */
+  EXPRPOOL poolJacob;
+  PEXPR *rgpexJacob;
+
+  /* Rows of rgpexJacob written as loops, from PlanJacobLoops(): the run of
+     rows starting at row i has rglJacobRun[i] rows, 0 for its other rows
+     and 1 for rows apart. Along a run, entry k of its first row steps by
+     rglJacobColStride[k] columns and its variables by rgplJacobStride[k],
+     in the order WriteExpr() writes them */
+  long *rglJacobRun;
+  long *rglJacobColStride;
+  long **rgplJacobStride;
+  long *rglExprStride; /* Strides WriteExpr() is writing with, or NULL */
+  int iExprVar;        /* Next of them */
+
+  /* Jacobian sparsity pattern, from BuildJacobPattern(): the columns of
+     row i, sorted, are rgiJacobCol[rglJacobRow[i]..rglJacobRow[i+1]-1] */
+  long *rglJacobRow;
+  int *rgiJacobCol;
+  long nJacobNonzero;
+
+  /* Trees of the Dynamics equations, from OptimizeDynamics() */
+  EXPRPOOL poolHoist;
+  EXPRHOIST hoist;        /* Parameter-only subexpressions */
+  EXPRCSE cse;            /* Common subexpressions */
+  BOOL bCse;              /* cse can be used */
+  PEXPR *rgpexDyn;        /* Tree of each equation, NULL if not parsed */
+  BOOL *rgbDynRewritten;  /* Tree differs from the text */
+  BOOL *rgbDynUnused;     /* Local substituted wherever the Dynamics read it, not written... */
+  BOOL *rgbDynCalcOut;    /* ... but where the CalcOutput equations follow, if they read it */
+
+  /* Messages, see lexerr.c */
+  PERRMSG *ppemTail; /* Tail of the list of CaptureErrors(), NULL when printing */
+  char szMsg[MAX_ERRMSG]; /* Message being written by ReportError() */
+  size_t cchMsg;
+  PSTR szConsole; /* Printed by ConsolePrintf() while capturing */
+  size_t cchConsole;
+  size_t cbConsole;
+
+} TRANSLATION, *PTRANSLATION; /* tagTRANSLATION */
+
+/* ---------------------------------------------------------------------------
+   Globals */
+
+/* Context of the translation running in this thread, see BindTranslation() */
+extern THREAD_LOCAL PTRANSLATION vptrans;
+
+/* ---------------------------------------------------------------------------
+   Prototypes */
+
+PTRANSLATION BindTranslation(PTRANSLATION ptrans);
+void FreeTranslation(PTRANSLATION ptrans);
+void InitTranslation(PTRANSLATION ptrans);
+
+#define MODCTX_H_DEFINED
+#endif
+
+/* End */
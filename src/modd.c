@@ -25,16 +25,21 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "lexerr.h"
 #include "lexfn.h"
 #include "mod.h"
+#include "modctx.h"
 #include "modd.h"
+#include "modexpr.h"
 #include "modi.h"
+#include "strutil.h"
 
 /* List of valid functions that can be used in equations,
    they all return the type DOUBLE, except the BOOLEAN set.
@@ -60,6 +65,21 @@ PSTR vrgszMathFuncs[] = {
     /* End flag */
     ""};
 
+/* Slots of the functions, see WORDHASH */
+static const short vrgiMathFuncSlots[128] = {
+    0, 0, 0, 5, 0, 47, 0, 0, 0, 0, 0, 0, 20, 0, 10, 0,
+    2, 19, 36, 38, 0, 0, 0, 28, 0, 0, 0, 0, 0, 0, 0, 7,
+    0, 0, 0, 0, 39, 25, 0, 0, 0, 0, 0, 0, 33, 0, 0, 22,
+    13, 0, 0, 16, 31, 14, 0, 40, 23, 0, 0, 30, 45, 0, 0, 9,
+    0, 0, 0, 17, 0, 0, 8, 26, 0, 0, 0, 48, 0, 0, 0, 50,
+    0, 4, 0, 0, 1, 0, 42, 0, 44, 0, 15, 0, 0, 0, 21, 24,
+    0, 37, 32, 41, 0, 0, 0, 18, 0, 49, 0, 0, 0, 0, 0, 0,
+    43, 35, 0, 27, 0, 29, 34, 3, 0, 0, 46, 11, 0, 12, 0, 6
+};
+
+WH_CHECK_WORDS(WH_MATHFUNCS_CHECK, vrgszMathFuncs, 50);
+static const WORDHASH vwhMathFuncs = {vrgszMathFuncs, sizeof(PSTR), 50, 2202u, 128, vrgiMathFuncSlots};
+
 /* Global used by modd.c and modo.c as a flag */
 char vszHasInitializer[] = "0.0; /* Redefined later */";
 
@@ -68,13 +88,7 @@ char vszHasInitializer[] = "0.0; /* Redefined later */";
 /* ----------------------------------------------------------------------------
  */
 BOOL IsMathFunc(PSTR sz) {
-  int i = 0;
-
-  while (*vrgszMathFuncs[i] && strcmp(vrgszMathFuncs[i], sz)) {
-    i++;
-  }
-
-  return (*vrgszMathFuncs[i]);
+  return (*vrgszMathFuncs[LookupWord(&vwhMathFuncs, sz)]);
 
 } /* IsMathFunc */
 
@@ -96,22 +110,23 @@ BOOL IsDelayFunc(BOOL *bDelays, PSTR sz) {
 } /* IsDelayFunc */
 
 /* ----------------------------------------------------------------------------
- */
-BOOL VerifyEqn(PINPUTBUF pibIn, PSTR szEqn) {
-  INPUTBUF ibDummy;
-  InitINPUTBUF(&ibDummy);
-  PSTRLEX szLex;
-  int iType, fContext;
+   VerifyEqn
+
+   Checks the lexemes of the equation peqn, read from pibIn. Errors are
+   reported; returns FALSE if there were any.
+*/
+BOOL VerifyEqn(PINPUTBUF pibIn, PEQN peqn) {
+  PSTR szLex;
+  int i, iType, fContext;
   BOOL bReturn = TRUE;
   BOOL bOK = TRUE;
   PINPUTINFO pinfo;
 
   pinfo = (PINPUTINFO)pibIn->pInfo;
 
-  MakeStringBuffer(pibIn, &ibDummy, szEqn);
-
-  while (!EOB(&ibDummy)) { /* bOK not checked here... */
-    PROPAGATE_EXIT(NextLex(&ibDummy, szLex, &iType)); /* ...all errors reported */
+  for (i = 0; i < peqn->nLex; i++) { /* bOK not checked here... all errors reported */
+    szLex = peqn->rglex[i].sz;
+    iType = peqn->rglex[i].iType;
 
     switch (iType) {
 
@@ -165,24 +180,254 @@ BOOL VerifyEqn(PINPUTBUF pibIn, PSTR szEqn) {
     } /* switch */
 
     bReturn = (bReturn && bOK);
-  } /* while */
+  } /* for */
   return (bReturn);
 
 } /* VerifyEqn */
 
-void AddEquationCleanup(PVMMAPSTRCT pvm) {
-  if (pvm) {
-    {
-      if (pvm->szName) {
-        free(pvm->szName);
-      }
-      if (pvm->szEqn) {
-        free(pvm->szEqn);
+/* ----------------------------------------------------------------------------
+   ModelAlloc, FreeModelArena
+
+   The variable maps, their names and equations, and the input functions
+   of a model are allocated by ModelAlloc() from the arena of the
+   translation context. They are not freed one by one: FreeModelArena()
+   releases them all once the model is written. ModelAlloc() returns
+   NULL if out of memory.
+*/
+PVOID ModelAlloc(size_t cb) {
+  return (ArenaAlloc(&vptrans->arenaModel, cb));
+
+} /* ModelAlloc */
+
+void FreeModelArena(void) {
+  FreeArena(&vptrans->arenaModel);
+  InitStrBuf(&vptrans->sbUnroll, &vptrans->arenaModel);
+
+} /* FreeModelArena */
+
+/* ----------------------------------------------------------------------------
+   HashName
+*/
+unsigned long HashName(PSTR sz) {
+  unsigned long ulHash = 0;
+
+  while (*sz) {
+    ulHash = ulHash * 31 + (unsigned char)*sz++;
+  }
+  return (ulHash);
+
+} /* HashName */
+
+/* ----------------------------------------------------------------------------
+   InitVarIndex, FreeVarIndex
+*/
+void InitVarIndex(PVARINDEX pvx) {
+  memset(pvx, 0, sizeof(VARINDEX));
+
+} /* InitVarIndex */
+
+void FreeVarIndex(PVARINDEX pvx) {
+  free(pvx->rgvxe);
+  free(pvx->rgiBuckets);
+  InitVarIndex(pvx);
+
+} /* FreeVarIndex */
+
+/* ----------------------------------------------------------------------------
+   AddVarEntry
+
+   Adds the variable pvm to the index pvx, as the newest. Grows the
+   entries and the buckets as needed. Returns FALSE if out of memory.
+*/
+BOOL AddVarEntry(PVARINDEX pvx, PVMMAPSTRCT pvm) {
+  PVXENTRY pvxe;
+  long i, iBucket;
+
+  if (pvx->nEntries == pvx->nMax) {
+    long nMax = (pvx->nMax ? 2 * pvx->nMax : 64);
+    PVXENTRY rgvxe = (PVXENTRY)realloc(pvx->rgvxe, nMax * sizeof(VXENTRY));
+    if (!rgvxe) {
+      return FALSE;
+    }
+    pvx->rgvxe = rgvxe;
+    pvx->nMax = nMax;
+  }
+
+  if (pvx->nEntries >= pvx->nBuckets) { /* Rehash, oldest first */
+    long nBuckets = (pvx->nBuckets ? 2 * pvx->nBuckets : 64);
+    long *rgiBuckets = (long *)realloc(pvx->rgiBuckets, nBuckets * sizeof(long));
+    if (!rgiBuckets) {
+      return FALSE;
+    }
+    pvx->rgiBuckets = rgiBuckets;
+    pvx->nBuckets = nBuckets;
+    for (i = 0; i < nBuckets; i++) {
+      rgiBuckets[i] = -1;
+    }
+    for (i = 0; i < pvx->nEntries; i++) {
+      iBucket = HashName(pvx->rgvxe[i].pvm->szName) & (nBuckets - 1);
+      pvx->rgvxe[i].iNextHash = rgiBuckets[iBucket];
+      rgiBuckets[iBucket] = i;
+    }
+  }
+
+  i = pvx->nEntries++;
+  pvxe = &pvx->rgvxe[i];
+  pvxe->pvm = pvm;
+  pvxe->iOrdinal = pvx->rgnTypes[TYPE(pvm) >> ID_TYPESHIFT]++;
+  iBucket = HashName(pvm->szName) & (pvx->nBuckets - 1);
+  pvxe->iNextHash = pvx->rgiBuckets[iBucket];
+  pvx->rgiBuckets[iBucket] = i;
+
+  return TRUE;
+
+} /* AddVarEntry */
+
+/* ----------------------------------------------------------------------------
+   FindVarEntry
+
+   Returns the entry of the newest variable named szName in pvx, or of
+   the oldest if bOldest is TRUE, or -1. A bucket chain goes from the
+   newest entry to the oldest.
+*/
+long FindVarEntry(PVARINDEX pvx, PSTR szName, BOOL bOldest) {
+  long i, iFound = -1;
+
+  if (!pvx->nBuckets) {
+    return -1;
+  }
+
+  for (i = pvx->rgiBuckets[HashName(szName) & (pvx->nBuckets - 1)]; i >= 0; i = pvx->rgvxe[i].iNextHash) {
+    if (!strcmp(szName, pvx->rgvxe[i].pvm->szName)) {
+      iFound = i;
+      if (!bOldest) {
+        break;
       }
-      free(pvm);
     }
   }
-}
+
+  return (iFound);
+
+} /* FindVarEntry */
+
+/* ----------------------------------------------------------------------------
+   IndexVarList
+
+   Adds the variables of the list pvmList to the index pvx, taking
+   the list as a stack: its head is the newest.
+*/
+int IndexVarList(PVARINDEX pvx, PVMMAPSTRCT pvmList) {
+  PVMMAPSTRCT pvm, *rgpvm;
+  long i, n = 0;
+
+  for (pvm = pvmList; pvm; pvm = pvm->pvmNextVar) {
+    n++;
+  }
+  if (!n) {
+    return 0;
+  }
+
+  if (!(rgpvm = (PVMMAPSTRCT *)malloc(n * sizeof(PVMMAPSTRCT)))) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "IndexVarList", NULL));
+  }
+  for (pvm = pvmList, i = n; pvm; pvm = pvm->pvmNextVar) {
+    rgpvm[--i] = pvm;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (!AddVarEntry(pvx, rgpvm[i])) {
+      free(rgpvm);
+      PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "IndexVarList", NULL));
+    }
+  }
+
+  if (!pvx->pvmOldest) {
+    pvx->pvmOldest = rgpvm[0];
+  }
+  pvx->pvmNewest = rgpvm[n - 1];
+  free(rgpvm);
+  return 0;
+
+} /* IndexVarList */
+
+/* ----------------------------------------------------------------------------
+   LookupVar
+
+   Returns the newest variable named szName in pvx, as GetVarPTR()
+   on the list as a stack, or NULL.
+*/
+PVMMAPSTRCT LookupVar(PVARINDEX pvx, PSTR szName) {
+  long i = FindVarEntry(pvx, szName, FALSE);
+
+  return (i >= 0 ? pvx->rgvxe[i].pvm : NULL);
+
+} /* LookupVar */
+
+/* ----------------------------------------------------------------------------
+   IndexGlobalVars
+
+   Starts keeping the global variable list *ppvmGlo indexed, in the
+   translation context. GetVarPTR(), GetVarType() and CalculateVarHandle()
+   then use the index when given the head of the list, whichever way it
+   points. The index is freed with the context, see FreeTranslation().
+*/
+int IndexGlobalVars(PVMMAPSTRCT *ppvmGlo) {
+  FreeVarIndex(&vptrans->vxGlo);
+  PROPAGATE_EXIT(IndexVarList(&vptrans->vxGlo, *ppvmGlo));
+  vptrans->vxGlo.ppvmList = ppvmGlo;
+  vptrans->vxGlo.bValid = TRUE;
+  return 0;
+
+} /* IndexGlobalVars */
+
+/* ----------------------------------------------------------------------------
+   AddGlobalVar
+
+   Indexes pvm, just pushed on the global list. If the list was not a
+   stack then (it was reversed), the index is dropped: lookups go back
+   to walking the list.
+*/
+void AddGlobalVar(PVMMAPSTRCT pvm) {
+  if (!vptrans->vxGlo.bValid) {
+    return;
+  }
+
+  if (pvm->pvmNextVar != vptrans->vxGlo.pvmNewest || !AddVarEntry(&vptrans->vxGlo, pvm)) {
+    vptrans->vxGlo.bValid = FALSE;
+    return;
+  }
+
+  vptrans->vxGlo.pvmNewest = pvm;
+  if (!vptrans->vxGlo.pvmOldest) {
+    vptrans->vxGlo.pvmOldest = pvm;
+  }
+
+} /* AddGlobalVar */
+
+/* ----------------------------------------------------------------------------
+   GlobalOrder
+
+   Returns 1 if pvm is the head of the indexed global list as a stack,
+   -1 if it is the head of the reversed list, 0 otherwise.
+*/
+int GlobalOrder(PVMMAPSTRCT pvm) {
+  BOOL bStack;
+
+  if (!vptrans->vxGlo.bValid || !pvm) {
+    return 0;
+  }
+
+  bStack = (vptrans->vxGlo.pvmNewest->pvmNextVar || vptrans->vxGlo.nEntries == 1);
+  if (pvm == vptrans->vxGlo.pvmNewest && bStack) {
+    return 1;
+  }
+  if (pvm == vptrans->vxGlo.pvmOldest && !bStack) {
+    return -1;
+  }
+  return 0;
+
+} /* GlobalOrder */
+
 /* ----------------------------------------------------------------------------
 PROPAGATE_EXIT(AddEquation
 
@@ -204,13 +449,18 @@ int AddEquation(PVMMAPSTRCT *ppvm, PSTR szName, PSTR szEqn, HANDLE hType) {
     return 0;
   }
 
-  if ((pvmNew = (PVMMAPSTRCT)malloc(sizeof(VMMAPSTRCT)))) {
-    CLEANUP_AND_PROPAGATE_EXIT(AddEquationCleanup(pvmNew), CopyString(szName, &pvmNew->szName));
-    CLEANUP_AND_PROPAGATE_EXIT(AddEquationCleanup(pvmNew), CopyString(szEqn, &pvmNew->szEqn));
+  if ((pvmNew = (PVMMAPSTRCT)ModelAlloc(sizeof(VMMAPSTRCT)))) {
+    PROPAGATE_EXIT(CopyString(szName, &pvmNew->szName));
+    PROPAGATE_EXIT(CopyString(szEqn, &pvmNew->szEqn));
+    pvmNew->peqn = (szEqn && szEqn == vptrans->szEqnRead ? vptrans->peqnRead : NULL);
+    pvmNew->parr = vptrans->parrRead;
     pvmNew->hType = hType;
     pvmNew->pvmNextVar = *ppvm;
 
     *ppvm = pvmNew; /* Redefine Head */
+    if (ppvm == vptrans->vxGlo.ppvmList) {
+      AddGlobalVar(pvmNew);
+    }
   } /* if */
 
   else {
@@ -223,7 +473,8 @@ int AddEquation(PVMMAPSTRCT *ppvm, PSTR szName, PSTR szEqn, HANDLE hType) {
    CopyString
 
    Creates a buffer large enough to hold the given equation, copies it
-   into this buffer and returns a pointer to the buffer.
+   into this buffer and returns a pointer to the buffer. The buffer
+   belongs to the model arena, see ModelAlloc().
 
    Reports memory errors.
 */
@@ -231,8 +482,7 @@ int CopyString(PSTR szOrg, PSTR *szBuf) {
   // PSTR szBuf;
 
   if (szOrg) {
-    if ((*szBuf = (PSTR)malloc(strlen(szOrg) + 1))) {
-      strcpy((PSTR)*szBuf, szOrg);
+    if ((*szBuf = ArenaCopyString(&vptrans->arenaModel, szOrg))) {
       return 0;
     } else {
       PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, szOrg, "* .. defining equation in CopyString"));
@@ -254,13 +504,10 @@ int SetEquation(PVMMAPSTRCT pvm, PSTR szEqn) {
     return 0;
   }
 
-  if (pvm->szEqn) {
-    free(pvm->szEqn);
-  }
-
   PSTR szEqnBuf;
   PROPAGATE_EXIT(CopyString(szEqn, &szEqnBuf));
   pvm->szEqn = szEqnBuf;
+  pvm->peqn = (szEqn == vptrans->szEqnRead ? vptrans->peqnRead : NULL);
   return 0;
 
 } /* SetEquation */
@@ -275,12 +522,18 @@ int SetEquation(PVMMAPSTRCT pvm, PSTR szEqn) {
    variable.
 */
 void SetVarType(PVMMAPSTRCT pvm, PSTR szName, HANDLE hType) {
-  while (pvm && strcmp(szName, pvm->szName)) {
-    pvm = pvm->pvmNextVar;
-  }
+  long i;
 
-  if (pvm) {
+  if ((pvm = GetVarPTR(pvm, szName))) {
+    BOOL bRetyped = (TYPE(pvm) != (hType & ID_TYPEMASK));
     pvm->hType = hType;
+
+    if (bRetyped && vptrans->vxGlo.bValid) { /* Renumber the ordinals */
+      memset(vptrans->vxGlo.rgnTypes, 0, sizeof(vptrans->vxGlo.rgnTypes));
+      for (i = 0; i < vptrans->vxGlo.nEntries; i++) {
+        vptrans->vxGlo.rgvxe[i].iOrdinal = vptrans->vxGlo.rgnTypes[TYPE(vptrans->vxGlo.rgvxe[i].pvm) >> ID_TYPESHIFT]++;
+      }
+    }
   }
 
 } /* SetVarType */
@@ -292,6 +545,13 @@ void SetVarType(PVMMAPSTRCT pvm, PSTR szName, HANDLE hType) {
    by szName, or NULL if it does not exist.
 */
 PVMMAPSTRCT GetVarPTR(PVMMAPSTRCT pvm, PSTR szName) {
+  int iOrder = GlobalOrder(pvm);
+
+  if (iOrder) {
+    long i = FindVarEntry(&vptrans->vxGlo, szName, iOrder < 0);
+    return (i >= 0 ? vptrans->vxGlo.rgvxe[i].pvm : NULL);
+  }
+
   while (pvm && strcmp(szName, pvm->szName)) {
     pvm = pvm->pvmNextVar;
   }
@@ -300,6 +560,26 @@ PVMMAPSTRCT GetVarPTR(PVMMAPSTRCT pvm, PSTR szName) {
 
 } /* GetVarPTR */
 
+/* ----------------------------------------------------------------------------
+   GetIndexedVarPTR
+
+   As GetVarPTR(), but for a variable initialized after its declaration,
+   returns the entry of the initialization, which holds its index (see
+   IndexOneVar() in modo.c), rather than that of the declaration.
+*/
+PVMMAPSTRCT GetIndexedVarPTR(PVMMAPSTRCT pvm, PSTR szName) {
+  PVMMAPSTRCT pvmVar = GetVarPTR(pvm, szName);
+  long i;
+
+  if (pvmVar && pvmVar->szEqn == vszHasInitializer) {
+    i = (vptrans->vxGlo.bValid ? FindVarEntry(&vptrans->vxGlo, szName, FALSE) : -1);
+    pvmVar = (i >= 0 ? vptrans->vxGlo.rgvxe[i].pvm : GetVarPTR(pvmVar->pvmNextVar, szName));
+  }
+
+  return (pvmVar);
+
+} /* GetIndexedVarPTR */
+
 /* ----------------------------------------------------------------------------
    GetVarType
 
@@ -327,6 +607,7 @@ int GetVarType(PVMMAPSTRCT pvm, PSTR szName) {
    the index of the variable in the global map.  Since the map is a
    stack, we find the variable, and then get the index by counting
    all of the variables of the same type that appear after it in the map.
+   The global map index keeps that count as the ordinal of the variable.
 
    This will give the index into the parm section of the map.  The
    routine AdjustVarHandles() in modo.c will do a fixup once all of
@@ -335,7 +616,21 @@ int GetVarType(PVMMAPSTRCT pvm, PSTR szName) {
 */
 HANDLE CalculateVarHandle(PVMMAPSTRCT pvm, PSTR sz) {
   PVMMAPSTRCT pvmVar;
-  int cSameType = 0; /* Count of same type of variable in map */
+  long cSameType = 0; /* Count of same type of variable in map */
+  int iOrder = GlobalOrder(pvm);
+
+  if (iOrder) {
+    long i = FindVarEntry(&vptrans->vxGlo, sz, iOrder < 0);
+    if (i < 0) {
+      return 0;
+    }
+    pvmVar = vptrans->vxGlo.rgvxe[i].pvm;
+    cSameType = vptrans->vxGlo.rgvxe[i].iOrdinal;
+    if (iOrder < 0) { /* Reversed, count the newer ones */
+      cSameType = vptrans->vxGlo.rgnTypes[TYPE(pvmVar) >> ID_TYPESHIFT] - 1 - cSameType;
+    }
+    return ((HANDLE)(pvmVar->hType | (HANDLE)cSameType));
+  }
 
   pvm = pvmVar = GetVarPTR(pvm, sz); /* Get PTR in map */
 
@@ -343,8 +638,10 @@ HANDLE CalculateVarHandle(PVMMAPSTRCT pvm, PSTR sz) {
     pvm = pvm->pvmNextVar;
   }
 
-  while (pvm && pvm->hType == pvmVar->hType) {
-    cSameType++; /* Count vars defined before it */
+  while (pvm) {
+    if (TYPE(pvm) == TYPE(pvmVar)) {
+      cSameType++; /* Count vars defined before it */
+    }
     pvm = pvm->pvmNextVar;
   } /* while */
 
@@ -378,24 +675,17 @@ int DefineGlobalVar(PINPUTBUF pibIn, PVMMAPSTRCT pvm, PSTR szName, PSTR szEqn, H
       assert(pvm != NULL);
       if (!pvm->szEqn) {         /* This is the first definition */
         if (hType == ID_INPUT) { /* Inputs use decl space for definition */
-          PIFN pifn = (PIFN)malloc(sizeof(IFN));
+          PIFN pifn = (PIFN)ModelAlloc(sizeof(IFN));
           if (!pifn) {
             PROPAGATE_EXIT(ReportError(pibIn, RE_OUTOFMEM, szName, NULL));
           }
           if (PROPAGATE_EXIT_OR_RETURN_RESULT(GetInputFn(pibIn, szEqn, pifn))) {
-            if (pvm->szEqn && pvm->szEqn != vszHasInitializer) {
-              free(pvm->szEqn);
-            }
             pvm->szEqn = (PSTR)pifn; /* THIS MAY CAUSE PROBS ON 68000 */
           } else {
-            free(pifn);
             pvm->szEqn = NULL;
           }
         } /* if */
         else {
-          if (pvm->szEqn && pvm->szEqn != vszHasInitializer) {
-            free(pvm->szEqn);
-          }
           pvm->szEqn = vszHasInitializer; /* Flag this variable */
           /* Add a new entry at end of list so
              that dependencies are handled. */
@@ -590,7 +880,7 @@ int DefineJacobEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType) {
 /* ----------------------------------------------------------------------------
  */
 __attribute__((warn_unused_result)) int DefineEventEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType) {
-  HANDLE hNewType = (hType ? hType : ID_LOCALJACOB);
+  HANDLE hNewType = (hType ? hType : ID_LOCALEVENT);
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
   /* If there was more than one line since last equation, set ID_SPACEFLAG.
@@ -624,9 +914,32 @@ __attribute__((warn_unused_result)) int DefineEventEqn(PINPUTBUF pibIn, PSTR szN
 } /* DefineEventEqn */
 
 /* ----------------------------------------------------------------------------
- */
+   RootIndex
+
+   Returns i if szName is gout_i, the name given by ProcessIdentifier()
+   to gout[i], the i-th root function of the Roots section, or -1.
+*/
+int RootIndex(PSTR szName) {
+  PSTR sz;
+  long i;
+
+  if (!szName || strncmp(szName, "gout_", 5) || !isdigit((unsigned char)szName[5])) {
+    return -1;
+  }
+
+  i = strtol(szName + 5, &sz, 10);
+  return ((*sz || i >= INT_MAX) ? -1 : (int)i);
+
+} /* RootIndex */
+
+/* ----------------------------------------------------------------------------
+   DefineRootEqn
+
+   Root functions gout[i] are kept in the pvmRootEqns list with type
+   ID_NULL, and are not variables of the model.
+*/
 __attribute__((warn_unused_result)) int DefineRootEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType) {
-  HANDLE hNewType = (hType ? hType : ID_LOCALJACOB);
+  HANDLE hNewType = (hType ? hType : ID_LOCALROOT);
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
   /* If there was more than one line since last equation, set ID_SPACEFLAG.
@@ -639,6 +952,14 @@ __attribute__((warn_unused_result)) int DefineRootEqn(PINPUTBUF pibIn, PSTR szNa
     PROPAGATE_EXIT(AddEquation(&pinfo->pvmRootEqns, szName, szEqn, ID_INLINE));
   }
 
+  else if (!hType && RootIndex(szName) >= 0) { /* 1 eqn per root function */
+    if (!GetVarPTR(pinfo->pvmRootEqns, szName)) {
+      PROPAGATE_EXIT(AddEquation(&pinfo->pvmRootEqns, szName, szEqn, ID_NULL | (hNewType & ID_SPACEFLAG)));
+    } else {
+      PROPAGATE_EXIT(ReportError(pibIn, RE_REDEF | RE_WARNING, szName, "* Ignoring"));
+    }
+  }
+
   else {
 
     if (!hType) { /* Original type is NULL */
@@ -659,6 +980,32 @@ __attribute__((warn_unused_result)) int DefineRootEqn(PINPUTBUF pibIn, PSTR szNa
   return 0;
 } /* DefineRootEqn */
 
+/* ----------------------------------------------------------------------------
+   DefineDoseEqn
+
+   Defines a dose of the state szName, given by the dosing function
+   szEqn, in the pvmDoseEqns list. Doses are kept in the order read:
+   a state may be dosed by several of them.
+*/
+int DefineDoseEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType) {
+  PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
+  PDFN pdfn;
+
+  if (hType != ID_STATE) {
+    PROPAGATE_EXIT(
+        ReportError(pibIn, RE_BADCONTEXT | RE_FATAL, szName, "Only states can be dosed in the Doses{} section."));
+  }
+
+  if (!(pdfn = (PDFN)ModelAlloc(sizeof(DFN)))) {
+    PROPAGATE_EXIT(ReportError(pibIn, RE_OUTOFMEM | RE_FATAL, szName, "* .. in DefineDoseEqn"));
+  }
+  if (PROPAGATE_EXIT_OR_RETURN_RESULT(GetDoseFn(pibIn, szEqn, pdfn))) {
+    PROPAGATE_EXIT(AddEquation(&pinfo->pvmDoseEqns, szName, NULL, ID_STATE));
+    pinfo->pvmDoseEqns->szEqn = (PSTR)pdfn;
+  }
+  return 0;
+} /* DefineDoseEqn */
+
 /* ----------------------------------------------------------------------------
 PROPAGATE_EXIT(DefineVariable
 
@@ -673,11 +1020,14 @@ PROPAGATE_EXIT(DefineVariable
 
    * Values given to States in a global context are initial values.
 
+   * States given a dosing function in the Doses section are dosed.
+
    * In the global parameter declarations, a duplicate definition issues
      a warning and ignores the redefinitions
 */
 int DefineVariable(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, int iKWCode) {
   PVMMAPSTRCT pvm;
+  PEQN peqn;
   HANDLE hGloVarType;
   PINPUTINFO pinfo;
 
@@ -723,9 +1073,16 @@ int DefineVariable(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, int iKWCode) {
     hGloVarType = TYPE(pvm);
   }
 
+  /* The equation is read once here; AddEquation() and SetEquation() keep
+     what was read with the variable they define */
   if ((iKWCode != KM_INLINE) && (hGloVarType != ID_INPUT || pinfo->wContext != CN_GLOBAL) &&
-      !PROPAGATE_EXIT_OR_RETURN_RESULT(VerifyEqn(pibIn, szEqn))) {
-    return 0; /* Errors reported in Verify eqn */
+      (pinfo->wContext != CN_DOSES)) {
+    PROPAGATE_EXIT(ReadEqn(pibIn, szEqn, &peqn));
+    if (!PROPAGATE_EXIT_OR_RETURN_RESULT(VerifyEqn(pibIn, peqn))) {
+      return 0; /* Errors reported in Verify eqn */
+    }
+    vptrans->szEqnRead = szEqn;
+    vptrans->peqnRead = peqn;
   }
 
   switch (pinfo->wContext) {
@@ -761,6 +1118,10 @@ int DefineVariable(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, int iKWCode) {
     PROPAGATE_EXIT(DefineRootEqn(pibIn, szName, szEqn, hGloVarType));
     break;
 
+  case CN_DOSES:
+    PROPAGATE_EXIT(DefineDoseEqn(pibIn, szName, szEqn, hGloVarType));
+    break;
+
   case CN_SCALE:
     PROPAGATE_EXIT(DefineScaleEqn(pibIn, szName, szEqn, hGloVarType));
     break;
@@ -783,6 +1144,9 @@ int DefineVariable(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, int iKWCode) {
     break;
 
   } /* switch */
+
+  vptrans->szEqnRead = NULL;
+  vptrans->peqnRead = NULL;
   return 0;
 } /* DefineVariable */
 
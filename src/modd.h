@@ -22,26 +22,79 @@
 
 #ifndef MODD_H_DEFINED
 
+/* ---------------------------------------------------------------------------
+   Inclusions  */
+
+#include <stddef.h>
+
+/* ---------------------------------------------------------------------------
+   Constants  */
+
+#define VX_NTYPES 16 /* Ordinals are kept by TYPE() >> ID_TYPESHIFT */
+
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* One variable of a VARINDEX */
+typedef struct tagVXENTRY {
+  PVMMAPSTRCT pvm;
+  long iOrdinal;  /* Variables of the same type added before it */
+  long iNextHash; /* Chain of the bucket, -1 at the end */
+
+} VXENTRY, *PVXENTRY; /* tagVXENTRY */
+
+/* Index by name of a variable list. The entries are in the order the
+   variables were added, that is from the tail of the list as a stack. */
+typedef struct tagVARINDEX {
+  PVMMAPSTRCT *ppvmList; /* List kept up to date by AddEquation(), or NULL */
+  PVMMAPSTRCT pvmNewest; /* Head of the list as a stack... */
+  PVMMAPSTRCT pvmOldest; /* ... and once reversed */
+  BOOL bValid;           /* FALSE once the order of the list is unknown */
+
+  PVXENTRY rgvxe;
+  long nEntries;
+  long nMax;
+  long *rgiBuckets; /* Last entry of each bucket, or -1 */
+  long nBuckets;    /* A power of 2 */
+  long rgnTypes[VX_NTYPES];
+
+} VARINDEX, *PVARINDEX; /* tagVARINDEX */
+
 /* ---------------------------------------------------------------------------
    Prototypes */
 
 __attribute__((warn_unused_result)) int AddEquation(PVMMAPSTRCT *ppvm, PSTR szName, PSTR szEqn, HANDLE hType);
+void AddGlobalVar(PVMMAPSTRCT pvm);
+BOOL AddVarEntry(PVARINDEX pvx, PVMMAPSTRCT pvm);
 HANDLE CalculateVarHandle(PVMMAPSTRCT pvm, PSTR sz);
 __attribute__((warn_unused_result)) int CopyString(PSTR szOrg, PSTR *szBuf);
 __attribute__((warn_unused_result)) int DeclareModelVar(PINPUTBUF pibIn, PSTR szName, int iKWCode);
 __attribute__((warn_unused_result)) int DefineCalcOutEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType);
+__attribute__((warn_unused_result)) int DefineDoseEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType);
 __attribute__((warn_unused_result)) int DefineDynamicsEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType);
 __attribute__((warn_unused_result)) int DefineGlobalVar(PINPUTBUF pibIn, PVMMAPSTRCT pvm, PSTR szName, PSTR szEqn,
                                                         HANDLE hType);
 __attribute__((warn_unused_result)) int DefineJacobEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType);
 __attribute__((warn_unused_result)) int DefineScaleEqn(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, HANDLE hType);
 __attribute__((warn_unused_result)) int DefineVariable(PINPUTBUF pibIn, PSTR szName, PSTR szEqn, int iKWCode);
+long FindVarEntry(PVARINDEX pvx, PSTR szName, BOOL bOldest);
+void FreeModelArena(void);
+void FreeVarIndex(PVARINDEX pvx);
+PVMMAPSTRCT GetIndexedVarPTR(PVMMAPSTRCT pvm, PSTR szName);
 PVMMAPSTRCT GetVarPTR(PVMMAPSTRCT pvm, PSTR szName);
 int GetVarType(PVMMAPSTRCT pvm, PSTR szName);
+int GlobalOrder(PVMMAPSTRCT pvm);
+unsigned long HashName(PSTR sz);
+__attribute__((warn_unused_result)) int IndexGlobalVars(PVMMAPSTRCT *ppvmGlo);
+__attribute__((warn_unused_result)) int IndexVarList(PVARINDEX pvx, PVMMAPSTRCT pvmList);
+void InitVarIndex(PVARINDEX pvx);
 BOOL IsMathFunc(PSTR sz);
+PVMMAPSTRCT LookupVar(PVARINDEX pvx, PSTR szName);
+PVOID ModelAlloc(size_t cb);
+int RootIndex(PSTR szName);
 __attribute__((warn_unused_result)) int SetEquation(PVMMAPSTRCT pvm, PSTR szEqn);
 void SetVarType(PVMMAPSTRCT pvm, PSTR szName, HANDLE hType);
-__attribute__((warn_unused_result)) BOOL VerifyEqn(PINPUTBUF pibIn, PSTR szEqn);
+__attribute__((warn_unused_result)) BOOL VerifyEqn(PINPUTBUF pibIn, struct tagEQN *peqn);
 
 #define MODD_H_DEFINED
 #endif
@@ -0,0 +1,1375 @@
+/* modexpr.c
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Expression trees for model equations: parsing, symbolic
+   differentiation, constant folding, hoisting of parameter-only
+   subexpressions, common subexpression elimination and output as C.
+
+   Each equation is read once, by ReadEqn() when it is defined, into an
+   EQN: its lexemes, which the code writers walk instead of lexing the
+   text again, and its syntax tree, in which identifiers are left
+   unresolved (EX_ID). ResolveExpr() turns the syntax tree into an
+   expression for each use: identifiers of Dynamics locals and outputs
+   are replaced by the tree of their last assignment (pebBound), so that
+   an expression depends on states, parameters, inputs and time only; a
+   binding can also be an EX_VAR of the local itself, to keep it as a
+   variable. Constructs that cannot be handled (Inlines, unknown
+   functions of states, delays) make the reader, the resolver or the
+   differentiator return EX_UNSUPPORTED; callers then fall back to code
+   that does not need the tree.
+
+   Nodes keep the C type of what they stand for (bInt), so that trees
+   written back out mean what the model said: 1/2 stays an integer
+   division.
+*/
+#define R_NO_REMAP
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "lexerr.h"
+#include "lexfn.h"
+#include "mod.h"
+#include "modctx.h"
+#include "modd.h"
+#include "modexpr.h"
+#include "modo.h"
+
+/* One token of an equation for the parser, pointing into its lexemes */
+typedef struct tagEXTOKEN {
+  int iType;
+  PSTR sz;
+
+} EXTOKEN, *PEXTOKEN; /* tagEXTOKEN */
+
+/* Parser state */
+typedef struct tagEXPARSER {
+  PEXPRPOOL ppool;
+  PEXTOKEN rgtok;
+  int nTok;
+  int iTok;
+
+} EXPARSER, *PEXPARSER; /* tagEXPARSER */
+
+/* Math functions without side effects: the same arguments give the same
+   value, so calls can be moved. The random number functions can't. */
+static PSTR vrgszPureFuncs[] = {"acos",  "asin",  "atan",  "atan2", "ceil",      "cos",      "cosh",
+                                "exp",   "fabs",  "floor", "fmax",  "fmin",      "fmod",     "log",
+                                "log10", "pow",   "sin",   "sinh",  "sqrt",      "tan",      "tanh",
+                                "erfc",  "lnGamma", "CDFNormal", "lnDFNormal", ""};
+
+static BOOL IsPureCall(PEXPR pex) {
+  int i;
+
+  for (i = 0; *vrgszPureFuncs[i] && strcmp(vrgszPureFuncs[i], pex->szName); i++) {
+    ;
+  }
+  return (*vrgszPureFuncs[i] != '\0');
+
+} /* IsPureCall */
+
+/* ----------------------------------------------------------------------------
+   InitExprPool, FreeExprPool
+
+   All nodes, and their names, are allocated from the arena of a pool
+   and freed together.
+*/
+void InitExprPool(PEXPRPOOL ppool) {
+  InitArena(&ppool->arena);
+  ppool->nNodes = 0;
+
+} /* InitExprPool */
+
+void FreeExprPool(PEXPRPOOL ppool) {
+  FreeArena(&ppool->arena);
+  ppool->nNodes = 0;
+
+} /* FreeExprPool */
+
+/* ----------------------------------------------------------------------------
+   NewExpr
+
+   Allocates a node. Children that are NULL (out of memory) make the node
+   NULL too, so that failures propagate to the root.
+*/
+static PEXPR NewExpr(PEXPRPOOL ppool, int iOp, PSTR szName, int nArgs, PEXPR pexA, PEXPR pexB, PEXPR pexC) {
+  PEXPR pex;
+
+  if ((nArgs > 0 && !pexA) || (nArgs > 1 && !pexB) || (nArgs > 2 && !pexC)) {
+    return (NULL);
+  }
+
+  if (!(pex = (PEXPR)ArenaCalloc(&ppool->arena, sizeof(EXPR)))) {
+    return (NULL);
+  }
+  if (szName && !(pex->szName = ArenaCopyString(&ppool->arena, szName))) {
+    return (NULL);
+  }
+
+  pex->iOp = iOp;
+  pex->iTemp = -1;
+  pex->nArgs = nArgs;
+  pex->rgpexArg[0] = pexA;
+  pex->rgpexArg[1] = pexB;
+  pex->rgpexArg[2] = pexC;
+
+  switch (iOp) { /* C type, by the usual arithmetic conversions */
+  case EX_REL:
+  case EX_NOT:
+    pex->bInt = TRUE;
+    break;
+  case EX_NEG:
+    pex->bInt = pexA->bInt;
+    break;
+  case EX_ADD:
+  case EX_SUB:
+  case EX_MUL:
+  case EX_DIV:
+    pex->bInt = (pexA->bInt && pexB->bInt);
+    break;
+  case EX_COND:
+    pex->bInt = (pexB->bInt && pexC->bInt);
+    break;
+  default: /* Numbers are set by the caller, the rest is double */
+    break;
+  }
+
+  ppool->nNodes++;
+
+  return (pex);
+
+} /* NewExpr */
+
+/* ----------------------------------------------------------------------------
+   NewVarExpr
+
+   Returns an EX_VAR node for pvm. iClass is used for locals and outputs
+   bound to themselves, see ClassifyExpr().
+*/
+PEXPR NewVarExpr(PEXPRPOOL ppool, PVMMAPSTRCT pvm, int iClass) {
+  PEXPR pex = NewExpr(ppool, EX_VAR, NULL, 0, NULL, NULL, NULL);
+
+  if (pex) {
+    pex->pvm = pvm;
+    pex->iClass = iClass;
+  }
+  return (pex);
+
+} /* NewVarExpr */
+
+/* ----------------------------------------------------------------------------
+   Node constructors
+
+   They fold constants and drop zeros and ones, which keeps derivatives
+   short, unless dropping an operand would change the C type of the
+   result (0.0 + (a < b) is a double, a < b is not).
+*/
+static PEXPR MkNumT(PEXPRPOOL ppool, double d, BOOL bInt) {
+  PEXPR pex = NewExpr(ppool, EX_NUM, NULL, 0, NULL, NULL, NULL);
+
+  if (pex) {
+    pex->dVal = d;
+    pex->bInt = bInt;
+  }
+  return (pex);
+
+} /* MkNumT */
+
+static PEXPR MkNum(PEXPRPOOL ppool, double d) { return (MkNumT(ppool, d, FALSE)); } /* MkNum */
+
+static BOOL CanDrop(PEXPR pexKeep, PEXPR pexDrop) {
+  return (!pexKeep->bInt || pexDrop->bInt);
+
+} /* CanDrop */
+
+static BOOL IsNums(PEXPR pexA, PEXPR pexB) {
+  return (pexA->iOp == EX_NUM && pexB->iOp == EX_NUM);
+
+} /* IsNums */
+
+BOOL IsZeroExpr(PEXPR pex) { return (pex && pex->iOp == EX_NUM && pex->dVal == 0.0); } /* IsZeroExpr */
+
+static BOOL IsNumExpr(PEXPR pex, double d) {
+  return (pex && pex->iOp == EX_NUM && pex->dVal == d);
+
+} /* IsNumExpr */
+
+static PEXPR MkNeg(PEXPRPOOL ppool, PEXPR pexA) {
+  if (pexA && pexA->iOp == EX_NUM) {
+    return (MkNumT(ppool, -pexA->dVal, pexA->bInt));
+  }
+  if (pexA && pexA->iOp == EX_NEG) {
+    return (pexA->rgpexArg[0]);
+  }
+  return (NewExpr(ppool, EX_NEG, NULL, 1, pexA, NULL, NULL));
+
+} /* MkNeg */
+
+static PEXPR MkAdd(PEXPRPOOL ppool, PEXPR pexA, PEXPR pexB) {
+  if (!pexA || !pexB) {
+    return (NULL);
+  }
+  if (IsNums(pexA, pexB)) {
+    return (MkNumT(ppool, pexA->dVal + pexB->dVal, pexA->bInt && pexB->bInt));
+  }
+  if (IsZeroExpr(pexA) && CanDrop(pexB, pexA)) {
+    return (pexB);
+  }
+  if (IsZeroExpr(pexB) && CanDrop(pexA, pexB)) {
+    return (pexA);
+  }
+  return (NewExpr(ppool, EX_ADD, NULL, 2, pexA, pexB, NULL));
+
+} /* MkAdd */
+
+static PEXPR MkSub(PEXPRPOOL ppool, PEXPR pexA, PEXPR pexB) {
+  if (!pexA || !pexB) {
+    return (NULL);
+  }
+  if (IsNums(pexA, pexB)) {
+    return (MkNumT(ppool, pexA->dVal - pexB->dVal, pexA->bInt && pexB->bInt));
+  }
+  if (IsZeroExpr(pexB) && CanDrop(pexA, pexB)) {
+    return (pexA);
+  }
+  if (IsZeroExpr(pexA) && CanDrop(pexB, pexA)) {
+    return (MkNeg(ppool, pexB));
+  }
+  return (NewExpr(ppool, EX_SUB, NULL, 2, pexA, pexB, NULL));
+
+} /* MkSub */
+
+static PEXPR MkMul(PEXPRPOOL ppool, PEXPR pexA, PEXPR pexB) {
+  if (!pexA || !pexB) {
+    return (NULL);
+  }
+  if (IsNums(pexA, pexB)) {
+    return (MkNumT(ppool, pexA->dVal * pexB->dVal, pexA->bInt && pexB->bInt));
+  }
+  if ((IsZeroExpr(pexA) || IsNumExpr(pexB, 1.0)) && CanDrop(pexA, pexB)) {
+    return (pexA);
+  }
+  if ((IsZeroExpr(pexB) || IsNumExpr(pexA, 1.0)) && CanDrop(pexB, pexA)) {
+    return (pexB);
+  }
+  if (IsNumExpr(pexA, -1.0) && CanDrop(pexB, pexA)) {
+    return (MkNeg(ppool, pexB));
+  }
+  if (IsNumExpr(pexB, -1.0) && CanDrop(pexA, pexB)) {
+    return (MkNeg(ppool, pexA));
+  }
+  return (NewExpr(ppool, EX_MUL, NULL, 2, pexA, pexB, NULL));
+
+} /* MkMul */
+
+static PEXPR MkDiv(PEXPRPOOL ppool, PEXPR pexA, PEXPR pexB) {
+  BOOL bInt;
+
+  if (!pexA || !pexB) {
+    return (NULL);
+  }
+  bInt = (pexA->bInt && pexB->bInt);
+  if (IsNums(pexA, pexB) && pexB->dVal != 0.0) {
+    return (bInt ? MkNumT(ppool, (double)((long)pexA->dVal / (long)pexB->dVal), TRUE)
+                 : MkNum(ppool, pexA->dVal / pexB->dVal));
+  }
+  if ((IsZeroExpr(pexA) || IsNumExpr(pexB, 1.0)) && CanDrop(pexA, pexB)) {
+    return (pexA);
+  }
+  return (NewExpr(ppool, EX_DIV, NULL, 2, pexA, pexB, NULL));
+
+} /* MkDiv */
+
+static PEXPR MkCall(PEXPRPOOL ppool, PSTR szFunc, int nArgs, PEXPR pexA, PEXPR pexB) {
+  return (NewExpr(ppool, EX_CALL, szFunc, nArgs, pexA, pexB, NULL));
+
+} /* MkCall */
+
+/* ----------------------------------------------------------------------------
+   Parser
+
+   Recursive descent over C precedence levels, for what VerifyEqn()
+   accepts in equations:
+
+     cond    : eq ['?' cond ':' cond]
+     eq      : rel [('==' | '!=') rel]...
+     rel     : add [('<' | '>' | '<=' | '>=') add]...
+     add     : mul [('+' | '-') mul]...
+     mul     : unary [('*' | '/') unary]...
+     unary   : ('-' | '+' | '!') unary | primary
+     primary : number | identifier | function '(' cond [',' cond]... ')'
+             | '(' cond ')'
+*/
+static BOOL IsTok(PEXPARSER pp, PSTR sz) {
+  return (pp->iTok < pp->nTok && pp->rgtok[pp->iTok].iType != LX_IDENTIFIER &&
+          !(pp->rgtok[pp->iTok].iType & LX_NUMBER) && !strcmp(pp->rgtok[pp->iTok].sz, sz));
+
+} /* IsTok */
+
+static int ParseCond(PEXPARSER pp, PEXPR *ppex);
+
+static int ParsePrimary(PEXPARSER pp, PEXPR *ppex) {
+  PEXTOKEN ptok;
+  PEXPR rgpexArg[EX_MAXARGS];
+  int iRet, nArgs = 0;
+
+  if (pp->iTok >= pp->nTok) {
+    return (EX_UNSUPPORTED);
+  }
+  ptok = &pp->rgtok[pp->iTok++];
+
+  if (ptok->iType & LX_NUMBER) { /* Kept as written */
+    *ppex = NewExpr(pp->ppool, EX_NUM, ptok->sz, 0, NULL, NULL, NULL);
+    if (*ppex) {
+      (*ppex)->dVal = atof(ptok->sz);
+      (*ppex)->bInt = (ptok->iType == LX_INTEGER);
+    }
+    return 0;
+  }
+
+  if (ptok->iType != LX_IDENTIFIER) {
+    if (!strcmp(ptok->sz, "(")) {
+      if ((iRet = ParseCond(pp, ppex))) {
+        return (iRet);
+      }
+      if (!IsTok(pp, ")")) {
+        return (EX_UNSUPPORTED);
+      }
+      pp->iTok++;
+      return 0;
+    }
+    return (EX_UNSUPPORTED);
+  }
+
+  if (IsTok(pp, "(")) { /* Function call */
+    pp->iTok++;
+    if (!strcmp(ptok->sz, "CalcDelay") || !IsMathFunc(ptok->sz)) {
+      return (EX_UNSUPPORTED);
+    }
+    if (!IsTok(pp, ")")) {
+      do {
+        if (nArgs == EX_MAXARGS) {
+          return (EX_UNSUPPORTED);
+        }
+        if ((iRet = ParseCond(pp, &rgpexArg[nArgs++]))) {
+          return (iRet);
+        }
+      } while (IsTok(pp, ",") && ++pp->iTok);
+    }
+    if (!IsTok(pp, ")")) {
+      return (EX_UNSUPPORTED);
+    }
+    pp->iTok++;
+
+    *ppex = NewExpr(pp->ppool, EX_CALL, ptok->sz, nArgs, (nArgs > 0 ? rgpexArg[0] : NULL),
+                    (nArgs > 1 ? rgpexArg[1] : NULL), (nArgs > 2 ? rgpexArg[2] : NULL));
+    if (*ppex && nArgs > 3) {
+      (*ppex)->rgpexArg[3] = rgpexArg[3];
+    }
+    return 0;
+  }
+
+  /* Resolved by ResolveExpr() */
+  *ppex = NewExpr(pp->ppool, EX_ID, ptok->sz, 0, NULL, NULL, NULL);
+  return 0;
+
+} /* ParsePrimary */
+
+static int ParseUnary(PEXPARSER pp, PEXPR *ppex) {
+  int iRet;
+
+  if (IsTok(pp, "-") || IsTok(pp, "+") || IsTok(pp, "!")) {
+    char c = pp->rgtok[pp->iTok++].sz[0];
+
+    if ((iRet = ParseUnary(pp, ppex))) {
+      return (iRet);
+    }
+    if (c == '-') { /* Folded by ResolveExpr() */
+      *ppex = NewExpr(pp->ppool, EX_NEG, NULL, 1, *ppex, NULL, NULL);
+    } else if (c == '!') {
+      *ppex = NewExpr(pp->ppool, EX_NOT, NULL, 1, *ppex, NULL, NULL);
+    }
+    return 0;
+  }
+
+  return (ParsePrimary(pp, ppex));
+
+} /* ParseUnary */
+
+static int ParseMul(PEXPARSER pp, PEXPR *ppex) {
+  PEXPR pexB;
+  int iRet, iOp;
+
+  if ((iRet = ParseUnary(pp, ppex))) {
+    return (iRet);
+  }
+
+  while (IsTok(pp, "*") || IsTok(pp, "/")) {
+    iOp = (pp->rgtok[pp->iTok++].sz[0] == '*' ? EX_MUL : EX_DIV);
+    if ((iRet = ParseUnary(pp, &pexB))) {
+      return (iRet);
+    }
+    *ppex = NewExpr(pp->ppool, iOp, NULL, 2, *ppex, pexB, NULL);
+  }
+
+  return 0;
+
+} /* ParseMul */
+
+static int ParseAdd(PEXPARSER pp, PEXPR *ppex) {
+  PEXPR pexB;
+  int iRet, iOp;
+
+  if ((iRet = ParseMul(pp, ppex))) {
+    return (iRet);
+  }
+
+  while (IsTok(pp, "+") || IsTok(pp, "-")) {
+    iOp = (pp->rgtok[pp->iTok++].sz[0] == '+' ? EX_ADD : EX_SUB);
+    if ((iRet = ParseMul(pp, &pexB))) {
+      return (iRet);
+    }
+    *ppex = NewExpr(pp->ppool, iOp, NULL, 2, *ppex, pexB, NULL);
+  }
+
+  return 0;
+
+} /* ParseAdd */
+
+static int ParseRel(PEXPARSER pp, PEXPR *ppex) {
+  static PSTR vrgszRel[] = {"<", ">", "<=", ">=", ""};
+  PEXPR pexB;
+  int i, iRet;
+
+  if ((iRet = ParseAdd(pp, ppex))) {
+    return (iRet);
+  }
+
+  for (i = 0; *vrgszRel[i];) {
+    if (!IsTok(pp, vrgszRel[i])) {
+      i++;
+      continue;
+    }
+    pp->iTok++;
+    if ((iRet = ParseAdd(pp, &pexB))) {
+      return (iRet);
+    }
+    *ppex = NewExpr(pp->ppool, EX_REL, vrgszRel[i], 2, *ppex, pexB, NULL);
+    i = 0;
+  }
+
+  return 0;
+
+} /* ParseRel */
+
+static int ParseEq(PEXPARSER pp, PEXPR *ppex) {
+  static PSTR vrgszEq[] = {"==", "!=", ""};
+  PEXPR pexB;
+  int i, iRet;
+
+  if ((iRet = ParseRel(pp, ppex))) {
+    return (iRet);
+  }
+
+  for (i = 0; *vrgszEq[i];) {
+    if (!IsTok(pp, vrgszEq[i])) {
+      i++;
+      continue;
+    }
+    pp->iTok++;
+    if ((iRet = ParseRel(pp, &pexB))) {
+      return (iRet);
+    }
+    *ppex = NewExpr(pp->ppool, EX_REL, vrgszEq[i], 2, *ppex, pexB, NULL);
+    i = 0;
+  }
+
+  return 0;
+
+} /* ParseEq */
+
+static int ParseCond(PEXPARSER pp, PEXPR *ppex) {
+  PEXPR pexB, pexC;
+  int iRet;
+
+  if ((iRet = ParseEq(pp, ppex))) {
+    return (iRet);
+  }
+
+  if (IsTok(pp, "?")) {
+    pp->iTok++;
+    if ((iRet = ParseCond(pp, &pexB))) {
+      return (iRet);
+    }
+    if (!IsTok(pp, ":")) {
+      return (EX_UNSUPPORTED);
+    }
+    pp->iTok++;
+    if ((iRet = ParseCond(pp, &pexC))) {
+      return (iRet);
+    }
+    *ppex = NewExpr(pp->ppool, EX_COND, NULL, 3, *ppex, pexB, pexC);
+  }
+
+  return 0;
+
+} /* ParseCond */
+
+/* ----------------------------------------------------------------------------
+   ReadEqn
+
+   Reads szEqn into a new EQN in *ppeqn: its lexemes, as NextLex() gives
+   them, and its syntax tree, NULL if the equation cannot be represented.
+   pibIn, if not NULL, gives the line for the errors of the lexer. The
+   EQN is allocated for the whole translation.
+
+   The lexer reads "a -1" as "a" and the number "-1"; for the parser,
+   such a sign after an operand is split off as a binary operator.
+*/
+int ReadEqn(PINPUTBUF pibIn, PSTR szEqn, PEQN *ppeqn) {
+  PARENA parena = &vptrans->poolEqn.arena;
+  INPUTBUF ibDum;
+  PSTRLEX szLex;
+  PEQN peqn;
+  PEQNLEX rglex = NULL, rglexNew;
+  EXPARSER ps;
+  int i, iType, iRet, nMax = 0;
+  BOOL bOperand = FALSE;
+
+  *ppeqn = NULL;
+  if (!(peqn = (PEQN)ArenaCalloc(parena, sizeof(EQN)))) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "ReadEqn", NULL));
+  }
+
+  InitINPUTBUF(&ibDum);
+  MakeStringBuffer(pibIn, &ibDum, szEqn);
+
+  PROPAGATE_EXIT(NextLex(&ibDum, szLex, &iType));
+  while (iType) {
+    if (peqn->nLex == nMax) { /* Grown in the arena: equations are short */
+      nMax = (nMax ? 2 * nMax : 16);
+      if (!(rglexNew = (PEQNLEX)ArenaAlloc(parena, nMax * sizeof(EQNLEX)))) {
+        PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "ReadEqn", NULL));
+      }
+      if (peqn->nLex) {
+        memcpy(rglexNew, rglex, peqn->nLex * sizeof(EQNLEX));
+      }
+      rglex = rglexNew;
+    }
+    rglex[peqn->nLex].iType = iType;
+    rglex[peqn->nLex].ibEnd = (long)(ibDum.pbufCur - ibDum.pbufOrg);
+    if (!(rglex[peqn->nLex++].sz = ArenaCopyString(parena, szLex))) {
+      PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "ReadEqn", NULL));
+    }
+    PROPAGATE_EXIT(NextLex(&ibDum, szLex, &iType));
+  }
+  peqn->rglex = rglex;
+
+  /* Tokens for the parser */
+  ps.ppool = &vptrans->poolEqn;
+  ps.iTok = ps.nTok = 0;
+  if (!(ps.rgtok = (PEXTOKEN)malloc((2 * peqn->nLex + 1) * sizeof(EXTOKEN)))) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "ReadEqn", NULL));
+  }
+  for (i = 0; i < peqn->nLex; i++) {
+    PSTR sz = rglex[i].sz;
+
+    iType = rglex[i].iType;
+    if (bOperand && (iType & LX_NUMBER) && (sz[0] == '-' || sz[0] == '+')) {
+      ps.rgtok[ps.nTok].iType = LX_EQNPUNCT;
+      ps.rgtok[ps.nTok++].sz = (sz[0] == '-' ? "-" : "+");
+      sz++;
+    }
+    ps.rgtok[ps.nTok].iType = iType;
+    ps.rgtok[ps.nTok++].sz = sz;
+    bOperand = (iType == LX_IDENTIFIER || (iType & LX_NUMBER) || !strcmp(rglex[i].sz, ")"));
+  }
+
+  iRet = ParseCond(&ps, &peqn->pexSyntax);
+  free(ps.rgtok);
+  if (iRet || ps.iTok != ps.nTok) { /* Unsupported, or trailing tokens */
+    peqn->pexSyntax = NULL;
+  } else if (!peqn->pexSyntax) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "ReadEqn", NULL));
+  }
+
+  *ppeqn = peqn;
+  return 0;
+
+} /* ReadEqn */
+
+/* ----------------------------------------------------------------------------
+   GetEqn
+
+   Sets *ppeqn to the EQN of the equation of pvm, reading it the first
+   time for equations that were not defined by DefineVariable() (those
+   of the SBML reader, for one).
+*/
+int GetEqn(PVMMAPSTRCT pvm, PEQN *ppeqn) {
+  if (!pvm->peqn) {
+    PROPAGATE_EXIT(ReadEqn(NULL, pvm->szEqn, &pvm->peqn));
+  }
+  *ppeqn = pvm->peqn;
+  return 0;
+
+} /* GetEqn */
+
+/* ----------------------------------------------------------------------------
+   ResolveExpr
+
+   Sets *ppex to a new tree, in ppool, for the syntax tree pexSyn: its
+   identifiers are looked up in pvmGlo, Dynamics locals and outputs in
+   pebBound, and negations are folded as they are rebuilt. Returns
+   EX_UNSUPPORTED for identifiers that cannot be represented.
+*/
+static int ResolveId(PEXPRPOOL ppool, PSTR szName, PVMMAPSTRCT pvmGlo, PEXPRBIND pebBound, PEXPR *ppex) {
+  PVMMAPSTRCT pvm = GetIndexedVarPTR(pvmGlo, szName);
+  PEXPRBIND peb;
+
+  if (!pvm && (!strcmp(szName, VSZ_TIME) || !strcmp(szName, VSZ_TIME_SBML))) {
+    *ppex = NewExpr(ppool, EX_TIME, NULL, 0, NULL, NULL, NULL);
+    return 0;
+  }
+
+  switch (TYPE(pvm)) {
+  case ID_STATE:
+  case ID_PARM:
+  case ID_INPUT:
+    *ppex = NewVarExpr(ppool, pvm, 0);
+    return 0;
+
+  case ID_LOCALDYN:
+  case ID_OUTPUT:
+    for (peb = pebBound; peb; peb = peb->pebNext) {
+      if (peb->pvm == pvm) {
+        *ppex = peb->pex;
+        return 0;
+      }
+    }
+    return (EX_UNSUPPORTED); /* Read before assigned */
+
+  default: /* Undeclared, or not a variable of the Dynamics */
+    return (EX_UNSUPPORTED);
+  }
+
+} /* ResolveId */
+
+static int ResolveExpr(PEXPRPOOL ppool, PEXPR pexSyn, PVMMAPSTRCT pvmGlo, PEXPRBIND pebBound, PEXPR *ppex) {
+  PEXPR rgpexArg[EX_MAXARGS] = {NULL, NULL, NULL, NULL};
+  int i, iRet;
+
+  switch (pexSyn->iOp) {
+  case EX_ID:
+    return (ResolveId(ppool, pexSyn->szName, pvmGlo, pebBound, ppex));
+
+  case EX_NUM:
+    if ((*ppex = NewExpr(ppool, EX_NUM, pexSyn->szName, 0, NULL, NULL, NULL))) {
+      (*ppex)->dVal = pexSyn->dVal;
+      (*ppex)->bInt = pexSyn->bInt;
+    }
+    return 0;
+
+  default:
+    break;
+  }
+
+  for (i = 0; i < pexSyn->nArgs; i++) {
+    if ((iRet = ResolveExpr(ppool, pexSyn->rgpexArg[i], pvmGlo, pebBound, &rgpexArg[i]))) {
+      return (iRet);
+    }
+  }
+
+  if (pexSyn->iOp == EX_NEG) {
+    *ppex = MkNeg(ppool, rgpexArg[0]);
+  } else {
+    *ppex = NewExpr(ppool, pexSyn->iOp, pexSyn->szName, pexSyn->nArgs, rgpexArg[0], rgpexArg[1], rgpexArg[2]);
+    if (*ppex && pexSyn->nArgs > 3) {
+      (*ppex)->rgpexArg[3] = rgpexArg[3];
+    }
+  }
+  return 0;
+
+} /* ResolveExpr */
+
+/* ----------------------------------------------------------------------------
+   EqnExpr
+
+   Sets *ppex to the tree, in ppool, of the equation of pvm, see
+   ResolveExpr(). Returns EX_UNSUPPORTED if the equation cannot be
+   represented.
+*/
+int EqnExpr(PEXPRPOOL ppool, PVMMAPSTRCT pvm, PVMMAPSTRCT pvmGlo, PEXPRBIND pebBound, PEXPR *ppex) {
+  PEQN peqn;
+  int iRet;
+
+  *ppex = NULL;
+  PROPAGATE_EXIT(GetEqn(pvm, &peqn));
+  if (!peqn->pexSyntax) {
+    return (EX_UNSUPPORTED);
+  }
+
+  iRet = ResolveExpr(ppool, peqn->pexSyntax, pvmGlo, pebBound, ppex);
+  if (!iRet && !*ppex) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "EqnExpr", NULL));
+  }
+  return (iRet);
+
+} /* EqnExpr */
+
+/* ----------------------------------------------------------------------------
+   DiffExpr
+
+   Sets *ppexD to the derivative of pex with respect to the state
+   pvmState. Comparisons are piecewise constant and differentiate to 0.
+   Returns EX_UNSUPPORTED for functions without a rule here whose
+   arguments depend on the state.
+*/
+int DiffExpr(PEXPRPOOL ppool, PEXPR pex, PVMMAPSTRCT pvmState, PEXPR *ppexD) {
+  PEXPR rgpexD[EX_MAXARGS], pexA, pexB;
+  PSTR szF;
+  int i, iRet;
+  BOOL bConst = TRUE;
+
+  *ppexD = NULL;
+
+  switch (pex->iOp) {
+  case EX_NUM:
+  case EX_TIME:
+  case EX_REL:
+  case EX_NOT:
+  case EX_HOIST:
+    *ppexD = MkNum(ppool, 0.0);
+    return 0;
+
+  case EX_VAR:
+    if (TYPE(pex->pvm) != ID_STATE && TYPE(pex->pvm) != ID_PARM && TYPE(pex->pvm) != ID_INPUT) {
+      return (EX_UNSUPPORTED); /* A local kept as a variable */
+    }
+    *ppexD = MkNum(ppool, (pex->pvm == pvmState ? 1.0 : 0.0));
+    return 0;
+
+  default:
+    break;
+  }
+
+  for (i = (pex->iOp == EX_COND ? 1 : 0); i < pex->nArgs; i++) {
+    if ((iRet = DiffExpr(ppool, pex->rgpexArg[i], pvmState, &rgpexD[i]))) {
+      return (iRet);
+    }
+    bConst = bConst && IsZeroExpr(rgpexD[i]);
+  }
+
+  if (bConst) {
+    *ppexD = MkNum(ppool, 0.0);
+    return 0;
+  }
+
+  pexA = pex->rgpexArg[0];
+  pexB = pex->rgpexArg[1];
+
+  switch (pex->iOp) {
+  case EX_NEG:
+    *ppexD = MkNeg(ppool, rgpexD[0]);
+    break;
+
+  case EX_ADD:
+    *ppexD = MkAdd(ppool, rgpexD[0], rgpexD[1]);
+    break;
+
+  case EX_SUB:
+    *ppexD = MkSub(ppool, rgpexD[0], rgpexD[1]);
+    break;
+
+  case EX_MUL: /* a'b + ab' */
+    *ppexD = MkAdd(ppool, MkMul(ppool, rgpexD[0], pexB), MkMul(ppool, pexA, rgpexD[1]));
+    break;
+
+  case EX_DIV: /* a'/b - a b'/(b b) */
+    *ppexD = MkSub(ppool, MkDiv(ppool, rgpexD[0], pexB),
+                   MkDiv(ppool, MkMul(ppool, pexA, rgpexD[1]), MkMul(ppool, pexB, pexB)));
+    break;
+
+  case EX_COND:
+    *ppexD = NewExpr(ppool, EX_COND, NULL, 3, pexA, rgpexD[1], rgpexD[2]);
+    break;
+
+  case EX_CALL:
+    szF = pex->szName;
+    if (pex->nArgs == 1) {
+      if (!strcmp(szF, "exp")) {
+        *ppexD = MkMul(ppool, pex, rgpexD[0]);
+      } else if (!strcmp(szF, "log")) {
+        *ppexD = MkDiv(ppool, rgpexD[0], pexA);
+      } else if (!strcmp(szF, "log10")) {
+        *ppexD = MkDiv(ppool, rgpexD[0], MkMul(ppool, pexA, MkCall(ppool, "log", 1, MkNum(ppool, 10.0), NULL)));
+      } else if (!strcmp(szF, "sqrt")) {
+        *ppexD = MkDiv(ppool, rgpexD[0], MkMul(ppool, MkNum(ppool, 2.0), pex));
+      } else if (!strcmp(szF, "sin")) {
+        *ppexD = MkMul(ppool, MkCall(ppool, "cos", 1, pexA, NULL), rgpexD[0]);
+      } else if (!strcmp(szF, "cos")) {
+        *ppexD = MkNeg(ppool, MkMul(ppool, MkCall(ppool, "sin", 1, pexA, NULL), rgpexD[0]));
+      } else if (!strcmp(szF, "tan")) {
+        *ppexD = MkDiv(ppool, rgpexD[0], MkMul(ppool, MkCall(ppool, "cos", 1, pexA, NULL),
+                                               MkCall(ppool, "cos", 1, pexA, NULL)));
+      } else if (!strcmp(szF, "fabs")) {
+        *ppexD = NewExpr(ppool, EX_COND, NULL, 3, NewExpr(ppool, EX_REL, ">=", 2, pexA, MkNum(ppool, 0.0), NULL),
+                         rgpexD[0], MkNeg(ppool, rgpexD[0]));
+      } else if (!strcmp(szF, "ceil") || !strcmp(szF, "floor")) {
+        *ppexD = MkNum(ppool, 0.0);
+      } else {
+        return (EX_UNSUPPORTED);
+      }
+    } else if (pex->nArgs == 2 && !strcmp(szF, "pow")) {
+      if (IsZeroExpr(rgpexD[1])) { /* b a^(b-1) a' */
+        *ppexD = MkMul(ppool, MkMul(ppool, pexB, MkCall(ppool, "pow", 2, pexA, MkSub(ppool, pexB, MkNum(ppool, 1.0)))),
+                       rgpexD[0]);
+      } else { /* a^b (b' log(a) + b a'/a) */
+        *ppexD = MkMul(ppool, pex,
+                       MkAdd(ppool, MkMul(ppool, rgpexD[1], MkCall(ppool, "log", 1, pexA, NULL)),
+                             MkDiv(ppool, MkMul(ppool, pexB, rgpexD[0]), pexA)));
+      }
+    } else {
+      return (EX_UNSUPPORTED);
+    }
+    break;
+
+  default:
+    return (EX_UNSUPPORTED);
+  }
+
+  if (!*ppexD) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "DiffExpr", NULL));
+  }
+  return 0;
+
+} /* DiffExpr */
+
+/* ----------------------------------------------------------------------------
+   ClassifyExpr
+
+   Returns what pex varies with: EC_CONST, EC_PARM, EC_INPUT or EC_STATE.
+   Calls of functions with side effects count as EC_STATE, and so do
+   locals and outputs kept as variables, unless they were bound with a
+   lower class.
+*/
+int ClassifyExpr(PEXPR pex) {
+  int i, iClass = EC_CONST, iArg;
+
+  switch (pex->iOp) {
+  case EX_NUM:
+    return (EC_CONST);
+
+  case EX_TIME:
+    return (EC_INPUT);
+
+  case EX_HOIST:
+    return (EC_PARM);
+
+  case EX_VAR:
+    switch (TYPE(pex->pvm)) {
+    case ID_PARM:
+      return (EC_PARM);
+    case ID_INPUT:
+      return (EC_INPUT);
+    case ID_STATE:
+      return (EC_STATE);
+    default:
+      return (pex->iClass);
+    }
+
+  case EX_CALL:
+    if (!IsPureCall(pex)) {
+      return (EC_STATE);
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  for (i = 0; i < pex->nArgs; i++) {
+    if ((iArg = ClassifyExpr(pex->rgpexArg[i])) > iClass) {
+      iClass = iArg;
+    }
+  }
+
+  return (iClass);
+
+} /* ClassifyExpr */
+
+/* ----------------------------------------------------------------------------
+   FoldExpr
+
+   Sets *ppexOut to pex with the arithmetic on numbers done, e.g. 1.0/60.0
+   becomes 0.016666666666666666 and 3/4 becomes 0, as C would compute
+   them. Nothing is reassociated, so a * 1.0/60.0, which is (a * 1.0) /
+   60.0, is left alone. Sets *ppexOut to pex itself if there was nothing
+   to fold; pex is not modified.
+*/
+int FoldExpr(PEXPRPOOL ppool, PEXPR pex, PEXPR *ppexOut) {
+  PEXPR rgpexArg[EX_MAXARGS] = {NULL, NULL, NULL, NULL}, pexA, pexB;
+  BOOL bChanged = FALSE;
+  int i;
+
+  *ppexOut = pex;
+  for (i = 0; i < pex->nArgs; i++) {
+    PROPAGATE_EXIT(FoldExpr(ppool, pex->rgpexArg[i], &rgpexArg[i]));
+    bChanged = (bChanged || rgpexArg[i] != pex->rgpexArg[i]);
+  }
+  pexA = rgpexArg[0];
+  pexB = rgpexArg[1];
+
+  switch (pex->iOp) {
+  case EX_NEG:
+    if (pexA->iOp == EX_NUM) {
+      *ppexOut = MkNeg(ppool, pexA);
+    }
+    break;
+
+  case EX_ADD:
+    if (IsNums(pexA, pexB)) {
+      *ppexOut = MkAdd(ppool, pexA, pexB);
+    }
+    break;
+
+  case EX_SUB:
+    if (IsNums(pexA, pexB)) {
+      *ppexOut = MkSub(ppool, pexA, pexB);
+    }
+    break;
+
+  case EX_MUL:
+    if (IsNums(pexA, pexB)) {
+      *ppexOut = MkMul(ppool, pexA, pexB);
+    }
+    break;
+
+  case EX_DIV: /* Not by zero: that is for the run time to say */
+    if (IsNums(pexA, pexB) && pexB->dVal != 0.0) {
+      *ppexOut = MkDiv(ppool, pexA, pexB);
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  if (*ppexOut == pex && bChanged) {
+    *ppexOut = NewExpr(ppool, pex->iOp, pex->szName, pex->nArgs, rgpexArg[0], (pex->nArgs > 1 ? rgpexArg[1] : NULL),
+                       (pex->nArgs > 2 ? rgpexArg[2] : NULL));
+    if (*ppexOut && pex->nArgs > 3) {
+      (*ppexOut)->rgpexArg[3] = rgpexArg[3];
+    }
+  }
+
+  if (!*ppexOut) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "FoldExpr", NULL));
+  }
+  return 0;
+
+} /* FoldExpr */
+
+/* ----------------------------------------------------------------------------
+   HoistExpr
+
+   Replaces the largest parameter-only subexpressions of pex by EX_HOIST
+   nodes and appends them to phoist. Leaves, negated leaves and
+   expressions of C type int are left in place: there is nothing to save,
+   or their meaning could change in a double. Sets *ppexOut to pex itself
+   if nothing was hoisted; pex is not modified.
+*/
+int HoistExpr(PEXPRPOOL ppool, PEXPRHOIST phoist, PEXPR pex, PEXPR *ppexOut) {
+  PEXPR rgpexArg[EX_MAXARGS], *rgpexNew, pexNew;
+  BOOL bChanged = FALSE;
+  int i;
+
+  *ppexOut = pex;
+  if (pex->nArgs == 0 || (pex->iOp == EX_NEG && pex->rgpexArg[0]->nArgs == 0)) {
+    return 0;
+  }
+
+  if (!pex->bInt && ClassifyExpr(pex) == EC_PARM) {
+    if (phoist->nSlots == phoist->nMax) {
+      phoist->nMax = (phoist->nMax ? 2 * phoist->nMax : 16);
+      if (!(rgpexNew = (PEXPR *)realloc(phoist->rgpex, phoist->nMax * sizeof(PEXPR)))) {
+        PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "HoistExpr", NULL));
+      }
+      phoist->rgpex = rgpexNew;
+    }
+    if (!(pexNew = NewExpr(ppool, EX_HOIST, NULL, 0, NULL, NULL, NULL))) {
+      PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "HoistExpr", NULL));
+    }
+    pexNew->iSlot = phoist->nSlots;
+    phoist->rgpex[phoist->nSlots++] = pex;
+    *ppexOut = pexNew;
+    return 0;
+  }
+
+  for (i = 0; i < pex->nArgs; i++) {
+    PROPAGATE_EXIT(HoistExpr(ppool, phoist, pex->rgpexArg[i], &rgpexArg[i]));
+    bChanged = (bChanged || rgpexArg[i] != pex->rgpexArg[i]);
+  }
+
+  if (bChanged) {
+    pexNew = NewExpr(ppool, pex->iOp, pex->szName, pex->nArgs, rgpexArg[0], (pex->nArgs > 1 ? rgpexArg[1] : NULL),
+                     (pex->nArgs > 2 ? rgpexArg[2] : NULL));
+    if (!pexNew) {
+      PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "HoistExpr", NULL));
+    }
+    if (pex->nArgs > 3) {
+      pexNew->rgpexArg[3] = rgpexArg[3];
+    }
+    *ppexOut = pexNew;
+  }
+  return 0;
+
+} /* HoistExpr */
+
+/* ----------------------------------------------------------------------------
+   InitExprCse, FreeExprCse
+
+   The table of ShareExpr(), with nBuckets hash chains.
+*/
+int InitExprCse(PEXPRCSE pcse, int nBuckets) {
+  pcse->nBuckets = (nBuckets > 0 ? nBuckets : 1);
+  pcse->nTemps = 0;
+  if (!(pcse->rgpexHash = (PEXPR *)calloc(pcse->nBuckets, sizeof(PEXPR)))) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "InitExprCse", NULL));
+  }
+  return 0;
+
+} /* InitExprCse */
+
+void FreeExprCse(PEXPRCSE pcse) {
+  free(pcse->rgpexHash);
+  pcse->rgpexHash = NULL;
+  pcse->nBuckets = 0;
+
+} /* FreeExprCse */
+
+/* ----------------------------------------------------------------------------
+   HashExpr, SameExpr
+
+   Hash and equality of nodes whose children are already shared, so that
+   children compare by address. Numbers compare by bits: 0.0 and -0.0 are
+   not the same.
+*/
+static unsigned long HashExpr(PEXPR pex) {
+  unsigned long ulHash = (unsigned long)pex->iOp * 31 + (unsigned long)pex->bInt;
+  unsigned char *pb;
+  PSTR sz;
+  int i;
+
+  if (pex->iOp == EX_NUM) {
+    for (pb = (unsigned char *)&pex->dVal, i = 0; i < (int)sizeof(double); i++) {
+      ulHash = ulHash * 31 + pb[i];
+    }
+  } else if (pex->szName) {
+    for (sz = pex->szName; *sz; sz++) {
+      ulHash = ulHash * 31 + (unsigned char)*sz;
+    }
+  }
+
+  ulHash = ulHash * 31 + (unsigned long)(size_t)pex->pvm;
+  ulHash = ulHash * 31 + (unsigned long)pex->iSlot;
+  for (i = 0; i < pex->nArgs; i++) {
+    ulHash = ulHash * 31 + (unsigned long)(size_t)pex->rgpexArg[i];
+  }
+
+  return (ulHash);
+
+} /* HashExpr */
+
+static BOOL SameExpr(PEXPR pexA, PEXPR pexB) {
+  int i;
+
+  if (pexA->iOp != pexB->iOp || pexA->bInt != pexB->bInt || pexA->nArgs != pexB->nArgs || pexA->pvm != pexB->pvm ||
+      pexA->iSlot != pexB->iSlot) {
+    return (FALSE);
+  }
+  if (pexA->iOp == EX_NUM) {
+    return (!memcmp(&pexA->dVal, &pexB->dVal, sizeof(double)));
+  }
+  if ((pexA->iOp == EX_REL || pexA->iOp == EX_CALL) && strcmp(pexA->szName, pexB->szName)) {
+    return (FALSE);
+  }
+  for (i = 0; i < pexA->nArgs; i++) {
+    if (pexA->rgpexArg[i] != pexB->rgpexArg[i]) {
+      return (FALSE);
+    }
+  }
+
+  return (TRUE);
+
+} /* SameExpr */
+
+/* ----------------------------------------------------------------------------
+   ShareExpr
+
+   Returns the node of the table equal to pex, entering pex if there is
+   none, after doing the same for its children, in place. Trees shared
+   this way have one node per distinct subexpression, which
+   CountExprUses() then finds the repeated ones among.
+
+   Locals and outputs kept as variables are distinct at each assignment
+   (see NewVarExpr()), so that a value is never shared across a new
+   assignment, and calls with side effects are never shared. States are
+   shared by name: the caller must not use this on sections that assign
+   them.
+*/
+PEXPR ShareExpr(PEXPRCSE pcse, PEXPR pex) {
+  PEXPR pexH;
+  unsigned long iBucket;
+  int i;
+
+  if (pex->bShared) {
+    return (pex);
+  }
+
+  for (i = 0; i < pex->nArgs; i++) {
+    pex->rgpexArg[i] = ShareExpr(pcse, pex->rgpexArg[i]);
+  }
+  pex->bShared = TRUE;
+
+  if ((pex->iOp == EX_VAR && TYPE(pex->pvm) != ID_STATE && TYPE(pex->pvm) != ID_PARM && TYPE(pex->pvm) != ID_INPUT) ||
+      (pex->iOp == EX_CALL && !IsPureCall(pex))) {
+    return (pex);
+  }
+
+  iBucket = HashExpr(pex) % (unsigned long)pcse->nBuckets;
+  for (pexH = pcse->rgpexHash[iBucket]; pexH; pexH = pexH->pexNextHash) {
+    if (SameExpr(pexH, pex)) {
+      return (pexH);
+    }
+  }
+  pex->pexNextHash = pcse->rgpexHash[iBucket];
+  pcse->rgpexHash[iBucket] = pex;
+
+  return (pex);
+
+} /* ShareExpr */
+
+/* ----------------------------------------------------------------------------
+   CountExprUses, ResetExprUses
+
+   CountExprUses() counts in nUses the references to each node of a
+   shared tree, once per distinct parent: the children of a node used
+   twice are only computed once, in the node. The branches of ?: are not
+   counted, as they are not always evaluated. ResetExprUses() clears the
+   counts and temporaries again.
+*/
+void CountExprUses(PEXPR pex) {
+  int i, nArgs = (pex->iOp == EX_COND ? 1 : pex->nArgs);
+
+  if (pex->nUses++ > 0) {
+    return;
+  }
+  for (i = 0; i < nArgs; i++) {
+    CountExprUses(pex->rgpexArg[i]);
+  }
+
+} /* CountExprUses */
+
+void ResetExprUses(PEXPR pex) {
+  int i;
+
+  if (pex->nUses == 0 && pex->iTemp < 0) {
+    return;
+  }
+  pex->nUses = 0;
+  pex->iTemp = -1;
+  for (i = 0; i < pex->nArgs; i++) {
+    ResetExprUses(pex->rgpexArg[i]);
+  }
+
+} /* ResetExprUses */
+
+/* ----------------------------------------------------------------------------
+   CountExprNodes
+
+   Returns the size of the expression written out as a tree (shared
+   subtrees counted each time), stopping at nMax.
+*/
+long CountExprNodes(PEXPR pex, long nMax) {
+  long n = 1;
+  int i;
+
+  for (i = 0; i < pex->nArgs && n < nMax; i++) {
+    n += CountExprNodes(pex->rgpexArg[i], nMax - n);
+  }
+
+  return (n);
+
+} /* CountExprNodes */
+
+/* ----------------------------------------------------------------------------
+   WriteNumber
+
+   Writes d with the fewest digits that read back exactly, as a floating
+   point constant.
+*/
+static void WriteNumber(PFILE pfile, double d) {
+  char szNum[32];
+  int iPrec = 15;
+
+  do {
+    snprintf(szNum, sizeof(szNum), "%.*g", iPrec, d);
+  } while (strtod(szNum, NULL) != d && ++iPrec <= 17);
+
+  if (!strpbrk(szNum, ".eEn")) { /* n: inf and nan */
+    strcat(szNum, ".0");
+  }
+
+  fprintf(pfile, (d < 0 ? "(%s)" : "%s"), szNum);
+
+} /* WriteNumber */
+
+/* ----------------------------------------------------------------------------
+   WriteExpr
+
+   Writes pex as C, fully parenthesized. Numbers from the model are
+   written as they were, others by value and type. szTime is written for
+   the time variable. Subexpressions already in a temporary (see
+   WriteExprTemps()) are written as the temporary, but in a loop: there,
+   if vptrans->rglExprStride is set, the variables are stepped by their
+   strides in turn (see WriteLoopRef()).
+*/
+void WriteExpr(PFILE pfile, PEXPR pex, PSTR szTime) {
+  int i;
+  long lStride;
+
+  if (pex->iTemp >= 0 && !vptrans->rglExprStride) {
+    fprintf(pfile, "%scse%d", vptrans->szGen, pex->iTemp);
+    return;
+  }
+
+  switch (pex->iOp) {
+  case EX_NUM:
+    if (pex->szName) {
+      fprintf(pfile, (pex->szName[0] == '-' ? "(%s)" : "%s"), pex->szName);
+    } else if (pex->bInt) {
+      fprintf(pfile, (pex->dVal < 0 ? "(%.0f)" : "%.0f"), pex->dVal);
+    } else {
+      WriteNumber(pfile, pex->dVal);
+    }
+    break;
+
+  case EX_HOIST:
+    fprintf(pfile, "CTX_HOIST(%d)", pex->iSlot);
+    break;
+
+  case EX_VAR:
+    lStride = (vptrans->rglExprStride ? vptrans->rglExprStride[vptrans->iExprVar++] : 0);
+    if (lStride) {
+      WriteLoopRef(pfile, GetName(pex->pvm, NULL, NULL, ID_NULL), lStride);
+    } else {
+      fprintf(pfile, "%s", GetName(pex->pvm, NULL, NULL, ID_NULL));
+    }
+    break;
+
+  case EX_TIME:
+    fprintf(pfile, "%s", szTime);
+    break;
+
+  case EX_NEG:
+  case EX_NOT:
+    fprintf(pfile, (pex->iOp == EX_NEG ? "(-" : "(!"));
+    WriteExpr(pfile, pex->rgpexArg[0], szTime);
+    fprintf(pfile, ")");
+    break;
+
+  case EX_ADD:
+  case EX_SUB:
+  case EX_MUL:
+  case EX_DIV:
+  case EX_REL:
+    fprintf(pfile, "(");
+    WriteExpr(pfile, pex->rgpexArg[0], szTime);
+    if (pex->iOp == EX_REL) {
+      fprintf(pfile, " %s ", pex->szName);
+    } else {
+      fprintf(pfile, " %c ", "+-*/"[pex->iOp - EX_ADD]);
+    }
+    WriteExpr(pfile, pex->rgpexArg[1], szTime);
+    fprintf(pfile, ")");
+    break;
+
+  case EX_COND:
+    fprintf(pfile, "(");
+    WriteExpr(pfile, pex->rgpexArg[0], szTime);
+    fprintf(pfile, " ? ");
+    WriteExpr(pfile, pex->rgpexArg[1], szTime);
+    fprintf(pfile, " : ");
+    WriteExpr(pfile, pex->rgpexArg[2], szTime);
+    fprintf(pfile, ")");
+    break;
+
+  case EX_CALL:
+    fprintf(pfile, "%s(", pex->szName);
+    for (i = 0; i < pex->nArgs; i++) {
+      if (i) {
+        fprintf(pfile, ", ");
+      }
+      WriteExpr(pfile, pex->rgpexArg[i], szTime);
+    }
+    fprintf(pfile, ")");
+    break;
+  }
+
+} /* WriteExpr */
+
+/* ----------------------------------------------------------------------------
+   WriteExprTemps
+
+   Writes a local double for each subexpression of pex counted more than
+   once by CountExprUses() that does not have one yet, innermost first,
+   for WriteExpr() to use. Ints are left inline, like leaves and negated
+   leaves, which cost nothing to repeat.
+
+   Returns TRUE if pex uses a temporary.
+*/
+BOOL WriteExprTemps(PFILE pfile, PEXPRCSE pcse, PEXPR pex, PSTR szTime) {
+  int i, nArgs = (pex->iOp == EX_COND ? 1 : pex->nArgs);
+  BOOL bUses = FALSE;
+
+  if (pex->iTemp >= 0) {
+    return (TRUE);
+  }
+
+  for (i = 0; i < nArgs; i++) {
+    bUses = (WriteExprTemps(pfile, pcse, pex->rgpexArg[i], szTime) || bUses);
+  }
+
+  if (pex->nUses > 1 && !pex->bInt && pex->nArgs > 0 && !(pex->iOp == EX_NEG && pex->rgpexArg[0]->nArgs == 0)) {
+    fprintf(pfile, "  double %scse%d = ", vptrans->szGen, pcse->nTemps);
+    WriteExpr(pfile, pex, szTime);
+    fprintf(pfile, ";\n");
+    pex->iTemp = pcse->nTemps++;
+    return (TRUE);
+  }
+
+  return (bUses);
+
+} /* WriteExprTemps */
+
+/* End */
@@ -0,0 +1,158 @@
+/* modexpr.h
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Header file for the equation expression trees of modexpr.c
+*/
+
+#ifndef MODEXPR_H_DEFINED
+
+/* ---------------------------------------------------------------------------
+   Inclusions  */
+
+#include "arena.h"
+#include "hungtype.h"
+#include "mod.h"
+
+/* ---------------------------------------------------------------------------
+   Constants  */
+
+/* Expression node operators */
+#define EX_NUM 1  /* Number */
+#define EX_VAR 2  /* Model variable (state, parameter or input) */
+#define EX_TIME 3 /* The time variable */
+#define EX_NEG 4  /* Unary minus */
+#define EX_NOT 5  /* Logical not */
+#define EX_ADD 6
+#define EX_SUB 7
+#define EX_MUL 8
+#define EX_DIV 9
+#define EX_REL 10  /* Comparison, operator in szName */
+#define EX_COND 11 /* a ? b : c */
+#define EX_CALL 12 /* Function call, name in szName */
+#define EX_HOIST 13 /* Hoisted subexpression, slot in iSlot */
+#define EX_ID 14    /* Identifier of a syntax tree, name in szName */
+
+/* Classes of expressions, by what they vary with (see ClassifyExpr()) */
+#define EC_CONST 0
+#define EC_PARM 1  /* Parameters, and constants */
+#define EC_INPUT 2 /* Inputs or time, and the above */
+#define EC_STATE 3 /* States, or anything else read at run time */
+
+#define EX_MAXARGS 4 /* Children per node, and arguments per call */
+
+/* Returned by the parser and differentiator for unsupported constructs */
+#define EX_UNSUPPORTED 1
+
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* An expression node. Trees may share subtrees (they are DAGs after
+   substitution), so nodes are owned by an EXPRPOOL, not by their parents. */
+typedef struct tagEXPR {
+  int iOp;
+  PSTR szName;     /* Number text, comparison or function name */
+  double dVal;     /* Value of numbers */
+  BOOL bInt;       /* The C type is int, e.g. 1/2 or a < b */
+  PVMMAPSTRCT pvm; /* Variable of EX_VAR */
+  int iClass;      /* Class of EX_VAR locals and outputs */
+  int iSlot;       /* Slot of EX_HOIST */
+  int nArgs;
+  struct tagEXPR *rgpexArg[EX_MAXARGS];
+
+  BOOL bShared;                /* In the table of ShareExpr() */
+  int nUses;                   /* References counted by CountExprUses() */
+  int iTemp;                   /* Temporary holding the value, or -1 */
+  struct tagEXPR *pexNextHash; /* Chain of the table */
+
+} EXPR, *PEXPR; /* tagEXPR */
+
+typedef struct tagEXPRPOOL {
+  ARENA arena;
+  long nNodes;
+
+} EXPRPOOL, *PEXPRPOOL; /* tagEXPRPOOL */
+
+/* Binding of a Dynamics local or output to its current expression */
+typedef struct tagEXPRBIND {
+  PVMMAPSTRCT pvm;
+  PEXPR pex;
+  struct tagEXPRBIND *pebNext;
+
+} EXPRBIND, *PEXPRBIND; /* tagEXPRBIND */
+
+/* Subexpressions taken out of equations by HoistExpr(), by slot */
+typedef struct tagEXPRHOIST {
+  PEXPR *rgpex;
+  int nSlots;
+  int nMax;
+
+} EXPRHOIST, *PEXPRHOIST; /* tagEXPRHOIST */
+
+/* Table of distinct subexpressions, for common subexpression elimination */
+typedef struct tagEXPRCSE {
+  PEXPR *rgpexHash;
+  int nBuckets;
+  int nTemps; /* Temporaries written so far */
+
+} EXPRCSE, *PEXPRCSE; /* tagEXPRCSE */
+
+/* One lexeme of an equation, as NextLex() gives it */
+typedef struct tagEQNLEX {
+  int iType;
+  PSTR sz;
+  long ibEnd; /* Offset just past it in the equation */
+
+} EQNLEX, *PEQNLEX; /* tagEQNLEX */
+
+/* An equation as read once by ReadEqn(), for all the later passes */
+typedef struct tagEQN {
+  PEQNLEX rglex;
+  int nLex;
+  PEXPR pexSyntax; /* Syntax tree, NULL if it cannot be represented */
+
+} EQN, *PEQN; /* tagEQN */
+
+/* ---------------------------------------------------------------------------
+   Prototypes */
+
+void InitExprPool(PEXPRPOOL ppool);
+void FreeExprPool(PEXPRPOOL ppool);
+__attribute__((warn_unused_result)) int InitExprCse(PEXPRCSE pcse, int nBuckets);
+void FreeExprCse(PEXPRCSE pcse);
+PEXPR NewVarExpr(PEXPRPOOL ppool, PVMMAPSTRCT pvm, int iClass);
+BOOL IsZeroExpr(PEXPR pex);
+int ClassifyExpr(PEXPR pex);
+long CountExprNodes(PEXPR pex, long nMax);
+void CountExprUses(PEXPR pex);
+void ResetExprUses(PEXPR pex);
+__attribute__((warn_unused_result)) int EqnExpr(PEXPRPOOL ppool, PVMMAPSTRCT pvm, PVMMAPSTRCT pvmGlo, PEXPRBIND pebBound,
+                                                PEXPR *ppex);
+__attribute__((warn_unused_result)) int DiffExpr(PEXPRPOOL ppool, PEXPR pex, PVMMAPSTRCT pvmState, PEXPR *ppexD);
+__attribute__((warn_unused_result)) int FoldExpr(PEXPRPOOL ppool, PEXPR pex, PEXPR *ppexOut);
+__attribute__((warn_unused_result)) int GetEqn(PVMMAPSTRCT pvm, PEQN *ppeqn);
+__attribute__((warn_unused_result)) int HoistExpr(PEXPRPOOL ppool, PEXPRHOIST phoist, PEXPR pex, PEXPR *ppexOut);
+__attribute__((warn_unused_result)) int ReadEqn(PINPUTBUF pibIn, PSTR szEqn, PEQN *ppeqn);
+PEXPR ShareExpr(PEXPRCSE pcse, PEXPR pex);
+void WriteExpr(PFILE pfile, PEXPR pex, PSTR szTime);
+BOOL WriteExprTemps(PFILE pfile, PEXPRCSE pcse, PEXPR pex, PSTR szTime);
+
+#define MODEXPR_H_DEFINED
+#endif
+
+/* End */
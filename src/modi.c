@@ -31,9 +31,11 @@
 
 #include "lexerr.h"
 #include "mod.h"
+#include "modctx.h"
 #include "modd.h"
 #include "modi.h"
 #include "modiSBML.h"
+#include "strutil.h"
 
 /* Global Keyword Map Structure */
 
@@ -51,6 +53,7 @@ KM vrgkmKeywordMap[] = {
     {"Jacob", KM_JACOB, CN_GLOBAL},   /* obsolete */
     {"Events", KM_EVENTS, CN_GLOBAL}, /* for R deSolve */
     {"Roots", KM_ROOTS, CN_GLOBAL},   /* for R deSolve */
+    {"Doses", KM_DOSES, CN_GLOBAL},   /* compiled dosing schedule */
     {"CalcOutputs", KM_CALCOUTPUTS, CN_GLOBAL},
 
     /* Can be LHS only in Dynamics */
@@ -68,6 +71,17 @@ KM vrgkmKeywordMap[] = {
 
 }; /* vrgkmKeywordMap[] */
 
+/* Slots of the keywords, see WORDHASH */
+static const short vrgiKeywordSlots[64] = {
+    15, 0, 0, 0, 18, 0, 0, 0, 0, 0, 0, 0, 11, 0, 4, 14,
+    0, 0, 0, 0, 19, 0, 0, 0, 10, 0, 7, 0, 0, 0, 17, 0,
+    0, 0, 0, 0, 0, 0, 5, 1, 8, 0, 0, 0, 0, 0, 13, 0,
+    9, 0, 12, 6, 0, 16, 0, 2, 0, 0, 0, 0, 0, 0, 3, 0
+};
+
+WH_CHECK_WORDS(WH_KEYWORDS_CHECK, vrgkmKeywordMap, 19);
+static const WORDHASH vwhKeywords = {vrgkmKeywordMap, sizeof(KM), 19, 7u, 64, vrgiKeywordSlots};
+
 /* ----------------------------------------------------------------------------
    GetKeyword
 
@@ -90,15 +104,12 @@ PSTR GetKeyword(int iCode) {
    GetKeywordCode
 
    Returns the code of the szKeyword given.  If the string is not
-   a valid keyword or abbreviation, returns 0.
+   a valid keyword or abbreviation, returns 0.  The keyword is found
+   by a perfect hash, see LookupWord().
 */
 
 int GetKeywordCode(PSTR szKeyword, PINT pfContext) {
-  PKM pkm = &vrgkmKeywordMap[0];
-
-  while (*pkm->szKeyword && strcmp(szKeyword, pkm->szKeyword)) {
-    pkm++;
-  }
+  PKM pkm = &vrgkmKeywordMap[LookupWord(&vwhKeywords, szKeyword)];
 
   if (pfContext) {
     *pfContext = pkm->fContext; /* Set iContext flag */
@@ -108,6 +119,161 @@ int GetKeywordCode(PSTR szKeyword, PINT pfContext) {
 
 } /* GetKeywordCode */
 
+/* ----------------------------------------------------------------------------
+   BeginArrayEqn
+
+   Records the array statement szName[iLB to iUB - 1] about to be unrolled,
+   if in the Dynamics or CalcOutputs: the equations and locals defined
+   until parrRead is reset point to it (see AddEquation()).
+*/
+int BeginArrayEqn(PINPUTBUF pibIn, PSTR szName, long iLB, long iUB) {
+  PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
+  PARRAYEQN parr;
+
+  vptrans->parrRead = NULL;
+  if (pinfo->wContext != CN_DYNAMICS && pinfo->wContext != CN_CALCOUTPUTS) {
+    return 0;
+  }
+
+  if (!(parr = (PARRAYEQN)ModelAlloc(sizeof(ARRAYEQN)))) {
+    PROPAGATE_EXIT(ReportError(pibIn, RE_OUTOFMEM | RE_FATAL, szName, "* .. in BeginArrayEqn"));
+  }
+  memset(parr, 0, sizeof(ARRAYEQN));
+  PROPAGATE_EXIT(CopyString(szName, &parr->szName));
+  parr->iLB = iLB;
+  parr->iUB = iUB;
+  parr->wContext = pinfo->wContext;
+  parr->parrNext = vptrans->parrList;
+  vptrans->parrList = vptrans->parrRead = parr;
+  return 0;
+
+} /* BeginArrayEqn */
+
+/* ----------------------------------------------------------------------------
+   ExpandSums
+
+   Replaces each Sum(lb-ub, expression) of psbEqn, the sum of expression
+   for i from lb to ub, by the last of an array of partial sums defined
+   before the equation, in the section being read:
+
+     _sum<n>[lb] = expression;
+     _sum<n>[lb+1 - ub] = _sum<n>[i - 1] + (expression);
+
+   with the first n whose elements are not variables of the model yet,
+   so that it is unrolled and written as a loop like any array statement.
+   The brackets of expression are those of an array statement, with i
+   standing for the index of the sum. An equation without sums is left as
+   it is.
+
+   The partial sums are locals of the section, so sums are only allowed
+   in Dynamics and CalcOutputs, whose locals derivs_ctx() and outputs_ctx()
+   declare.
+*/
+int ExpandSums(PINPUTBUF pibIn, PSTRBUF psbEqn, int iKWCode) {
+  PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
+  STRBUF sbTerm, sbStep, sbOut;
+  PSTR szEqnU;
+  PSTRLEX szTmp;
+  char szName[32];
+  PSTR szEqn = psbEqn->sz, pchCopied = szEqn, pch = szEqn, pchEnd;
+  long i, iLB, iUB;
+  int iDepth;
+
+  if (!strstr(szEqn, "Sum")) {
+    return 0;
+  }
+
+  InitStrBuf(&sbTerm, psbEqn->parena);
+  InitStrBuf(&sbStep, psbEqn->parena);
+  InitStrBuf(&sbOut, psbEqn->parena);
+
+  while ((pch = strstr(pch, "Sum"))) {
+    /* Only the identifier Sum, called */
+    pchEnd = pch + 3;
+    while (isspace(*pchEnd)) {
+      pchEnd++;
+    }
+    if ((pch > szEqn && (isalnum(pch[-1]) || IsUnderscore(pch[-1]))) || *pchEnd != '(') {
+      pch += 3;
+      continue;
+    }
+
+    if (pinfo->wContext != CN_DYNAMICS && pinfo->wContext != CN_CALCOUTPUTS) {
+      PROPAGATE_EXIT(
+          ReportError(pibIn, RE_BADCONTEXT | RE_FATAL, "Sum", "Sums can only be used in Dynamics and CalcOutputs."));
+    }
+
+    /* Bounds, lb-ub, and the expression up to the closing parenthesis */
+    pchEnd++;
+    iLB = strtol(pchEnd, &pchEnd, 10);
+    while (isspace(*pchEnd)) {
+      pchEnd++;
+    }
+    iUB = (*pchEnd == '-' ? strtol(pchEnd + 1, &pchEnd, 10) : -1);
+    while (isspace(*pchEnd)) {
+      pchEnd++;
+    }
+    if (iLB < 0 || iUB < iLB || *pchEnd != ',') {
+      PROPAGATE_EXIT(ReportError(pibIn, RE_LEXEXPECTED | RE_FATAL, "Sum(lb-ub, expression), 0 <= lb <= ub", NULL));
+    }
+
+    for (i = 1, iDepth = 0; pchEnd[i] && (iDepth || pchEnd[i] != ')'); i++) {
+      iDepth += (pchEnd[i] == '(' ? 1 : (pchEnd[i] == ')' ? -1 : 0));
+    }
+    if (!pchEnd[i]) {
+      PROPAGATE_EXIT(ReportError(pibIn, RE_UNBALPAR | RE_FATAL, "Sum", NULL));
+    }
+    ClearStrBuf(&sbTerm);
+    PROPAGATE_EXIT(StrBufCat(pibIn, &sbTerm, pchEnd + 1, (size_t)i - 1));
+    pchEnd += i + 1;
+    PROPAGATE_EXIT(ExpandSums(pibIn, &sbTerm, iKWCode));
+
+    /* The partial sums, of names not taken by the model */
+    do {
+      snprintf(szName, sizeof(szName), "_sum%d", ++vptrans->nSums);
+      for (i = iLB; i <= iUB; i++) {
+        snprintf(szTmp, MAX_LEX, "%s_%ld", szName, i);
+        if (GetVarPTR(pinfo->pvmGloVars, szTmp)) {
+          break;
+        }
+      }
+    } while (i <= iUB);
+    snprintf(szTmp, MAX_LEX, "%s_%ld", szName, iLB);
+    PROPAGATE_EXIT(UnrollEquation(pibIn, iLB, sbTerm.sz, &vptrans->sbUnroll, &szEqnU));
+    PROPAGATE_EXIT(BeginArrayEqn(pibIn, szName, iLB, iLB + 1));
+    PROPAGATE_EXIT(DefineVariable(pibIn, szTmp, szEqnU, KM_NULL));
+    vptrans->parrRead = NULL;
+
+    if (iUB > iLB) {
+      ClearStrBuf(&sbStep);
+      PROPAGATE_EXIT(StrBufCatSz(pibIn, &sbStep, szName));
+      PROPAGATE_EXIT(StrBufCatSz(pibIn, &sbStep, "[i - 1] + ("));
+      PROPAGATE_EXIT(StrBufCat(pibIn, &sbStep, sbTerm.sz, sbTerm.cch));
+      PROPAGATE_EXIT(StrBufCatSz(pibIn, &sbStep, ")"));
+      PROPAGATE_EXIT(BeginArrayEqn(pibIn, szName, iLB + 1, iUB + 1));
+      for (i = iLB + 1; i <= iUB; i++) {
+        snprintf(szTmp, MAX_LEX, "%s_%ld", szName, i);
+        PROPAGATE_EXIT(UnrollEquation(pibIn, i, sbStep.sz, &vptrans->sbUnroll, &szEqnU));
+        PROPAGATE_EXIT(DefineVariable(pibIn, szTmp, szEqnU, KM_NULL));
+      }
+      vptrans->parrRead = NULL;
+    }
+
+    /* The sum is the last one */
+    snprintf(szTmp, MAX_LEX, "%s_%ld", szName, iUB);
+    PROPAGATE_EXIT(StrBufCat(pibIn, &sbOut, pchCopied, (size_t)(pch - pchCopied)));
+    PROPAGATE_EXIT(StrBufCatSz(pibIn, &sbOut, szTmp));
+    pch = pchCopied = pchEnd;
+  }
+
+  if (pchCopied != szEqn) {
+    PROPAGATE_EXIT(StrBufCatSz(pibIn, &sbOut, pchCopied));
+    *psbEqn = sbOut;
+  }
+  return 0;
+
+} /* ExpandSums */
+
 /* ----------------------------------------------------------------------------
    GetVarList
 
@@ -151,9 +317,9 @@ int GetVarList(PINPUTBUF pibIn, PSTR szLex, int iKWCode) {
    process a differential equation definition
 */
 
-int ProcessDTStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
+int ProcessDTStatement(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn, int iKWCode) {
   PSTRLEX szPunct, szTmp;
-  PSTREQN szEqnU;
+  PSTR szEqnU;
   PINPUTINFO pinfo;
   int iArgType = LX_IDENTIFIER;
   long i, iLB, iUB;
@@ -175,12 +341,15 @@ int ProcessDTStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
     }
 
     /* read assignment */
-    PROPAGATE_EXIT(GetStatement(pibIn, szEqn, iKWCode));
-    PROPAGATE_EXIT(UnrollEquation(pibIn, 0, szEqn, szEqnU));
+    PROPAGATE_EXIT(GetStatement(pibIn, psbEqn, iKWCode));
+    PROPAGATE_EXIT(ExpandSums(pibIn, psbEqn, iKWCode));
+    PROPAGATE_EXIT(UnrollEquation(pibIn, 0, psbEqn->sz, &vptrans->sbUnroll, &szEqnU));
     PROPAGATE_EXIT(DefineVariable(pibIn, szLex, szEqnU, iKWCode));
   } else { /* array */
     /* read assignment */
-    PROPAGATE_EXIT(GetStatement(pibIn, szEqn, iKWCode));
+    PROPAGATE_EXIT(GetStatement(pibIn, psbEqn, iKWCode));
+    PROPAGATE_EXIT(ExpandSums(pibIn, psbEqn, iKWCode));
+    PROPAGATE_EXIT(BeginArrayEqn(pibIn, szLex, iLB, iUB));
     for (i = iLB; i < iUB; i++) {
       snprintf(szTmp, MAX_LEX, "%s_%ld", szLex, i); /* create names */
       /* check this is a declared state */
@@ -188,9 +357,10 @@ int ProcessDTStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
         snprintf(szTmp, MAX_LEX, "%s[%ld]", szLex, i); /* recreate name */
         PROPAGATE_EXIT(ReportError(pibIn, RE_BADSTATE | RE_FATAL, szTmp, NULL));
       }
-      PROPAGATE_EXIT(UnrollEquation(pibIn, i, szEqn, szEqnU));
+      PROPAGATE_EXIT(UnrollEquation(pibIn, i, psbEqn->sz, &vptrans->sbUnroll, &szEqnU));
       PROPAGATE_EXIT(DefineVariable(pibIn, szTmp, szEqnU, iKWCode));
     }
+    vptrans->parrRead = NULL;
   }
 
   if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szLex, CH_STMTTERM))) {
@@ -204,9 +374,9 @@ int ProcessDTStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
    ProcessIdentifier
 */
 
-int ProcessIdentifier(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
+int ProcessIdentifier(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn, int iKWCode) {
   PSTRLEX szPunct, szTmp;
-  PSTREQN szEqnU;
+  PSTR szEqnU;
   PINPUTINFO pinfo;
   long i, iLB, iUB;
 
@@ -219,8 +389,9 @@ int ProcessIdentifier(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
 
   if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, '['))) { /* scalar */
     if (szPunct[0] == '=') {                                             /* read assignment */
-      PROPAGATE_EXIT(GetStatement(pibIn, szEqn, iKWCode));
-      PROPAGATE_EXIT(UnrollEquation(pibIn, 0, szEqn, szEqnU));
+      PROPAGATE_EXIT(GetStatement(pibIn, psbEqn, iKWCode));
+      PROPAGATE_EXIT(ExpandSums(pibIn, psbEqn, iKWCode));
+      PROPAGATE_EXIT(UnrollEquation(pibIn, 0, psbEqn->sz, &vptrans->sbUnroll, &szEqnU));
       PROPAGATE_EXIT(DefineVariable(pibIn, szLex, szEqnU, iKWCode));
       if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szLex, CH_STMTTERM))) {
         PROPAGATE_EXIT(ReportError(pibIn, RE_EXPECTED | RE_FATAL, ";", NULL));
@@ -240,12 +411,15 @@ int ProcessIdentifier(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
   else { /* array */
     PROPAGATE_EXIT(GetArrayBounds(pibIn, &iLB, &iUB));
     if (PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, '='))) { /* read assignment */
-      PROPAGATE_EXIT(GetStatement(pibIn, szEqn, iKWCode));
+      PROPAGATE_EXIT(GetStatement(pibIn, psbEqn, iKWCode));
+      PROPAGATE_EXIT(ExpandSums(pibIn, psbEqn, iKWCode));
+      PROPAGATE_EXIT(BeginArrayEqn(pibIn, szLex, iLB, iUB));
       for (i = iLB; i < iUB; i++) {
         snprintf(szTmp, MAX_LEX, "%s_%ld", szLex, i); /* create names */
-        PROPAGATE_EXIT(UnrollEquation(pibIn, i, szEqn, szEqnU));
+        PROPAGATE_EXIT(UnrollEquation(pibIn, i, psbEqn->sz, &vptrans->sbUnroll, &szEqnU));
         PROPAGATE_EXIT(DefineVariable(pibIn, szTmp, szEqnU, iKWCode));
       }
+      vptrans->parrRead = NULL;
       if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szLex, CH_STMTTERM))) {
         PROPAGATE_EXIT(ReportError(pibIn, RE_EXPECTED | RE_FATAL, ";", NULL));
       }
@@ -269,12 +443,14 @@ int ProcessIdentifier(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
    ProcessInlineStatement
 */
 
-int ProcessInlineStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode) {
-  PROPAGATE_EXIT(GetStatement(pibIn, szEqn, iKWCode));
+int ProcessInlineStatement(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn, int iKWCode) {
+  PSTR szEqn;
+
+  PROPAGATE_EXIT(GetStatement(pibIn, psbEqn, iKWCode));
   /* remove leading parenthesis */
-  szEqn = szEqn + 1;
+  szEqn = psbEqn->sz + 1;
   /* remove ending parenthesis */
-  szEqn[strlen(szEqn) - 1] = '\0';
+  szEqn[psbEqn->cch - 2] = '\0';
   PROPAGATE_EXIT(DefineVariable(pibIn, szLex, szEqn, iKWCode));
 
   if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szLex, CH_STMTTERM))) {
@@ -289,28 +465,13 @@ int ProcessInlineStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode)
    Processes the word szLex.
 */
 
-int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
+int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn) {
   int iErr = 0;
   int iKWCode, fContext;
   PSTRLEX szPunct;
   PINPUTINFO pinfo;
 
-  static BOOL bCalcOutputsDefined = FALSE;
-  static BOOL bDynamicsDefined = FALSE;
-  static BOOL bInitializeDefined = FALSE;
-  static BOOL bJacobianDefined = FALSE;
-
-  // need to clear state when we are handling a new model in ".so" mode
-  // as the 'static' variables are not reset from model to model
-  if (!pibIn) {
-    bCalcOutputsDefined = FALSE;
-    bDynamicsDefined = FALSE;
-    bInitializeDefined = FALSE;
-    bJacobianDefined = FALSE;
-    return 0;
-  }
-
-  if (!pibIn || !szLex || !szLex[0] || !szEqn) {
+  if (!pibIn || !szLex || !szLex[0] || !psbEqn) {
     return 0;
   }
 
@@ -348,10 +509,10 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
       break;
 
     case KM_CALCOUTPUTS:
-      if (bCalcOutputsDefined) {
+      if (vptrans->bCalcOutputsDefined) {
         PROPAGATE_EXIT(ReportError(pibIn, RE_DUPSECT | RE_FATAL, "CalcOutputs", NULL));
       }
-      bCalcOutputsDefined = TRUE;
+      vptrans->bCalcOutputsDefined = TRUE;
       if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_LBRACE))) {
         szPunct[1] = CH_LBRACE;
         PROPAGATE_EXIT(
@@ -362,10 +523,10 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
       break;
 
     case KM_JACOB:
-      if (bJacobianDefined) {
+      if (vptrans->bJacobianDefined) {
         PROPAGATE_EXIT(ReportError(pibIn, RE_DUPSECT | RE_FATAL, "Jacobian", NULL));
       }
-      bJacobianDefined = TRUE;
+      vptrans->bJacobianDefined = TRUE;
       if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_LBRACE))) {
         szPunct[1] = CH_LBRACE;
         PROPAGATE_EXIT(
@@ -376,10 +537,10 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
       break;
 
     case KM_SCALE:
-      if (bInitializeDefined) {
+      if (vptrans->bInitializeDefined) {
         PROPAGATE_EXIT(ReportError(pibIn, RE_DUPSECT | RE_FATAL, "Initialize", NULL));
       }
-      bInitializeDefined = TRUE;
+      vptrans->bInitializeDefined = TRUE;
       if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_LBRACE))) {
         szPunct[1] = CH_LBRACE;
         PROPAGATE_EXIT(
@@ -391,6 +552,7 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
 
     case KM_EVENTS:
     case KM_ROOTS:
+    case KM_DOSES:
       if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_LBRACE))) {
         szPunct[1] = CH_LBRACE;
         PROPAGATE_EXIT(
@@ -401,10 +563,10 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
       break;
 
     case KM_DYNAMICS:
-      if (bDynamicsDefined) {
+      if (vptrans->bDynamicsDefined) {
         PROPAGATE_EXIT(ReportError(pibIn, RE_DUPSECT | RE_FATAL, "Dynamics", NULL));
       }
-      bDynamicsDefined = TRUE;
+      vptrans->bDynamicsDefined = TRUE;
 
       if (!PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_LBRACE))) {
         szPunct[1] = CH_LBRACE;
@@ -416,11 +578,11 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
       break;
 
     case KM_DXDT: /* State equation definition */
-      PROPAGATE_EXIT(ProcessDTStatement(pibIn, szLex, szEqn, iKWCode));
+      PROPAGATE_EXIT(ProcessDTStatement(pibIn, szLex, psbEqn, iKWCode));
       break;
 
     case KM_INLINE: /* Inline statement definition */
-      PROPAGATE_EXIT(ProcessInlineStatement(pibIn, szLex, szEqn, iKWCode));
+      PROPAGATE_EXIT(ProcessInlineStatement(pibIn, szLex, psbEqn, iKWCode));
       break;
 
     case KM_SBMLMODELS:
@@ -438,7 +600,7 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
     case KM_PKTEMPLATE:
       if (PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, '='))) {
         if (PROPAGATE_EXIT_OR_RETURN_RESULT(GetPunct(pibIn, szPunct, CH_LBRACE))) {
-          Rprintf("\nreading pharmacokinetic template ");
+          ConsolePrintf("\nreading pharmacokinetic template ");
           PROPAGATE_EXIT(ReadPKTemplate(pibIn));
         } else {
           PROPAGATE_EXIT(ReportError(pibIn, RE_EXPECTED | RE_FATAL, "{", NULL));
@@ -449,7 +611,7 @@ int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn) {
       break;
 
     default: /* Not a keyword, process identifier */
-      PROPAGATE_EXIT(ProcessIdentifier(pibIn, szLex, szEqn, iKWCode));
+      PROPAGATE_EXIT(ProcessIdentifier(pibIn, szLex, psbEqn, iKWCode));
       break;
 
     } /* switch */
@@ -474,19 +636,14 @@ int FindEnd(PBUF pBuf, long N) {
 
   c = pBuf;
   end = pBuf + N;
-  while (c < end) {
-    if (*c == CH_EOLN) { /* eat up leading white space */
+  while (c < end && (c = (char *)memchr(c, CH_EOLN, end - c))) {
+    c++; /* eat up leading white space */
+    while ((c < end) && (isspace(*c))) {
       c++;
-      while ((c < end) && (isspace(*c))) {
-        c++;
-      }
-      if (c < end) {
-        if (((c + 2) < end) && (*c == 'E') && (*(c + 1) == 'n') && (*(c + 2) == 'd')) {
-          return (1);
-        }
-      }
     }
-    c++;
+    if (((c + 2) < end) && (*c == 'E') && (*(c + 1) == 'n') && (*(c + 2) == 'd')) {
+      return (1);
+    }
   }
 
   /* not found */
@@ -510,36 +667,67 @@ void ReadModelCleanup(PINPUTBUF pibIn) {
 int ReadModel(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PSTR szFileIn) {
   INPUTBUF ibIn;
   InitINPUTBUF(&ibIn);
-  PSTRLEX szLex; /* Lex elem of MAX_LEX length */
-  PSTREQN szEqn; /* Equation buffer of MAX_EQN length */
-  int iLexType;
-
-  // need to clear state when we are handling a new model in ".so" mode
-  // as the 'static' variables are not reset from model to model
-  PROPAGATE_EXIT(ProcessWord(NULL, 0, 0));
 
   if (!PROPAGATE_EXIT_OR_RETURN_RESULT(InitBuffer(&ibIn, -1, szFileIn))) {
     PROPAGATE_EXIT(ReportError(&ibIn, RE_INIT | RE_FATAL, "ReadModel", NULL));
   }
 
+  return ReadModelBuffer(pinfo, ptempinfo, &ibIn, szFileIn);
+
+} /* ReadModel */
+
+/* ----------------------------------------------------------------------------
+   ReadModelText
+
+   Same as ReadModel(), from the model definition in the string szText.
+   szName stands for the file in messages.
+*/
+
+int ReadModelText(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PSTR szText, PSTR szName) {
+  INPUTBUF ibIn;
+  InitINPUTBUF(&ibIn);
+
+  if (!PROPAGATE_EXIT_OR_RETURN_RESULT(InitStringBuffer(&ibIn, szText))) {
+    PROPAGATE_EXIT(ReportError(&ibIn, RE_INIT | RE_FATAL, "ReadModelText", NULL));
+  }
+
+  return ReadModelBuffer(pinfo, ptempinfo, &ibIn, szName);
+
+} /* ReadModelText */
+
+/* ----------------------------------------------------------------------------
+   ReadModelBuffer
+
+   Parses the model definition held in the initialized buffer pibIn,
+   and frees the buffer.
+*/
+
+int ReadModelBuffer(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PINPUTBUF pibIn, PSTR szFileIn) {
+  PSTRLEX szLex; /* Lex elem of MAX_LEX length */
+  STRBUF sbEqn;  /* Statement being read, reused */
+  int iLexType;
+
+  CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(pibIn), IndexGlobalVars(&pinfo->pvmGloVars));
+  InitStrBuf(&sbEqn, &vptrans->arenaModel);
+
   /* Attach info records to input buffer */
-  ibIn.pInfo = (PVOID)pinfo;
-  ibIn.pTempInfo = (PVOID)ptempinfo;
+  pibIn->pInfo = (PVOID)pinfo;
+  pibIn->pTempInfo = (PVOID)ptempinfo;
 
   /* immediately check whether a valid End is found */
-  if (FindEnd(ibIn.pbufOrg, ibIn.lBufSize) == 0) {
-    CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(&ibIn), ReportError(NULL, RE_NOEND | RE_FATAL, szFileIn, NULL));
+  if (FindEnd(pibIn->pbufOrg, pibIn->lBufSize) == 0) {
+    CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(pibIn), ReportError(NULL, RE_NOEND | RE_FATAL, szFileIn, NULL));
   }
 
   do { /* State machine for parsing syntax */
-    CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(&ibIn), NextLex(&ibIn, szLex, &iLexType));
+    CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(pibIn), NextLex(pibIn, szLex, &iLexType));
     switch (iLexType) {
     case LX_NULL:
       pinfo->wContext = CN_END;
       break;
 
     case LX_IDENTIFIER:
-      CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(&ibIn), ProcessWord(&ibIn, szLex, szEqn));
+      CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(pibIn), ProcessWord(pibIn, szLex, &sbEqn));
       break;
 
     case LX_PUNCT:
@@ -547,12 +735,12 @@ int ReadModel(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PSTR szFileIn) {
       if (szLex[0] == CH_STMTTERM) {
         break;
       } else {
-        if (szLex[0] == CH_RBRACE && (pinfo->wContext & (CN_DYNAMICS | CN_JACOB | CN_SCALE))) {
+        if (szLex[0] == CH_RBRACE && (pinfo->wContext & (CN_DYNAMICS | CN_JACOB | CN_SCALE | CN_DOSES))) {
           pinfo->wContext = CN_GLOBAL;
           break;
         } else {
           if (szLex[0] == CH_COMMENT) {
-            CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(&ibIn), SkipComment(&ibIn));
+            CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(pibIn), SkipComment(pibIn));
             break;
           }
           /* else: fall through! */
@@ -560,12 +748,12 @@ int ReadModel(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PSTR szFileIn) {
       }
 
     default:
-      CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(&ibIn), ReportError(&ibIn, RE_UNEXPECTED, szLex, "* Ignoring"));
+      CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(pibIn), ReportError(pibIn, RE_UNEXPECTED, szLex, "* Ignoring"));
       break;
 
     case LX_INTEGER:
     case LX_FLOAT:
-      CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(&ibIn), ReportError(&ibIn, RE_UNEXPNUMBER, szLex, "* Ignoring"));
+      CLEANUP_AND_PROPAGATE_EXIT(ReadModelCleanup(pibIn), ReportError(pibIn, RE_UNEXPNUMBER, szLex, "* Ignoring"));
       break;
 
     } /* switch */
@@ -574,9 +762,9 @@ int ReadModel(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PSTR szFileIn) {
 
   pinfo->wContext = CN_END;
 
-  if (ibIn.pbufOrg) {
-    free(ibIn.pbufOrg);
+  if (pibIn->pbufOrg) {
+    free(pibIn->pbufOrg);
   }
   return 0;
 
-} /* ReadModel */
+} /* ReadModelBuffer */
@@ -34,14 +34,20 @@ typedef struct tagKM {
 /* ---------------------------------------------------------------------------
    Public Prototypes */
 
+__attribute__((warn_unused_result)) int BeginArrayEqn(PINPUTBUF pibIn, PSTR szName, long iLB, long iUB);
+__attribute__((warn_unused_result)) int ExpandSums(PINPUTBUF pibIn, PSTRBUF psbEqn, int iKWCode);
 int GetKeywordCode(PSTR szKeyword, PINT pfContext);
 PSTR GetKeyword(int iCode);
 __attribute__((warn_unused_result)) int GetVarList(PINPUTBUF pibIn, PSTR szLex, int iKWCode);
-__attribute__((warn_unused_result)) int ProcessDTStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode);
-__attribute__((warn_unused_result)) int ProcessIdentifier(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode);
-__attribute__((warn_unused_result)) int ProcessInlineStatement(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn, int iKWCode);
-__attribute__((warn_unused_result)) int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTR szEqn);
+__attribute__((warn_unused_result)) int ProcessDTStatement(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn, int iKWCode);
+__attribute__((warn_unused_result)) int ProcessIdentifier(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn, int iKWCode);
+__attribute__((warn_unused_result)) int ProcessInlineStatement(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn, int iKWCode);
+__attribute__((warn_unused_result)) int ProcessWord(PINPUTBUF pibIn, PSTR szLex, PSTRBUF psbEqn);
 __attribute__((warn_unused_result)) int ReadModel(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PSTR szFileIn);
+__attribute__((warn_unused_result)) int ReadModelBuffer(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PINPUTBUF pibIn,
+                                                        PSTR szFileIn);
+__attribute__((warn_unused_result)) int ReadModelText(PINPUTINFO pinfo, PINPUTINFO ptempinfo, PSTR szText,
+                                                      PSTR szName);
 
 #define MODI_H_DEFINED
 #endif
@@ -39,6 +39,7 @@
 
 #include "lexerr.h"
 #include "mod.h"
+#include "modctx.h"
 #include "modd.h"
 #include "modi.h"
 #include "modiSBML.h"
@@ -168,7 +169,7 @@ __attribute__((warn_unused_result)) int AugmentEquation(PVMMAPSTRCT pvm, PSTR sz
   }
 
   int buf_len = strlen(pvm->szEqn) + strlen(szSymbol) + strlen(szStoi) + strlen(szEqn) + 5;
-  if ((szBuf = (PSTR)malloc(buf_len))) {
+  if ((szBuf = (PSTR)ModelAlloc(buf_len))) {
     if (!strcmp(szStoi, "1")) {
       snprintf(szBuf, buf_len, "%s%s%s", pvm->szEqn, szSymbol, szEqn);
     } else {
@@ -178,11 +179,8 @@ __attribute__((warn_unused_result)) int AugmentEquation(PVMMAPSTRCT pvm, PSTR sz
     PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, szEqn, "* .. defining equation in AugmentEquation"));
   }
 
-  if (pvm->szEqn) {
-    free(pvm->szEqn);
-  }
-
-  pvm->szEqn = szBuf;
+  pvm->szEqn = szBuf; /* The old one stays in the model arena */
+  pvm->peqn = NULL;   /* Read again when used, see GetEqn() */
   return 0;
 } /* AugmentEquation */
 
@@ -219,15 +217,15 @@ __attribute__((warn_unused_result)) int ConstructEqn(PINPUTBUF pibIn, PSTR szRNa
   } else {
     snprintf(szStoichio, MAX_LEX, "1");
   }
-  Rprintf("%s stoichio: %s\n", szSName, szStoichio);
+  ConsolePrintf("%s stoichio: %s\n", szSName, szStoichio);
 
   /* reactions are supposed to happen in the one compartment defined:
      pad species name with that compartment name */
   if (!GetVarPTR(pinfo->pvmGloVars, szSName)) {
     int len = strlen(szSName) + strlen(pinfo->pvmLocalCpts->szName) + 1 + 1 + 1;
     if (len > MAX_LEX) {
-      Rprintf("\n***Error: max string length MAX_LEX exceeded in: %s_%s\n", szSName, pinfo->pvmLocalCpts->szName);
-      Rprintf("Exiting...\n\n");
+      ConsolePrintf("\n***Error: max string length MAX_LEX exceeded in: %s_%s\n", szSName, pinfo->pvmLocalCpts->szName);
+      ConsolePrintf("Exiting...\n\n");
       return EXIT_ERROR;
     }
     if (snprintf(szSNameSwap, len, "%s_%s", szSName, pinfo->pvmLocalCpts->szName) <
@@ -258,45 +256,6 @@ __attribute__((warn_unused_result)) int ConstructEqn(PINPUTBUF pibIn, PSTR szRNa
   return 0;
 } /* ConstructEqn */
 
-/* ----------------------------------------------------------------------------
-   CountLines
-
-   Count the actual lines of a stream (which must be already open) and reset
-   the stream.
-*/
-long CountLines(PFILE pFileIn) {
-  int nLines = 0;
-  char szDummy[2];
-
-  /* skip the first line of comments in pFileIn */
-  if (fscanf(pFileIn, "%*[^\n]") < 0) {
-    Rprintf("Error Counting Lines.Exiting...\n\n");
-    return EXIT_ERROR;
-  }
-  getc(pFileIn);
-
-  /* keep reading lines as long as we have not reached eof */
-  while (!(feof(pFileIn))) {
-    int ret = fscanf(pFileIn, "%1s", szDummy);
-    if (ret > 0) {
-      nLines++;
-    } else if (ret < 0) {
-      Rprintf("Error Counting Lines.Exiting...\n\n");
-      return EXIT_ERROR;
-    }
-    if (fscanf(pFileIn, "%*[^\n]") < 0) {
-      Rprintf("Error Counting Lines.Exiting...\n\n");
-      return EXIT_ERROR;
-    };
-    getc(pFileIn); /* throw away rest of line */
-  }
-
-  rewind(pFileIn);
-
-  return (nLines);
-
-} /* CountLines */
-
 /* ----------------------------------------------------------------------------
    GetSBMLKeywordCode
 
@@ -390,7 +349,7 @@ __attribute__((warn_unused_result)) int SetVar(PINPUTBUF pibIn, PSTR szName, PST
         (hType == (ID_LOCALSCALE | ID_SPACEFLAG))) {
       PROPAGATE_EXIT(AddEquation(&pinfo->pvmGloVars, szName, szVal, hType));
       if (hType == ID_PARM) {
-        Rprintf("param.   %s = %s\n", szName, szVal);
+        ConsolePrintf("param.   %s = %s\n", szName, szVal);
       }
     } else {
       PROPAGATE_EXIT(DeclareModelVar(pibIn, szName, iKWCode));
@@ -400,15 +359,15 @@ __attribute__((warn_unused_result)) int SetVar(PINPUTBUF pibIn, PSTR szName, PST
       PROPAGATE_EXIT(DefineGlobalVar(pibIn, pvm, szName, szVal, hType));
 
       if (hType == ID_STATE) {
-        Rprintf("species  %s = %s\n", szName, szVal);
+        ConsolePrintf("species  %s = %s\n", szName, szVal);
       }
 
       if (hType == ID_INPUT) {
-        Rprintf("input    %s = %s\n", szName, szVal);
+        ConsolePrintf("input    %s = %s\n", szName, szVal);
       }
 
       if (hType == ID_OUTPUT) {
-        Rprintf("output   %s = %s\n", szName, szVal);
+        ConsolePrintf("output   %s = %s\n", szName, szVal);
       }
     }
   }
@@ -459,8 +418,7 @@ __attribute__((warn_unused_result)) int Create1Var(PFILE pfile, PVMMAPSTRCT pvm,
 __attribute__((warn_unused_result)) int Transcribe1AlgEqn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
   PFORSV pV = (PFORSV)pInfo;
   PSTRLEX szTmpName = "";
-  PSTREQN szTmpEq = "";
-  PSTREQN szTmpEqSwap = "";
+  STRBUF sbTmpEq;
   INPUTBUF ibDummy;
   InitINPUTBUF(&ibDummy);
   PSTRLEX szLex;
@@ -474,6 +432,7 @@ __attribute__((warn_unused_result)) int Transcribe1AlgEqn(PFILE pfile, PVMMAPSTR
   }
 
   /* deal with the equation */
+  InitStrBuf(&sbTmpEq, &vptrans->arenaModel);
   MakeStringBuffer(NULL, &ibDummy, pvm->szEqn);
 
   while (!EOB(&ibDummy)) {
@@ -481,44 +440,20 @@ __attribute__((warn_unused_result)) int Transcribe1AlgEqn(PFILE pfile, PVMMAPSTR
     PROPAGATE_EXIT(NextLex(&ibDummy, szLex, &iType)); /* ...all errors reported */
 
     if ((iType == LX_IDENTIFIER) && !(IsMathFunc(szLex)) && (szLex[0] == '_')) {
-      int len = strlen(szTmpEq) + strlen(pV->szName) + strlen(szLex) + 1;
-      if (len > MAX_EQN) {
-        Rprintf("\n***Error: max string length MAX_EQN exceeded in "
-                "Transcribe1AlgEqn: %s%s%s\n",
-                szTmpEq, pV->szName, szLex);
-        Rprintf("Exiting...\n\n");
-        return EXIT_ERROR;
-      }
-      // because of the check above we ensure we will be under MAX_EQN 
-      // so the following operations will always emit non negative values
-      strncat(szTmpEq, pV->szName, MAX_EQN - strlen(szTmpEq) - 1);
-      strncat(szTmpEq, szLex, MAX_EQN - strlen(szTmpEq) - 1);
-    } else {
-      int len = strlen(szTmpEq) + 1 + strlen(szLex) + 1;
-      if (len > MAX_EQN) {
-        Rprintf("\n***Error: max string length MAX_EQN exceeded in "
-                "Transcribe1AlgEqn: %s%s\n",
-                szTmpEq, szLex);
-        Rprintf("Exiting...\n\n");
-        return EXIT_ERROR;
-      }
-      if (snprintf(szTmpEqSwap, len, "%s%s", szTmpEq, szLex) <
-          0) { // truncated--should never happen with the above check.
-        return EXIT_ERROR;
-      }
-      strncpy(szTmpEq, szTmpEqSwap, len);
+      PROPAGATE_EXIT(StrBufCatSz(pV->pibIn, &sbTmpEq, pV->szName));
     }
+    PROPAGATE_EXIT(StrBufCatSz(pV->pibIn, &sbTmpEq, szLex));
 
   } /* while */
 
   if (!(GetVarPTR(pV->pTarget, szTmpName))) { /* New id */
     if (pvm->hType < ID_DERIV) {
-      PROPAGATE_EXIT(DefineVariable(pV->pibIn, szTmpName, szTmpEq, KM_NULL));
-      Rprintf("local v. %s = %s\n", szTmpName, szTmpEq);
+      PROPAGATE_EXIT(DefineVariable(pV->pibIn, szTmpName, sbTmpEq.sz, KM_NULL));
+      ConsolePrintf("local v. %s = %s\n", szTmpName, sbTmpEq.sz);
     } else {
       if (pvm->hType == ID_INLINE) {
-        PROPAGATE_EXIT(DefineVariable(pV->pibIn, szTmpName, szTmpEq, KM_INLINE));
-        Rprintf("inline   %s\n", szTmpEq);
+        PROPAGATE_EXIT(DefineVariable(pV->pibIn, szTmpName, sbTmpEq.sz, KM_INLINE));
+        ConsolePrintf("inline   %s\n", sbTmpEq.sz);
       }
     }
   }
@@ -543,8 +478,7 @@ __attribute__((warn_unused_result)) int Transcribe1AlgEqn(PFILE pfile, PVMMAPSTR
 __attribute__((warn_unused_result)) int Transcribe1DiffEqn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
   PFORSV pV = (PFORSV)pInfo;
   PSTRLEX szTmpName = "";
-  PSTREQN szTmpEq = "";
-  PSTREQN szTmpEqSwap = "";
+  STRBUF sbTmpEq;
   INPUTBUF ibDummy;
   InitINPUTBUF(&ibDummy);
   PSTRLEX szLex;
@@ -562,6 +496,7 @@ __attribute__((warn_unused_result)) int Transcribe1DiffEqn(PFILE pfile, PVMMAPST
   }
 
   /* deal with the equation */
+  InitStrBuf(&sbTmpEq, &vptrans->arenaModel);
   MakeStringBuffer(NULL, &ibDummy, pvm->szEqn);
 
   while (!EOB(&ibDummy)) {
@@ -569,40 +504,15 @@ __attribute__((warn_unused_result)) int Transcribe1DiffEqn(PFILE pfile, PVMMAPST
     PROPAGATE_EXIT(NextLex(&ibDummy, szLex, &iType)); /* ...all errors reported */
 
     if ((iType == LX_IDENTIFIER) && !(IsMathFunc(szLex)) && (szLex[0] == '_')) {
-      int len = strlen(szTmpEq) + strlen(pV->szName) + strlen(szLex) + 1;
-      if (len > MAX_EQN) {
-        Rprintf("\n***Error: max string length MAX_EQN exceeded in "
-                "Transcribe1DiffEqn: %s%s%s\n",
-                szTmpEq, pV->szName, szLex);
-        Rprintf("Exiting...\n\n");
-        return EXIT_ERROR;
-      }
-      // because of the check above we ensure we will be under MAX_EQN 
-      // so the following operations will always emit non negative values
-      strncat(szTmpEq, pV->szName, MAX_EQN - strlen(szTmpEq) - 1);
-      strncat(szTmpEq, szLex, MAX_EQN - strlen(szTmpEq) - 1);
-
-    } else {
-      int len = strlen(szTmpEq) + 1 + strlen(szLex) + 1;
-      if (len > MAX_EQN) {
-        Rprintf("\n***Error: max string length MAX_EQN exceeded in "
-                "Transcribe1DiffEqn: %s%s\n",
-                szTmpEq, szLex);
-        Rprintf("Exiting...\n\n");
-        return EXIT_ERROR;
-      }
-      if (snprintf(szTmpEqSwap, len, "%s%s", szTmpEq, szLex) <
-          0) { // truncated--should never happen with the above check.
-        return EXIT_ERROR;
-      }
-      strncpy(szTmpEq, szTmpEqSwap, len);
+      PROPAGATE_EXIT(StrBufCatSz(pV->pibIn, &sbTmpEq, pV->szName));
     }
+    PROPAGATE_EXIT(StrBufCatSz(pV->pibIn, &sbTmpEq, szLex));
 
   } /* while */
 
   if (!(GetVarPTR(pV->pTarget, szTmpName))) { /* New id */
-    PROPAGATE_EXIT(DefineVariable(pV->pibIn, szTmpName, szTmpEq, KM_DXDT));
-    Rprintf("template ODE term for %s = %s\n", szTmpName, szTmpEq);
+    PROPAGATE_EXIT(DefineVariable(pV->pibIn, szTmpName, sbTmpEq.sz, KM_DXDT));
+    ConsolePrintf("template ODE term for %s = %s\n", szTmpName, sbTmpEq.sz);
   }
 
   return (1);
@@ -618,7 +528,7 @@ __attribute__((warn_unused_result)) int Transcribe1DiffEqn(PFILE pfile, PVMMAPST
 */
 __attribute__((warn_unused_result)) int ReadCpt(PINPUTBUF pibIn, BOOL bTell) {
   PSTRLEX szName;
-  PSTREQN szEqn;
+  PSTRLEX szEqn;
   int iLexType;
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
@@ -643,14 +553,14 @@ __attribute__((warn_unused_result)) int ReadCpt(PINPUTBUF pibIn, BOOL bTell) {
 
     GetNumber(pibIn, szEqn, &iLexType);
     if (!iLexType) { /* no value, assign 0 by default */
-      snprintf(szEqn, MAX_EQN, "0.0");
+      snprintf(szEqn, MAX_LEX, "0.0");
     }
 
     /* link value to symbol */
     PROPAGATE_EXIT(AddEquation(&pinfo->pvmLocalCpts, szName, szEqn, ID_COMPARTMENT));
 
     if (bTell) {
-      Rprintf("compart. %s = %s\n", szName, szEqn);
+      ConsolePrintf("compart. %s = %s\n", szName, szEqn);
     }
 
   } /* end if */
@@ -684,7 +594,7 @@ __attribute__((warn_unused_result)) int ReadCpts(PINPUTBUF pibIn, BOOL bTell) {
 */
 __attribute__((warn_unused_result)) int ReadFunction(PINPUTBUF pibIn) {
   PSTRLEX szRName;
-  PSTREQN szEqn;
+  STRBUF sbEqn;
   int bInited = FALSE;
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
@@ -705,12 +615,13 @@ __attribute__((warn_unused_result)) int ReadFunction(PINPUTBUF pibIn) {
   /* get an "apply" tag */
   GetSBMLLex(pibIn, KM_SBML, KM_APPLY);
 
-  PROPAGATE_EXIT(ReadApply(pibIn, &bInited, szEqn));
+  InitStrBuf(&sbEqn, &vptrans->arenaModel);
+  PROPAGATE_EXIT(ReadApply(pibIn, &bInited, &sbEqn));
 
-  Rprintf("rate for %s = %s\n", szRName, szEqn);
+  ConsolePrintf("rate for %s = %s\n", szRName, sbEqn.sz);
 
   /* define reaction name as Derivative spec in the Dynamics section */
-  PROPAGATE_EXIT(DefineVariable(pibIn, szRName, szEqn, KM_DXDT));
+  PROPAGATE_EXIT(DefineVariable(pibIn, szRName, sbEqn.sz, KM_DXDT));
 
   while (*pibIn->pbufCur++ != '>')
     ; /* go to end of tag */
@@ -725,7 +636,7 @@ __attribute__((warn_unused_result)) int ReadFunction(PINPUTBUF pibIn) {
 __attribute__((warn_unused_result)) int ReadFunctions(PINPUTBUF pibIn, int iSBML_level) {
 
   if (iSBML_level == 1) {
-    Rprintf("mod: ignoring function definitions in level 1...\n");
+    ConsolePrintf("mod: ignoring function definitions in level 1...\n");
   } else {
     while (GetSBMLLex(pibIn, KM_FUNCLIST, KM_FUNC)) {
       PROPAGATE_EXIT(ReadFunction(pibIn));
@@ -786,7 +697,7 @@ __attribute__((warn_unused_result)) int ReadDifferentials(PINPUTBUF pibIn) {
 */
 __attribute__((warn_unused_result)) int ReadParameter(PINPUTBUF pibIn) {
   PSTRLEX szName;
-  PSTREQN szEqn;
+  PSTRLEX szEqn;
   int iLexType;
   PVMMAPSTRCT pvm = NULL;
   HANDLE hType;
@@ -807,19 +718,19 @@ __attribute__((warn_unused_result)) int ReadParameter(PINPUTBUF pibIn) {
 
     GetNumber(pibIn, szEqn, &iLexType);
     if (!iLexType) { /* no value, assign 0 by default */
-      snprintf(szEqn, MAX_EQN, "0.0");
+      snprintf(szEqn, MAX_LEX, "0.0");
     }
 
     /* link value to symbol */
     PROPAGATE_EXIT(DefineGlobalVar(pibIn, pvm, szName, szEqn, hType));
 
-    Rprintf("param.   %s = %s\n", szName, szEqn);
+    ConsolePrintf("param.   %s = %s\n", szName, szEqn);
 
   } /* end if */
 
   else { /* the parameter was already defined, this is confusing, exit */
-    Rprintf("***Error: redeclaration of parameter %s\n", szName);
-    Rprintf("Exiting...\n\n");
+    ConsolePrintf("***Error: redeclaration of parameter %s\n", szName);
+    ConsolePrintf("Exiting...\n\n");
     return EXIT_ERROR;
   }
 
@@ -848,7 +759,7 @@ __attribute__((warn_unused_result)) int ReadParameters(PINPUTBUF pibIn) {
 */
 __attribute__((warn_unused_result)) int ReadReaction_L1(PINPUTBUF pibIn) {
   PSTRLEX szRName;
-  PSTREQN szEqn;
+  PSTRLEX szEqn;
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
   /* set context to Dynamics section */
@@ -874,7 +785,7 @@ __attribute__((warn_unused_result)) int ReadReaction_L1(PINPUTBUF pibIn) {
 
   PROPAGATE_EXIT(GetaString(pibIn, szEqn));
 
-  Rprintf("reaction %s = %s\n", szRName, szEqn);
+  ConsolePrintf("reaction %s = %s\n", szRName, szEqn);
 
   /* define reaction name as a local variable in the Dynamics section */
   PROPAGATE_EXIT(DefineVariable(pibIn, szRName, szEqn, 0));
@@ -913,7 +824,7 @@ __attribute__((warn_unused_result)) int TranscribeOpSymbol(PSTR szOp) {
     break;
 
   default:
-    Rprintf("***Error: unknown mathXML operation '%s' - exiting...\n\n", szOp);
+    ConsolePrintf("***Error: unknown mathXML operation '%s' - exiting...\n\n", szOp);
     return EXIT_ERROR;
   }
   return 0;
@@ -924,29 +835,26 @@ __attribute__((warn_unused_result)) int TranscribeOpSymbol(PSTR szOp) {
    ReadApply
 
    Recursive. Get the content of an <apply> section of MathXML and write it to
-   szEqn.
+   psbEqn.
    The opening <apply> tag is supposed to have been read.
    Note : this rather a hack.
 */
-int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTR szEqn) {
+int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTRBUF psbEqn) {
   PSTRLEX szOp;
   PSTRLEX szLex;
   PSTRLEX szLexSwap;
-  PSTREQN szEqnSwap;
   int iKw;
   int ithTerm = 0;
   BOOL bDone = FALSE;
   char c;
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
-  /* write an opening '(' to szEqn */
-  if (*bInited) { /* we are somewhere in an "apply" section: concatenate */
-    snprintf(szEqnSwap, MAX_EQN, "%s(", szEqn);
-    strncpy(szEqn, szEqnSwap, MAX_EQN);
-  } else {
-    snprintf(szEqn, MAX_EQN, "("); /* initiate */
+  /* write an opening '(' to psbEqn */
+  if (!*bInited) { /* initiate, else we are somewhere in an "apply" section: concatenate */
+    ClearStrBuf(psbEqn);
     *bInited = TRUE;
   }
+  PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, "("));
 
   /* get the operation */
   while (*pibIn->pbufCur++ != '<')
@@ -970,8 +878,7 @@ int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTR szEqn) {
       GetIdentifier(pibIn, szLex);
       iKw = GetSBMLKeywordCode(szLex);
       if ((iKw == KM_APPLY) || (iKw == KM_MATH)) {
-        snprintf(szEqnSwap, MAX_EQN, "%s)", szEqn);
-        strncpy(szEqn, szEqnSwap, MAX_EQN);
+        PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, ")"));
         return 0;
       }
     } else { /* 'c' is not '/', read item */
@@ -983,19 +890,17 @@ int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTR szEqn) {
 
       if (!strcmp(szOp, "pow")) {
         if (ithTerm > 1) {
-          snprintf(szEqnSwap, MAX_EQN, "%s)", szEqn);
-          strncpy(szEqn, szEqnSwap, MAX_EQN);
+          PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, ")"));
         } else {
-          snprintf(szEqnSwap, MAX_EQN, "%s%s(,", szEqn, szOp);
-          strncpy(szEqn, szEqnSwap, MAX_EQN);
+          PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, szOp));
+          PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, "(,"));
         }
       } else {
         if (ithTerm > 1) {
-          snprintf(szEqnSwap, MAX_EQN, "%s%s", szEqn, szOp);
-          strncpy(szEqn, szEqnSwap, MAX_EQN);
+          PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, szOp));
         }
       }
-      PROPAGATE_EXIT(ReadApply(pibIn, bInited, szEqn)); /* found "apply", get lower level */
+      PROPAGATE_EXIT(ReadApply(pibIn, bInited, psbEqn)); /* found "apply", get lower level */
     } else { /* szLex == "ci" (hopefully!), get the atoms of the expression */
       do {
         /* go one char, beyond '>' */
@@ -1008,10 +913,10 @@ int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTR szEqn) {
         if ((pinfo->bTemplateInUse) && (!GetVarPTR(pinfo->pvmGloVars, szLex))) {
           int len = strlen(szLex) + 1 + 1 + strlen(pinfo->pvmLocalCpts->szName) + 1;
           if (len > MAX_LEX) {
-            Rprintf("\n***Error: max string length MAX_LEX exceeded in "
-                    "ReadApply: %s_%s\n",
-                    szLex, pinfo->pvmLocalCpts->szName);
-            Rprintf("Exiting...\n\n");
+            ConsolePrintf("\n***Error: max string length MAX_LEX exceeded in "
+                          "ReadApply: %s_%s\n",
+                          szLex, pinfo->pvmLocalCpts->szName);
+            ConsolePrintf("Exiting...\n\n");
             return EXIT_ERROR;
           }
           if (snprintf(szLexSwap, len, "%s_%s", szLex,
@@ -1025,24 +930,22 @@ int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTR szEqn) {
 
         if (!strcmp(szOp, "pow")) {
           if (ithTerm > 1) {
-            snprintf(szEqnSwap, MAX_EQN, "%s%s)", szEqn, szLex);
-            strncpy(szEqn, szEqnSwap, MAX_EQN);
+            PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, szLex));
+            PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, ")"));
           } else {
-            snprintf(szEqnSwap, MAX_EQN, "%s%s(%s,", szEqn, szOp, szLex);
-            strncpy(szEqn, szEqnSwap, MAX_EQN);
+            PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, szOp));
+            PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, "("));
+            PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, szLex));
+            PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, ","));
           }
         } else {
           if (ithTerm > 1) {
-            snprintf(szEqnSwap, MAX_EQN, "%s%s%s", szEqn, szOp, szLex);
-            strncpy(szEqn, szEqnSwap, MAX_EQN);
-          } else {
-            snprintf(szEqnSwap, MAX_EQN, "%s%s", szEqn, szLex);
-            strncpy(szEqn, szEqnSwap, MAX_EQN);
+            PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, szOp));
           }
+          PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, szLex));
         }
       } while (GetSBMLLex(pibIn, KM_APPLY, KM_CI));
-      snprintf(szEqnSwap, MAX_EQN, "%s)", szEqn);
-      strncpy(szEqn, szEqnSwap, MAX_EQN);
+      PROPAGATE_EXIT(StrBufCatSz(pibIn, psbEqn, ")"));
       return 0;
     } /* end else */
   } /* end do */
@@ -1059,7 +962,7 @@ int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTR szEqn) {
 */
 __attribute__((warn_unused_result)) int ReadReaction_L2(PINPUTBUF pibIn) {
   PSTRLEX szRName;
-  PSTREQN szEqn;
+  STRBUF sbEqn;
   int bInited = FALSE;
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
@@ -1077,12 +980,13 @@ __attribute__((warn_unused_result)) int ReadReaction_L2(PINPUTBUF pibIn) {
   /* get an "apply" tag */
   GetSBMLLex(pibIn, KM_SBML, KM_APPLY);
 
-  PROPAGATE_EXIT(ReadApply(pibIn, &bInited, szEqn));
+  InitStrBuf(&sbEqn, &vptrans->arenaModel);
+  PROPAGATE_EXIT(ReadApply(pibIn, &bInited, &sbEqn));
 
-  Rprintf("reaction %s = %s\n", szRName, szEqn);
+  ConsolePrintf("reaction %s = %s\n", szRName, sbEqn.sz);
 
   /* define reaction name as a local variable in the Dynamics section */
-  PROPAGATE_EXIT(DefineVariable(pibIn, szRName, szEqn, 0));
+  PROPAGATE_EXIT(DefineVariable(pibIn, szRName, sbEqn.sz, 0));
 
   while (*pibIn->pbufCur++ != '>')
     ; /* go to end of tag */
@@ -1112,7 +1016,7 @@ __attribute__((warn_unused_result)) int ReadReactions(PINPUTBUF pibIn, int iSBML
 */
 __attribute__((warn_unused_result)) int ReadRule(PINPUTBUF pibIn) {
   PSTRLEX szRName;
-  PSTREQN szEqn;
+  STRBUF sbEqn;
   int bInited = FALSE;
   PINPUTINFO pinfo = (PINPUTINFO)pibIn->pInfo;
 
@@ -1130,12 +1034,13 @@ __attribute__((warn_unused_result)) int ReadRule(PINPUTBUF pibIn) {
   /* get an "apply" tag */
   GetSBMLLex(pibIn, KM_SBML, KM_APPLY);
 
-  PROPAGATE_EXIT(ReadApply(pibIn, &bInited, szEqn));
+  InitStrBuf(&sbEqn, &vptrans->arenaModel);
+  PROPAGATE_EXIT(ReadApply(pibIn, &bInited, &sbEqn));
 
-  Rprintf("rate for %s = %s\n", szRName, szEqn);
+  ConsolePrintf("rate for %s = %s\n", szRName, sbEqn.sz);
 
   /* define reaction name as Derivative spec in the Dynamics section */
-  PROPAGATE_EXIT(DefineVariable(pibIn, szRName, szEqn, KM_DXDT));
+  PROPAGATE_EXIT(DefineVariable(pibIn, szRName, sbEqn.sz, KM_DXDT));
 
   while (*pibIn->pbufCur++ != '>')
     ; /* go to end of tag */
@@ -1150,7 +1055,7 @@ __attribute__((warn_unused_result)) int ReadRule(PINPUTBUF pibIn) {
 __attribute__((warn_unused_result)) int ReadRules(PINPUTBUF pibIn, int iSBML_level) {
 
   if (iSBML_level == 1) {
-    Rprintf("mod: ignoring rate rules definitions in level 1...\n");
+    ConsolePrintf("mod: ignoring rate rules definitions in level 1...\n");
   } else {
     while (GetSBMLLex(pibIn, KM_RULESLIST, KM_RATERULE)) {
       PROPAGATE_EXIT(ReadRule(pibIn));
@@ -1166,7 +1071,7 @@ __attribute__((warn_unused_result)) int ReadRules(PINPUTBUF pibIn, int iSBML_lev
    Read a sbml tag content and get the level.
 */
 __attribute__((warn_unused_result)) int ReadSBMLLevel(PINPUTBUF pibIn) {
-  PSTREQN szEqn;
+  PSTRLEX szEqn;
   int iLexType;
 
   /* assumes that level comes as second spec */
@@ -1180,7 +1085,7 @@ __attribute__((warn_unused_result)) int ReadSBMLLevel(PINPUTBUF pibIn) {
   GetNumber(pibIn, szEqn, &iLexType);
 
   if (!iLexType) { /* no value, assign 0 by default */
-    Rprintf("***Error: cannot read the sbml level - exiting...\n\n");
+    ConsolePrintf("***Error: cannot read the sbml level - exiting...\n\n");
     return EXIT_ERROR;
   }
 
@@ -1190,15 +1095,15 @@ __attribute__((warn_unused_result)) int ReadSBMLLevel(PINPUTBUF pibIn) {
   switch (szEqn[0]) {
 
   case '1':
-    Rprintf("sbml level 1\n");
+    ConsolePrintf("sbml level 1\n");
     return (1);
 
   case '2':
-    Rprintf("sbml level 2\n");
+    ConsolePrintf("sbml level 2\n");
     return (2);
 
   default:
-    Rprintf("***Error: unknown sbml level %s - exiting...\n\n", szEqn);
+    ConsolePrintf("***Error: unknown sbml level %s - exiting...\n\n", szEqn);
     return EXIT_ERROR;
   }
 
@@ -1218,7 +1123,7 @@ __attribute__((warn_unused_result)) int Read1Species(PINPUTBUF pibIn, BOOL bProc
   PSTRLEX szNameSwap;
   PSTRLEX szBoundary;
   PSTRLEX szCpt;
-  PSTREQN szEqn;
+  PSTRLEX szEqn;
   int iLexType;
   BOOL bBoundary;
   FORSV sVar;
@@ -1248,7 +1153,7 @@ __attribute__((warn_unused_result)) int Read1Species(PINPUTBUF pibIn, BOOL bProc
 
   if (pinfo->bTemplateInUse) {
     /* reset the species' value, to avoid confusion in case of redefinition */
-    snprintf(szEqn, MAX_EQN, "0");
+    snprintf(szEqn, MAX_LEX, "0");
     /* get the species compartment */
     pibIn->pbufCur = pibIn->pbufCur + 1; /* pass closing '"' of value */
     while (*pibIn->pbufCur++ != '"')
@@ -1258,16 +1163,16 @@ __attribute__((warn_unused_result)) int Read1Species(PINPUTBUF pibIn, BOOL bProc
     if (strcmp(szCpt, "compartment")) { /* species is in a meaningful cpt */
       if (!(GetVarPTR(ptempinfo->pvmCpts, szCpt))) {
         /* compartment not defined by the template: error */
-        Rprintf("***Error: template did not defined");
-        Rprintf(" compartment '%s' - exiting...\n\n", szCpt);
+        ConsolePrintf("***Error: template did not defined");
+        ConsolePrintf(" compartment '%s' - exiting...\n\n", szCpt);
         return EXIT_ERROR;
       } else { /* extend the variable name with the compartment name */
         int len = strlen(szName) + 1 + 1 + strlen(szCpt) + 1;
         if (len > MAX_LEX) {
-          Rprintf("\n***Error: max string length MAX_LEX exceeded in "
-                  "Read1Species: %s_%s\n",
-                  szName, szCpt);
-          Rprintf("Exiting...\n\n");
+          ConsolePrintf("\n***Error: max string length MAX_LEX exceeded in "
+                        "Read1Species: %s_%s\n",
+                        szName, szCpt);
+          ConsolePrintf("Exiting...\n\n");
           return EXIT_ERROR;
         }
         if (snprintf(szNameSwap, len, "%s_%s", szName, szCpt) <
@@ -1282,7 +1187,7 @@ __attribute__((warn_unused_result)) int Read1Species(PINPUTBUF pibIn, BOOL bProc
         if (!(hType = GetVarType(pinfo->pvmGloVars, szName))) { /* New id */
           /* link value to symbol */
           PROPAGATE_EXIT(DefineGlobalVar(pibIn, pvm, szName, szEqn, hType));
-          Rprintf("param.   %s = %s  (was boundary species)\n", szName, szEqn);
+          ConsolePrintf("param.   %s = %s  (was boundary species)\n", szName, szEqn);
         } /* end if */
       } /* end if bBoundary */
       else { /* not boundary, create a state variable */
@@ -1294,9 +1199,9 @@ __attribute__((warn_unused_result)) int Read1Species(PINPUTBUF pibIn, BOOL bProc
          not allowed to circulate. If found outside of a meaningful
          compartment: exit with error message */
       if (bBoundary) {
-        Rprintf("***Error: Species %s is set to boundary;\n", szName);
-        Rprintf("          It has to be inside a meaningful compartment -");
-        Rprintf("exiting.\n\n");
+        ConsolePrintf("***Error: Species %s is set to boundary;\n", szName);
+        ConsolePrintf("          It has to be inside a meaningful compartment -");
+        ConsolePrintf("exiting.\n\n");
         return EXIT_ERROR;
       }
 
@@ -1337,14 +1242,14 @@ __attribute__((warn_unused_result)) int Read1Species(PINPUTBUF pibIn, BOOL bProc
 
   else { /* no PK template, process the variable, ignoring compartments */
     if (!iLexType) {
-      snprintf(szEqn, MAX_EQN, "0.0"); /* no value, assign 0 by default */
+      snprintf(szEqn, MAX_LEX, "0.0"); /* no value, assign 0 by default */
     }
     if (bBoundary) {
       /* species assigned boundary conditions are defined as parameters */
       if (!(hType = GetVarType(pinfo->pvmGloVars, szName))) { /* New id */
                                                               /* link value to symbol */
         PROPAGATE_EXIT(DefineGlobalVar(pibIn, pvm, szName, szEqn, hType));
-        Rprintf("param.   %s = %s  (was boundary species)\n", szName, szEqn);
+        ConsolePrintf("param.   %s = %s  (was boundary species)\n", szName, szEqn);
       } /* end if */
     } /* end if bBoundary */
     else { /* not boundary, create a state variable */
@@ -1453,7 +1358,7 @@ int ReadSBMLModels(PINPUTBUF pibIn) {
      rate rules  or reactions (to be set up as local variables) */
   for (i = 0; i < nFiles; i++) {
 
-    Rprintf("\nreading model %s\n", pszFileNames[i]);
+    ConsolePrintf("\nreading model %s\n", pszFileNames[i]);
 
     /* init buffer and read in the input file. */
     /* buffer size -1 will create a buffer of the size of the input file */
@@ -1473,8 +1378,8 @@ int ReadSBMLModels(PINPUTBUF pibIn) {
 
     /* PK template requires level 2 SBML, issue an error otherwise */
     if ((pinfo->bTemplateInUse) && (iSBML_level < 2)) {
-      Rprintf("***Error: use of a PK template requires ");
-      Rprintf("SBML level 2 - exiting.\n\n");
+      ConsolePrintf("***Error: use of a PK template requires ");
+      ConsolePrintf("SBML level 2 - exiting.\n\n");
       ReadSBMLModelsCleanup(&ibInLocal, nFiles, pszFileNames);
 
       return EXIT_ERROR;
@@ -1488,7 +1393,7 @@ int ReadSBMLModels(PINPUTBUF pibIn) {
                                    ReadCpts(&ibInLocal, TRUE)); /* TRUE -> print the cpt name etc. */
       }
     } else { /* ignore the compartments of SBML models if no template */
-      Rprintf("no PK template given: ignoring SBML compartments\n");
+      ConsolePrintf("no PK template given: ignoring SBML compartments\n");
     }
 
     /* read function definitions, reset buffer */
@@ -1554,7 +1459,7 @@ int ReadSBMLModels(PINPUTBUF pibIn) {
       }
     }
 
-    Rprintf("\nmod: reading differentials in model %s\n", pszFileNames[i]);
+    ConsolePrintf("\nmod: reading differentials in model %s\n", pszFileNames[i]);
 
     /* re-read SBML species, reset buffer */
     ibInLocal.pbufCur = ibInLocal.pbufOrg;
@@ -1572,7 +1477,7 @@ int ReadSBMLModels(PINPUTBUF pibIn) {
 
   } /* for model index i*/
 
-  Rprintf("\n");
+  ConsolePrintf("\n");
 
   /* cleanup */
   ReadSBMLModelsCleanup(&ibInLocal, nFiles, pszFileNames);
@@ -1609,7 +1514,7 @@ int ReadPKTemplate(PINPUTBUF pibIn) {
   INPUTBUF ibInLocal;
   InitINPUTBUF(&ibInLocal);
   PSTRLEX szLex; /* Lex elem of MAX_LEX length */
-  PSTREQN szEqn; /* Equation buffer of MAX_EQN length */
+  STRBUF sbEqn;  /* Statement being read, reused */
   int iLexType;
   long nFiles = 0;
   PSTR *pszFileNames;
@@ -1625,19 +1530,19 @@ int ReadPKTemplate(PINPUTBUF pibIn) {
   PROPAGATE_EXIT(ReadFileNames(pibIn, &nFiles, &pszFileNames));
 
   if (nFiles > 1) {
-    Rprintf("mod: cannot use more that one template - using only the 1st\n\n");
+    ConsolePrintf("mod: cannot use more that one template - using only the 1st\n\n");
   }
 
   /* give the template name used */
-  Rprintf("%s\n", pszFileNames[0]);
+  ConsolePrintf("%s\n", pszFileNames[0]);
 
-  if (InitBuffer(&ibInLocal, BUFFER_SIZE, pszFileNames[0]) <= 0) {
+  if (InitBuffer(&ibInLocal, -1, pszFileNames[0]) <= 0) {
     CLEANUP_AND_PROPAGATE_EXIT(ReadPKTemplateCleanup(&ibInLocal, nFiles, pszFileNames),
                                ReportError(&ibInLocal, RE_INIT | RE_FATAL, "ReadModel", NULL));
   }
 
   ibInLocal.pInfo = (PVOID)pinfo; /* Attach info to local input buffer */
-  int ret;
+  InitStrBuf(&sbEqn, &vptrans->arenaModel);
   do { /* State machine for parsing syntax */
     CLEANUP_AND_PROPAGATE_EXIT(ReadPKTemplateCleanup(&ibInLocal, nFiles, pszFileNames),
                                NextLex(&ibInLocal, szLex, &iLexType));
@@ -1648,7 +1553,7 @@ int ReadPKTemplate(PINPUTBUF pibIn) {
 
     case LX_IDENTIFIER:
       CLEANUP_AND_PROPAGATE_EXIT(ReadPKTemplateCleanup(&ibInLocal, nFiles, pszFileNames),
-                                 ProcessWord(&ibInLocal, szLex, szEqn));
+                                 ProcessWord(&ibInLocal, szLex, &sbEqn));
       break;
 
     case LX_PUNCT:
@@ -1682,12 +1587,7 @@ int ReadPKTemplate(PINPUTBUF pibIn) {
 
     } /* switch */
 
-    ret = CLEANUP_AND_PROPAGATE_EXIT_OR_RETURN_RESULT(ReadPKTemplateCleanup(&ibInLocal, nFiles, pszFileNames),
-                                                      FillBuffer(&ibInLocal, BUFFER_SIZE));
-
-  } while (pinfo->wContext != CN_END && (*ibInLocal.pbufCur || ret != EOF));
-
-  fclose(ibInLocal.pfileIn);
+  } while (pinfo->wContext != CN_END);
 
   ReversePointers(&pinfo->pvmGloVars);
   ReversePointers(&pinfo->pvmDynEqns);
@@ -50,7 +50,7 @@
    Prototypes */
 
 int GetSBMLKeywordCode(PSTR szKeyword);
-__attribute__((warn_unused_result)) int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTR toto);
+__attribute__((warn_unused_result)) int ReadApply(PINPUTBUF pibIn, PINT bInited, PSTRBUF psbEqn);
 __attribute__((warn_unused_result)) int ReadSBMLModels(PINPUTBUF pibIn);
 __attribute__((warn_unused_result)) int ReadPKTemplate(PINPUTBUF pibIn);
 
@@ -36,30 +36,29 @@
 #include "lexerr.h"
 #include "lexfn.h"
 #include "mod.h"
+#include "modctx.h"
 #include "modd.h"
+#include "modexpr.h"
 #include "modi.h"
 #include "modo.h"
 
 /* Global Variables */
 
-static char *vszModelFilename = NULL;
-static char *vszModGenName = NULL;
-
 static char vszModelArrayName[] = "vrgModelVars";
 static char vszInputArrayName[] = "vrgInputs";
 extern char vszHasInitializer[]; /* decl'd in modd.c */
 
-PVMMAPSTRCT vpvmGloVarList;
-
 char *vszIFNTypes[] = {/* Must match defines in lexfn.h */
                        "IFN_NULL /* ?? */", "IFN_CONSTANT", "IFN_PERDOSE",
                        "IFN_PERRATE",       "IFN_PEREXP",   "IFN_NDOSES"}; /* vszIFNTypes[] = */
 
-int vnStates, vnOutputs, vnInputs, vnParms, vnModelVars;
+/* The state of the model being written is in the translation context,
+   see modctx.h */
 
-BOOL bForR = FALSE;
-BOOL bForInits = FALSE;
-BOOL bDelay = TRUE; /* R specific code */
+#define MAX_JACOB_NODES 200000L /* Larger Jacobians are left to the solver */
+
+#define HIST_POINTS 10000 /* Points of the history of the delayed variables, as deSolve's mxhist */
+#define BATCH_LANES 8    /* Lanes of derivs_batch: a multiple of common SIMD widths */
 
 /* ----------------------------------------------------------------------------
 ForAllVar
@@ -103,6 +102,16 @@ int CountOneDecl(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
 
 } /* CountOneDecl */
 
+/* ----------------------------------------------------------------------------
+   CountOneInputFn
+
+   Counts the inputs defined in the model, which the R code computes
+   itself (see Write_R_InputFns()).
+
+   Callback for ForAllVar().
+*/
+int CountOneInputFn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) { return (pvm->szEqn != NULL); } /* CountOneInputFn */
+
 /* ----------------------------------------------------------------------------
  */
 void WritebDelays(PFILE pfile, BOOL bDelays) { fprintf(pfile, "\nBOOL bDelays = %d;\n", bDelays); } /* WritebDelays */
@@ -116,7 +125,7 @@ void WritebDelays(PFILE pfile, BOOL bDelays) { fprintf(pfile, "\nBOOL bDelays =
 */
 int WriteOneName(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
   if (pvm->szEqn != vszHasInitializer) { /* These appear later */
-    if (bForR) {
+    if (vptrans->bForR) {
       if (TYPE(pvm) == ID_OUTPUT) {
         fprintf(pfile, "    \"%s", pvm->szName);
       } else {
@@ -155,18 +164,32 @@ int WriteOneName(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
    timestamp, and a list of model variables.
 */
 int WriteHeader(PFILE pfile, PSTR szName, PVMMAPSTRCT pvmGlo) {
+  static const char *rgszDays[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  static const char *rgszMonths[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
   time_t ttTime;
+  struct tm tmTime;
+  char szDate[72];
 
+  /* As ctime() would, which is not safe in parallel translations */
   time(&ttTime);
+#ifdef _WIN32
+  localtime_s(&tmTime, &ttTime);
+#else
+  localtime_r(&ttTime, &tmTime);
+#endif
+  snprintf(szDate, sizeof(szDate), "%.3s %.3s%3d %.2d:%.2d:%.2d %d\n", rgszDays[tmTime.tm_wday],
+           rgszMonths[tmTime.tm_mon], tmTime.tm_mday, tmTime.tm_hour, tmTime.tm_min, tmTime.tm_sec,
+           1900 + tmTime.tm_year);
 
   if (fprintf(pfile, "/* %s\n", szName) < 0) {
     PROPAGATE_EXIT(ReportError(NULL, RE_CANNOTOPEN | RE_FATAL, szName, "...in WriteHeader ()"));
   }
 
   fprintf(pfile, "   ___________________________________________________\n\n");
-  fprintf(pfile, "   Model File:  %s\n\n", vszModelFilename);
-  fprintf(pfile, "   Date:  %s\n", ctime(&ttTime));
-  fprintf(pfile, "   Created by:  \"%s %s\"\n", vszModGenName, VSZ_VERSION);
+  fprintf(pfile, "   Model File:  %s\n\n", vptrans->szModelFilename);
+  fprintf(pfile, "   Date:  %s\n", szDate);
+  fprintf(pfile, "   Created by:  \"%s %s\"\n", vptrans->szModGenName, VSZ_VERSION);
   fprintf(pfile, "    -- a model preprocessor by Don Maszle\n");
   fprintf(pfile, "   ___________________________________________________\n\n");
 
@@ -174,31 +197,31 @@ int WriteHeader(PFILE pfile, PSTR szName, PVMMAPSTRCT pvmGlo) {
 
   fprintf(pfile, "\n   Model calculations for compartmental model:\n\n");
 
-  if (vnStates == 1) {
+  if (vptrans->nStates == 1) {
     fprintf(pfile, "   1 State:\n");
   } else {
-    fprintf(pfile, "   %d States:\n", vnStates);
+    fprintf(pfile, "   %d States:\n", vptrans->nStates);
   }
   PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneName, ID_STATE, NULL));
 
-  if (vnOutputs == 1) {
+  if (vptrans->nOutputs == 1) {
     fprintf(pfile, "\n   1 Output:\n");
   } else {
-    fprintf(pfile, "\n   %d Outputs:\n", vnOutputs);
+    fprintf(pfile, "\n   %d Outputs:\n", vptrans->nOutputs);
   }
   PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneName, ID_OUTPUT, NULL));
 
-  if (vnInputs == 1) {
+  if (vptrans->nInputs == 1) {
     fprintf(pfile, "\n   1 Input:\n");
   } else {
-    fprintf(pfile, "\n   %d Inputs:\n", vnInputs);
+    fprintf(pfile, "\n   %d Inputs:\n", vptrans->nInputs);
   }
   PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneName, ID_INPUT, NULL));
 
-  if (vnParms == 1) {
+  if (vptrans->nParms == 1) {
     fprintf(pfile, "\n   1 Parameter:\n");
   } else {
-    fprintf(pfile, "\n   %d Parameters:\n", vnParms);
+    fprintf(pfile, "\n   %d Parameters:\n", vptrans->nParms);
   }
   PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneName, ID_PARM, NULL));
 
@@ -221,16 +244,50 @@ void WriteIncludes(PFILE pfile) {
 
 } /* WriteIncludes */
 
+/* ----------------------------------------------------------------------------
+   StoredIndex
+
+   Returns the index of the Dynamics or CalcOutputs local pvm (of the
+   global variable list) in the C array of its array statement, or -1 if
+   it is a plain double. See PlanArrayLoops().
+*/
+static long StoredIndex(PVMMAPSTRCT pvm) {
+  PARRAYEQN parrBase;
+
+  if (!vptrans->bStoredArrays || !pvm || (TYPE(pvm) != ID_LOCALDYN && TYPE(pvm) != ID_LOCALCALCOUT) || !pvm->parr) {
+    return (-1);
+  }
+
+  parrBase = pvm->parr->parrBase;
+  if (!parrBase->bStored) {
+    return (-1);
+  }
+  return (strtol(pvm->szName + strlen(parrBase->szName) + 1, NULL, 10) - parrBase->iMin);
+
+} /* StoredIndex */
+
 /* ----------------------------------------------------------------------------
    WriteOneDecl
 
    Write one global or local declaration.  Callback for ForAllVar().
+   Dynamics locals stored in a C array are declared with the first of
+   them.
 */
 int WriteOneDecl(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
+  long iStored = StoredIndex(pvm);
+
   assert(TYPE(pvm) != ID_INPUT);
   assert(TYPE(pvm) != ID_OUTPUT);
   assert(TYPE(pvm) != ID_STATE);
 
+  if (iStored > 0) {
+    return (0);
+  } else if (iStored == 0) {
+    fprintf(pfile, "  /* local */ double %srg%s[%ld];\n", vptrans->szGen, pvm->parr->szName,
+            pvm->parr->parrBase->iMax - pvm->parr->parrBase->iMin + 1);
+    return (1);
+  }
+
   if (TYPE(pvm) > ID_PARM) {
     fprintf(pfile, "  /* local */ ");
   }
@@ -277,102 +334,155 @@ int WriteDecls(PFILE pfile, PVMMAPSTRCT pvmGlo) {
   fprintf(pfile, "\n\n/*----- Global Variables */\n");
 
   fprintf(pfile, "\n/* For export. Keep track of who we are. */\n");
-  fprintf(pfile, "char szModelDescFilename[] = \"%s\";\n", vszModelFilename);
+  fprintf(pfile, "char szModelDescFilename[] = \"%s\";\n", vptrans->szModelFilename);
   fprintf(pfile, "char szModelSourceFilename[] = __FILE__;\n");
-  fprintf(pfile, "char szModelGenAndVersion[] = \"%s %s\";\n", vszModGenName, VSZ_VERSION);
+  fprintf(pfile, "char szModelGenAndVersion[] = \"%s %s\";\n", vptrans->szModGenName, VSZ_VERSION);
 
   fprintf(pfile, "\n/* Externs */\n");
   fprintf(pfile, "extern BOOL vbModelReinitd;\n");
 
   fprintf(pfile, "\n/* Model Dimensions */\n");
-  fprintf(pfile, "int vnStates = %d;\n", vnStates);
-  fprintf(pfile, "int vnOutputs = %d;\n", vnOutputs);
-  fprintf(pfile, "int vnModelVars = %d;\n", vnModelVars);
-  fprintf(pfile, "int vnInputs = %d;\n", vnInputs);
-  fprintf(pfile, "int vnParms = %d;\n", vnParms);
+  fprintf(pfile, "int vnStates = %d;\n", vptrans->nStates);
+  fprintf(pfile, "int vnOutputs = %d;\n", vptrans->nOutputs);
+  fprintf(pfile, "int vnModelVars = %d;\n", vptrans->nModelVars);
+  fprintf(pfile, "int vnInputs = %d;\n", vptrans->nInputs);
+  fprintf(pfile, "int vnParms = %d;\n", vptrans->nParms);
 
   fprintf(pfile, "\n/* States and Outputs*/\n");
-  fprintf(pfile, "double %s[%d];\n", vszModelArrayName, vnModelVars);
+  fprintf(pfile, "double %s[%d];\n", vszModelArrayName, vptrans->nModelVars);
 
   fprintf(pfile, "\n/* Inputs */\n");
-  /* if vnInputs is zero put a dummy 1 for array size */
-  fprintf(pfile, "IFN %s[%d];\n", vszInputArrayName, (vnInputs > 0 ? vnInputs : 1));
+  /* if nInputs is zero put a dummy 1 for array size */
+  fprintf(pfile, "IFN %s[%d];\n", vszInputArrayName, (vptrans->nInputs > 0 ? vptrans->nInputs : 1));
 
   fprintf(pfile, "\n/* Parameters */\n");
   PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_PARM, NULL));
   return 0;
 } /* WriteDecls */
 
+/* ----------------------------------------------------------------------------
+   ParmIndex
+
+   Returns the element of the parameters of the model context, parms[],
+   of the parameter pvm.
+*/
+static long ParmIndex(PVMMAPSTRCT pvm) {
+  pvm = GetIndexedVarPTR(vptrans->pvmGloVarList, pvm->szName);
+  return ((long)INDEX(pvm) - (vptrans->nStates + vptrans->nOutputs + vptrans->nInputs));
+
+} /* ParmIndex */
+
+/* ----------------------------------------------------------------------------
+   InputSlot
+
+   Returns the element of the inputs of the model context, forc[], of the
+   input pvm, see Index_R_Inputs().
+*/
+static long InputSlot(PVMMAPSTRCT pvm) {
+  pvm = GetIndexedVarPTR(vptrans->pvmGloVarList, pvm->szName);
+  return (vptrans->rglInputSlot[INDEX(pvm)]);
+
+} /* InputSlot */
+
 /* ----------------------------------------------------------------------------
    GetName
 
    returns a string to the name of the pvm variable given.  The
-   string is static and must be used immediately or copied.  It will
-   be changed on the next call of this function.
+   string is in the translation context and must be used immediately or
+   copied.  It will be changed on the next call of this function.
 
    szModelVarName and szDerivName are names to be used for
    state variables and derivatives arrays, resp.
 
    The name is determined by hType if hType is non-NULL.  If hType is
    NULL, then the type is taken to be the hType field of pvm.
+
+   For R, parameters and inputs are read from the model context, by
+   CTX_PARM(i) and CTX_FORC(i). Dynamics and CalcOutputs locals of array
+   statements may be elements of a C array, see PlanArrayLoops().
 */
 PSTR GetName(PVMMAPSTRCT pvm, PSTR szModelVarName, PSTR szDerivName, HANDLE hType) {
-  static PSTRLEX vszVarName;
+  PSTR szVarName = vptrans->szVarName;
   HANDLE hTypeToUse = (hType ? hType : TYPE(pvm));
+  PVMMAPSTRCT pvmGlo;
+  long iStored;
 
   switch (hTypeToUse) {
 
   case ID_INPUT:
-    if (bForR) {
-      snprintf(vszVarName, MAX_LEX, "%s", pvm->szName);
+    if (vptrans->bForR) {
+      if (vptrans->bForInits) {
+        snprintf(szVarName, MAX_LEX, "%s", pvm->szName);
+      } else {
+        snprintf(szVarName, MAX_LEX, "CTX_FORC(%ld)", InputSlot(pvm));
+      }
     } else {
-      snprintf(vszVarName, MAX_LEX, "vrgInputs[ID_%s]", pvm->szName);
+      snprintf(szVarName, MAX_LEX, "vrgInputs[ID_%s]", pvm->szName);
     }
     break;
 
   case ID_STATE:
-    if (bForR) {
-      if (bForInits) {
-        snprintf(vszVarName, MAX_LEX, "%s", pvm->szName);
+    if (vptrans->bForR) {
+      if (vptrans->bForInits) {
+        snprintf(szVarName, MAX_LEX, "%s", pvm->szName);
       } else {
-        snprintf(vszVarName, MAX_LEX, "y[ID_%s]", pvm->szName);
+        snprintf(szVarName, MAX_LEX, (vptrans->bForBatch ? "y[ID_%s][%sw]" : "y[ID_%s]"), pvm->szName, vptrans->szGen);
       }
     } else {
       if (szModelVarName) {
-        snprintf(vszVarName, MAX_LEX, "%s[ID_%s]", szModelVarName, pvm->szName);
+        snprintf(szVarName, MAX_LEX, "%s[ID_%s]", szModelVarName, pvm->szName);
       } else {
-        snprintf(vszVarName, MAX_LEX, "vrgModelVars[ID_%s]", pvm->szName);
+        snprintf(szVarName, MAX_LEX, "vrgModelVars[ID_%s]", pvm->szName);
       }
     }
     break;
 
   case ID_OUTPUT:
-    if (bForR) {
-      snprintf(vszVarName, MAX_LEX, "yout[ID_%s]", pvm->szName);
+    if (vptrans->bForR) {
+      snprintf(szVarName, MAX_LEX, (vptrans->bForBatch ? "yout[ID_%s][%sw]" : "yout[ID_%s]"), pvm->szName, vptrans->szGen);
     } else {
       if (szModelVarName) {
-        snprintf(vszVarName, MAX_LEX, "%s[ID_%s]", szModelVarName, pvm->szName);
+        snprintf(szVarName, MAX_LEX, "%s[ID_%s]", szModelVarName, pvm->szName);
       } else {
-        snprintf(vszVarName, MAX_LEX, "vrgModelVars[ID_%s]", pvm->szName);
+        snprintf(szVarName, MAX_LEX, "vrgModelVars[ID_%s]", pvm->szName);
       }
     }
     break;
 
   case ID_DERIV:
     assert(szDerivName);
-    if (bForR) {
-      snprintf(vszVarName, MAX_LEX, "ydot[ID_%s]", pvm->szName);
+    if (vptrans->bForR) {
+      snprintf(szVarName, MAX_LEX, (vptrans->bForBatch ? "ydot[ID_%s][%sw]" : "ydot[ID_%s]"), pvm->szName, vptrans->szGen);
+    } else {
+      snprintf(szVarName, MAX_LEX, "%s[ID_%s]", szDerivName, pvm->szName);
+    }
+    break;
+
+  case ID_LOCALDYN:
+  case ID_LOCALCALCOUT:
+    /* Equations and the variable list each have their own entry */
+    pvmGlo = (vptrans->bStoredArrays ? GetVarPTR(vptrans->pvmGloVarList, pvm->szName) : NULL);
+    if ((iStored = StoredIndex(pvmGlo)) >= 0) {
+      snprintf(szVarName, MAX_LEX, "%srg%s[%ld]", vptrans->szGen, pvmGlo->parr->szName, iStored);
     } else {
-      snprintf(vszVarName, MAX_LEX, "%s[ID_%s]", szDerivName, pvm->szName);
+      snprintf(szVarName, MAX_LEX, "%s", pvm->szName);
     }
     break;
 
-  default: /* Parms and local variables */
-    snprintf(vszVarName, MAX_LEX, "%s", pvm->szName);
+  case ID_PARM:
+    if (vptrans->bForR && !vptrans->bForInits) {
+      snprintf(szVarName, MAX_LEX, "CTX_PARM(%ld)", ParmIndex(pvm));
+    } else {
+      snprintf(szVarName, MAX_LEX, "%s", pvm->szName);
+    }
+    break;
+
+  default: /* Local variables */
+    snprintf(szVarName, MAX_LEX, "%s", pvm->szName);
     break;
   } /* switch */
 
-  return (vszVarName);
+  return (szVarName);
 
 } /* GetName */
 
@@ -513,7 +623,7 @@ int TranslateID(PINPUTBUF pibDum, PFILE pfile, PSTR szLex, int iEqType) {
     PVMMAPSTRCT pvm = NULL;
 
     if (PROPAGATE_EXIT_OR_RETURN_RESULT(GetFuncArgs(pibDum, 1, &iArg, szLex, &iLowerB, &iUpperB)) &&
-        (pvm = GetVarPTR(vpvmGloVarList, szLex)) && TYPE(pvm) == ID_STATE) {
+        (pvm = GetVarPTR(vptrans->pvmGloVarList, szLex)) && TYPE(pvm) == ID_STATE) {
       fprintf(pfile, "%s", GetName(pvm, NULL, "rgDerivs", ID_DERIV));
     } else {
       PROPAGATE_EXIT(ReportError(pibDum, RE_BADSTATE | RE_FATAL, (pvm ? szLex : NULL), NULL));
@@ -522,14 +632,14 @@ int TranslateID(PINPUTBUF pibDum, PFILE pfile, PSTR szLex, int iEqType) {
   break;
 
   case KM_NULL: {
-    PVMMAPSTRCT pvm = GetVarPTR(vpvmGloVarList, szLex);
+    PVMMAPSTRCT pvm = GetVarPTR(vptrans->pvmGloVarList, szLex);
 
     /* Handle undeclared ids */
     if (!pvm) {
       if ((iEqType == KM_DYNAMICS || iEqType == KM_SCALE || iEqType == KM_CALCOUTPUTS) &&
           !(strcmp(szLex, VSZ_TIME) && strcmp(szLex, VSZ_TIME_SBML))) {
         /* If this is the time variable, convert to the correct formal arg */
-        fprintf(pfile, "(*pdTime)");
+        fprintf(pfile, (vptrans->bForBatch ? "pdTime[%sw]" : "(*pdTime)"), vptrans->szGen);
       } else {
         /* otherwise output id exactly as is */
         fprintf(pfile, "%s", szLex);
@@ -544,7 +654,7 @@ int TranslateID(PINPUTBUF pibDum, PFILE pfile, PSTR szLex, int iEqType) {
         fprintf(pfile, "%s", GetName(pvm, "rgModelVars", NULL, ID_NULL));
       }
 
-      if ((TYPE(pvm) == ID_INPUT) && (!bForR)) {
+      if ((TYPE(pvm) == ID_INPUT) && (!vptrans->bForR)) {
         fprintf(pfile, ".dVal"); /* Use current value */
       }
     } /* else */
@@ -562,71 +672,113 @@ int TranslateID(PINPUTBUF pibDum, PFILE pfile, PSTR szLex, int iEqType) {
   return 0;
 } /* TranslateID */
 
+/* ----------------------------------------------------------------------------
+   WriteLoopRef
+
+   Writes szName, the name of a variable in the first pass of the loop of
+   WriteArrayLoop(), stepped by lStride elements per pass: inside its
+   brackets or the parentheses of its context accessor (parameters and
+   inputs) if it has some, through its address otherwise. In the
+   lane-batched kernel, the lane subscript stays last.
+*/
+void WriteLoopRef(PFILE pfile, PSTR szName, long lStride) {
+  size_t cch = strlen(szName);
+  PSTRLEX szStep, szLane;
+
+  snprintf(szLane, MAX_LEX, "[%sw]", vptrans->szGen);
+  if (vptrans->bForBatch && cch > strlen(szLane) && !strcmp(szName + cch - strlen(szLane), szLane)) {
+    cch -= strlen(szLane);
+  } else {
+    szLane[0] = '\0';
+  }
+
+  if (lStride == 1 || lStride == -1) {
+    snprintf(szStep, MAX_LEX, "%siElem", vptrans->szGen);
+  } else {
+    snprintf(szStep, MAX_LEX, "%ld * %siElem", (lStride < 0 ? -lStride : lStride), vptrans->szGen);
+  }
+
+  if (cch && (szName[cch - 1] == ']' || szName[cch - 1] == ')')) {
+    fprintf(pfile, "%.*s %c %s%c%s", (int)(cch - 1), szName, (lStride < 0 ? '-' : '+'), szStep, szName[cch - 1], szLane);
+  } else {
+    fprintf(pfile, "(&%.*s)[%s%s]%s", (int)cch, szName, (lStride < 0 ? "-" : ""), szStep, szLane);
+  }
+
+} /* WriteLoopRef */
+
 /* ----------------------------------------------------------------------------
    TranslateEquation
 
-   Writes an equation to the output file substituting model variable
-   names, inputs names, derivative names, etc.
+   Writes the equation of pvm to the output file substituting model
+   variable names, inputs names, derivative names, etc.
 
    Tries to do some hack formatting.
 */
 
-int TranslateEquation(PFILE pfile, PSTR szEqn, long iEqType) {
+int TranslateEquation(PFILE pfile, PVMMAPSTRCT pvm, long iEqType) {
   INPUTBUF ibDum;
   PINPUTBUF pibDum = &ibDum;
   InitINPUTBUF(pibDum);
   PSTRLEX szLex;
-  PVMMAPSTRCT pvm = NULL;
-  int iType;
+  PEQN peqn;
+  PEQNLEX plex;
+  PVMMAPSTRCT pvmArg = NULL;
+  long ibEnd;
+  int i;
   BOOL bDelayCall = FALSE;
 
-  MakeStringBuffer(NULL, pibDum, szEqn);
-
-  PROPAGATE_EXIT(NextLex(pibDum, szLex, &iType));
-  if (!iType) {
+  PROPAGATE_EXIT(GetEqn(pvm, &peqn));
+  if (!peqn->nLex) {
     fprintf(pfile, "0.0;  /* NULL EQN!?? */");
     return 0;
   } /* if */
 
-  do {
-    if (iType == LX_IDENTIFIER) { /* Process Identifier */
-      if (bDelayCall) {
+  for (i = 0; i < peqn->nLex; i++) {
+    plex = &peqn->rglex[i];
+
+    if (plex->iType == LX_IDENTIFIER) { /* Process Identifier */
+      /* The rest of the equation, for what TranslateID() reads itself */
+      MakeStringBuffer(NULL, pibDum, pvm->szEqn + plex->ibEnd);
+
+      if (vptrans->parrLoop && vptrans->parrLoop->rglStride[i]) {
+        /* Steps through an array in the loop of WriteArrayLoop() */
+        pvmArg = GetVarPTR(vptrans->pvmGloVarList, plex->sz);
+        WriteLoopRef(pfile, GetName(pvmArg, "rgModelVars", NULL, ID_NULL), vptrans->parrLoop->rglStride[i]);
+      } else if (bDelayCall) {
         /* do not translate the 1st param of CalcDelay but check it */
-        pvm = GetVarPTR(vpvmGloVarList, szLex);
-        if ((bForR && ((pvm && (TYPE(pvm) == ID_STATE)))) ||
-            (!bForR && ((pvm && (TYPE(pvm) == ID_STATE)) || (TYPE(pvm) == ID_OUTPUT)))) {
-          fprintf(pfile, "ID_%s", szLex);
-          fprintf(pfile, ", (*pdTime)"); /* add the automatic time variable */
-          bDelayCall = FALSE;            /* turn delay context off */
+        pvmArg = GetVarPTR(vptrans->pvmGloVarList, plex->sz);
+        if (!pvmArg || (TYPE(pvmArg) != ID_STATE && TYPE(pvmArg) != ID_OUTPUT)) {
+          PROPAGATE_EXIT(ReportError(pibDum, RE_LEXEXPECTED | RE_FATAL, "state or output", NULL));
+        }
+        if (vptrans->bForR) {
+          fprintf(pfile, "%spctx, LAG_%s", vptrans->szGen, plex->sz); /* the history is per instance, see CollectDelays() */
         } else {
-          PROPAGATE_EXIT(ReportError(pibDum, RE_LEXEXPECTED | RE_FATAL, (bForR ? "state" : "state or output"), NULL));
+          fprintf(pfile, "ID_%s", plex->sz);
         }
+        fprintf(pfile, ", (*pdTime)"); /* add the automatic time variable */
+        bDelayCall = FALSE;            /* turn delay context off */
       } else {
+        strcpy(szLex, plex->sz); /* Overwritten by the arguments of dt() */
         PROPAGATE_EXIT(TranslateID(pibDum, pfile, szLex, iEqType));
-      }
-    } else {
-      if ((iType == LX_EQNPUNCT || iType == LX_PUNCT) && (*(szLex) == CH_COMMENT)) {
-        while (*pibDum->pbufCur && *pibDum->pbufCur != CH_EOLN) {
-          pibDum->pbufCur++;
-        }
 
-        fprintf(pfile, "\n");
-      } else { /* Spew everything else */
-        fprintf(pfile, "%s", szLex);
+        /* Skip the lexemes it read, the argument of dt() */
+        ibEnd = plex->ibEnd + (long)(pibDum->pbufCur - pibDum->pbufOrg);
+        while (i + 1 < peqn->nLex && peqn->rglex[i + 1].ibEnd <= ibEnd) {
+          i++;
+        }
       }
+    } else { /* Spew everything else */
+      fprintf(pfile, "%s", plex->sz);
     }
 
     if (!bDelayCall) { /* check delay context */
-      bDelayCall = (!strcmp("CalcDelay", szLex));
-      bDelay = bDelay || bDelayCall;
+      bDelayCall = (!strcmp("CalcDelay", plex->sz));
     }
 
     fprintf(pfile, " ");
-    PROPAGATE_EXIT(NextLex(pibDum, szLex, &iType));
-
-  } while (iType);
+  }
 
-  if (bForR && bForInits) {
+  if (vptrans->bForR && vptrans->bForInits) {
     fprintf(pfile, "\n");
   } else {
     fprintf(pfile, ";\n");
@@ -634,6 +786,81 @@ int TranslateEquation(PFILE pfile, PSTR szEqn, long iEqType) {
   return 0;
 } /* TranslateEquation */
 
+/* ----------------------------------------------------------------------------
+   NextInlineId
+
+   Copies to szLex the next identifier of the C code sz, skipping numbers
+   and punctuation, and returns what follows it, or NULL at the end.
+*/
+static PSTR NextInlineId(PSTR sz, PSTR szLex) {
+  PSTR szId;
+  size_t cch;
+
+  while (*sz && !isalpha((unsigned char)*sz) && *sz != '_') {
+    sz += (isdigit((unsigned char)*sz) ? strspn(sz, "0123456789.eE") : 1); /* Not in a number */
+  }
+  if (!*sz) {
+    return NULL;
+  }
+
+  for (szId = sz; isalnum((unsigned char)*sz) || *sz == '_'; sz++) {
+    ;
+  }
+  cch = ((size_t)(sz - szId) < MAX_LEX ? (size_t)(sz - szId) : MAX_LEX - 1);
+  memcpy(szLex, szId, cch);
+  szLex[cch] = '\0';
+  return sz;
+
+} /* NextInlineId */
+
+/* ----------------------------------------------------------------------------
+   WriteInline
+
+   Writes the C code of an Inline statement as is. For R, it may name
+   parameters and inputs, which are read from the model context: those
+   it names are #defined as their accessors around it.
+*/
+int WriteInline(PFILE pfile, PVMMAPSTRCT pvm) {
+  PSTR sz = pvm->szEqn;
+  PSTRLEX szLex;
+  PVMMAPSTRCT pvmVar, *rgpvmVar;
+  int i, nVars = 0;
+
+  if (!vptrans->bForR) {
+    fprintf(pfile, "\n%s\n", pvm->szEqn);
+    return 0;
+  }
+
+  /* At most one variable per two characters */
+  if (!(rgpvmVar = (PVMMAPSTRCT *)malloc((strlen(pvm->szEqn) / 2 + 1) * sizeof(PVMMAPSTRCT)))) {
+    return ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "WriteInline", NULL);
+  }
+
+  fprintf(pfile, "\n");
+  while ((sz = NextInlineId(sz, szLex))) {
+    pvmVar = GetVarPTR(vptrans->pvmGloVarList, szLex);
+    if (TYPE(pvmVar) != ID_PARM && TYPE(pvmVar) != ID_INPUT) {
+      continue;
+    }
+    for (i = 0; i < nVars && rgpvmVar[i] != pvmVar; i++) {
+      ;
+    }
+    if (i == nVars) {
+      rgpvmVar[nVars++] = pvmVar;
+      fprintf(pfile, "#define %s %s\n", pvmVar->szName, GetName(pvmVar, NULL, NULL, ID_NULL));
+    }
+  }
+
+  fprintf(pfile, "%s\n", pvm->szEqn);
+  for (i = 0; i < nVars; i++) {
+    fprintf(pfile, "#undef %s\n", rgpvmVar[i]->szName);
+  }
+
+  free(rgpvmVar);
+  return 0;
+
+} /* WriteInline */
+
 /* ----------------------------------------------------------------------------
    WriteOneEquation
 
@@ -655,12 +882,12 @@ int WriteOneEquation(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
 
     /* Inputs not allowed anymore in Scale section - FB 7/12/96 */
     if (TYPE(pvm) == ID_INPUT) {
-      Rprintf("Error: input '%s' used in Scale context.\n", pvm->szName);
+      ConsolePrintf("Error: input '%s' used in Scale context.\n", pvm->szName);
       return EXIT_ERROR;
     }
 
     if (TYPE(pvm) != ID_INLINE) { /* do not write "Inline" */
-      if (bForR && bForInits && TYPE(pvm) == ID_STATE) {
+      if (vptrans->bForR && vptrans->bForInits && TYPE(pvm) == ID_STATE) {
         fprintf(pfile, "    Y[\"%s\"] <- ", GetName(pvm, NULL, NULL, ID_NULL));
       } else {
         fprintf(pfile, "  %s = ", GetName(pvm, NULL, NULL, ID_NULL));
@@ -668,11 +895,16 @@ int WriteOneEquation(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
     }
     break;
 
+  case KM_ROOTS:
+    if (TYPE(pvm) == ID_NULL) { /* Root function gout[i], see DefineRootEqn() */
+      fprintf(pfile, "  gout[%d] = ", RootIndex(pvm->szName));
+      break;
+    }
+    /* fall through */
   case KM_CALCOUTPUTS:
   case KM_DYNAMICS:
   case KM_JACOB:
   case KM_EVENTS:
-  case KM_ROOTS:
     if (TYPE(pvm) != ID_INLINE) { /* do not write "Inline" */
       fprintf(pfile, "  %s = ", GetName(pvm, "rgModelVars", "rgDerivs", ID_NULL));
     }
@@ -681,9 +913,9 @@ int WriteOneEquation(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
   } /* switch */
 
   if (TYPE(pvm) == ID_INLINE) { /* write out the equation */
-    fprintf(pfile, "\n%s\n", pvm->szEqn);
+    PROPAGATE_EXIT(WriteInline(pfile, pvm));
   } else {
-    PROPAGATE_EXIT(TranslateEquation(pfile, pvm->szEqn, iType));
+    PROPAGATE_EXIT(TranslateEquation(pfile, pvm, iType));
   }
 
   return 1;
@@ -699,7 +931,7 @@ int WriteOneEquation(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
 
 int WriteCalcDeriv(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn) {
   if (!pvmDyn) {
-    Rprintf("No Dynamics{} equations.\n\n");
+    ConsolePrintf("No Dynamics{} equations.\n\n");
   }
 
   fprintf(pfile, "/*----- Dynamics section */\n\n");
@@ -721,7 +953,7 @@ int WriteCalcDeriv(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn) {
 */
 int WriteScale(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmScale) {
   if (!pvmScale) {
-    Rprintf("No Scale{} equations. Null function defined.\n\n");
+    ConsolePrintf("No Scale{} equations. Null function defined.\n\n");
   }
 
   fprintf(pfile, "/*----- Model scaling */\n\n");
@@ -752,7 +984,7 @@ int WriteCalcJacob(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmJacob) {
 */
 int WriteCalcOutputs(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmCalcOut) {
   if (!pvmCalcOut) {
-    Rprintf("No CalcOutputs{} equations. Null function defined.\n\n");
+    ConsolePrintf("No CalcOutputs{} equations. Null function defined.\n\n");
   }
 
   fprintf(pfile, "/*----- Outputs calculations */\n\n");
@@ -770,8 +1002,8 @@ int WriteCalcOutputs(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmCalcOut) {
    ORs the index passed through the info pointer, a PINT,
    and increments the value of the pointer.
 
-   The handle is corrected for use in the simulation.  For this, the
-   TYPE part of the handle is shifted left 4 bits.
+   The index goes in the ID_INDEXMASK bits of the handle, below the
+   type, see mod.h.
 
    Callback function for ForAllVar().
 */
@@ -797,30 +1029,37 @@ int IndexOneVar(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
    The indices to inputs are into the array of inputs.
 */
 int IndexVariables(PVMMAPSTRCT pvmGlo) {
-  int iIndex, iMax = MAX_VARS;
+  int iIndex, iMax;
+  BOOL bTooMany = FALSE;
 
   /* Get counts */
-  vnStates = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_STATE, NULL);
-  vnOutputs = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_OUTPUT, NULL);
-  vnInputs = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_INPUT, NULL);
-  vnParms = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_PARM, NULL);
-  vnModelVars = vnStates + vnOutputs;
-
-  /* Report all errors */
-  if (vnStates > MAX_VARS) {
+  vptrans->nStates = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_STATE, NULL);
+  vptrans->nOutputs = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_OUTPUT, NULL);
+  vptrans->nInputs = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_INPUT, NULL);
+  vptrans->nInputFns = ForAllVar(NULL, pvmGlo, &CountOneInputFn, ID_INPUT, NULL);
+  vptrans->nParms = ForAllVar(NULL, pvmGlo, &CountOneDecl, ID_PARM, NULL);
+  vptrans->nModelVars = vptrans->nStates + vptrans->nOutputs;
+
+  /* Report all errors: the indices of the outputs follow those of the
+     states, and those of the parameters follow all the others */
+  if (vptrans->nStates > (iMax = MAX_VARS)) {
+    bTooMany = TRUE;
     PROPAGATE_EXIT(ReportError(NULL, RE_TOOMANYVARS, "state", (PSTR)&iMax));
   }
-  if (vnOutputs > MAX_VARS) {
-    PROPAGATE_EXIT(ReportError(NULL, RE_TOOMANYVARS, "input", (PSTR)&iMax));
-  }
-  if (vnInputs > MAX_VARS) {
+  if (vptrans->nOutputs > (iMax = MAX_VARS - vptrans->nStates)) {
+    bTooMany = TRUE;
     PROPAGATE_EXIT(ReportError(NULL, RE_TOOMANYVARS, "output", (PSTR)&iMax));
   }
-  if (vnParms > (iMax = MAX_VARS - vnModelVars)) {
+  if (vptrans->nInputs > (iMax = MAX_VARS)) {
+    bTooMany = TRUE;
+    PROPAGATE_EXIT(ReportError(NULL, RE_TOOMANYVARS, "input", (PSTR)&iMax));
+  }
+  if (vptrans->nParms > (iMax = MAX_VARS - vptrans->nModelVars - vptrans->nInputs)) {
+    bTooMany = TRUE;
     PROPAGATE_EXIT(ReportError(NULL, RE_TOOMANYVARS, "parameter", (PSTR)&iMax));
   }
 
-  if (vnStates > MAX_VARS || vnInputs > MAX_VARS || vnOutputs > MAX_VARS || vnParms > iMax) {
+  if (bTooMany) {
     PROPAGATE_EXIT(ReportError(NULL, RE_FATAL, NULL, NULL)); /* Abort generation */
   }
 
@@ -832,7 +1071,7 @@ int IndexVariables(PVMMAPSTRCT pvmGlo) {
   iIndex = 0;
   PROPAGATE_EXIT(ForAllVar(NULL, pvmGlo, &IndexOneVar, ID_INPUT, (PVOID)&iIndex));
 
-  iIndex = vnStates + vnOutputs + vnInputs;
+  iIndex = vptrans->nStates + vptrans->nOutputs + vptrans->nInputs;
   PROPAGATE_EXIT(ForAllVar(NULL, pvmGlo, &IndexOneVar, ID_PARM, (PVOID)&iIndex));
 
   return 0;
@@ -883,12 +1122,54 @@ int AdjustOneVar(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
    the global variable map.
 */
 int AdjustVarHandles(PVMMAPSTRCT pvmGlo) {
-  WORD wOffset = (WORD)vnInputs + vnStates + vnOutputs;
+  WORD wOffset = (WORD)vptrans->nInputs + vptrans->nStates + vptrans->nOutputs;
 
   PROPAGATE_EXIT(ForAllVar(NULL, pvmGlo, &AdjustOneVar, ID_INPUT, (PVOID)&wOffset));
   return 0;
 } /* AdjustVarHandles */
 
+/* ----------------------------------------------------------------------------
+   AdjustOneDose
+
+   Increments the dependent parameter handles of a dose by the iOffset
+   given through the info pointer, as AdjustOneVar() does for inputs.
+
+   Callback function for ForAllVar().
+*/
+int AdjustOneDose(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
+  PDFN pdfn = (PDFN)pvm->szEqn;
+  WORD wOffset = *(PWORD)pInfo;
+
+  if (pdfn->hVal) {
+    pdfn->hVal += wOffset;
+  }
+  if (pdfn->hTper) {
+    pdfn->hTper += wOffset;
+  }
+  if (pdfn->hT0) {
+    pdfn->hT0 += wOffset;
+  }
+  if (pdfn->hN) {
+    pdfn->hN += wOffset;
+  }
+
+  return 1;
+
+} /* AdjustOneDose */
+
+/* ----------------------------------------------------------------------------
+   AdjustDoseHandles
+
+   Adjusts the variable handles of the doses of the Doses section, as
+   AdjustVarHandles() does for input definitions.
+*/
+int AdjustDoseHandles(PVMMAPSTRCT pvmDoses) {
+  WORD wOffset = (WORD)vptrans->nInputs + vptrans->nStates + vptrans->nOutputs;
+
+  PROPAGATE_EXIT(ForAllVar(NULL, pvmDoses, &AdjustOneDose, ALL_VARS, (PVOID)&wOffset));
+  return 0;
+} /* AdjustDoseHandles */
+
 /* ----------------------------------------------------------------------------
    ReversePointers
 
@@ -921,12 +1202,13 @@ void ReversePointers(PVMMAPSTRCT *ppvm) {
 
    Check that equation exists.
 
-   Uses info pointer of ForAllVar's callback as a second eqn list.
+   Uses info pointer of ForAllVar's callback as the index (PVARINDEX)
+   of a second eqn list.
 
-   (1) If the second list is NULL, checks for initialization
+   (1) If the index is NULL, checks for initialization
    of pvm.
 
-   (2) If the second list in non-NULL, checks it for definition.
+   (2) If the index is non-NULL, checks the list for definition.
 
    Note that case (1) and (2) apply to inputs and dynamics eqns respectively.
    Further assertion will have to be handled otherwise.  Parms are
@@ -938,11 +1220,11 @@ void ReversePointers(PVMMAPSTRCT *ppvm) {
 */
 int AssertExistsEqn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
   int iReturn = 0;
-  PVMMAPSTRCT pvmDyn = (PVMMAPSTRCT)pInfo;
+  PVARINDEX pvxDyn = (PVARINDEX)pInfo;
 
   if (pvm->szEqn != vszHasInitializer) { /* Don't count these! */
-    if (pvmDyn) {
-      if (!(iReturn = (GetVarPTR(pvmDyn, pvm->szName) != NULL))) {
+    if (pvxDyn) {
+      if (!(iReturn = (LookupVar(pvxDyn, pvm->szName) != NULL))) {
         PROPAGATE_EXIT(ReportError(NULL, RE_NODYNEQN, pvm->szName, NULL));
       }
     } else if (!(iReturn = (pvm->szEqn != NULL))) {
@@ -962,13 +1244,17 @@ int AssertExistsEqn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
    defined.
 
    Calls AssertExistsEqn on each and return a fatal error if one or more
-   equation is missing.
+   equation is missing. The equations are looked up through an index.
 */
 int VerifyEqns(PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn) {
   BOOL bStatesOK;
+  VARINDEX vxDyn;
 
-  bStatesOK =
-      (vnStates == PROPAGATE_EXIT_OR_RETURN_RESULT(ForAllVar(NULL, pvmGlo, &AssertExistsEqn, ID_STATE, (PVOID)pvmDyn)));
+  InitVarIndex(&vxDyn);
+  CLEANUP_AND_PROPAGATE_EXIT(FreeVarIndex(&vxDyn), IndexVarList(&vxDyn, pvmDyn));
+  bStatesOK = (vptrans->nStates == CLEANUP_AND_PROPAGATE_EXIT_OR_RETURN_RESULT(
+                               FreeVarIndex(&vxDyn), ForAllVar(NULL, pvmGlo, &AssertExistsEqn, ID_STATE, (PVOID)&vxDyn)));
+  FreeVarIndex(&vxDyn);
 
   if (!bStatesOK) {
     PROPAGATE_EXIT(ReportError(NULL, RE_FATAL, NULL, "State equations missing.\n"));
@@ -980,20 +1266,19 @@ int VerifyEqns(PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn) {
    AssertExistsOutputEqn
 
    Check that an equation exists in either the Dynamics section or the
-   CalcOutputs section for each output variable.
+   CalcOutputs section for each output variable. The info pointer is
+   the index (PVARINDEX) of both sections.
 
    The errors are not reported as fatal so that all errors can
    be discovered.  They will cause exit subsequently.
 */
 __attribute__((warn_unused_result)) int AssertExistsOutputEqn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
   int iReturn = 0;
-  PINPUTINFO pinfo = (PINPUTINFO)pInfo;
-  PVMMAPSTRCT pvmDyn = (PVMMAPSTRCT)pinfo->pvmDynEqns;
-  PVMMAPSTRCT pvmOut = (PVMMAPSTRCT)pinfo->pvmCalcOutEqns;
+  PVARINDEX pvxEqns = (PVARINDEX)pInfo;
 
   if (pvm->szEqn != vszHasInitializer) { /* Don't count these! */
 
-    if ((GetVarPTR(pvmDyn, pvm->szName) == NULL) && (GetVarPTR(pvmOut, pvm->szName) == NULL)) {
+    if (LookupVar(pvxEqns, pvm->szName) == NULL) {
       PROPAGATE_EXIT(ReportError(NULL, RE_NOOUTPUTEQN, pvm->szName, NULL));
       iReturn = 0;
     } else {
@@ -1016,9 +1301,15 @@ __attribute__((warn_unused_result)) int AssertExistsOutputEqn(PFILE pfile, PVMMA
 */
 __attribute__((warn_unused_result)) int VerifyOutputEqns(PINPUTINFO pInfo) {
   BOOL bOutputsOK;
+  VARINDEX vxEqns;
 
-  bOutputsOK = (vnOutputs == PROPAGATE_EXIT_OR_RETURN_RESULT(
-                                 ForAllVar(NULL, pInfo->pvmGloVars, &AssertExistsOutputEqn, ID_OUTPUT, (PVOID)pInfo)));
+  InitVarIndex(&vxEqns);
+  CLEANUP_AND_PROPAGATE_EXIT(FreeVarIndex(&vxEqns), IndexVarList(&vxEqns, pInfo->pvmDynEqns));
+  CLEANUP_AND_PROPAGATE_EXIT(FreeVarIndex(&vxEqns), IndexVarList(&vxEqns, pInfo->pvmCalcOutEqns));
+  bOutputsOK = (vptrans->nOutputs == CLEANUP_AND_PROPAGATE_EXIT_OR_RETURN_RESULT(
+                                 FreeVarIndex(&vxEqns),
+                                 ForAllVar(NULL, pInfo->pvmGloVars, &AssertExistsOutputEqn, ID_OUTPUT, (PVOID)&vxEqns)));
+  FreeVarIndex(&vxEqns);
 
   if (!bOutputsOK) {
     PROPAGATE_EXIT(ReportError(NULL, RE_FATAL, NULL, "Output equations missing.\n"));
@@ -1036,7 +1327,7 @@ int WriteModel(PINPUTINFO pinfo, PSTR szFileOut) {
   PFILE pfile;
 
   if (!pinfo->pvmGloVars || (!pinfo->pvmDynEqns && !pinfo->pvmCalcOutEqns)) {
-    Rprintf("Error: No Dynamics, no outputs or no global variables defined\n");
+    ConsolePrintf("Error: No Dynamics, no outputs or no global variables defined\n");
     return 0;
   }
 
@@ -1045,7 +1336,7 @@ int WriteModel(PINPUTINFO pinfo, PSTR szFileOut) {
   ReversePointers(&pinfo->pvmScaleEqns);
   ReversePointers(&pinfo->pvmCalcOutEqns);
   ReversePointers(&pinfo->pvmJacobEqns);
-  vpvmGloVarList = pinfo->pvmGloVars;
+  vptrans->pvmGloVarList = pinfo->pvmGloVars;
 
   PROPAGATE_EXIT(IndexVariables(pinfo->pvmGloVars));
   PROPAGATE_EXIT(AdjustVarHandles(pinfo->pvmGloVars));
@@ -1057,8 +1348,8 @@ int WriteModel(PINPUTINFO pinfo, PSTR szFileOut) {
   if (pfile) {
 
     /* Keep track of the model description file and generator name */
-    vszModelFilename = pinfo->szInputFilename;
-    vszModGenName = pinfo->szModGenName;
+    vptrans->szModelFilename = pinfo->szInputFilename;
+    vptrans->szModGenName = pinfo->szModGenName;
 
     PROPAGATE_EXIT(WriteHeader(pfile, szFileOut, pinfo->pvmGloVars));
 
@@ -1075,7 +1366,7 @@ int WriteModel(PINPUTINFO pinfo, PSTR szFileOut) {
 
     fclose(pfile);
 
-    Rprintf("\n* Created model file '%s'.\n\n", szFileOut);
+    ConsolePrintf("\n* Created model file '%s'.\n\n", szFileOut);
 
   } /* if */
   else {
@@ -1087,27 +1378,15 @@ int WriteModel(PINPUTINFO pinfo, PSTR szFileOut) {
 /* ----------------------------------------------------------------------------
  */
 int WriteOne_R_SODefine(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
-  static long iStates = 0;  /* indexing states  */
-  static long iOutputs = 0; /* indexing outputs */
-  PINPUTINFO pinfo = (PINPUTINFO)pInfo;
-
-  // need to clear state when we are handling a new model in ".so" mode
-  // as the 'static' variables are not reset from model to model
-  if (pinfo && pinfo->bClearState == TRUE) {
-    iStates = 0;
-    iOutputs = 0;
-    pinfo->bClearState = FALSE;
-  }
-
   if (pvm->szEqn != vszHasInitializer) {
     fprintf(pfile, "#define ");
     WriteIndexName(pfile, pvm);
     if (TYPE(pvm) == ID_STATE) {
-      fprintf(pfile, " 0x%05lx\n", iStates);
-      iStates = iStates + 1;
+      fprintf(pfile, " 0x%05lx\n", vptrans->iStates);
+      vptrans->iStates = vptrans->iStates + 1;
     } else {
-      fprintf(pfile, " 0x%05lx\n", iOutputs);
-      iOutputs = iOutputs + 1;
+      fprintf(pfile, " 0x%05lx\n", vptrans->iOutputs);
+      vptrans->iOutputs = vptrans->iOutputs + 1;
     }
 
     return 1;
@@ -1121,20 +1400,28 @@ int WriteOne_R_SODefine(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
    Write_R_Scale
 */
 int Write_R_Scale(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmScale) {
-  fprintf(pfile, "void getParms (double *inParms, double *out, int *nout) {\n");
+  PSTR szGen = vptrans->szGen; /* Next to the locals of the Scale section */
+
+  fprintf(pfile, "void getParms_ctx (MODEL_CTX *%spctx, double *%sinParms, double *%sout, int *%snout) {\n", szGen, szGen,
+          szGen, szGen);
   fprintf(pfile, "/*----- Model scaling */\n\n");
 
   PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALSCALE, NULL));
 
-  fprintf(pfile, "  int i;\n\n");
-  fprintf(pfile, "  for (i = 0; i < *nout; i++) {\n");
-  fprintf(pfile, "    parms[i] = inParms[i];\n  }\n\n");
+  fprintf(pfile, "  int %si;\n\n", szGen);
+  fprintf(pfile, "  for (%si = 0; %si < *%snout; %si++) {\n", szGen, szGen, szGen, szGen);
+  fprintf(pfile, "    %spctx->parms[%si] = %sinParms[%si];\n  }\n\n", szGen, szGen, szGen, szGen);
 
   PROPAGATE_EXIT(ForAllVar(pfile, pvmScale, &WriteOneEquation, ID_PARM, (PVOID)KM_SCALE));
+  fprintf(pfile, "\n  hoist_ctx(%spctx);\n", szGen);
 
-  fprintf(pfile, "\n  for (i = 0; i < *nout; i++) {\n");
-  fprintf(pfile, "    out[i] = parms[i];\n  }\n");
-  fprintf(pfile, "  }\n");
+  fprintf(pfile, "\n  for (%si = 0; %si < *%snout; %si++) {\n", szGen, szGen, szGen, szGen);
+  fprintf(pfile, "    %sout[%si] = %spctx->parms[%si];\n  }\n", szGen, szGen, szGen, szGen);
+  fprintf(pfile, "  }\n\n");
+
+  fprintf(pfile, "void getParms (double *_inParms, double *_out, int *_nout) {\n");
+  fprintf(pfile, "  getParms_ctx(&vctxDefault, _inParms, _out, _nout);\n");
+  fprintf(pfile, "}\n");
   return 0;
 } /* Write_R_Scale */
 
@@ -1152,162 +1439,2653 @@ int Write_R_State_Scale(PFILE pfile, PVMMAPSTRCT pvmScale) {
 } /* Write_R_State_Scale */
 
 /* ----------------------------------------------------------------------------
-   Write_R_CalcDeriv
+   EqnReads
 
-   Writes the CalcDeriv() function for compatibility with R deSolve package.
-   Writes dynamics equations in the order they appeared in the model definition
-   file. Appends the CalcOutput equations, if any, at the end.
+   Sets *pbReads to TRUE if the equation of pvm uses the identifier szName.
 */
-int Write_R_CalcDeriv(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut) {
-  if (!pvmDyn) {
-    Rprintf("No Dynamics{} equations.\n\n");
+int EqnReads(PVMMAPSTRCT pvm, PSTR szName, BOOL *pbReads) {
+  PEQN peqn;
+  int i;
+
+  PROPAGATE_EXIT(GetEqn(pvm, &peqn));
+
+  *pbReads = FALSE;
+  for (i = 0; i < peqn->nLex && !*pbReads; i++) {
+    *pbReads = (peqn->rglex[i].iType == LX_IDENTIFIER && !strcmp(peqn->rglex[i].sz, szName));
   }
 
-  fprintf(pfile, "/*----- Dynamics section */\n\n");
-  fprintf(pfile, "void derivs (int *neq, double *pdTime, double *y, ");
-  fprintf(pfile, "double *ydot, double *yout, int *ip)\n{\n");
+  return 0;
 
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALDYN, NULL));
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALCALCOUT, NULL));
+} /* EqnReads */
 
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmDyn, &WriteOneEquation, ALL_VARS, (PVOID)KM_DYNAMICS));
+/* ----------------------------------------------------------------------------
+   EqnReadsVar
 
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmCalcOut, &WriteOneEquation, ALL_VARS, (PVOID)KM_CALCOUTPUTS));
+   Sets *pbReads to TRUE if the equation of pvm uses the variable of the
+   Dynamics equation pvmVar: dt(x) for the derivative of x, the
+   identifier otherwise.
+*/
+static int EqnReadsVar(PVMMAPSTRCT pvm, PVMMAPSTRCT pvmVar, BOOL *pbReads) {
+  PEQN peqn;
+  int i;
+
+  if (TYPE(pvmVar) != ID_DERIV) {
+    return EqnReads(pvm, pvmVar->szName, pbReads);
+  }
+
+  PROPAGATE_EXIT(GetEqn(pvm, &peqn));
+
+  *pbReads = FALSE;
+  for (i = 0; i + 2 < peqn->nLex && !*pbReads; i++) {
+    *pbReads = (peqn->rglex[i].iType == LX_IDENTIFIER && !strcmp(peqn->rglex[i].sz, "dt") &&
+                peqn->rglex[i + 2].iType == LX_IDENTIFIER && !strcmp(peqn->rglex[i + 2].sz, pvmVar->szName));
+  }
 
-  fprintf(pfile, "\n} /* derivs */\n\n\n");
   return 0;
-} /* Write_R_CalcDeriv */
+
+} /* EqnReadsVar */
 
 /* ----------------------------------------------------------------------------
-   Write_R_InitModel
+   MarkEqns
 
-   Writes the routine to initialize the model variables for R deSolve.
+   Flags in *prgbMark the Dynamics equations needed by the derivatives,
+   from dt() and state assignments, or if bOutputs by the outputs, from
+   output and state assignments and the CalcOutput equations pvmCalcOut.
+   Going backwards, every equation whose variable is read by one already
+   flagged is flagged too. Inlines are opaque C, so if there is one all
+   equations are flagged.
+
+   Returns the number of equations not flagged in *pnOff.
 */
-void Write_R_InitModel(PFILE pfile, PVMMAPSTRCT pvmGlo) {
-  fprintf(pfile, "/*----- Initializers */\n");
-  fprintf(pfile, "void initmod (void (* odeparms)(int *, double *))\n{\n");
-  fprintf(pfile, "  int N=%d;\n", vnParms);
-  fprintf(pfile, "  odeparms(&N, parms);\n");
-  fprintf(pfile, "}\n\n");
+static int MarkEqns(PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut, BOOL bOutputs, BOOL **prgbMark, int *pnOff) {
+  PVMMAPSTRCT pvm, *rgpvm;
+  int i, j, nEqns = 0;
+  BOOL bInline = (HasInline(pvmDyn) > 0);
+  BOOL *rgbMark;
+
+  for (pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar) {
+    nEqns++;
+  }
 
-  fprintf(pfile, "void initforc (void (* odeforcs)(int *, double *))\n{\n");
-  fprintf(pfile, "  int N=%d;\n", vnInputs);
-  fprintf(pfile, "  odeforcs(&N, forc);\n");
-  fprintf(pfile, "}\n\n\n");
+  free(*prgbMark);
+  rgbMark = *prgbMark = (BOOL *)malloc((nEqns > 0 ? nEqns : 1) * sizeof(BOOL));
+  rgpvm = (PVMMAPSTRCT *)malloc((nEqns > 0 ? nEqns : 1) * sizeof(PVMMAPSTRCT));
+  if (!rgbMark || !rgpvm) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "MarkEqns", NULL));
+  }
 
-  if (bDelay) {
-    fprintf(pfile, "/* Calling R code will ensure that input y has same\n");
-    fprintf(pfile, "   dimension as yini */\n");
-    fprintf(pfile, "void initState (double *y)\n");
-    fprintf(pfile, "{\n");
-    fprintf(pfile, "  int i;\n\n");
-    fprintf(pfile, "  for (i = 0; i < sizeof(yini) / sizeof(yini[0]); i++)\n");
-    fprintf(pfile, "  {\n");
-    fprintf(pfile, "    yini[i] = y[i];\n");
-    fprintf(pfile, "  }\n}\n\n");
+  for (i = 0, pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar, i++) {
+    rgpvm[i] = pvm;
+    rgbMark[i] = (bInline || TYPE(pvm) == ID_STATE || TYPE(pvm) == (bOutputs ? ID_OUTPUT : ID_DERIV));
   }
 
-} /* Write_R_InitModel */
+  *pnOff = 0;
+  for (i = nEqns - 1; i >= 0; i--) {
+    for (pvm = (bOutputs ? pvmCalcOut : NULL); pvm && !rgbMark[i]; pvm = pvm->pvmNextVar) {
+      PROPAGATE_EXIT(EqnReadsVar(pvm, rgpvm[i], &rgbMark[i]));
+    }
+    for (j = i + 1; j < nEqns && !rgbMark[i]; j++) {
+      if (rgbMark[j]) {
+        PROPAGATE_EXIT(EqnReadsVar(rgpvm[j], rgpvm[i], &rgbMark[i]));
+      }
+    }
+    if (!rgbMark[i]) {
+      (*pnOff)++;
+    }
+  }
+
+  free(rgpvm);
+  return 0;
+
+} /* MarkEqns */
 
 /* ----------------------------------------------------------------------------
-   Write_R_CalcJacob: empty in fact
+   MarkDerivEqns
+
+   Flags in rgbDerivEqn the Dynamics equations the derivatives depend on,
+   see MarkEqns(). The others only feed outputs: their number is returned
+   in *pnOutOnly.
 */
-int Write_R_CalcJacob(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmJacob) {
-  fprintf(pfile, "/*----- Jacobian calculations: */\n");
-  fprintf(pfile, "void jac (int *neq, double *t, double *y, int *ml, ");
-  fprintf(pfile, "int *mu, ");
-  fprintf(pfile, "double *pd, int *nrowpd, double *yout, int *ip)\n");
-  fprintf(pfile, "{\n");
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALJACOB, NULL));
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmJacob, &WriteOneEquation, ALL_VARS, (PVOID)KM_JACOB));
-  fprintf(pfile, "\n} /* jac */\n\n\n");
-  return 0;
-} /* Write_R_CalcJacob */
+int MarkDerivEqns(PVMMAPSTRCT pvmDyn, int *pnOutOnly) {
+  return MarkEqns(pvmDyn, NULL, FALSE, &vptrans->rgbDerivEqn, pnOutOnly);
+
+} /* MarkDerivEqns */
 
 /* ----------------------------------------------------------------------------
-   Write_R_Events: may contain Inlines
+   MarkOutputEqns
+
+   Flags in rgbOutputEqn the Dynamics equations the outputs depend on, for
+   outputs_ctx() and outputs_batch(), see MarkEqns().
 */
-int Write_R_Events(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmEvents) {
-  fprintf(pfile, "/*----- Events calculations: */\n");
-  fprintf(pfile, "void event (int *n, double *t, double *y)\n");
-  fprintf(pfile, "{\n");
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALEVENT, NULL));
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmEvents, &WriteOneEquation, ALL_VARS, (PVOID)KM_EVENTS));
-  fprintf(pfile, "\n} /* event */\n\n");
-  return 0;
-} /* Write_R_Events */
+int MarkOutputEqns(PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut) {
+  int nOff;
+
+  return MarkEqns(pvmDyn, pvmCalcOut, TRUE, &vptrans->rgbOutputEqn, &nOff);
+
+} /* MarkOutputEqns */
 
 /* ----------------------------------------------------------------------------
-   Write_R_Roots: may contain Inlines
+   WritesCalcOut
+
+   Returns TRUE if the CalcOutput equations are written after the Dynamics
+   equations flagged in rgbEqn: in outputs_ctx() and in derivs_ctx() if
+   it computes the outputs, where rgbEqn is rgbOutputEqn or NULL.
 */
-int Write_R_Roots(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmRoots) {
-  fprintf(pfile, "/*----- Roots calculations: */\n");
-  fprintf(pfile, "void root (int *neq, double *t, double *y, ");
-  fprintf(pfile, "int *ng, double *gout, double *out, int *ip)\n");
-  fprintf(pfile, "{\n");
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALROOT, NULL));
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmRoots, &WriteOneEquation, ALL_VARS, (PVOID)KM_ROOTS));
-  fprintf(pfile, "\n} /* root */\n\n");
-  return 0;
-} /* Write_R_Roots */
+static BOOL WritesCalcOut(BOOL *rgbEqn) {
+  return (!rgbEqn || rgbEqn == vptrans->rgbOutputEqn);
+
+} /* WritesCalcOut */
 
 /* ----------------------------------------------------------------------------
-   WriteOne_R_PIDefine
+   IsDynDropped
 
-   Write one global or local declaration for parameters and inputs (forcing
-   functions) passed through R.
-   Increments and prints two parallel counters ("iParms" and "iForcs").
-   Callback for ForAllVar().
+   Returns TRUE if the Dynamics equation i is not written where the
+   equations flagged in rgbEqn are (see WriteDerivEqns()): it sets a local
+   that DropSubstitutedLocals() left unused there. The CalcOutput
+   equations follow the Dynamics ones but in the lean derivs.
+*/
+static BOOL IsDynDropped(BOOL *rgbEqn, int i) {
+  return (vptrans->rgbDynUnused && vptrans->rgbDynUnused[i] && !(WritesCalcOut(rgbEqn) && vptrans->rgbDynCalcOut[i]));
+
+} /* IsDynDropped */
+
+/* ----------------------------------------------------------------------------
+   WriteArrayLoop
+
+   Writes the equations of the array statement parr as one loop over its
+   elements, from the equation of the first one (see PlanArrayLoops()).
+   iEqType is KM_DYNAMICS or KM_CALCOUTPUTS.
 */
-int WriteOne_R_PIDefine(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
-  static long iParms = 0; /* indexing parameters */
-  static long iForcs = 0; /* indexing input functions (forcing function) */
+int WriteArrayLoop(PFILE pfile, PARRAYEQN parr, long iEqType) {
+  PVMMAPSTRCT pvm = parr->pvmFirst;
+
+  fprintf(pfile, "\n  for (%siElem = 0; %siElem < %ld; %siElem++) {\n    ", vptrans->szGen, vptrans->szGen, parr->iUB - parr->iLB, vptrans->szGen);
+  WriteLoopRef(pfile, GetName(pvm, "rgModelVars", "rgDerivs", ID_NULL), parr->lStride);
+  fprintf(pfile, " = ");
+  vptrans->parrLoop = parr;
+  PROPAGATE_EXIT(TranslateEquation(pfile, pvm, iEqType));
+  vptrans->parrLoop = NULL;
+  fprintf(pfile, "  }\n");
+  return 0;
 
-  PINPUTINFO pinfo = (PINPUTINFO)pInfo;
+} /* WriteArrayLoop */
 
-  // need to clear state when we are handling a new model in ".so" mode
-  // as the 'static' variables are not reset from model to model
-  if (pinfo && pinfo->bClearState == TRUE) {
-    iParms = 0;
-    iForcs = 0;
-    pinfo->bClearState = FALSE;
+/* ----------------------------------------------------------------------------
+   WriteDerivEqns
+
+   Writes the Dynamics equations flagged in rgbEqn (rgbDerivEqn or
+   rgbOutputEqn), or all of them if rgbEqn is NULL, but for the locals
+   OptimizeDynamics() found unused. Equations rewritten
+   by OptimizeDynamics() are written from their trees, and so are those
+   that use common subexpressions: these are counted among the equations
+   written, and each is computed into a local the first time it is needed
+   (see WriteExprTemps()). The array statements planned as loops are
+   written as such, in the lane-batched kernel too, inside its loop over
+   lanes.
+*/
+int WriteDerivEqns(PFILE pfile, PVMMAPSTRCT pvmDyn, BOOL *rgbEqn) {
+  PVMMAPSTRCT pvm;
+  PSTRLEX szTime;
+  BOOL bTemps;
+  int i, n, nElems;
+
+  snprintf(szTime, MAX_LEX, (vptrans->bForBatch ? "pdTime[%sw]" : "(*pdTime)"), vptrans->szGen);
+
+  if (vptrans->bCse) {
+    vptrans->cse.nTemps = 0;
+    for (i = 0, pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar, i++) {
+      if ((!rgbEqn || rgbEqn[i]) && vptrans->rgpexDyn[i] && !IsDynDropped(rgbEqn, i)) {
+        CountExprUses(vptrans->rgpexDyn[i]);
+      }
+    }
   }
 
-  assert(TYPE(pvm) != ID_OUTPUT);
-  assert(TYPE(pvm) != ID_STATE);
+  for (i = 0, pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar, i++) {
+    if (rgbEqn && !rgbEqn[i]) {
+      continue;
+    }
+    if (pvm->parr && pvm->parr->bLoop && pvm == pvm->parr->pvmFirst) {
+      /* One loop, unless only some of the elements are needed */
+      nElems = (int)(pvm->parr->iUB - pvm->parr->iLB);
+      n = 1;
+      while (n < nElems && (!rgbEqn || rgbEqn[i + n])) {
+        n++;
+      }
+      if (n == nElems) {
+        PROPAGATE_EXIT(WriteArrayLoop(pfile, pvm->parr, KM_DYNAMICS));
+        for (n = 1; n < nElems; n++, i++) {
+          pvm = pvm->pvmNextVar;
+        }
+        continue;
+      }
+    }
+    if (!vptrans->rgpexDyn || !vptrans->rgpexDyn[i]) {
+      PROPAGATE_EXIT(WriteOneEquation(pfile, pvm, (PVOID)KM_DYNAMICS));
+      continue;
+    }
+    if (IsDynDropped(rgbEqn, i)) {
+      continue;
+    }
 
-  if (TYPE(pvm) == ID_PARM) {
-    fprintf(pfile, "#define %s parms[%ld]\n", pvm->szName, iParms);
-    iParms = iParms + 1;
-  } else {
-    fprintf(pfile, "#define %s forc[%ld]\n", pvm->szName, iForcs);
-    iForcs = iForcs + 1;
+    if (pvm->hType & ID_SPACEFLAG) {
+      fprintf(pfile, "\n");
+    }
+    bTemps = (vptrans->bCse && WriteExprTemps(pfile, &vptrans->cse, vptrans->rgpexDyn[i], szTime));
+    fprintf(pfile, "  %s = ", GetName(pvm, "rgModelVars", "rgDerivs", ID_NULL));
+    if (bTemps || vptrans->rgbDynRewritten[i]) {
+      WriteExpr(pfile, vptrans->rgpexDyn[i], szTime);
+      fprintf(pfile, ";\n");
+    } else {
+      PROPAGATE_EXIT(TranslateEquation(pfile, pvm, KM_DYNAMICS));
+    }
   }
 
-  return (1);
+  if (vptrans->bCse) {
+    for (i = 0, pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar, i++) {
+      if (vptrans->rgpexDyn[i]) {
+        ResetExprUses(vptrans->rgpexDyn[i]);
+      }
+    }
+  }
+
+  return 0;
 
-} /* WriteOne_R_PIDefine */
+} /* WriteDerivEqns */
 
 /* ----------------------------------------------------------------------------
-ForAllVarwSep
+   GloVarNamed
 
-   Takes a pfile, a pvm list head and a callback function which is called
-   for all variables in the list if hType == ALL_VARS or only for
-   only those that match hType otherwise. This version is for writing
-   lists with separating punctuation.  It sets End to -1 for the first
-   item in the list, 0 for items in the middle of the list, and 1 for the
-   last item.
+   Returns the oldest global variable named szName if bOldest, else the
+   newest, or NULL. A local of a section redefined by another has one
+   entry in each.
 */
-int ForAllVarwSep(PFILE pfile, PVMMAPSTRCT pvm, PFI_CALLBACK pfiFunc, HANDLE hType, PVOID pinfo) {
-  int iTotal = 0;
-  int64_t End = -1;
-  int iCount = 0;
+static PVMMAPSTRCT GloVarNamed(PSTR szName, BOOL bOldest) {
+  PVMMAPSTRCT pvm, pvmFound = NULL;
+  long i;
 
-  while (pvm) {
-    if (hType == ALL_VARS        /* Do for all ... */
-        || TYPE(pvm) == hType) { /* ... or do only for vars of hType */
+  if (vptrans->vxGlo.bValid) {
+    i = FindVarEntry(&vptrans->vxGlo, szName, bOldest);
+    return (i >= 0 ? vptrans->vxGlo.rgvxe[i].pvm : NULL);
+  }
 
-      if (pvm->szEqn != vszHasInitializer) {
+  for (pvm = vptrans->pvmGloVarList; pvm && !(bOldest && pvmFound); pvm = pvm->pvmNextVar) {
+    if (!strcmp(pvm->szName, szName)) {
+      pvmFound = pvm;
+    }
+  }
+  return (pvmFound);
+
+} /* GloVarNamed */
+
+/* ----------------------------------------------------------------------------
+   IsRedefinedLocal
+
+   Returns TRUE if pvm is a Dynamics local that the CalcOutputs define
+   again: where both sections are written, one declaration does.
+*/
+static BOOL IsRedefinedLocal(PVMMAPSTRCT pvm) {
+  PVMMAPSTRCT pvmNewest;
+
+  if (TYPE(pvm) != ID_LOCALDYN) {
+    return FALSE;
+  }
+  pvmNewest = GloVarNamed(pvm->szName, FALSE);
+  return (pvmNewest && pvmNewest != pvm && TYPE(pvmNewest) == ID_LOCALCALCOUT);
+
+} /* IsRedefinedLocal */
+
+/* ----------------------------------------------------------------------------
+   WritesLoops
+
+   Returns TRUE if WriteModelEqns() writes one of the equations as a
+   loop: those of an array statement planned as one, among the Dynamics
+   equations flagged in rgbEqn (all of them if rgbEqn is NULL) if all its
+   elements are flagged, or among the CalcOutput equations if they are
+   written (see WritesCalcOut()).
+*/
+static BOOL WritesLoops(PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut, BOOL *rgbEqn) {
+  PVMMAPSTRCT pvm;
+  int i, n, nElems;
+
+  if (!vptrans->bArrayLoops) {
+    return FALSE;
+  }
+
+  for (i = 0, pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar, i++) {
+    if (pvm->parr && pvm->parr->bLoop && pvm == pvm->parr->pvmFirst) {
+      nElems = (int)(pvm->parr->iUB - pvm->parr->iLB);
+      for (n = 0; n < nElems && (!rgbEqn || rgbEqn[i + n]); n++) {
+        ;
+      }
+      if (n == nElems) {
+        return TRUE;
+      }
+    }
+  }
+
+  for (pvm = (WritesCalcOut(rgbEqn) ? pvmCalcOut : NULL); pvm; pvm = pvm->pvmNextVar) {
+    if (pvm->parr && pvm->parr->bLoop) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+
+} /* WritesLoops */
+
+/* ----------------------------------------------------------------------------
+   WriteDynDecls
+
+   Declares the Dynamics locals set by the equations of pvmDyn flagged in
+   rgbEqn, or all of them if rgbEqn is NULL, but for those written by none
+   (see DropSubstitutedLocals()) and those the CalcOutputs redefine, if
+   their declarations follow. A C array of an array statement is declared
+   if any of its elements is set.
+*/
+static int WriteDynDecls(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn, BOOL *rgbEqn) {
+  PVMMAPSTRCT pvm, pvmEqn;
+  PARRAYEQN parrBase;
+  BOOL bSet;
+  int i;
+
+  for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) != ID_LOCALDYN || StoredIndex(pvm) > 0 || (WritesCalcOut(rgbEqn) && IsRedefinedLocal(pvm))) {
+      continue;
+    }
+    parrBase = (StoredIndex(pvm) == 0 ? pvm->parr->parrBase : NULL);
+    bSet = (!rgbEqn && !vptrans->rgbDynUnused);
+    for (i = 0, pvmEqn = pvmDyn; pvmEqn && !bSet; pvmEqn = pvmEqn->pvmNextVar, i++) {
+      bSet = ((!rgbEqn || rgbEqn[i]) && !IsDynDropped(rgbEqn, i) &&
+              (parrBase ? (pvmEqn->parr && pvmEqn->parr->parrBase == parrBase) : !strcmp(pvmEqn->szName, pvm->szName)));
+    }
+    if (bSet) {
+      PROPAGATE_EXIT(WriteOneDecl(pfile, pvm, NULL));
+    }
+  }
+
+  return 0;
+
+} /* WriteDynDecls */
+
+/* ----------------------------------------------------------------------------
+   WriteCalcOutEqns
+
+   Writes the CalcOutput equations, those of the array statements planned
+   as loops as such.
+*/
+static int WriteCalcOutEqns(PFILE pfile, PVMMAPSTRCT pvmCalcOut) {
+  PVMMAPSTRCT pvm;
+  long n;
+
+  for (pvm = pvmCalcOut; pvm; pvm = pvm->pvmNextVar) {
+    if (pvm->parr && pvm->parr->bLoop && pvm == pvm->parr->pvmFirst) {
+      PROPAGATE_EXIT(WriteArrayLoop(pfile, pvm->parr, KM_CALCOUTPUTS));
+      for (n = 1; n < pvm->parr->iUB - pvm->parr->iLB; n++) {
+        pvm = pvm->pvmNextVar;
+      }
+    } else {
+      PROPAGATE_EXIT(WriteOneEquation(pfile, pvm, (PVOID)KM_CALCOUTPUTS));
+    }
+  }
+
+  return 0;
+
+} /* WriteCalcOutEqns */
+
+/* ----------------------------------------------------------------------------
+   WriteModelDecls
+
+   Declares the locals of a function that writes the Dynamics equations
+   flagged in rgbEqn (see WriteDerivEqns()), then the CalcOutput ones if
+   WritesCalcOut(), and the index of its loops.
+*/
+static int WriteModelDecls(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut, BOOL *rgbEqn) {
+  PROPAGATE_EXIT(WriteDynDecls(pfile, pvmGlo, pvmDyn, rgbEqn));
+  if (WritesCalcOut(rgbEqn)) {
+    PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALCALCOUT, NULL));
+  }
+  if (WritesLoops(pvmDyn, pvmCalcOut, rgbEqn)) {
+    fprintf(pfile, "  int %siElem;\n", vptrans->szGen);
+  }
+  return 0;
+
+} /* WriteModelDecls */
+
+/* ----------------------------------------------------------------------------
+   WriteModelEqns
+
+   Writes the equations declared by WriteModelDecls().
+*/
+static int WriteModelEqns(PFILE pfile, PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut, BOOL *rgbEqn) {
+  PROPAGATE_EXIT(WriteDerivEqns(pfile, pvmDyn, rgbEqn));
+  if (WritesCalcOut(rgbEqn)) {
+    PROPAGATE_EXIT(WriteCalcOutEqns(pfile, pvmCalcOut));
+  }
+  return 0;
+
+} /* WriteModelEqns */
+
+/* ----------------------------------------------------------------------------
+   Write_R_CalcDeriv
+
+   Writes the CalcDeriv() function for compatibility with R deSolve package.
+   Writes dynamics equations in the order they appeared in the model definition
+   file.
+
+   The equations go in derivs_ctx(), which takes the model context; derivs()
+   is the deSolve entry point and runs it on the default context. The same
+   split is used for jac, event and root below.
+
+   If bLeanDerivs is set, derivs_ctx() holds only the equations the
+   derivatives need (see MarkDerivEqns()), and the outputs are computed
+   after integration by outputs() at the saved times. Otherwise (delays
+   must be computed during integration) the CalcOutput equations are
+   appended to derivs_ctx(), as before.
+*/
+int Write_R_CalcDeriv(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut) {
+  if (!pvmDyn) {
+    ConsolePrintf("No Dynamics{} equations.\n\n");
+  }
+
+  fprintf(pfile, "/*----- Dynamics section */\n\n");
+  fprintf(pfile, "void derivs_ctx (MODEL_CTX *%spctx, double *pdTime, double *y, ", vptrans->szGen);
+  fprintf(pfile, "double *ydot, double *yout)\n{\n");
+
+  PROPAGATE_EXIT(WriteModelDecls(pfile, pvmGlo, pvmDyn, pvmCalcOut, (vptrans->bLeanDerivs ? vptrans->rgbDerivEqn : NULL)));
+
+  fprintf(pfile, "\n  if (!yout) yout = %spctx->yout;\n", vptrans->szGen);
+  Write_R_InputsCall(pfile, "*pdTime");
+
+  PROPAGATE_EXIT(WriteModelEqns(pfile, pvmDyn, pvmCalcOut, (vptrans->bLeanDerivs ? vptrans->rgbDerivEqn : NULL)));
+  fprintf(pfile, "\n} /* derivs_ctx */\n\n");
+
+  fprintf(pfile, "void derivs (int *_neq, double *pdTime, double *y, ");
+  fprintf(pfile, "double *ydot, double *yout, int *_ip)\n{\n");
+  fprintf(pfile, "  derivs_ctx(&vctxDefault, pdTime, y, ydot, yout);\n");
+  fprintf(pfile, "} /* derivs */\n\n\n");
+  return 0;
+} /* Write_R_CalcDeriv */
+
+/* ----------------------------------------------------------------------------
+   SetsDerivs
+
+   Returns TRUE if the Dynamics equations flagged in rgbEqn write to the
+   derivatives: dt() equations and Inlines, which may set anything.
+*/
+static BOOL SetsDerivs(PVMMAPSTRCT pvmDyn, BOOL *rgbEqn) {
+  PVMMAPSTRCT pvm;
+  int i;
+
+  for (i = 0, pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar, i++) {
+    if (rgbEqn[i] && (TYPE(pvm) == ID_DERIV || TYPE(pvm) == ID_INLINE)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+
+} /* SetsDerivs */
+
+/* ----------------------------------------------------------------------------
+   Write_R_CalcOutputs
+
+   Writes outputs_ctx(), which computes the outputs at one point: the
+   Dynamics equations they depend on (see MarkOutputEqns()), into scratch
+   derivatives if dt() is among them, then the CalcOutput equations.
+   outputs() is the entry point for R: it runs outputs_ctx() over the
+   saved times of a simulation, with arrays stored by column (nTimes rows)
+   as in deSolve's result.
+*/
+int Write_R_CalcOutputs(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut) {
+  fprintf(pfile, "/*----- Outputs section */\n\n");
+  fprintf(pfile, "void outputs_ctx (MODEL_CTX *%spctx, double *pdTime, double *y, double *yout)\n{\n", vptrans->szGen);
+  if (SetsDerivs(pvmDyn, vptrans->rgbOutputEqn)) {
+    fprintf(pfile, "  double ydot[%d];\n", (vptrans->nStates > 0 ? vptrans->nStates : 1));
+  }
+
+  PROPAGATE_EXIT(WriteModelDecls(pfile, pvmGlo, pvmDyn, pvmCalcOut, vptrans->rgbOutputEqn));
+  fprintf(pfile, "\n");
+  Write_R_InputsCall(pfile, "*pdTime");
+
+  PROPAGATE_EXIT(WriteModelEqns(pfile, pvmDyn, pvmCalcOut, vptrans->rgbOutputEqn));
+
+  fprintf(pfile, "\n} /* outputs_ctx */\n\n");
+
+  fprintf(pfile, "void outputs (int *_pnTimes, double *_rgdTimes, double *_rgdY, ");
+  fprintf(pfile, "double *_rgdForc, double *_rgdParms, double *_rgdOut)\n{\n");
+  fprintf(pfile, "  double y[%d], yout[%d];\n", (vptrans->nStates > 0 ? vptrans->nStates : 1), (vptrans->nOutputs > 0 ? vptrans->nOutputs : 1));
+  fprintf(pfile, "  int _i, _j, _n = *_pnTimes;\n\n");
+  fprintf(pfile, "  for (_j = 0; _j < %d; _j++)\n", vptrans->nParms);
+  fprintf(pfile, "    vctxDefault.parms[_j] = _rgdParms[_j];\n");
+  fprintf(pfile, "  hoist_ctx(&vctxDefault);\n\n");
+  fprintf(pfile, "  for (_i = 0; _i < _n; _i++) {\n");
+  fprintf(pfile, "    for (_j = 0; _j < %d; _j++)\n", vptrans->nStates);
+  fprintf(pfile, "      y[_j] = _rgdY[_i + _n * _j];\n");
+  fprintf(pfile, "    for (_j = 0; _j < %d; _j++)\n", vptrans->nInputs - vptrans->nInputFns);
+  fprintf(pfile, "      vctxDefault.forc[_j] = _rgdForc[_i + _n * _j];\n");
+  fprintf(pfile, "    outputs_ctx(&vctxDefault, &_rgdTimes[_i], y, yout);\n");
+  fprintf(pfile, "    for (_j = 0; _j < %d; _j++)\n", vptrans->nOutputs);
+  fprintf(pfile, "      _rgdOut[_i + _n * _j] = yout[_j];\n");
+  fprintf(pfile, "  }\n");
+  fprintf(pfile, "} /* outputs */\n\n\n");
+  return 0;
+} /* Write_R_CalcOutputs */
+
+/* ----------------------------------------------------------------------------
+   HasInline
+
+   Returns the number of Inline statements in the list: raw C code that
+   cannot be rewritten for the batched kernel.
+*/
+int HasInline(PVMMAPSTRCT pvm) {
+  int n = 0;
+
+  while (pvm) {
+    if (TYPE(pvm) == ID_INLINE) {
+      n++;
+    }
+    pvm = pvm->pvmNextVar;
+  }
+
+  return (n);
+
+} /* HasInline */
+
+/* ----------------------------------------------------------------------------
+   LoopAddress
+
+   Finds the variable szName as stepped through by a loop: *ppvm is its
+   entry, the one indexed if it was initialized, and *plAddr its position
+   in its storage. Returns FALSE if it is not in an array that a loop can
+   index: the states, outputs, parameters and inputs, or the C array of
+   Dynamics or CalcOutputs locals of the same name.
+*/
+static BOOL LoopAddress(PINPUTINFO pinfo, PSTR szName, PVMMAPSTRCT *ppvm, long *plAddr) {
+  PVMMAPSTRCT pvm = GetIndexedVarPTR(pinfo->pvmGloVars, szName);
+
+  *ppvm = pvm;
+  switch (TYPE(pvm)) {
+  case ID_STATE:
+  case ID_OUTPUT:
+  case ID_PARM:
+    *plAddr = INDEX(pvm);
+    return (pvm->szEqn != vszHasInitializer);
+
+  case ID_INPUT: /* Forcings and inputs defined in the model are apart */
+    *plAddr = (pvm->szEqn != vszHasInitializer ? InputSlot(pvm) : 0);
+    return (pvm->szEqn != vszHasInitializer);
+
+  case ID_LOCALDYN:
+  case ID_LOCALCALCOUT:
+    *plAddr = StoredIndex(pvm);
+    return (*plAddr >= 0);
+
+  default:
+    return (FALSE);
+  }
+
+} /* LoopAddress */
+
+/* ----------------------------------------------------------------------------
+   SameArray
+
+   Returns TRUE if the variables pvm1 and pvm2 of LoopAddress() are in the
+   same array.
+*/
+static BOOL SameArray(PVMMAPSTRCT pvm1, PVMMAPSTRCT pvm2) {
+  return (TYPE(pvm1) == TYPE(pvm2) &&
+          ((TYPE(pvm1) != ID_LOCALDYN && TYPE(pvm1) != ID_LOCALCALCOUT) || pvm1->parr->parrBase == pvm2->parr->parrBase));
+
+} /* SameArray */
+
+/* ----------------------------------------------------------------------------
+   PlanArrayLoop
+
+   Sets bLoop if the equations of the array statement parr, from pvmFirst,
+   can be written as one loop: they assign derivatives, outputs or stored
+   locals at a fixed stride (lStride), and differ only by identifiers that
+   step through one array likewise (rglStride). Equations with a delay or
+   a dt() are left alone.
+*/
+static int PlanArrayLoop(PINPUTINFO pinfo, PARRAYEQN parr) {
+  PVMMAPSTRCT pvm, pvmVar, *rgpvmVar = NULL;
+  PEQN peqn, peqnFirst;
+  PEQNLEX plex, plexFirst;
+  long j, lAddr, lAddrLHS = 0, *rglAddr = NULL;
+  int i, iType = TYPE(parr->pvmFirst);
+  BOOL bLoop;
+
+  parr->bLoop = FALSE;
+  if (iType != ID_DERIV && iType != ID_OUTPUT && iType != ID_LOCALDYN && iType != ID_LOCALCALCOUT) {
+    return 0;
+  }
+
+  /* Strides are kept with the statement, the rest goes with the model */
+  PROPAGATE_EXIT(GetEqn(parr->pvmFirst, &peqnFirst));
+  parr->rglStride = (long *)ModelAlloc((peqnFirst->nLex + 1) * sizeof(long));
+  rglAddr = (long *)ModelAlloc((peqnFirst->nLex + 1) * sizeof(long));
+  rgpvmVar = (PVMMAPSTRCT *)ModelAlloc((peqnFirst->nLex + 1) * sizeof(PVMMAPSTRCT));
+  if (!parr->rglStride || !rglAddr || !rgpvmVar) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "PlanArrayLoop", NULL));
+  }
+  memset(parr->rglStride, 0, (peqnFirst->nLex + 1) * sizeof(long));
+
+  bLoop = TRUE;
+  for (j = 0, pvm = parr->pvmFirst; j < parr->iUB - parr->iLB && bLoop; j++, pvm = pvm->pvmNextVar) {
+    /* The variable assigned */
+    bLoop = (TYPE(pvm) == iType && LoopAddress(pinfo, pvm->szName, &pvmVar, &lAddr) &&
+             (TYPE(pvmVar) == ID_STATE) == (iType == ID_DERIV));
+    if (bLoop && j == 1) {
+      parr->lStride = lAddr - lAddrLHS;
+    }
+    bLoop = (bLoop && (j < 2 || lAddr - lAddrLHS == parr->lStride));
+    lAddrLHS = lAddr;
+
+    /* The lexemes, against those of the first equation */
+    if (bLoop) {
+      PROPAGATE_EXIT(GetEqn(pvm, &peqn));
+      bLoop = (peqn->nLex == peqnFirst->nLex);
+    }
+    for (i = 0; i < peqnFirst->nLex && bLoop; i++) {
+      plex = &peqn->rglex[i];
+      plexFirst = &peqnFirst->rglex[i];
+      if (j == 0) {
+        /* No call that TranslateEquation() handles itself */
+        bLoop = (plex->iType != LX_IDENTIFIER || (GetKeywordCode(plex->sz, NULL) == KM_NULL && strcmp(plex->sz, "CalcDelay")));
+      } else if (plex->iType != LX_IDENTIFIER || (j > 1 && !parr->rglStride[i])) {
+        bLoop = (plex->iType == plexFirst->iType && !strcmp(plex->sz, plexFirst->sz));
+      } else if (j == 1) {
+        /* Constant, or steps from the first equation to the second */
+        if (plexFirst->iType == LX_IDENTIFIER && strcmp(plex->sz, plexFirst->sz)) {
+          bLoop = (LoopAddress(pinfo, plexFirst->sz, &rgpvmVar[i], &rglAddr[i]) &&
+                   LoopAddress(pinfo, plex->sz, &pvmVar, &lAddr) && SameArray(pvmVar, rgpvmVar[i]) &&
+                   lAddr != rglAddr[i]);
+          parr->rglStride[i] = lAddr - rglAddr[i];
+          rglAddr[i] = lAddr;
+        } else {
+          bLoop = (plex->iType == plexFirst->iType);
+        }
+      } else {
+        /* Keeps stepping the same way */
+        bLoop = (LoopAddress(pinfo, plex->sz, &pvmVar, &lAddr) && SameArray(pvmVar, rgpvmVar[i]) &&
+                 lAddr - rglAddr[i] == parr->rglStride[i]);
+        rglAddr[i] = lAddr;
+      }
+    }
+  }
+
+  parr->bLoop = (bLoop && parr->lStride);
+  return 0;
+
+} /* PlanArrayLoop */
+
+/* ----------------------------------------------------------------------------
+   PlanArrayLoops
+
+   Plans the writing of the array statements of the Dynamics and
+   CalcOutputs, sums included, which were unrolled into one equation per
+   element (see BeginArrayEqn()).
+
+   The locals they define are kept in a C array per name and section,
+   rg<name>, so that they can be indexed; not those a section defines
+   again under the same name, which stay plain doubles. Then the equations
+   of a statement are written as one loop over its elements by
+   WriteArrayLoop(), if they differ only by variables stored at a fixed
+   stride: rather than N copies of an equation over y, ydot, yout, the
+   parameters or such locals, the C code has one, which compiles faster
+   and can be vectorized. The others are written one by one as before.
+   Loops go through the elements in the order of the equations, so
+   results do not change.
+
+   The elements are still separate variables in the variable list and
+   the R inits file, and separate equations for the analyses that work
+   element by element (dependencies, the Jacobian and its pattern); the
+   functions written from them are looped as well, see
+   PlanJacobLoops().
+
+   Nothing is done if there is an Inline, which could use the locals by
+   name. The loop index and the C arrays have the prefix of the generated
+   identifiers, see ChooseGenPrefix().
+*/
+int PlanArrayLoops(PINPUTINFO pinfo) {
+  PARRAYEQN parr, parrOther;
+  PVMMAPSTRCT pvm, pvmNext;
+  long k, n;
+  int iList;
+
+  vptrans->bArrayLoops = vptrans->bStoredArrays = FALSE;
+  vptrans->parrLoop = NULL;
+  if (!vptrans->parrList || HasInline(pinfo->pvmDynEqns) || HasInline(pinfo->pvmCalcOutEqns)) {
+    return 0;
+  }
+
+  /* The locals of a name go in one C array, described by the first
+     statement on it */
+  for (parr = vptrans->parrList; parr; parr = parr->parrNext) {
+    parr->parrBase = parr;
+    for (parrOther = parr->parrNext; parrOther; parrOther = parrOther->parrNext) {
+      if (!strcmp(parrOther->szName, parr->szName) && parrOther->wContext == parr->wContext) {
+        parr->parrBase = parrOther;
+      }
+    }
+    parr->iMin = parr->iMax = -1;
+    parr->bStored = TRUE; /* So far */
+  }
+
+  for (pvm = pinfo->pvmGloVars; pvm; pvm = pvm->pvmNextVar) {
+    if ((TYPE(pvm) == ID_LOCALDYN || TYPE(pvm) == ID_LOCALCALCOUT) && pvm->parr) {
+      parr = pvm->parr->parrBase;
+      k = strtol(pvm->szName + strlen(parr->szName) + 1, NULL, 10);
+      parr->iMin = (parr->iMin < 0 || k < parr->iMin ? k : parr->iMin);
+      parr->iMax = (k > parr->iMax ? k : parr->iMax);
+      parr->bStored = (parr->bStored && GloVarNamed(pvm->szName, TRUE) == GloVarNamed(pvm->szName, FALSE));
+    }
+  }
+
+  for (parr = vptrans->parrList; parr; parr = parr->parrNext) {
+    parr->bStored = (parr->bStored && parr->parrBase == parr && parr->iMax >= 0);
+    vptrans->bStoredArrays = (vptrans->bStoredArrays || parr->bStored);
+  }
+
+  /* The equations of each statement follow each other */
+  for (iList = 0; iList < 2; iList++) {
+    for (pvm = (iList ? pinfo->pvmCalcOutEqns : pinfo->pvmDynEqns); pvm; pvm = pvmNext) {
+      for (n = 1, pvmNext = pvm->pvmNextVar; pvm->parr && pvmNext && pvmNext->parr == pvm->parr; n++) {
+        pvmNext = pvmNext->pvmNextVar;
+      }
+      if (pvm->parr && !pvm->parr->pvmFirst && n > 1 && n == pvm->parr->iUB - pvm->parr->iLB) {
+        pvm->parr->pvmFirst = pvm;
+        PROPAGATE_EXIT(PlanArrayLoop(pinfo, pvm->parr));
+        vptrans->bArrayLoops = (vptrans->bArrayLoops || pvm->parr->bLoop);
+      }
+    }
+  }
+  return 0;
+
+} /* PlanArrayLoops */
+
+/* ----------------------------------------------------------------------------
+   DropSubstitutedLocals
+
+   Of the Dynamics locals flagged in rgbDynUnused, which depend on
+   parameters only and were substituted in the trees of the equations
+   after them, keeps those still read by an equation written as text:
+   one with no tree (see OptimizeDynamics()), or a CalcOutput equation.
+   The latter are flagged in rgbDynCalcOut, and kept only in the
+   functions that write the CalcOutput equations (see IsDynDropped()).
+   The equations with a tree that read one are written from it.
+*/
+static int DropSubstitutedLocals(PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut, int nEqns) {
+  PVMMAPSTRCT pvm, pvmRead, *rgpvm;
+  BOOL bReads;
+  int i, j;
+
+  if (!(rgpvm = (PVMMAPSTRCT *)malloc((nEqns > 0 ? nEqns : 1) * sizeof(PVMMAPSTRCT)))) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "DropSubstitutedLocals", NULL));
+  }
+  for (i = 0, pvm = pvmDyn; pvm; pvm = pvm->pvmNextVar, i++) {
+    rgpvm[i] = pvm;
+  }
+
+  for (i = 0; i < nEqns; i++) {
+    if (!vptrans->rgbDynUnused[i]) {
+      continue;
+    }
+    for (j = i + 1; j < nEqns && vptrans->rgbDynUnused[i]; j++) {
+      PROPAGATE_EXIT(EqnReads(rgpvm[j], rgpvm[i]->szName, &bReads));
+      if (bReads && vptrans->rgpexDyn[j]) {
+        vptrans->rgbDynRewritten[j] = TRUE;
+      } else if (bReads) {
+        vptrans->rgbDynUnused[i] = FALSE;
+      }
+    }
+    for (pvmRead = pvmCalcOut; pvmRead && !vptrans->rgbDynCalcOut[i]; pvmRead = pvmRead->pvmNextVar) {
+      PROPAGATE_EXIT(EqnReads(pvmRead, rgpvm[i]->szName, &vptrans->rgbDynCalcOut[i]));
+    }
+  }
+
+  free(rgpvm);
+  return 0;
+
+} /* DropSubstitutedLocals */
+
+/* ----------------------------------------------------------------------------
+   OptimizeDynamics
+
+   Parses the Dynamics equations into trees and simplifies them for
+   WriteDerivEqns():
+
+   Arithmetic on numbers is done here (see FoldExpr()).
+
+   Parameter-only subexpressions are taken out, so that they are computed
+   once per simulation by hoist_ctx() instead of at every call of derivs.
+   Each subexpression is classified as constant, parameter-only,
+   input-dependent or state-dependent (see ClassifyExpr()); the largest
+   parameter-only ones get a slot in the context, CTX_HOIST(i), and the
+   equations that contained them are rewritten to read it. Locals and
+   outputs that depend on parameters only are substituted in later
+   equations, so that e.g. Qliv = QCC * pow(BW, 0.75) lets Qliv/Vliv be
+   hoisted too. Others are kept as variables.
+
+   The trees are then shared (see ShareExpr()), for the common
+   subexpressions to be found when they are written. Not if the section
+   assigns states directly, since a state's value could then differ
+   between two uses.
+
+   Equations that cannot be parsed (delays, non-math functions), and those
+   written as loops (see PlanArrayLoops()), are left alone and their
+   variable counts as state-dependent; with an Inline, or if
+   pinfo->bOptimize is FALSE, nothing is done. Nothing is reassociated,
+   so results do not change.
+
+   The substituted locals are then dropped if they can be, see
+   DropSubstitutedLocals().
+*/
+int OptimizeDynamics(PINPUTINFO pinfo) {
+  PVMMAPSTRCT pvm;
+  PEXPRBIND pebBound = NULL, peb;
+  PEXPR pex, pexFolded, pexOut;
+  int i, iRet, iClass, nEqns = 0;
+  BOOL bAssignsStates = FALSE;
+
+  InitExprPool(&vptrans->poolHoist);
+  vptrans->hoist.rgpex = NULL;
+  vptrans->hoist.nSlots = vptrans->hoist.nMax = 0;
+  vptrans->cse.rgpexHash = NULL;
+  vptrans->bCse = FALSE;
+  vptrans->rgpexDyn = NULL;
+  vptrans->rgbDynRewritten = NULL;
+  vptrans->rgbDynUnused = NULL;
+  vptrans->rgbDynCalcOut = NULL;
+  if (!pinfo->bOptimize || HasInline(pinfo->pvmDynEqns)) {
+    return 0;
+  }
+
+  for (pvm = pinfo->pvmDynEqns; pvm; pvm = pvm->pvmNextVar) {
+    nEqns++;
+  }
+  vptrans->rgpexDyn = (PEXPR *)calloc((nEqns > 0 ? nEqns : 1), sizeof(PEXPR));
+  vptrans->rgbDynRewritten = (BOOL *)calloc((nEqns > 0 ? nEqns : 1), sizeof(BOOL));
+  vptrans->rgbDynUnused = (BOOL *)calloc((nEqns > 0 ? nEqns : 1), sizeof(BOOL));
+  vptrans->rgbDynCalcOut = (BOOL *)calloc((nEqns > 0 ? nEqns : 1), sizeof(BOOL));
+  if (!vptrans->rgpexDyn || !vptrans->rgbDynRewritten || !vptrans->rgbDynUnused || !vptrans->rgbDynCalcOut) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "OptimizeDynamics", NULL));
+  }
+
+  for (i = 0, pvm = pinfo->pvmDynEqns; pvm; pvm = pvm->pvmNextVar, i++) {
+    iRet = (pvm->parr && pvm->parr->bLoop ? EX_UNSUPPORTED
+                                          : EqnExpr(&vptrans->poolHoist, pvm, pinfo->pvmGloVars, pebBound, &pex));
+    if (iRet == EX_UNSUPPORTED) {
+      pex = NULL;
+    } else if (iRet) {
+      return (iRet);
+    }
+
+    pexOut = pex;
+    if (pex && (TYPE(pvm) == ID_DERIV || TYPE(pvm) == ID_LOCALDYN || TYPE(pvm) == ID_OUTPUT)) {
+      PROPAGATE_EXIT(FoldExpr(&vptrans->poolHoist, pex, &pexFolded));
+      PROPAGATE_EXIT(HoistExpr(&vptrans->poolHoist, &vptrans->hoist, pexFolded, &pexOut));
+      vptrans->rgpexDyn[i] = pexOut;
+      vptrans->rgbDynRewritten[i] = (pexOut != pex);
+    }
+
+    if (TYPE(pvm) == ID_LOCALDYN || TYPE(pvm) == ID_OUTPUT) {
+      if (!(peb = (PEXPRBIND)malloc(sizeof(EXPRBIND)))) {
+        PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "OptimizeDynamics", NULL));
+      }
+      peb->pvm = GetIndexedVarPTR(pinfo->pvmGloVars, pvm->szName);
+      peb->pebNext = pebBound;
+      pebBound = peb;
+
+      /* The variable is a double: an int expression can't stand for it */
+      iClass = (pex ? ClassifyExpr(pex) : EC_STATE);
+      if (pex && iClass <= EC_PARM && !pex->bInt) {
+        peb->pex = pexOut;
+        vptrans->rgbDynUnused[i] = (TYPE(pvm) == ID_LOCALDYN && !pvm->parr); /* So far */
+      } else {
+        peb->pex = NewVarExpr(&vptrans->poolHoist, peb->pvm, (iClass > EC_INPUT ? iClass : EC_INPUT));
+        if (!peb->pex) {
+          PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "OptimizeDynamics", NULL));
+        }
+      }
+    }
+
+    bAssignsStates = (bAssignsStates || TYPE(pvm) == ID_STATE);
+  }
+
+  while (pebBound) {
+    peb = pebBound->pebNext;
+    free(pebBound);
+    pebBound = peb;
+  }
+  PROPAGATE_EXIT(DropSubstitutedLocals(pinfo->pvmDynEqns, pinfo->pvmCalcOutEqns, nEqns));
+
+  if (!bAssignsStates) {
+    PROPAGATE_EXIT(InitExprCse(&vptrans->cse, (int)vptrans->poolHoist.nNodes));
+    for (i = 0; i < nEqns; i++) {
+      if (vptrans->rgpexDyn[i]) {
+        vptrans->rgpexDyn[i] = ShareExpr(&vptrans->cse, vptrans->rgpexDyn[i]);
+      }
+    }
+    vptrans->bCse = TRUE;
+  }
+  return 0;
+
+} /* OptimizeDynamics */
+
+/* ----------------------------------------------------------------------------
+   Write_R_Hoist
+
+   Writes hoist_ctx(), which computes the subexpressions hoisted by
+   OptimizeDynamics() from the parameters of a context. It is called
+   whenever the parameters are set: in initmod, getParms and outputs, and
+   by the ensemble runner. hoist_batch() does the same for one lane of the
+   batched context, see Write_R_CalcDerivBatch().
+*/
+void Write_R_Hoist(PFILE pfile, PSTR szFunc, PSTR szArgs) {
+  int i;
+
+  fprintf(pfile, "void %s (%s)\n{\n", szFunc, szArgs);
+  for (i = 0; i < vptrans->hoist.nSlots; i++) {
+    fprintf(pfile, "  CTX_HOIST(%d) = ", i);
+    WriteExpr(pfile, vptrans->hoist.rgpex[i], "0.0");
+    fprintf(pfile, ";\n");
+  }
+  fprintf(pfile, "} /* %s */\n\n", szFunc);
+
+} /* Write_R_Hoist */
+
+/* ----------------------------------------------------------------------------
+   WriteInputNumber
+
+   Writes a number of an input definition, with as few digits as give it
+   back exactly.
+*/
+static void WriteInputNumber(PFILE pfile, double dVal) {
+  char sz[32];
+
+  snprintf(sz, sizeof(sz), "%.15g", dVal);
+  if (strtod(sz, NULL) != dVal) {
+    snprintf(sz, sizeof(sz), "%.17g", dVal);
+  }
+  fprintf(pfile, "%s", sz);
+
+} /* WriteInputNumber */
+
+/* ----------------------------------------------------------------------------
+   WriteInputArg
+
+   Writes one argument of the input function of pvmInput, or of a dose
+   of that state: the number dVal, or the parameter of handle hParm if it
+   has one (see DefDepParm()).
+*/
+static int WriteInputArg(PFILE pfile, PVMMAPSTRCT pvmInput, double dVal, HANDLE hParm) {
+  PVMMAPSTRCT pvm;
+
+  if (!hParm) {
+    WriteInputNumber(pfile, dVal);
+    return 0;
+  }
+
+  for (pvm = vptrans->pvmGloVarList; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_PARM && INDEX(pvm) == (hParm & ID_INDEXMASK)) {
+      fprintf(pfile, "%s", GetName(pvm, NULL, NULL, ID_NULL));
+      return 0;
+    }
+  }
+
+  return ReportError(NULL, RE_BADCONTEXT | RE_FATAL, pvmInput->szName,
+                     "Input and dosing functions take numbers or parameters as arguments");
+
+} /* WriteInputArg */
+
+/* ----------------------------------------------------------------------------
+   WriteOne_R_Input
+
+   Writes the assignment of one input defined in the model to its value
+   at time t. Inputs without a definition are forcings passed from R.
+*/
+static int WriteOne_R_Input(PFILE pfile, PVMMAPSTRCT pvm) {
+  PIFN pifn = (PIFN)pvm->szEqn;
+
+  if (!pifn) {
+    return 0;
+  }
+
+  fprintf(pfile, "  %s = ", GetName(pvm, NULL, NULL, ID_NULL));
+  switch (pifn->iType) {
+  case IFN_CONSTANT:
+    WriteInputNumber(pfile, pifn->dMag);
+    break;
+
+  case IFN_NDOSES:
+    fprintf(pfile, "ifn_ndoses(t, %d, vrgdMags_%s, vrgdT0s_%s, vrgdTexps_%s)", pifn->nDoses, pvm->szName,
+            pvm->szName, pvm->szName);
+    break;
+
+  default: /* Periodic */
+    fprintf(pfile, "ifn_%s(t, ",
+            (pifn->iType == IFN_PERDOSE ? "perdose" : (pifn->iType == IFN_PERRATE ? "perrate" : "perexp")));
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dMag, pifn->hMag));
+    fprintf(pfile, ", ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dTper, pifn->hTper));
+    fprintf(pfile, ", ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dT0, pifn->hT0));
+    fprintf(pfile, ", ");
+    if (pifn->iType == IFN_PEREXP) {
+      PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dDecay, pifn->hDecay));
+    } else {
+      PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dTexp, pifn->hTexp));
+    }
+    fprintf(pfile, ")");
+    break;
+  }
+  fprintf(pfile, ";\n");
+  return 0;
+
+} /* WriteOne_R_Input */
+
+/* ----------------------------------------------------------------------------
+   WriteDoseList
+
+   Writes one list of the doses of an NDoses() input, as a constant array.
+*/
+static void WriteDoseList(PFILE pfile, PSTR szList, PVMMAPSTRCT pvm, int nDoses, PDOUBLE rgd) {
+  int i;
+
+  fprintf(pfile, "static const double vrgd%s_%s[%d] = {", szList, pvm->szName, nDoses);
+  for (i = 0; i < nDoses; i++) {
+    if (i) {
+      fprintf(pfile, ", ");
+    }
+    WriteInputNumber(pfile, rgd[i]);
+  }
+  fprintf(pfile, "};\n");
+
+} /* WriteDoseList */
+
+/* ----------------------------------------------------------------------------
+   Write_R_InputsBody
+
+   Writes the assignments of the inputs defined in the model, for
+   inputs_ctx() and inputs_batch().
+*/
+int Write_R_InputsBody(PFILE pfile, PVMMAPSTRCT pvmGlo) {
+  PVMMAPSTRCT pvm;
+
+  for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_INPUT) {
+      PROPAGATE_EXIT(WriteOne_R_Input(pfile, pvm));
+    }
+  }
+  return 0;
+
+} /* Write_R_InputsBody */
+
+/* ----------------------------------------------------------------------------
+   Write_R_InputFns
+
+   Writes inputs_ctx(), which sets the inputs defined in the model to their
+   values at time t, and the functions it calls: periodic inputs are
+   computed from the phase of t in their period, and NDoses() inputs from
+   their lists of doses. The model functions call it at every time they
+   are given, so the inputs need no forcing tables from R. Inputs without
+   a definition stay forcings, in the first slots of forc[], so that the
+   forcings from R and from the ensemble runner fill them as before.
+   Writes nothing if the model defines no input. The times at which these
+   inputs jump are listed by the functions of Write_R_InputTimes().
+
+   PerDose(Mag, Tper, T0, Texp) gives Mag / Texp during the exposure, so
+   that each dose is Mag; PerRate() gives Mag; PerExp(Mag, Tper, T0,
+   Decay) gives Mag exp(-Decay (t - start of the period)) for N_TAU_EXPOSE
+   time constants. A period of 0 exposes once. The exposure times of
+   NDoses() are durations.
+*/
+int Write_R_InputFns(PFILE pfile, PVMMAPSTRCT pvmGlo) {
+  PVMMAPSTRCT pvm;
+  BOOL rgbType[IFN_NDOSES + 1] = {FALSE};
+  PIFN pifn;
+
+  if (!vptrans->nInputFns) {
+    return 0;
+  }
+
+  for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_INPUT && (pifn = (PIFN)pvm->szEqn)) {
+      rgbType[pifn->iType] = TRUE;
+    }
+  }
+
+  fprintf(pfile, "/*----- Inputs defined in the model */\n\n");
+  if (rgbType[IFN_PERDOSE] || rgbType[IFN_PERRATE] || rgbType[IFN_PEREXP]) {
+    fprintf(pfile, "static double ifn_phase (double _t, double _dTper, double _dTstart)\n{\n");
+    fprintf(pfile, "  if (_t < _dTstart) return -1.0;\n");
+    fprintf(pfile, "  return (_dTper > 0.0 ? fmod(_t - _dTstart, _dTper) : _t - _dTstart);\n");
+    fprintf(pfile, "}\n\n");
+  }
+  if (rgbType[IFN_PERDOSE]) {
+    fprintf(pfile, "static double ifn_perdose (double _t, double _dMag, double _dTper, double _dTstart, double _dTexp)\n{\n");
+    fprintf(pfile, "  double _dPhase = ifn_phase(_t, _dTper, _dTstart);\n\n");
+    fprintf(pfile, "  return (_dPhase >= 0.0 && _dPhase < _dTexp ? _dMag / _dTexp : 0.0);\n");
+    fprintf(pfile, "}\n\n");
+  }
+  if (rgbType[IFN_PERRATE]) {
+    fprintf(pfile, "static double ifn_perrate (double _t, double _dMag, double _dTper, double _dTstart, double _dTexp)\n{\n");
+    fprintf(pfile, "  double _dPhase = ifn_phase(_t, _dTper, _dTstart);\n\n");
+    fprintf(pfile, "  return (_dPhase >= 0.0 && _dPhase < _dTexp ? _dMag : 0.0);\n");
+    fprintf(pfile, "}\n\n");
+  }
+  if (rgbType[IFN_PEREXP]) {
+    fprintf(pfile, "static double ifn_perexp (double _t, double _dMag, double _dTper, double _dTstart, double _dDecay)\n{\n");
+    fprintf(pfile, "  double _dPhase = ifn_phase(_t, _dTper, _dTstart);\n\n");
+    fprintf(pfile, "  return (_dPhase >= 0.0 && _dPhase * _dDecay < %d ? _dMag * exp(-_dDecay * _dPhase) : 0.0);\n",
+            N_TAU_EXPOSE);
+    fprintf(pfile, "}\n\n");
+  }
+  if (rgbType[IFN_NDOSES]) {
+    fprintf(pfile, "static double ifn_ndoses (double _t, int _n, const double *_rgdMags, const double *_rgdT0s, ");
+    fprintf(pfile, "const double *_rgdTexps)\n{\n");
+    fprintf(pfile, "  double _dVal = 0.0;\n");
+    fprintf(pfile, "  int _i;\n\n");
+    fprintf(pfile, "  for (_i = 0; _i < _n; _i++)\n");
+    fprintf(pfile, "    if (_t >= _rgdT0s[_i] && _t < _rgdT0s[_i] + _rgdTexps[_i])\n");
+    fprintf(pfile, "      _dVal += _rgdMags[_i];\n");
+    fprintf(pfile, "  return _dVal;\n");
+    fprintf(pfile, "}\n\n");
+
+    for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+      if (TYPE(pvm) == ID_INPUT && (pifn = (PIFN)pvm->szEqn) && pifn->iType == IFN_NDOSES) {
+        WriteDoseList(pfile, "Mags", pvm, pifn->nDoses, pifn->rgMags);
+        WriteDoseList(pfile, "T0s", pvm, pifn->nDoses, pifn->rgT0s);
+        WriteDoseList(pfile, "Texps", pvm, pifn->nDoses, pifn->rgTexps);
+      }
+    }
+    fprintf(pfile, "\n");
+  }
+
+  fprintf(pfile, "void inputs_ctx (MODEL_CTX *%spctx, double t)\n{\n", vptrans->szGen);
+  PROPAGATE_EXIT(Write_R_InputsBody(pfile, pvmGlo));
+  fprintf(pfile, "} /* inputs_ctx */\n\n\n");
+  return 0;
+
+} /* Write_R_InputFns */
+
+/* ----------------------------------------------------------------------------
+   WriteOne_R_InputTimes
+
+   Writes the call that lists the times at which the input pvm, defined in
+   the model, changes abruptly: the start and end of each exposure.
+   PerExp() inputs only jump at the start of their periods.
+*/
+static int WriteOne_R_InputTimes(PFILE pfile, PVMMAPSTRCT pvm) {
+  PIFN pifn = (PIFN)pvm->szEqn;
+
+  if (!pifn || pifn->iType == IFN_CONSTANT) {
+    return 0;
+  }
+
+  if (pifn->iType == IFN_NDOSES) {
+    fprintf(pfile, "  ifn_dosetimes(_rgdTimes, _nMax, &_n, %d, vrgdT0s_%s, vrgdTexps_%s, _dT0, _dT1);\n", pifn->nDoses,
+            pvm->szName, pvm->szName);
+    return 0;
+  }
+
+  fprintf(pfile, "  ifn_pertimes(_rgdTimes, _nMax, &_n, ");
+  PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dTper, pifn->hTper));
+  fprintf(pfile, ", ");
+  PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dT0, pifn->hT0));
+  fprintf(pfile, ", ");
+  if (pifn->iType == IFN_PEREXP) {
+    fprintf(pfile, "0.0");
+  } else {
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pifn->dTexp, pifn->hTexp));
+  }
+  fprintf(pfile, ", _dT0, _dT1); /* %s */\n", pvm->szName);
+  return 0;
+
+} /* WriteOne_R_InputTimes */
+
+/* ----------------------------------------------------------------------------
+   HasInputJumps
+
+   Returns TRUE if an input defined in the model has steps, i.e. is not
+   constant.
+*/
+BOOL HasInputJumps(PVMMAPSTRCT pvmGlo) {
+  PVMMAPSTRCT pvm;
+
+  for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_INPUT && pvm->szEqn && ((PIFN)pvm->szEqn)->iType != IFN_CONSTANT) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+
+} /* HasInputJumps */
+
+/* ----------------------------------------------------------------------------
+   Write_R_InputTimes
+
+   Writes getInputTimes_ctx(), which lists the times from _dT0 up to, but
+   not including, _dT1 at which the inputs defined in the model change
+   abruptly or the doses of pvmDoses are given, sorted and without
+   duplicates. Solvers stop there and restart, instead of finding the
+   steps by failing to integrate across them. It returns the number of
+   times, and fills _rgdTimes only if they fit in _nMax; otherwise it must
+   be called again with room for that many. getInputTimes() is the entry
+   point for R, for the parameters _rgdParms. Writes nothing if no input
+   defined in the model has steps and nothing is dosed. As everywhere in
+   the generated code, the arguments and locals start with _, as the
+   names of the model cannot (see ProcessIdentifier()).
+*/
+int Write_R_InputTimes(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDoses) {
+  PVMMAPSTRCT pvm;
+  PIFN pifn;
+  PDFN pdfn;
+  BOOL bPeriodic = FALSE, bNDoses = FALSE;
+
+  if (!HasInputJumps(pvmGlo) && !pvmDoses) {
+    return 0;
+  }
+  for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_INPUT && (pifn = (PIFN)pvm->szEqn)) {
+      bNDoses = bNDoses || (pifn->iType == IFN_NDOSES);
+      bPeriodic = bPeriodic || (pifn->iType != IFN_NDOSES && pifn->iType != IFN_CONSTANT);
+    }
+  }
+
+  fprintf(pfile, "/*----- Times when the inputs defined in the model jump, and doses */\n\n");
+  fprintf(pfile, "static void ifn_addtime (double *_rgdTimes, int _nMax, int *_pn, double _t, double _dT0, double _dT1)\n");
+  fprintf(pfile, "{\n");
+  fprintf(pfile, "  if (_t >= _dT0 && _t < _dT1) {\n");
+  fprintf(pfile, "    if (*_pn < _nMax) _rgdTimes[*_pn] = _t;\n");
+  fprintf(pfile, "    (*_pn)++;\n");
+  fprintf(pfile, "  }\n");
+  fprintf(pfile, "}\n\n");
+
+  if (bPeriodic) {
+    fprintf(pfile, "static void ifn_pertimes (double *_rgdTimes, int _nMax, int *_pn, double _dTper, double _dTstart, ");
+    fprintf(pfile, "double _dTexp, double _dT0, double _dT1)\n{\n");
+    fprintf(pfile, "  double _dK = 0.0;\n\n");
+    fprintf(pfile, "  if (_dTper > 0.0 && _dT0 - _dTexp > _dTstart)\n");
+    fprintf(pfile, "    _dK = floor((_dT0 - _dTexp - _dTstart) / _dTper);\n");
+    fprintf(pfile, "  for (; _dTstart + _dK * _dTper < _dT1; _dK++) {\n");
+    fprintf(pfile, "    ifn_addtime(_rgdTimes, _nMax, _pn, _dTstart + _dK * _dTper, _dT0, _dT1);\n");
+    fprintf(pfile, "    if (_dTexp > 0.0)\n");
+    fprintf(pfile, "      ifn_addtime(_rgdTimes, _nMax, _pn, _dTstart + _dK * _dTper + _dTexp, _dT0, _dT1);\n");
+    fprintf(pfile, "    if (_dTper <= 0.0)\n");
+    fprintf(pfile, "      break;\n");
+    fprintf(pfile, "  }\n");
+    fprintf(pfile, "}\n\n");
+  }
+
+  if (bNDoses) {
+    fprintf(pfile, "static void ifn_dosetimes (double *_rgdTimes, int _nMax, int *_pn, int _nDoses, ");
+    fprintf(pfile, "const double *_rgdT0s, const double *_rgdTexps, double _dT0, double _dT1)\n{\n");
+    fprintf(pfile, "  int _i;\n\n");
+    fprintf(pfile, "  for (_i = 0; _i < _nDoses; _i++) {\n");
+    fprintf(pfile, "    ifn_addtime(_rgdTimes, _nMax, _pn, _rgdT0s[_i], _dT0, _dT1);\n");
+    fprintf(pfile, "    ifn_addtime(_rgdTimes, _nMax, _pn, _rgdT0s[_i] + _rgdTexps[_i], _dT0, _dT1);\n");
+    fprintf(pfile, "  }\n");
+    fprintf(pfile, "}\n\n");
+  }
+
+  if (pvmDoses) {
+    fprintf(pfile, "static void dfn_times (double *_rgdTimes, int _nMax, int *_pn, double _dTper, double _dTstart, double _dN, ");
+    fprintf(pfile, "double _dT0, double _dT1)\n{\n");
+    fprintf(pfile, "  double _dK = 0.0;\n\n");
+    fprintf(pfile, "  if (_dTper > 0.0 && _dT0 > _dTstart)\n");
+    fprintf(pfile, "    _dK = floor((_dT0 - _dTstart) / _dTper);\n");
+    fprintf(pfile, "  for (; _dTstart + _dK * _dTper < _dT1 && (_dN <= 0.0 || _dK < _dN); _dK++) {\n");
+    fprintf(pfile, "    ifn_addtime(_rgdTimes, _nMax, _pn, _dTstart + _dK * _dTper, _dT0, _dT1);\n");
+    fprintf(pfile, "    if (_dTper <= 0.0)\n");
+    fprintf(pfile, "      break;\n");
+    fprintf(pfile, "  }\n");
+    fprintf(pfile, "}\n\n");
+  }
+
+  fprintf(pfile, "static int ifn_cmptime (const void *_pv1, const void *_pv2)\n{\n");
+  fprintf(pfile, "  double _d1 = *(const double *)_pv1, _d2 = *(const double *)_pv2;\n\n");
+  fprintf(pfile, "  return ((_d1 > _d2) - (_d1 < _d2));\n");
+  fprintf(pfile, "}\n\n");
+
+  fprintf(pfile, "int getInputTimes_ctx (MODEL_CTX *%spctx, double _dT0, double _dT1, double *_rgdTimes, int _nMax)\n{\n", vptrans->szGen);
+  fprintf(pfile, "  int _i, _j, _n = 0;\n\n");
+  for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_INPUT) {
+      PROPAGATE_EXIT(WriteOne_R_InputTimes(pfile, pvm));
+    }
+  }
+  for (pvm = pvmDoses; pvm; pvm = pvm->pvmNextVar) {
+    pdfn = (PDFN)pvm->szEqn;
+    fprintf(pfile, "  dfn_times(_rgdTimes, _nMax, &_n, ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pdfn->dTper, pdfn->hTper));
+    fprintf(pfile, ", ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pdfn->dT0, pdfn->hT0));
+    fprintf(pfile, ", ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pdfn->dN, pdfn->hN));
+    fprintf(pfile, ", _dT0, _dT1); /* %s */\n", pvm->szName);
+  }
+  fprintf(pfile, "\n  if (_n > _nMax)\n");
+  fprintf(pfile, "    return _n;\n\n");
+  fprintf(pfile, "  qsort(_rgdTimes, _n, sizeof(double), ifn_cmptime);\n");
+  fprintf(pfile, "  for (_i = _j = 0; _i < _n; _i++)\n");
+  fprintf(pfile, "    if (_j == 0 || _rgdTimes[_i] > _rgdTimes[_j - 1])\n");
+  fprintf(pfile, "      _rgdTimes[_j++] = _rgdTimes[_i];\n");
+  fprintf(pfile, "  return _j;\n");
+  fprintf(pfile, "} /* getInputTimes_ctx */\n\n");
+
+  fprintf(pfile, "void getInputTimes (double *_rgdParms, double *_pdT0, double *_pdT1, int *_pnMax, ");
+  fprintf(pfile, "double *_rgdTimes, int *_pnTimes)\n{\n");
+  fprintf(pfile, "  int _j;\n\n");
+  fprintf(pfile, "  for (_j = 0; _j < %d; _j++)\n", vptrans->nParms);
+  fprintf(pfile, "    vctxDefault.parms[_j] = _rgdParms[_j];\n");
+  fprintf(pfile, "  hoist_ctx(&vctxDefault);\n\n");
+  fprintf(pfile, "  *_pnTimes = getInputTimes_ctx(&vctxDefault, *_pdT0, *_pdT1, _rgdTimes, *_pnMax);\n");
+  fprintf(pfile, "} /* getInputTimes */\n\n\n");
+  return 0;
+
+} /* Write_R_InputTimes */
+
+/* ----------------------------------------------------------------------------
+   Write_R_InputsCall
+
+   Writes the call that sets the inputs defined in the model at the time
+   szTime, at the start of a model function, if there are any. With
+   delays, it also starts the history at the first call, and drops the
+   delayed variables read by the previous call: the history may have
+   gained a point since.
+*/
+void Write_R_InputsCall(PFILE pfile, PSTR szTime) {
+  if (vptrans->nInputFns) {
+    fprintf(pfile, "  inputs_ctx(%spctx, %s);\n", vptrans->szGen, szTime);
+  }
+  if (vptrans->bDelay) {
+    fprintf(pfile, "  if (!%spctx->nHist)\n", vptrans->szGen);
+    fprintf(pfile, "    hist_start(%spctx, %s, y);\n", vptrans->szGen, szTime);
+    fprintf(pfile, "  %spctx->nLags = 0;\n", vptrans->szGen);
+  }
+
+} /* Write_R_InputsCall */
+
+/* ----------------------------------------------------------------------------
+   WriteBatchLoop
+
+   Writes the loop over lanes of a lane-batched function: the Dynamics
+   equations needed for the derivatives and, if bOutputs, all of them and
+   the CalcOutput equations. The inputs defined in the model are set
+   first, in a loop of their own.
+*/
+int WriteBatchLoop(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut, BOOL bOutputs) {
+  BOOL *rgbEqn;
+
+  if (vptrans->nInputFns) {
+    fprintf(pfile, "  for (%sw = 0; %sw < BATCH_W; %sw++)\n", vptrans->szGen, vptrans->szGen, vptrans->szGen);
+    fprintf(pfile, "    inputs_batch(%spbctx, %sw, pdTime[%sw]);\n\n", vptrans->szGen, vptrans->szGen, vptrans->szGen);
+  }
+  fprintf(pfile, "#if defined(__clang__)\n");
+  fprintf(pfile, "#pragma clang loop vectorize(enable)\n");
+  fprintf(pfile, "#elif defined(__GNUC__)\n");
+  fprintf(pfile, "#pragma GCC ivdep\n");
+  fprintf(pfile, "#endif\n");
+  fprintf(pfile, "  for (%sw = 0; %sw < BATCH_W; %sw++) {\n", vptrans->szGen, vptrans->szGen, vptrans->szGen);
+
+  vptrans->bForBatch = TRUE;
+  rgbEqn = (bOutputs ? vptrans->rgbOutputEqn : (vptrans->bLeanDerivs ? vptrans->rgbDerivEqn : NULL));
+  PROPAGATE_EXIT(WriteModelDecls(pfile, pvmGlo, pvmDyn, pvmCalcOut, rgbEqn));
+  PROPAGATE_EXIT(WriteModelEqns(pfile, pvmDyn, pvmCalcOut, rgbEqn));
+  vptrans->bForBatch = FALSE;
+
+  fprintf(pfile, "  } /* for %sw */\n\n", vptrans->szGen);
+  return 0;
+} /* WriteBatchLoop */
+
+/* ----------------------------------------------------------------------------
+   Write_R_CalcDerivBatch
+
+   Writes derivs_batch(), which evaluates the Dynamics equations for
+   BATCH_W parameter sets (lanes) at once, and outputs_batch(), which
+   computes their outputs as outputs_ctx() does. States, derivatives,
+   outputs and the context are in struct-of-arrays layout
+   ([variable][lane]) and the equations sit in a loop over lanes, so the
+   compiler can vectorize the arithmetic across lanes. Each lane has its
+   own time, for drivers with per-lane step control.
+
+   Parameters and inputs go through the same #defines as in derivs_ctx;
+   only CTX_PARM, CTX_FORC and CTX_HOIST are switched to the batched
+   layout.
+*/
+int Write_R_CalcDerivBatch(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut) {
+  PSTRLEX szArgs;
+
+  if (!vptrans->bBatchKernel) {
+    return 0;
+  }
+
+  fprintf(pfile, "/*----- Lane-batched Dynamics section */\n\n");
+  fprintf(pfile, "#undef CTX_PARM\n");
+  fprintf(pfile, "#undef CTX_FORC\n");
+  fprintf(pfile, "#undef CTX_HOIST\n");
+  fprintf(pfile, "#define CTX_PARM(i) (%spbctx->parms[i][%sw])\n", vptrans->szGen, vptrans->szGen);
+  fprintf(pfile, "#define CTX_FORC(i) (%spbctx->forc[i][%sw])\n", vptrans->szGen, vptrans->szGen);
+  fprintf(pfile, "#define CTX_HOIST(i) (%spbctx->hoist[i][%sw])\n\n", vptrans->szGen, vptrans->szGen);
+
+  snprintf(szArgs, MAX_LEX, "MODEL_BATCH_CTX *%spbctx, int %sw", vptrans->szGen, vptrans->szGen);
+  Write_R_Hoist(pfile, "hoist_batch", szArgs);
+  if (vptrans->nInputFns) {
+    fprintf(pfile, "void inputs_batch (MODEL_BATCH_CTX *%spbctx, int %sw, double t)\n{\n", vptrans->szGen, vptrans->szGen);
+    PROPAGATE_EXIT(Write_R_InputsBody(pfile, pvmGlo));
+    fprintf(pfile, "} /* inputs_batch */\n\n");
+  }
+
+  fprintf(pfile, "void derivs_batch (MODEL_BATCH_CTX *%spbctx, double *pdTime, ", vptrans->szGen);
+  fprintf(pfile, "double (*restrict y)[BATCH_W], double (*restrict ydot)[BATCH_W], ");
+  fprintf(pfile, "double (*restrict yout)[BATCH_W])\n{\n");
+  fprintf(pfile, "  int %sw;\n\n", vptrans->szGen);
+  PROPAGATE_EXIT(WriteBatchLoop(pfile, pvmGlo, pvmDyn, pvmCalcOut, FALSE));
+  fprintf(pfile, "} /* derivs_batch */\n\n");
+
+  fprintf(pfile, "void outputs_batch (MODEL_BATCH_CTX *%spbctx, double *pdTime, ", vptrans->szGen);
+  fprintf(pfile, "double (*restrict y)[BATCH_W], double (*restrict yout)[BATCH_W])\n{\n");
+  if (SetsDerivs(pvmDyn, vptrans->rgbOutputEqn)) {
+    fprintf(pfile, "  double (*ydot)[BATCH_W] = %spbctx->ydot;\n", vptrans->szGen);
+  }
+  fprintf(pfile, "  int %sw;\n\n", vptrans->szGen);
+  PROPAGATE_EXIT(WriteBatchLoop(pfile, pvmGlo, pvmDyn, pvmCalcOut, TRUE));
+  fprintf(pfile, "} /* outputs_batch */\n\n");
+
+  fprintf(pfile, "#undef CTX_PARM\n");
+  fprintf(pfile, "#undef CTX_FORC\n");
+  fprintf(pfile, "#undef CTX_HOIST\n");
+  fprintf(pfile, "#define CTX_PARM(i) (%spctx->parms[i])\n", vptrans->szGen);
+  fprintf(pfile, "#define CTX_FORC(i) (%spctx->forc[i])\n", vptrans->szGen);
+  fprintf(pfile, "#define CTX_HOIST(i) (%spctx->hoist[i])\n\n\n", vptrans->szGen);
+  return 0;
+} /* Write_R_CalcDerivBatch */
+
+/* ----------------------------------------------------------------------------
+   Write_R_InitModel
+
+   Writes the routine to initialize the model variables for R deSolve.
+*/
+void Write_R_InitModel(PFILE pfile, PVMMAPSTRCT pvmGlo) {
+  fprintf(pfile, "/*----- Initializers */\n");
+  fprintf(pfile, "void initmod (void (* _odeparms)(int *, double *))\n{\n");
+  fprintf(pfile, "  int _N=%d;\n", vptrans->nParms);
+  fprintf(pfile, "  _odeparms(&_N, vctxDefault.parms);\n");
+  fprintf(pfile, "  hoist_ctx(&vctxDefault);\n");
+  if (vptrans->bDelay) { /* initmod starts each simulation */
+    fprintf(pfile, "  hist_reset(&vctxDefault);\n");
+  }
+  fprintf(pfile, "}\n\n");
+
+  if (vptrans->bDelay && vptrans->nHistStates == vptrans->nHistVars) {
+    /* dede keeps the history of the states only */
+    fprintf(pfile, "/* initmod for deSolve's dede, whose history CalcDelay reads */\n");
+    fprintf(pfile, "void initmod_dede (void (* _odeparms)(int *, double *))\n{\n");
+    fprintf(pfile, "  initmod(_odeparms);\n");
+    fprintf(pfile, "  vctxDefault.bDeSolveHist = 1;\n");
+    fprintf(pfile, "}\n\n");
+  }
+
+  fprintf(pfile, "void initforc (void (* _odeforcs)(int *, double *))\n{\n");
+  fprintf(pfile, "  int _N=%d;\n", vptrans->nInputs - vptrans->nInputFns);
+  fprintf(pfile, "  _odeforcs(&_N, vctxDefault.forc);\n");
+  fprintf(pfile, "}\n\n\n");
+
+} /* Write_R_InitModel */
+
+/* ----------------------------------------------------------------------------
+   Write_R_ModelInfo
+
+   Writes the model dimensions and accessors to the context fields, so that
+   native drivers (e.g. the ensemble runner) can allocate and fill contexts
+   without knowing the MODEL_CTX layout. The fields are in the order of the
+   MI_ indices of ensemble.h and of .modelInfoNames in R/modelInfo.R.
+*/
+void Write_R_ModelInfo(PFILE pfile, PINPUTINFO pinfo) {
+  PVMMAPSTRCT pvm;
+  int nDoses = 0;
+
+  fprintf(pfile, "/*----- Model dimensions and context access */\n");
+  fprintf(pfile, "void getModelInfo (int *_rgiInfo)\n{\n");
+  fprintf(pfile, "  _rgiInfo[0] = %d; /* States */\n", vptrans->nStates);
+  fprintf(pfile, "  _rgiInfo[1] = %d; /* Outputs */\n", vptrans->nOutputs);
+  fprintf(pfile, "  _rgiInfo[2] = %d; /* Parameters */\n", vptrans->nParms);
+  fprintf(pfile, "  _rgiInfo[3] = %d; /* Inputs passed as forcings */\n", vptrans->nInputs - vptrans->nInputFns);
+  fprintf(pfile, "  _rgiInfo[4] = %d; /* Uses delays: 1 of states only, 2 of outputs too */\n",
+          (!pinfo->bDelays ? 0 : (vptrans->nHistStates < vptrans->nHistVars ? 2 : 1)));
+  fprintf(pfile, "  _rgiInfo[5] = (int) sizeof(MODEL_CTX);\n");
+  if (vptrans->bBatchKernel) {
+    fprintf(pfile, "  _rgiInfo[6] = BATCH_W; /* Lanes of derivs_batch */\n");
+    fprintf(pfile, "  _rgiInfo[7] = (int) sizeof(MODEL_BATCH_CTX);\n");
+  } else {
+    fprintf(pfile, "  _rgiInfo[6] = 0; /* No derivs_batch */\n");
+    fprintf(pfile, "  _rgiInfo[7] = 0;\n");
+  }
+  fprintf(pfile, "  _rgiInfo[8] = %d; /* Outputs left to outputs() */\n", (vptrans->bLeanDerivs ? 1 : 0));
+  fprintf(pfile, "  _rgiInfo[9] = %d; /* jac computes the Jacobian: 1 derived, 2 of the Jacobian section */\n",
+          (pinfo->pvmJacobEqns ? 2 : (vptrans->rgpexJacob ? 1 : 0)));
+  fprintf(pfile, "  _rgiInfo[10] = %ld; /* Nonzeros of getJacobPattern */\n", vptrans->nJacobNonzero);
+  fprintf(pfile, "  _rgiInfo[11] = %d; /* jacvec computes Jacobian columns */\n",
+          (!pinfo->pvmJacobEqns && vptrans->rgpexJacob ? 1 : 0));
+  fprintf(pfile, "  _rgiInfo[12] = %d; /* getInputTimes_ctx gives input jumps or doses */\n",
+          (HasInputJumps(pinfo->pvmGloVars) || pinfo->pvmDoseEqns ? 1 : 0));
+  for (pvm = pinfo->pvmDoseEqns; pvm; pvm = pvm->pvmNextVar) {
+    nDoses++;
+  }
+  fprintf(pfile, "  _rgiInfo[13] = %d; /* Doses given by doses_ctx */\n", nDoses);
+  fprintf(pfile, "  _rgiInfo[14] = %d; /* Root functions of root */\n", vptrans->nRoots);
+  fprintf(pfile, "  _rgiInfo[15] = %d; /* event has Events to give at roots */\n", (pinfo->pvmEventEqns ? 1 : 0));
+  fprintf(pfile, "} /* getModelInfo */\n\n");
+
+  fprintf(pfile, "double *getCtxParms (MODEL_CTX *_pctx) { return _pctx->parms; }\n\n");
+  fprintf(pfile, "double *getCtxForc (MODEL_CTX *_pctx) { return _pctx->forc; }\n\n");
+  if (vptrans->bBatchKernel) {
+    fprintf(pfile, "double *getBatchParms (MODEL_BATCH_CTX *_pbctx) { return &_pbctx->parms[0][0]; }\n\n");
+    fprintf(pfile, "double *getBatchForc (MODEL_BATCH_CTX *_pbctx) { return &_pbctx->forc[0][0]; }\n\n");
+  }
+  fprintf(pfile, "\n");
+
+} /* Write_R_ModelInfo */
+
+/* ----------------------------------------------------------------------------
+   IsIndexedState
+
+   Returns TRUE if pvm is a state entry that holds its index, not the
+   placeholder of a state initialized after its declaration.
+*/
+static BOOL IsIndexedState(PVMMAPSTRCT pvm) {
+  return (TYPE(pvm) == ID_STATE && pvm->szEqn != vszHasInitializer);
+
+} /* IsIndexedState */
+
+/* ----------------------------------------------------------------------------
+   StatesByIndex
+
+   Returns an array of the nStates states of pvmGlo, by index, to be
+   freed by the caller, or NULL if out of memory.
+*/
+static PVMMAPSTRCT *StatesByIndex(PVMMAPSTRCT pvmGlo) {
+  PVMMAPSTRCT pvm, *rgpvmState;
+
+  if ((rgpvmState = (PVMMAPSTRCT *)calloc((vptrans->nStates > 0 ? vptrans->nStates : 1), sizeof(PVMMAPSTRCT)))) {
+    for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+      if (IsIndexedState(pvm)) {
+        rgpvmState[INDEX(pvm)] = pvm;
+      }
+    }
+  }
+  return rgpvmState;
+} /* StatesByIndex */
+
+/* ----------------------------------------------------------------------------
+   BuildSymJacob
+
+   Derives the Jacobian of the Dynamics equations symbolically, for models
+   without a Jacobian section: each dt() equation, with the locals and
+   outputs it reads substituted, is differentiated with respect to each
+   state it may depend on (see BuildJacobPattern()). Sets rgpexJacob, one
+   derivative per nonzero of the pattern, on success; leaves it NULL if
+   the equations cannot be handled (see modexpr.c) or the result is too
+   large, with a warning, in which case the solver builds the Jacobian
+   numerically as before.
+*/
+int BuildSymJacob(PINPUTINFO pinfo) {
+  PVMMAPSTRCT pvm, pvmState, *rgpvmState;
+  PEXPRBIND pebBound = NULL, peb;
+  PEXPR *rgpexRhs, pexD;
+  int i, iRet = 0;
+  long k, nNodes = 0;
+
+  vptrans->rgpexJacob = NULL;
+  InitExprPool(&vptrans->poolJacob);
+  if (pinfo->bDelays || HasInline(pinfo->pvmDynEqns) || vptrans->nStates == 0 || !vptrans->rglJacobRow) {
+    return 0;
+  }
+
+  rgpexRhs = (PEXPR *)calloc(vptrans->nStates, sizeof(PEXPR));
+  rgpvmState = StatesByIndex(pinfo->pvmGloVars);
+  vptrans->rgpexJacob = (PEXPR *)calloc((vptrans->nJacobNonzero > 0 ? vptrans->nJacobNonzero : 1), sizeof(PEXPR));
+  if (!rgpexRhs || !rgpvmState || !vptrans->rgpexJacob) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "BuildSymJacob", NULL));
+  }
+
+  /* Right hand sides, in terms of states, parameters, inputs and time */
+  for (pvm = pinfo->pvmDynEqns; pvm && !iRet; pvm = pvm->pvmNextVar) {
+    switch (TYPE(pvm)) {
+    case ID_DERIV:
+      pvmState = GetIndexedVarPTR(pinfo->pvmGloVars, pvm->szName);
+      iRet = EqnExpr(&vptrans->poolJacob, pvm, pinfo->pvmGloVars, pebBound, &rgpexRhs[INDEX(pvmState)]);
+      break;
+
+    case ID_LOCALDYN:
+    case ID_OUTPUT:
+      if (!(peb = (PEXPRBIND)malloc(sizeof(EXPRBIND)))) {
+        PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "BuildSymJacob", NULL));
+      }
+      peb->pvm = GetIndexedVarPTR(pinfo->pvmGloVars, pvm->szName);
+      peb->pebNext = pebBound;
+      pebBound = peb;
+      iRet = EqnExpr(&vptrans->poolJacob, pvm, pinfo->pvmGloVars, pebBound->pebNext, &peb->pex);
+      break;
+
+    default: /* State assignments, SBML functions */
+      iRet = EX_UNSUPPORTED;
+      break;
+    }
+  }
+
+  /* Only the nonzeros of the pattern, the others are structural zeros */
+  for (i = 0; i < vptrans->nStates && !iRet; i++) {
+    for (k = vptrans->rglJacobRow[i]; k < vptrans->rglJacobRow[i + 1] && rgpexRhs[i] && !iRet; k++) {
+      iRet = DiffExpr(&vptrans->poolJacob, rgpexRhs[i], rgpvmState[vptrans->rgiJacobCol[k]], &pexD);
+      if (!iRet && !IsZeroExpr(pexD)) {
+        vptrans->rgpexJacob[k] = pexD;
+        nNodes += CountExprNodes(pexD, MAX_JACOB_NODES);
+        iRet = (nNodes >= MAX_JACOB_NODES ? EX_UNSUPPORTED : 0);
+      }
+    }
+  }
+
+  while (pebBound) {
+    peb = pebBound->pebNext;
+    free(pebBound);
+    pebBound = peb;
+  }
+  free(rgpexRhs);
+  free(rgpvmState);
+
+  if (iRet == EX_UNSUPPORTED && nNodes >= MAX_JACOB_NODES) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_TOOLARGE | RE_WARNING, "The derived Jacobian",
+                               "The solvers compute the Jacobian by finite differences."));
+  }
+  if (iRet == EX_UNSUPPORTED) {
+    free(vptrans->rgpexJacob);
+    vptrans->rgpexJacob = NULL;
+    FreeExprPool(&vptrans->poolJacob);
+    return 0;
+  }
+  return (iRet);
+
+} /* BuildSymJacob */
+
+/* ----------------------------------------------------------------------------
+   GloVarSlot
+
+   Returns a number of szName in the global variable list pvmGlo, below
+   *pnSlots, or -1 if it is not there: its entry in the index of the list
+   if pvmGlo is indexed, its position otherwise.
+*/
+static long GloVarSlot(PVMMAPSTRCT pvmGlo, PSTR szName, long *pnSlots) {
+  PVMMAPSTRCT pvm;
+  int iOrder = GlobalOrder(pvmGlo);
+  long i, iFound = -1;
+
+  if (iOrder) {
+    *pnSlots = vptrans->vxGlo.nEntries;
+    return FindVarEntry(&vptrans->vxGlo, szName, iOrder < 0);
+  }
+
+  for (i = 0, pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar, i++) {
+    if (iFound < 0 && !strcmp(pvm->szName, szName)) {
+      iFound = i;
+    }
+  }
+  *pnSlots = i;
+  return (iFound);
+
+} /* GloVarSlot */
+
+/* ----------------------------------------------------------------------------
+   CompareInts
+
+   qsort() comparison of ints, in increasing order.
+*/
+static int CompareInts(const void *pA, const void *pB) {
+  int iA = *(const int *)pA, iB = *(const int *)pB;
+
+  return ((iA > iB) - (iA < iB));
+
+} /* CompareInts */
+
+/* ----------------------------------------------------------------------------
+   IsInlineAssigned
+
+   Returns TRUE if the identifier of an Inline from szId to szEnd is
+   assigned there: followed by =, an assignment operator, ++ or --, or
+   preceded by ++ or --.
+*/
+static BOOL IsInlineAssigned(PSTR szInline, PSTR szId, PSTR szEnd) {
+  while (isspace((unsigned char)*szEnd)) {
+    szEnd++;
+  }
+  while (szId > szInline && isspace((unsigned char)szId[-1])) {
+    szId--;
+  }
+
+  return ((szEnd[0] == '=' && szEnd[1] != '=') || (szEnd[0] && strchr("+-*/%&|^", szEnd[0]) && szEnd[1] == '=') ||
+          ((szEnd[0] == '+' || szEnd[0] == '-') && szEnd[1] == szEnd[0]) ||
+          (szId - szInline >= 2 && (szId[-1] == '+' || szId[-1] == '-') && szId[-2] == szId[-1]));
+
+} /* IsInlineAssigned */
+
+/* ----------------------------------------------------------------------------
+   BuildJacobPattern
+
+   Derives which states each derivative may depend on from the identifiers
+   the Dynamics equations read. Going through the equations in order, each
+   assigned variable gets the set of states read by its equation, through
+   the variables assigned before it; a dt() equation sets the row of its
+   state. Both branches of a conditional count, and so does the state of a
+   CalcDelay(). The sets are sorted lists of state indices, so that the
+   time and memory taken grow with the nonzeros, not the square of the
+   number of states.
+
+   Inlines are opaque C: the model variables an Inline assigns may depend
+   on every state, and if it names y or ydot every derivative may.
+
+   Sets rglJacobRow, rgiJacobCol and nJacobNonzero.
+*/
+int BuildJacobPattern(PINPUTINFO pinfo) {
+  PVMMAPSTRCT pvm, pvmVar;
+  PEQN peqn;
+  PSTR sz, szId;
+  PSTRLEX szLex;
+  int **rgpiSet, *rgnSet, **rgpiRow, *rgnRow, *rgiAll, *rgiStamp, *rgiList;
+  int i, j, k, nList, n = vptrans->nStates;
+  long iSlot, nSlots, iRow;
+  BOOL bDense = FALSE;
+
+  free(vptrans->rglJacobRow);
+  free(vptrans->rgiJacobCol);
+  vptrans->rglJacobRow = NULL;
+  vptrans->rgiJacobCol = NULL;
+  vptrans->nJacobNonzero = 0;
+  if (n == 0) {
+    return 0;
+  }
+
+  GloVarSlot(pinfo->pvmGloVars, "", &nSlots);
+
+  /* Sets of states each global variable depends on, NULL if none; those
+     that depend on all states share rgiAll */
+  rgpiSet = (int **)calloc((nSlots > 0 ? nSlots : 1), sizeof(int *));
+  rgnSet = (int *)calloc((nSlots > 0 ? nSlots : 1), sizeof(int));
+  rgpiRow = (int **)calloc(n, sizeof(int *));
+  rgnRow = (int *)calloc(n, sizeof(int));
+  rgiAll = (int *)malloc(n * sizeof(int));
+  rgiStamp = (int *)malloc(n * sizeof(int));
+  rgiList = (int *)malloc(n * sizeof(int));
+  vptrans->rglJacobRow = (long *)malloc((n + 1) * sizeof(long));
+  if (!rgpiSet || !rgnSet || !rgpiRow || !rgnRow || !rgiAll || !rgiStamp || !rgiList || !vptrans->rglJacobRow) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "BuildJacobPattern", NULL));
+  }
+  for (j = 0; j < n; j++) {
+    rgiAll[j] = j;
+    rgiStamp[j] = -1;
+  }
+
+  for (pvm = pinfo->pvmGloVars; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_STATE && (iSlot = GloVarSlot(pinfo->pvmGloVars, pvm->szName, &nSlots)) >= 0 &&
+        !rgpiSet[iSlot]) {
+      if (!(rgpiSet[iSlot] = (int *)malloc(sizeof(int)))) {
+        PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "BuildJacobPattern", NULL));
+      }
+      pvmVar = GetIndexedVarPTR(pinfo->pvmGloVars, pvm->szName);
+      rgpiSet[iSlot][0] = INDEX(pvmVar);
+      rgnSet[iSlot] = 1;
+    }
+  }
+
+  for (i = 0, pvm = pinfo->pvmDynEqns; pvm; pvm = pvm->pvmNextVar, i++) {
+    if (TYPE(pvm) == ID_INLINE) {
+      for (sz = pvm->szEqn; (sz = NextInlineId(sz, szLex));) {
+        szId = sz - strlen(szLex);
+        if (!strcmp(szLex, "y") || !strcmp(szLex, "ydot")) {
+          bDense = TRUE;
+        } else if ((iSlot = GloVarSlot(pinfo->pvmGloVars, szLex, &nSlots)) >= 0 &&
+                   IsInlineAssigned(pvm->szEqn, szId, sz)) {
+          if (rgpiSet[iSlot] != rgiAll) {
+            free(rgpiSet[iSlot]);
+          }
+          rgpiSet[iSlot] = rgiAll;
+          rgnSet[iSlot] = n;
+        }
+      }
+      continue;
+    }
+
+    /* The union of the sets of the variables read, stamped with i */
+    nList = 0;
+    PROPAGATE_EXIT(GetEqn(pvm, &peqn));
+    for (k = 0; k < peqn->nLex; k++) {
+      if (peqn->rglex[k].iType == LX_IDENTIFIER &&
+          (iSlot = GloVarSlot(pinfo->pvmGloVars, peqn->rglex[k].sz, &nSlots)) >= 0) {
+        for (j = 0; j < rgnSet[iSlot]; j++) {
+          if (rgiStamp[rgpiSet[iSlot][j]] != i) {
+            rgiStamp[rgpiSet[iSlot][j]] = i;
+            rgiList[nList++] = rgpiSet[iSlot][j];
+          }
+        }
+      }
+    }
+    qsort(rgiList, nList, sizeof(int), CompareInts);
+
+    if (!(pvmVar = GetIndexedVarPTR(pinfo->pvmGloVars, pvm->szName))) {
+      continue;
+    }
+    if (TYPE(pvm) == ID_DERIV) {
+      free(rgpiRow[INDEX(pvmVar)]);
+      if (!(rgpiRow[INDEX(pvmVar)] = (int *)malloc((nList > 0 ? nList : 1) * sizeof(int)))) {
+        PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "BuildJacobPattern", NULL));
+      }
+      memcpy(rgpiRow[INDEX(pvmVar)], rgiList, nList * sizeof(int));
+      rgnRow[INDEX(pvmVar)] = nList;
+    } else if ((iSlot = GloVarSlot(pinfo->pvmGloVars, pvm->szName, &nSlots)) >= 0) {
+      if (rgpiSet[iSlot] != rgiAll) {
+        free(rgpiSet[iSlot]);
+      }
+      if (!(rgpiSet[iSlot] = (int *)malloc((nList > 0 ? nList : 1) * sizeof(int)))) {
+        PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "BuildJacobPattern", NULL));
+      }
+      memcpy(rgpiSet[iSlot], rgiList, nList * sizeof(int));
+      rgnSet[iSlot] = nList;
+    }
+  }
+
+  /* The rows, one after the other */
+  for (i = 0, iRow = 0; i < n; i++) {
+    vptrans->rglJacobRow[i] = iRow;
+    iRow += (bDense ? n : rgnRow[i]);
+  }
+  vptrans->rglJacobRow[n] = vptrans->nJacobNonzero = iRow;
+  if (!(vptrans->rgiJacobCol = (int *)malloc((iRow > 0 ? iRow : 1) * sizeof(int)))) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "BuildJacobPattern", NULL));
+  }
+  for (i = 0; i < n; i++) {
+    memcpy(&vptrans->rgiJacobCol[vptrans->rglJacobRow[i]], (bDense ? rgiAll : rgpiRow[i]),
+           (vptrans->rglJacobRow[i + 1] - vptrans->rglJacobRow[i]) * sizeof(int));
+    free(rgpiRow[i]);
+  }
+
+  for (iSlot = 0; iSlot < nSlots; iSlot++) {
+    if (rgpiSet[iSlot] != rgiAll) {
+      free(rgpiSet[iSlot]);
+    }
+  }
+  free(rgpiSet);
+  free(rgnSet);
+  free(rgpiRow);
+  free(rgnRow);
+  free(rgiAll);
+  free(rgiStamp);
+  free(rgiList);
+  return 0;
+
+} /* BuildJacobPattern */
+
+/* ----------------------------------------------------------------------------
+   JacobByColumn
+
+   Sets *prglCol, nStates + 1 starts, and *prglEntry and *prgiRow,
+   nJacobNonzero entries, so that the nonzeros of column j of the pattern
+   are from (*prglCol)[j] to (*prglCol)[j + 1] - 1 by row: each is entry
+   (*prglEntry)[k] of rgiJacobCol, in row (*prgiRow)[k].
+*/
+static int JacobByColumn(long **prglCol, long **prglEntry, int **prgiRow) {
+  int i, n = vptrans->nStates;
+  long k, *rglNext;
+
+  *prglCol = (long *)calloc(n + 1, sizeof(long));
+  *prglEntry = (long *)malloc((vptrans->nJacobNonzero > 0 ? vptrans->nJacobNonzero : 1) * sizeof(long));
+  *prgiRow = (int *)malloc((vptrans->nJacobNonzero > 0 ? vptrans->nJacobNonzero : 1) * sizeof(int));
+  rglNext = (long *)malloc((n > 0 ? n : 1) * sizeof(long));
+  if (!*prglCol || !*prglEntry || !*prgiRow || !rglNext) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "JacobByColumn", NULL));
+  }
+
+  for (k = 0; k < vptrans->nJacobNonzero; k++) {
+    (*prglCol)[vptrans->rgiJacobCol[k] + 1]++;
+  }
+  for (i = 0; i < n; i++) {
+    (*prglCol)[i + 1] += (*prglCol)[i];
+    rglNext[i] = (*prglCol)[i];
+  }
+  for (i = 0; i < n; i++) {
+    for (k = vptrans->rglJacobRow[i]; k < vptrans->rglJacobRow[i + 1]; k++) {
+      (*prgiRow)[rglNext[vptrans->rgiJacobCol[k]]] = i;
+      (*prglEntry)[rglNext[vptrans->rgiJacobCol[k]]++] = k;
+    }
+  }
+
+  free(rglNext);
+  return 0;
+
+} /* JacobByColumn */
+
+/* ----------------------------------------------------------------------------
+   CountExprVars
+
+   Returns the number of variables WriteExpr() writes for pex, repeats
+   included.
+*/
+static int CountExprVars(PEXPR pex) {
+  int i, n = (pex->iOp == EX_VAR ? 1 : 0);
+
+  for (i = 0; i < pex->nArgs; i++) {
+    n += CountExprVars(pex->rgpexArg[i]);
+  }
+  return (n);
+
+} /* CountExprVars */
+
+/* ----------------------------------------------------------------------------
+   StepsAlong
+
+   Returns TRUE if pex is pex0 lRow rows down a run of PlanJacobLoops():
+   the same tree, but for variables that step through an array by
+   rglStride, in WriteExpr() order from *piVar. The first row down sets
+   the strides.
+*/
+static BOOL StepsAlong(PINPUTINFO pinfo, PEXPR pex0, PEXPR pex, long lRow, long *rglStride, int *piVar) {
+  PVMMAPSTRCT pvm0, pvm;
+  long lAddr0, lAddr, lStep = 0;
+  int i;
+
+  if (pex0->iOp != pex->iOp || pex0->bInt != pex->bInt || pex0->nArgs != pex->nArgs) {
+    return (FALSE);
+  }
+
+  switch (pex0->iOp) {
+  case EX_NUM:
+    return (!memcmp(&pex0->dVal, &pex->dVal, sizeof(double)));
+
+  case EX_HOIST:
+    return (pex0->iSlot == pex->iSlot);
+
+  case EX_VAR:
+    i = (*piVar)++;
+    if (pex0->pvm != pex->pvm) {
+      if (!LoopAddress(pinfo, pex0->pvm->szName, &pvm0, &lAddr0) || !LoopAddress(pinfo, pex->pvm->szName, &pvm, &lAddr) ||
+          !SameArray(pvm0, pvm)) {
+        return (FALSE);
+      }
+      lStep = lAddr - lAddr0;
+    }
+    if (lRow == 1) {
+      rglStride[i] = lStep;
+    }
+    return (lStep == lRow * rglStride[i]);
+
+  case EX_REL:
+  case EX_CALL:
+    if (strcmp(pex0->szName, pex->szName)) {
+      return (FALSE);
+    }
+    break;
+  }
+
+  for (i = 0; i < pex0->nArgs; i++) {
+    if (!StepsAlong(pinfo, pex0->rgpexArg[i], pex->rgpexArg[i], lRow, rglStride, piVar)) {
+      return (FALSE);
+    }
+  }
+  return (TRUE);
+
+} /* StepsAlong */
+
+/* ----------------------------------------------------------------------------
+   RowStepsAlong
+
+   Returns TRUE if row i of the symbolic Jacobian is row i0 lRow rows
+   down a run of PlanJacobLoops(): as many entries, at columns stepping by
+   rglJacobColStride, of trees stepping along those of row i0 (see
+   StepsAlong()). The first row down sets the strides.
+*/
+static BOOL RowStepsAlong(PINPUTINFO pinfo, int i0, int i, long lRow) {
+  long k0, k, p, n = vptrans->rglJacobRow[i0 + 1] - vptrans->rglJacobRow[i0];
+  PEXPR pex0, pex;
+  int iVar;
+
+  if (vptrans->rglJacobRow[i + 1] - vptrans->rglJacobRow[i] != n) {
+    return (FALSE);
+  }
+  for (p = 0; p < n; p++) {
+    k0 = vptrans->rglJacobRow[i0] + p;
+    k = vptrans->rglJacobRow[i] + p;
+    pex0 = vptrans->rgpexJacob[k0];
+    pex = vptrans->rgpexJacob[k];
+    if (lRow == 1) {
+      vptrans->rglJacobColStride[k0] = vptrans->rgiJacobCol[k] - vptrans->rgiJacobCol[k0];
+    }
+    iVar = 0;
+    if (vptrans->rglJacobColStride[k0] < 0 ||
+        vptrans->rgiJacobCol[k] - vptrans->rgiJacobCol[k0] != lRow * vptrans->rglJacobColStride[k0] || !pex0 != !pex ||
+        (pex0 && !StepsAlong(pinfo, pex0, pex, lRow, vptrans->rgplJacobStride[k0], &iVar))) {
+      return (FALSE);
+    }
+  }
+  return (TRUE);
+
+} /* RowStepsAlong */
+
+/* ----------------------------------------------------------------------------
+   PlanJacobLoops
+
+   Plans the writing of the symbolic Jacobian of an array of dt()
+   statements as loops, as PlanArrayLoops() does for the equations: rows
+   of one array statement, with as many entries at columns stepping by a
+   fixed stride and whose derivatives differ only by variables stepping
+   through an array, go in runs of rows (see vptrans->rglJacobRun) that
+   jac_ctx() and jacvec() write as one loop per entry.
+*/
+static int PlanJacobLoops(PINPUTINFO pinfo) {
+  PVMMAPSTRCT pvm, pvmState;
+  PARRAYEQN *rgparrRow;
+  int i, i0, nVars, n = vptrans->nStates;
+  long k;
+
+  vptrans->rglJacobRun = NULL;
+  vptrans->rglJacobColStride = NULL;
+  vptrans->rgplJacobStride = NULL;
+  if (!vptrans->rgpexJacob || n == 0) {
+    return 0;
+  }
+
+  rgparrRow = (PARRAYEQN *)calloc(n, sizeof(PARRAYEQN));
+  vptrans->rglJacobRun = (long *)malloc(n * sizeof(long));
+  vptrans->rglJacobColStride = (long *)calloc((vptrans->nJacobNonzero > 0 ? vptrans->nJacobNonzero : 1), sizeof(long));
+  vptrans->rgplJacobStride = (long **)calloc((vptrans->nJacobNonzero > 0 ? vptrans->nJacobNonzero : 1), sizeof(long *));
+  if (!rgparrRow || !vptrans->rglJacobRun || !vptrans->rglJacobColStride || !vptrans->rgplJacobStride) {
+    PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "PlanJacobLoops", NULL));
+  }
+
+  for (k = 0; k < vptrans->nJacobNonzero; k++) {
+    if (vptrans->rgpexJacob[k] && (nVars = CountExprVars(vptrans->rgpexJacob[k])) > 0 &&
+        !(vptrans->rgplJacobStride[k] = (long *)ModelAlloc(nVars * sizeof(long)))) {
+      PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "PlanJacobLoops", NULL));
+    }
+  }
+
+  /* The array statement of the dt() of each row */
+  for (pvm = pinfo->pvmDynEqns; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_DERIV) {
+      pvmState = GetIndexedVarPTR(pinfo->pvmGloVars, pvm->szName);
+      rgparrRow[INDEX(pvmState)] = pvm->parr;
+    }
+  }
+
+  for (i0 = 0; i0 < n; i0 += (int)vptrans->rglJacobRun[i0]) {
+    vptrans->rglJacobRun[i0] = 1;
+    for (i = i0 + 1; i < n && rgparrRow[i0] && rgparrRow[i] == rgparrRow[i0] && RowStepsAlong(pinfo, i0, i, i - i0); i++) {
+      vptrans->rglJacobRun[i0]++;
+      vptrans->rglJacobRun[i] = 0;
+    }
+  }
+
+  free(rgparrRow);
+  return 0;
+
+} /* PlanJacobLoops */
+
+/* ----------------------------------------------------------------------------
+   InJacobLoop
+
+   Returns TRUE if the entries of row i of the symbolic Jacobian are
+   written in a loop of PlanJacobLoops().
+*/
+static BOOL InJacobLoop(int i) {
+  return (vptrans->rglJacobRun && vptrans->rglJacobRun[i] != 1);
+
+} /* InJacobLoop */
+
+/* ----------------------------------------------------------------------------
+   WriteJacobLoopExpr
+
+   Writes entry k0, the first of its loop (see PlanJacobLoops()), as the
+   loop writes it.
+*/
+static void WriteJacobLoopExpr(PFILE pfile, long k0) {
+  vptrans->rglExprStride = vptrans->rgplJacobStride[k0];
+  vptrans->iExprVar = 0;
+  WriteExpr(pfile, vptrans->rgpexJacob[k0], "(*t)");
+  vptrans->rglExprStride = NULL;
+
+} /* WriteJacobLoopExpr */
+
+/* ----------------------------------------------------------------------------
+   WriteLoopIndex
+
+   Writes ID_szName, stepped by lStride per pass of a loop.
+*/
+static void WriteLoopIndex(PFILE pfile, PSTR szName, long lStride) {
+  if (!lStride) {
+    fprintf(pfile, "ID_%s", szName);
+  } else if (lStride == 1) {
+    fprintf(pfile, "ID_%s + %siElem", szName, vptrans->szGen);
+  } else {
+    fprintf(pfile, "ID_%s + %ld * %siElem", szName, lStride, vptrans->szGen);
+  }
+
+} /* WriteLoopIndex */
+
+/* ----------------------------------------------------------------------------
+   Write_R_JacobPattern
+
+   Writes the sparsity pattern of BuildJacobPattern() as the (row, column)
+   pairs of its nonzeros, 1-based and by column, which is what lsodes takes
+   as inz. getModelInfo() gives their number.
+*/
+int Write_R_JacobPattern(PFILE pfile) {
+  int iPass, j, *rgiRow;
+  long n, *rglCol, *rglEntry;
+
+  if (vptrans->nJacobNonzero == 0) {
+    return 0;
+  }
+
+  PROPAGATE_EXIT(JacobByColumn(&rglCol, &rglEntry, &rgiRow));
+  fprintf(pfile, "/*----- Jacobian sparsity pattern */\n");
+  for (iPass = 0; iPass < 2; iPass++) {
+    fprintf(pfile, "static const int %s[%ld] = {", (iPass ? "vrgiJacobCol" : "vrgiJacobRow"), vptrans->nJacobNonzero);
+    for (n = 0, j = 0; j < vptrans->nStates; j++) {
+      for (; n < rglCol[j + 1]; n++) {
+        fprintf(pfile, "%s%s%d", (n ? "," : ""), (n % 16 ? " " : "\n  "), (iPass ? j : rgiRow[n]) + 1);
+      }
+    }
+    fprintf(pfile, "\n};\n\n");
+  }
+  free(rglCol);
+  free(rglEntry);
+  free(rgiRow);
+
+  fprintf(pfile, "void getJacobPattern (int *_rgiRow, int *_rgiCol)\n{\n");
+  fprintf(pfile, "  memcpy(_rgiRow, vrgiJacobRow, sizeof(vrgiJacobRow));\n");
+  fprintf(pfile, "  memcpy(_rgiCol, vrgiJacobCol, sizeof(vrgiJacobCol));\n");
+  fprintf(pfile, "} /* getJacobPattern */\n\n\n");
+  return 0;
+
+} /* Write_R_JacobPattern */
+
+/* ----------------------------------------------------------------------------
+   ReadsContext
+
+   Returns TRUE if pex, as WriteExpr() writes it, reads the model context:
+   a parameter, an input or a hoisted subexpression.
+*/
+static BOOL ReadsContext(PEXPR pex) {
+  int i;
+
+  if (pex->iOp == EX_HOIST ||
+      (pex->iOp == EX_VAR && (TYPE(pex->pvm) == ID_PARM || TYPE(pex->pvm) == ID_INPUT))) {
+    return TRUE;
+  }
+  for (i = 0; i < pex->nArgs; i++) {
+    if (ReadsContext(pex->rgpexArg[i])) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+
+} /* ReadsContext */
+
+/* ----------------------------------------------------------------------------
+   Write_R_CalcJacob
+
+   Writes jac_ctx() from the Jacobian section, or, if there is none, from
+   the symbolic Jacobian of BuildSymJacob(). pd is column-major:
+   pd[i + nrowpd * j] is the derivative of dt(state i) with respect to
+   state j. The entries of a symbolic Jacobian repeat the same
+   subexpressions a lot; these are computed once, into locals (see
+   WriteExprTemps()), unless vptrans->bOptimize is FALSE; the rows of an
+   array statement are written as loops where they can be (see
+   PlanJacobLoops()). The arguments keep deSolve's names (pd, nrowpd...)
+   for the Inlines of a Jacobian section, which fill pd; otherwise they
+   and the locals start with _, as parameters cannot.
+*/
+int Write_R_CalcJacob(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmJacob) {
+  PVMMAPSTRCT pvmI, pvmJ, *rgpvmState = NULL;
+  EXPRCSE cse;
+  long i, k, n, *rglCol, *rglEntry;
+  int *rgiRow;
+  BOOL bCtx, bLoops = FALSE, bBlank;
+
+  fprintf(pfile, "/*----- Jacobian calculations: */\n");
+  if (pvmJacob || !vptrans->rgpexJacob) {
+    fprintf(pfile, "void jac_ctx (MODEL_CTX *%spctx, int *neq, double *t, double *y, int *ml, ", vptrans->szGen);
+    fprintf(pfile, "int *mu, ");
+    fprintf(pfile, "double *pd, int *nrowpd, double *yout)\n");
+    fprintf(pfile, "{\n");
+    PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALJACOB, NULL));
+    Write_R_InputsCall(pfile, "*t");
+    PROPAGATE_EXIT(ForAllVar(pfile, pvmJacob, &WriteOneEquation, ALL_VARS, (PVOID)KM_JACOB));
+  } else {
+    fprintf(pfile, "void jac_ctx (MODEL_CTX *%spctx, int *_neq, double *t, double *y, int *_ml, ", vptrans->szGen);
+    fprintf(pfile, "int *_mu, ");
+    fprintf(pfile, "double *_pd, int *_nrowpd, double *yout)\n");
+    fprintf(pfile, "{\n");
+    fprintf(pfile, "  int _i, _j;\n");
+    for (i = 0, bLoops = FALSE; i < vptrans->nStates && !bLoops; i++) {
+      bLoops = InJacobLoop((int)i);
+    }
+    if (bLoops) {
+      fprintf(pfile, "  int %siElem;\n", vptrans->szGen);
+    }
+    fprintf(pfile, "\n");
+    if (vptrans->nInputFns) {
+      Write_R_InputsCall(pfile, "*t");
+      fprintf(pfile, "\n");
+    }
+    fprintf(pfile, "  for (_j = 0; _j < %d; _j++)\n", vptrans->nStates);
+    fprintf(pfile, "    for (_i = 0; _i < %d; _i++)\n", vptrans->nStates);
+    fprintf(pfile, "      _pd[_i + (*_nrowpd) * _j] = 0.0;\n\n");
+
+    if (!(rgpvmState = StatesByIndex(pvmGlo))) {
+      PROPAGATE_EXIT(ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "Write_R_CalcJacob", NULL));
+    }
+    PROPAGATE_EXIT(InitExprCse(&cse, (int)vptrans->poolJacob.nNodes));
+    for (i = 0; i < vptrans->nStates; i++) { /* Loops are written without */
+      for (k = vptrans->rglJacobRow[i]; k < vptrans->rglJacobRow[i + 1] && !InJacobLoop((int)i); k++) {
+        if (vptrans->rgpexJacob[k] && vptrans->bOptimize) {
+          vptrans->rgpexJacob[k] = ShareExpr(&cse, vptrans->rgpexJacob[k]);
+          CountExprUses(vptrans->rgpexJacob[k]);
+        }
+      }
+    }
+
+    for (pvmI = pvmGlo; pvmI; pvmI = pvmI->pvmNextVar) {
+      if (IsIndexedState(pvmI) && InJacobLoop(INDEX(pvmI))) {
+        n = vptrans->rglJacobRun[INDEX(pvmI)];
+        for (k = vptrans->rglJacobRow[INDEX(pvmI)]; k < vptrans->rglJacobRow[INDEX(pvmI) + 1] && n; k++) {
+          if (vptrans->rgpexJacob[k]) {
+            fprintf(pfile, "  for (%siElem = 0; %siElem < %ld; %siElem++)\n    _pd[", vptrans->szGen, vptrans->szGen, n, vptrans->szGen);
+            WriteLoopIndex(pfile, pvmI->szName, 1);
+            fprintf(pfile, " + (*_nrowpd) * %s", (vptrans->rglJacobColStride[k] ? "(" : ""));
+            WriteLoopIndex(pfile, rgpvmState[vptrans->rgiJacobCol[k]]->szName, vptrans->rglJacobColStride[k]);
+            fprintf(pfile, "%s] = ", (vptrans->rglJacobColStride[k] ? ")" : ""));
+            WriteJacobLoopExpr(pfile, k);
+            fprintf(pfile, ";\n");
+          }
+        }
+        continue;
+      }
+
+      for (k = (IsIndexedState(pvmI) ? vptrans->rglJacobRow[INDEX(pvmI)] : 0);
+           IsIndexedState(pvmI) && k < vptrans->rglJacobRow[INDEX(pvmI) + 1]; k++) {
+        PEXPR pex = vptrans->rgpexJacob[k];
+
+        if (pex) {
+          WriteExprTemps(pfile, &cse, pex, "(*t)");
+          fprintf(pfile, "  _pd[ID_%s + (*_nrowpd) * ID_%s] = ", pvmI->szName,
+                  rgpvmState[vptrans->rgiJacobCol[k]]->szName);
+          WriteExpr(pfile, pex, "(*t)");
+          fprintf(pfile, ";\n");
+        }
+      }
+    }
+
+    for (i = 0; i < vptrans->nJacobNonzero; i++) { /* jacvec below is written without */
+      if (vptrans->rgpexJacob[i]) {
+        ResetExprUses(vptrans->rgpexJacob[i]);
+      }
+    }
+    FreeExprCse(&cse);
+  }
+  fprintf(pfile, "\n} /* jac_ctx */\n\n");
+
+  fprintf(pfile, "void jac (int *_neq, double *t, double *y, int *_ml, ");
+  fprintf(pfile, "int *_mu, ");
+  fprintf(pfile, "double *_pd, int *_nrowpd, double *yout, int *_ip)\n");
+  fprintf(pfile, "{\n");
+  fprintf(pfile, "  jac_ctx(&vctxDefault, _neq, t, y, _ml, _mu, _pd, _nrowpd, yout);\n");
+  fprintf(pfile, "} /* jac */\n\n\n");
+
+  /* One column of the symbolic Jacobian at a time, for lsodes */
+  if (!pvmJacob && vptrans->rgpexJacob) {
+    fprintf(pfile, "void jacvec (int *_neq, double *t, double *y, int *_j, int *_ian, int *_jan, ");
+    fprintf(pfile, "double *_pdj, double *yout, int *_ip)\n");
+    fprintf(pfile, "{\n");
+    for (i = 0, bCtx = (vptrans->nInputFns > 0); i < vptrans->nJacobNonzero && !bCtx; i++) {
+      bCtx = (vptrans->rgpexJacob[i] && ReadsContext(vptrans->rgpexJacob[i]));
+    }
+    if (bCtx) { /* as jac_ctx() names it */
+      fprintf(pfile, "  MODEL_CTX *%spctx = &vctxDefault;\n", vptrans->szGen);
+    }
+    fprintf(pfile, "  int _i;\n");
+    if (bLoops) {
+      fprintf(pfile, "  int %siElem;\n", vptrans->szGen);
+    }
+    fprintf(pfile, "\n");
+    if (vptrans->nInputFns) {
+      Write_R_InputsCall(pfile, "*t");
+      fprintf(pfile, "\n");
+    }
+    fprintf(pfile, "  for (_i = 0; _i < %d; _i++)\n", vptrans->nStates);
+    fprintf(pfile, "    _pdj[_i] = 0.0;\n\n");
+    PROPAGATE_EXIT(JacobByColumn(&rglCol, &rglEntry, &rgiRow));
+    for (k = 0, n = 0; k < vptrans->nJacobNonzero; k++) {
+      n += (vptrans->rgpexJacob[rglEntry[k]] && !InJacobLoop(rgiRow[k]));
+    }
+    if (n) {
+      fprintf(pfile, "  switch (*_j - 1) {\n");
+    }
+    for (pvmJ = pvmGlo; pvmJ && n; pvmJ = pvmJ->pvmNextVar) {
+      BOOL bCase = FALSE;
+
+      if (!IsIndexedState(pvmJ)) {
+        continue;
+      }
+      for (k = rglCol[INDEX(pvmJ)]; k < rglCol[INDEX(pvmJ) + 1]; k++) {
+        PEXPR pex = vptrans->rgpexJacob[rglEntry[k]];
+
+        if (pex && !InJacobLoop(rgiRow[k])) {
+          if (!bCase) {
+            fprintf(pfile, "  case ID_%s:\n", pvmJ->szName);
+            bCase = TRUE;
+          }
+          fprintf(pfile, "    _pdj[ID_%s] = ", rgpvmState[rgiRow[k]]->szName);
+          WriteExpr(pfile, pex, "(*t)");
+          fprintf(pfile, ";\n");
+        }
+      }
+      if (bCase) {
+        fprintf(pfile, "    break;\n");
+      }
+    }
+    if (n) {
+      fprintf(pfile, "  }\n");
+    }
+
+    /* The loops, for the columns they step through */
+    for (i = 0, bBlank = (n > 0); i < vptrans->nStates; i++) {
+      n = (InJacobLoop((int)i) ? vptrans->rglJacobRun[i] : 0);
+      for (k = vptrans->rglJacobRow[i]; k < vptrans->rglJacobRow[i + 1] && n; k++) {
+        PSTR szCol = rgpvmState[vptrans->rgiJacobCol[k]]->szName;
+        long lStride = vptrans->rglJacobColStride[k];
+
+        if (!vptrans->rgpexJacob[k]) {
+          continue;
+        }
+        fprintf(pfile, (bBlank ? "\n" : ""));
+        bBlank = TRUE;
+        if (!lStride) {
+          fprintf(pfile, "  if (*_j - 1 == ID_%s)\n", szCol);
+          fprintf(pfile, "    for (%siElem = 0; %siElem < %ld; %siElem++)\n  ", vptrans->szGen, vptrans->szGen, n, vptrans->szGen);
+        } else if (lStride == 1) {
+          fprintf(pfile, "  %siElem = *_j - 1 - ID_%s;\n", vptrans->szGen, szCol);
+          fprintf(pfile, "  if (%siElem >= 0 && %siElem < %ld)\n", vptrans->szGen, vptrans->szGen, n);
+        } else {
+          fprintf(pfile, "  %siElem = (*_j - 1 - ID_%s) / %ld;\n", vptrans->szGen, szCol, lStride);
+          fprintf(pfile, "  if (*_j - 1 >= ID_%s && (*_j - 1 - ID_%s) %% %ld == 0 && %siElem < %ld)\n", szCol, szCol, lStride,
+                  vptrans->szGen, n);
+        }
+        fprintf(pfile, "    _pdj[");
+        WriteLoopIndex(pfile, rgpvmState[i]->szName, 1);
+        fprintf(pfile, "] = ");
+        WriteJacobLoopExpr(pfile, k);
+        fprintf(pfile, ";\n");
+      }
+    }
+    fprintf(pfile, "} /* jacvec */\n\n\n");
+    free(rglCol);
+    free(rglEntry);
+    free(rgiRow);
+  }
+  free(rgpvmState);
+  return 0;
+} /* Write_R_CalcJacob */
+
+/* ----------------------------------------------------------------------------
+   Write_R_Events: may contain Inlines
+*/
+int Write_R_Events(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmEvents) {
+  fprintf(pfile, "/*----- Events calculations: */\n");
+  fprintf(pfile, "void event_ctx (MODEL_CTX *%spctx, int *%sn, double *t, double *y)\n", vptrans->szGen, vptrans->szGen);
+  fprintf(pfile, "{\n");
+  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALEVENT, NULL));
+  Write_R_InputsCall(pfile, "*t");
+  PROPAGATE_EXIT(ForAllVar(pfile, pvmEvents, &WriteOneEquation, ALL_VARS, (PVOID)KM_EVENTS));
+  fprintf(pfile, "\n} /* event_ctx */\n\n");
+
+  fprintf(pfile, "void event (int *_n, double *t, double *y)\n");
+  fprintf(pfile, "{\n");
+  fprintf(pfile, "  event_ctx(&vctxDefault, _n, t, y);\n");
+  fprintf(pfile, "} /* event */\n\n");
+  return 0;
+} /* Write_R_Events */
+
+/* ----------------------------------------------------------------------------
+   CountRoots
+
+   Sets vptrans->nRoots to the number of root functions gout[i] of the
+   Roots section, which must define all of gout[0] to gout[n-1]: deSolve
+   looks for the roots of each.
+*/
+int CountRoots(PVMMAPSTRCT pvmRoots) {
+  PVMMAPSTRCT pvm;
+  int i, n = 0, nDefined = 0;
+  char szMsg[MAX_LEX];
+
+  for (pvm = pvmRoots; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_NULL && (i = RootIndex(pvm->szName)) >= 0) {
+      nDefined++;
+      n = (i >= n ? i + 1 : n);
+    }
+  }
+
+  if (nDefined < n) { /* Each is defined once, see DefineRootEqn() */
+    snprintf(szMsg, MAX_LEX, "Roots{} must define all of gout[0] to gout[%d].\n", n - 1);
+    PROPAGATE_EXIT(ReportError(NULL, RE_FATAL, NULL, szMsg));
+  }
+
+  vptrans->nRoots = n;
+  return 0;
+} /* CountRoots */
+
+/* ----------------------------------------------------------------------------
+   Write_R_Roots: may contain Inlines. The root functions are gout[0] to
+   gout[n-1], n given by getModelInfo.
+*/
+int Write_R_Roots(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmRoots) {
+  fprintf(pfile, "/*----- Roots calculations: */\n");
+  fprintf(pfile, "void root_ctx (MODEL_CTX *%spctx, int *%sneq, double *t, double *y, ", vptrans->szGen, vptrans->szGen);
+  fprintf(pfile, "int *%sng, double *gout, double *%sout)\n", vptrans->szGen, vptrans->szGen);
+  fprintf(pfile, "{\n");
+  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneDecl, ID_LOCALROOT, NULL));
+  Write_R_InputsCall(pfile, "*t");
+  PROPAGATE_EXIT(ForAllVar(pfile, pvmRoots, &WriteOneEquation, ALL_VARS, (PVOID)KM_ROOTS));
+  fprintf(pfile, "\n} /* root_ctx */\n\n");
+
+  fprintf(pfile, "void root (int *_neq, double *t, double *y, ");
+  fprintf(pfile, "int *_ng, double *gout, double *_out, int *_ip)\n");
+  fprintf(pfile, "{\n");
+  fprintf(pfile, "  root_ctx(&vctxDefault, _neq, t, y, _ng, gout, _out);\n");
+  fprintf(pfile, "} /* root */\n\n");
+  return 0;
+} /* Write_R_Roots */
+
+/* ----------------------------------------------------------------------------
+   Write_R_Doses
+
+   Writes doses_ctx(), which gives the states the doses of pvmDoses due
+   at time t, in the order of the Doses section, and doses(), its deSolve
+   event function. They are called at the times listed by
+   getInputTimes_ctx(), so a dose is due if t is one of its dosing times,
+   up to rounding. Writes nothing if nothing is dosed.
+*/
+int Write_R_Doses(PFILE pfile, PVMMAPSTRCT pvmDoses) {
+  static PSTR vrgszDoseOps[] = {NULL, "+=", "=", "*="};
+  PVMMAPSTRCT pvm;
+  PDFN pdfn;
+
+  if (!pvmDoses) {
+    return 0;
+  }
+
+  fprintf(pfile, "/*----- Doses: */\n");
+  fprintf(pfile, "static int dfn_due (double _t, double _dTper, double _dTstart, double _dN)\n{\n");
+  fprintf(pfile, "  double _dK = 0.0;\n\n");
+  fprintf(pfile, "  if (_dTper > 0.0)\n");
+  fprintf(pfile, "    _dK = floor((_t - _dTstart) / _dTper + 0.5);\n");
+  fprintf(pfile, "  return (_dK >= 0.0 && (_dN <= 0.0 || _dK < _dN) && ");
+  fprintf(pfile, "fabs(_dTstart + _dK * _dTper - _t) <= 1e-12 * fmax(1.0, fabs(_t)));\n");
+  fprintf(pfile, "}\n\n");
+
+  fprintf(pfile, "void doses_ctx (MODEL_CTX *%spctx, double t, double *y)\n", vptrans->szGen);
+  fprintf(pfile, "{\n");
+  for (pvm = pvmDoses; pvm; pvm = pvm->pvmNextVar) {
+    pdfn = (PDFN)pvm->szEqn;
+    fprintf(pfile, "  if (dfn_due(t, ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pdfn->dTper, pdfn->hTper));
+    fprintf(pfile, ", ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pdfn->dT0, pdfn->hT0));
+    fprintf(pfile, ", ");
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pdfn->dN, pdfn->hN));
+    fprintf(pfile, "))\n    y[ID_%s] %s ", pvm->szName, vrgszDoseOps[pdfn->iType]);
+    PROPAGATE_EXIT(WriteInputArg(pfile, pvm, pdfn->dVal, pdfn->hVal));
+    fprintf(pfile, ";\n");
+  }
+  fprintf(pfile, "} /* doses_ctx */\n\n");
+
+  fprintf(pfile, "void doses (int *_n, double *_t, double *_y)\n");
+  fprintf(pfile, "{\n");
+  fprintf(pfile, "  doses_ctx(&vctxDefault, *_t, _y);\n");
+  fprintf(pfile, "} /* doses */\n\n");
+  return 0;
+} /* Write_R_Doses */
+
+/* ----------------------------------------------------------------------------
+   IsGenName
+
+   Returns TRUE if szName could be one of the identifiers of the generated
+   code that share a scope with the model's own: its locals and Inlines.
+   Those are the prefix szGen followed by one of the names below, or by
+   rg (C arrays of locals, see PlanArrayLoops()) or cse (temporaries of
+   common subexpressions, see WriteExprTemps()).
+*/
+static BOOL IsGenName(PSTR szName, PSTR szGen) {
+  static PSTR vrgszGen[] = {"pctx", "pbctx", "w", "iElem", "inParms", "out", "nout", "i", "n", "neq", "ng", ""};
+  size_t cch = strlen(szGen);
+  int i;
+
+  if (strncmp(szName, szGen, cch)) {
+    return FALSE;
+  }
+
+  szName += cch;
+  for (i = 0; *vrgszGen[i] && strcmp(szName, vrgszGen[i]); i++) {
+    ;
+  }
+  return (*vrgszGen[i] || !strncmp(szName, "rg", 2) || !strncmp(szName, "cse", 3));
+
+} /* IsGenName */
+
+/* ----------------------------------------------------------------------------
+   UsesGenName
+
+   Returns TRUE if a variable of the list pvm, or an identifier of one of
+   its Inlines, could be an identifier of the generated code of prefix
+   szGen (see IsGenName()).
+*/
+static BOOL UsesGenName(PVMMAPSTRCT pvm, PSTR szGen) {
+  PSTRLEX szLex;
+  PSTR sz;
+
+  for (; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) != ID_INLINE) {
+      if (IsGenName(pvm->szName, szGen)) {
+        return TRUE;
+      }
+      continue;
+    }
+    for (sz = pvm->szEqn; (sz = NextInlineId(sz, szLex));) {
+      if (IsGenName(szLex, szGen)) {
+        return TRUE;
+      }
+    }
+  }
+
+  return FALSE;
+
+} /* UsesGenName */
+
+/* ----------------------------------------------------------------------------
+   ChooseGenPrefix
+
+   Sets vptrans->szGen, the prefix of the arguments, locals and
+   temporaries of the generated code in the functions that hold the
+   model's code: "_", or if the model has a variable or an Inline
+   identifier of that name, "__mcsim_" and as many more "_" as needed.
+*/
+int ChooseGenPrefix(PINPUTINFO pinfo) {
+  PVMMAPSTRCT rgpvmList[] = {pinfo->pvmGloVars,   pinfo->pvmDynEqns,   pinfo->pvmScaleEqns, pinfo->pvmCalcOutEqns,
+                             pinfo->pvmJacobEqns, pinfo->pvmEventEqns, pinfo->pvmRootEqns};
+  int i, nLists = (int)(sizeof(rgpvmList) / sizeof(rgpvmList[0]));
+
+  strcpy(vptrans->szGen, "_");
+  for (i = 0; i < nLists; i++) {
+    if (UsesGenName(rgpvmList[i], vptrans->szGen)) {
+      if (!strcmp(vptrans->szGen, "_")) {
+        strcpy(vptrans->szGen, "__mcsim_");
+      } else if (strlen(vptrans->szGen) < MAX_LEX / 2) {
+        strcat(vptrans->szGen, "_");
+      } else {
+        return ReportError(NULL, RE_BADCONTEXT | RE_FATAL, vptrans->szGen, "No prefix left for the generated code.");
+      }
+      i = -1; /* Check the new prefix from the start */
+    }
+  }
+  return 0;
+
+} /* ChooseGenPrefix */
+
+/* ----------------------------------------------------------------------------
+   Index_R_Inputs
+
+   Sets the element of forc[] of each input in the model context: the
+   forcings passed through R first, then the inputs defined in the model
+   (see Write_R_InputFns()). Parameters need no such table, their
+   elements of parms[] follow their indices.
+*/
+int Index_R_Inputs(PVMMAPSTRCT pvmGlo) {
+  PVMMAPSTRCT pvm;
+  long iForcs = 0, iInputFns = vptrans->nInputs - vptrans->nInputFns;
+
+  vptrans->rglInputSlot = (long *)malloc((vptrans->nInputs + 1) * sizeof(long));
+  if (!vptrans->rglInputSlot) {
+    return ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "Index_R_Inputs", NULL);
+  }
+
+  for (pvm = pvmGlo; pvm; pvm = pvm->pvmNextVar) {
+    if (TYPE(pvm) == ID_INPUT && pvm->szEqn != vszHasInitializer) {
+      vptrans->rglInputSlot[INDEX(pvm)] = (pvm->szEqn ? iInputFns++ : iForcs++);
+    }
+  }
+  return 0;
+
+} /* Index_R_Inputs */
+
+/* ----------------------------------------------------------------------------
+ForAllVarwSep
+
+   Takes a pfile, a pvm list head and a callback function which is called
+   for all variables in the list if hType == ALL_VARS or only for
+   only those that match hType otherwise. This version is for writing
+   lists with separating punctuation.  It sets End to -1 for the first
+   item in the list, 0 for items in the middle of the list, and 1 for the
+   last item.
+*/
+int ForAllVarwSep(PFILE pfile, PVMMAPSTRCT pvm, PFI_CALLBACK pfiFunc, HANDLE hType, PVOID pinfo) {
+  int iTotal = 0;
+  int64_t End = -1;
+  int iCount = 0;
+
+  while (pvm) {
+    if (hType == ALL_VARS        /* Do for all ... */
+        || TYPE(pvm) == hType) { /* ... or do only for vars of hType */
+
+      if (pvm->szEqn != vszHasInitializer) {
         if (pfiFunc) {
           if (iCount > 0) {
             End = 0;
@@ -1478,20 +4256,6 @@ int WriteOneOutputName(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
 
 } /* WriteOneOutputName */
 
-/* ----------------------------------------------------------------------------
-   This is where we are going...
-
-int WriteOneRForcing (PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo)
-{
-  PIFN pifn = (PIFN) pvm->szEqn;
-}
-
-void Write_R_Forcings(PFILE pfile, PVMMAPSTRCT pvmGlo)
-{
-PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneRForcing, ID_INIT, NULL));
-}
-*/
-
 /* ----------------------------------------------------------------------------
    Write_R_InitPOS
 
@@ -1499,6 +4263,9 @@ PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOneRForcing, ID_INIT, NULL));
    and states.
 */
 int Write_R_InitPOS(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmScale) {
+  /* R names the variables themselves, not the context fields of the C code */
+  vptrans->bForInits = TRUE;
+
   /* write R function initParms */
   fprintf(pfile, "initParms <- function(newParms = NULL) {\n");
   fprintf(pfile, "  parms <- c(\n");
@@ -1531,7 +4298,6 @@ int Write_R_InitPOS(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmScale) {
   fprintf(pfile, ")\n\n");
 
   /* write R function initStates */
-  bForInits = TRUE;
   fprintf(pfile, "initStates <- function(parms, newStates = NULL)"
                  " {\n  Y <- c(\n");
   PROPAGATE_EXIT(ForAllVarwSep(pfile, pvmGlo, &WriteOne_R_PSDecl, ID_STATE, NULL));
@@ -1550,114 +4316,429 @@ int Write_R_InitPOS(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmScale) {
   fprintf(pfile, "    }\n");
   fprintf(pfile, "    Y[names(newStates)] <- newStates\n  }\n\n");
 
-  if (bDelay) {
-    fprintf(pfile, ".C(\"initState\", as.double(Y));\n");
-  }
   fprintf(pfile, "Y\n}\n");
 
-  /* Write_R_Forcings: unfinished;
-     translate mcsim's input information into a default forcing
-     formulation for deSolve solvers. */
-
-  bForInits = FALSE;
+  vptrans->bForInits = FALSE;
   return 0;
 } /* Write_R_InitPOS */
 
+/* ----------------------------------------------------------------------------
+   CollectOneDelay
+
+   Adds to vptrans->rgpvmHist the variables of type (intptr_t)pInfo that
+   the equation of pvm delays with CalcDelay(), once each, and counts the
+   calls in vptrans->nHistLags while collecting the states.
+
+   Callback for ForAllVar().
+*/
+int CollectOneDelay(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo) {
+  PEQN peqn;
+  PVMMAPSTRCT pvmArg;
+  BOOL bDelayCall = FALSE;
+  int i, j;
+
+  if (TYPE(pvm) == ID_INLINE) {
+    return 0;
+  }
+
+  PROPAGATE_EXIT(GetEqn(pvm, &peqn));
+  for (i = 0; i < peqn->nLex; i++) {
+    if (peqn->rglex[i].iType != LX_IDENTIFIER) {
+      continue;
+    }
+
+    if (!bDelayCall) {
+      bDelayCall = !strcmp("CalcDelay", peqn->rglex[i].sz);
+      continue;
+    }
+
+    /* The first argument, checked by TranslateEquation() */
+    bDelayCall = FALSE;
+    if ((HANDLE)(intptr_t)pInfo == ID_STATE) {
+      vptrans->nHistLags++;
+    }
+    pvmArg = GetVarPTR(vptrans->pvmGloVarList, peqn->rglex[i].sz);
+    if (!pvmArg || TYPE(pvmArg) != (HANDLE)(intptr_t)pInfo) {
+      continue;
+    }
+    for (j = 0; j < vptrans->nHistVars && vptrans->rgpvmHist[j] != pvmArg; j++) {
+      ;
+    }
+    if (j == vptrans->nHistVars) {
+      vptrans->rgpvmHist[vptrans->nHistVars++] = pvmArg;
+    }
+  }
+
+  return 0;
+
+} /* CollectOneDelay */
+
+/* ----------------------------------------------------------------------------
+   CollectDelays
+
+   Lists in vptrans->rgpvmHist the variables delayed by CalcDelay() in the
+   equations of the model, states first: their values at each accepted
+   point of the integrator are kept in the history of the model context,
+   the states with their slopes for Hermite interpolation.
+*/
+int CollectDelays(PINPUTINFO pinfo) {
+  PVMMAPSTRCT rgpvmEqns[5];
+  int i;
+
+  vptrans->nHistVars = vptrans->nHistStates = vptrans->nHistLags = 0;
+  if (!pinfo->bDelays) {
+    return 0;
+  }
+
+  if (!(vptrans->rgpvmHist = (PVMMAPSTRCT *)ModelAlloc((vptrans->nStates + vptrans->nOutputs + 1) * sizeof(PVMMAPSTRCT)))) {
+    return ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "CollectDelays", NULL);
+  }
+
+  rgpvmEqns[0] = pinfo->pvmDynEqns;
+  rgpvmEqns[1] = pinfo->pvmCalcOutEqns;
+  rgpvmEqns[2] = pinfo->pvmJacobEqns;
+  rgpvmEqns[3] = pinfo->pvmEventEqns;
+  rgpvmEqns[4] = pinfo->pvmRootEqns;
+
+  for (i = 0; i < 5; i++) {
+    PROPAGATE_EXIT(ForAllVar(NULL, rgpvmEqns[i], &CollectOneDelay, ALL_VARS, (PVOID)(intptr_t)ID_STATE));
+  }
+  vptrans->nHistStates = vptrans->nHistVars;
+  for (i = 0; i < 5; i++) {
+    PROPAGATE_EXIT(ForAllVar(NULL, rgpvmEqns[i], &CollectOneDelay, ALL_VARS, (PVOID)(intptr_t)ID_OUTPUT));
+  }
+  return 0;
+
+} /* CollectDelays */
+
+/* ----------------------------------------------------------------------------
+   Write_R_HistDefines
+
+   Writes the index in the history of each delayed variable, and the
+   dimensions of the history.
+*/
+void Write_R_HistDefines(PFILE pfile) {
+  int i;
+
+  fprintf(pfile, "\n/* Delayed variables: index in the history */\n");
+  for (i = 0; i < vptrans->nHistVars; i++) {
+    fprintf(pfile, "#define LAG_%s %d\n", vptrans->rgpvmHist[i]->szName, i);
+  }
+  fprintf(pfile, "#define HIST_VARS %d\n", (vptrans->nHistVars > 0 ? vptrans->nHistVars : 1));
+  fprintf(pfile, "#define HIST_LEN %d /* Points of the history */\n", HIST_POINTS);
+  fprintf(pfile, "#define HIST_LAGS %d /* CalcDelay calls: at most as many delay times at once */\n",
+          (vptrans->nHistLags > 0 ? vptrans->nHistLags : 1));
+
+} /* Write_R_HistDefines */
+
+/* ----------------------------------------------------------------------------
+   WriteHistVars
+
+   Writes, for each delayed variable of type hType (ID_STATE or ID_OUTPUT),
+   szFmt with its name for up to three %s, as a line.
+*/
+void WriteHistVars(PFILE pfile, HANDLE hType, PSTR szFmt) {
+  int i;
+
+  for (i = 0; i < vptrans->nHistVars; i++) {
+    if (TYPE(vptrans->rgpvmHist[i]) == hType) {
+      fprintf(pfile, szFmt, vptrans->rgpvmHist[i]->szName, vptrans->rgpvmHist[i]->szName, vptrans->rgpvmHist[i]->szName);
+    }
+  }
+
+} /* WriteHistVars */
+
+/* ----------------------------------------------------------------------------
+   Write_R_History
+
+   Writes the history of the delayed variables, kept in the model context,
+   and CalcDelay(), which reads it. The integrator stores a point at each
+   accepted step with hist_store_ctx(), and one after each dose. Points
+   are dropped once older than the longest delay read so far, or the
+   oldest when HIST_LEN are kept. Each point holds the values of the
+   variables and their slopes, those of the outputs by a difference along
+   the slopes of the states, and the variables are interpolated between
+   points by cubic Hermite polynomials. Before the first point the delayed
+   variables keep its values. A delay time between the first point and the
+   oldest point kept cannot be read: CalcDelay() flags it in bHistLost,
+   which hist_store_ctx() returns, and the integrator fails the run.
+
+   Under deSolve's dede (see Write_R_InitModel()), the delayed states are
+   read from the history of dede with its lagvalue() instead.
+
+   All the delayed variables at a delay time are read at once and kept
+   until the next call of a model function (see Write_R_InputsCall()), so
+   that each distinct delay time is looked up once per evaluation.
+*/
+void Write_R_History(PFILE pfile) {
+  int nStates = (vptrans->nStates > 0 ? vptrans->nStates : 1);
+  int nOutputs = (vptrans->nOutputs > 0 ? vptrans->nOutputs : 1);
+  BOOL bOutputs = (vptrans->nHistStates < vptrans->nHistVars);
+  int i;
+
+  fprintf(pfile, "/* Delayed variables */\n\n");
+  fprintf(pfile, "#define HIST_PT(_pctx, _k) (((_pctx)->iHistFirst + (_k)) %% HIST_LEN) /* _k-th oldest */\n\n");
+
+  fprintf(pfile, "void derivs_ctx (MODEL_CTX *_pctx, double *pdTime, double *y, double *ydot, double *yout);\n");
+  fprintf(pfile, "void outputs_ctx (MODEL_CTX *_pctx, double *pdTime, double *y, double *yout);\n\n");
+
+  fprintf(pfile, "void hist_reset (MODEL_CTX *_pctx)\n{\n");
+  fprintf(pfile, "  _pctx->iHistFirst = _pctx->nHist = 0;\n");
+  fprintf(pfile, "  _pctx->dMaxDelay = 0;\n");
+  fprintf(pfile, "  _pctx->bHistLost = _pctx->bDeSolveHist = 0;\n");
+  fprintf(pfile, "  _pctx->nLags = 0;\n");
+  fprintf(pfile, "} /* hist_reset */\n\n");
+
+  fprintf(pfile, "/* Starts the history with the states at the first call of a model\n");
+  fprintf(pfile, "   function, until hist_store_ctx stores the start */\n");
+  fprintf(pfile, "static void hist_start (MODEL_CTX *_pctx, double _dTime, double *_y)\n{\n");
+  fprintf(pfile, "  double *_pd = _pctx->rgdHist[0];\n");
+  fprintf(pfile, "  int _j;\n\n");
+  fprintf(pfile, "  _pctx->iHistFirst = 0;\n");
+  fprintf(pfile, "  _pctx->nHist = 1;\n");
+  fprintf(pfile, "  _pctx->rgdHistT[0] = _pctx->dHistStart = _dTime;\n");
+  fprintf(pfile, "  for (_j = 0; _j < 2 * HIST_VARS; _j++)\n");
+  fprintf(pfile, "    _pd[_j] = 0;\n");
+  WriteHistVars(pfile, ID_STATE, "  _pd[LAG_%s] = _y[ID_%s];\n");
+  fprintf(pfile, "} /* hist_start */\n\n");
+
+  fprintf(pfile, "/* Sets point _i of the history to the variables at _dTime. _ydot are\n");
+  fprintf(pfile, "   the derivatives at the end of a step, or NULL at the start of one:\n");
+  fprintf(pfile, "   they are computed, and the slopes of the outputs taken forward. */\n");
+  fprintf(pfile, "static void hist_set (MODEL_CTX *_pctx, int _i, double _dTime, double *_y, double *_ydot)\n{\n");
+  fprintf(pfile, "  double *_pd = _pctx->rgdHist[_i];\n");
+  fprintf(pfile, "  double _rgdYdot[%d];\n", nStates);
+  if (bOutputs) {
+    fprintf(pfile, "  double _yout[%d], _rgdY[%d], _dT, _dDelta;\n", nOutputs, nStates);
+    fprintf(pfile, "  int _j;\n");
+  }
+  fprintf(pfile, "\n  _pctx->rgdHistT[_i] = _dTime;\n");
+  fprintf(pfile, "  if (!_ydot)\n");
+  fprintf(pfile, "    derivs_ctx(_pctx, &_dTime, _y, _rgdYdot, NULL);\n");
+  WriteHistVars(pfile, ID_STATE, "  _pd[LAG_%s] = _y[ID_%s];\n");
+  WriteHistVars(pfile, ID_STATE, "  _pd[HIST_VARS + LAG_%s] = (_ydot ? _ydot : _rgdYdot)[ID_%s];\n");
+  if (bOutputs) {
+    fprintf(pfile, "  outputs_ctx(_pctx, &_dTime, _y, _yout);\n");
+    WriteHistVars(pfile, ID_OUTPUT, "  _pd[LAG_%s] = _yout[ID_%s];\n");
+    fprintf(pfile, "\n  _dDelta = 1.5e-8 * (fabs(_dTime) > _pctx->dMaxDelay ? fabs(_dTime) : _pctx->dMaxDelay);\n");
+    fprintf(pfile, "  if (_dDelta == 0)\n");
+    fprintf(pfile, "    _dDelta = 1.5e-8;\n");
+    fprintf(pfile, "  if (_ydot)\n");
+    fprintf(pfile, "    _dDelta = -_dDelta;\n");
+    fprintf(pfile, "  _dT = _dTime + _dDelta;\n");
+    fprintf(pfile, "  for (_j = 0; _j < %d; _j++)\n", vptrans->nStates);
+    fprintf(pfile, "    _rgdY[_j] = _y[_j] + _dDelta * (_ydot ? _ydot : _rgdYdot)[_j];\n");
+    fprintf(pfile, "  outputs_ctx(_pctx, &_dT, _rgdY, _yout);\n");
+    WriteHistVars(pfile, ID_OUTPUT, "  _pd[HIST_VARS + LAG_%s] = (_yout[ID_%s] - _pd[LAG_%s]) / _dDelta;\n");
+  }
+  fprintf(pfile, "} /* hist_set */\n\n");
+
+  fprintf(pfile, "/* Stores the point (_dTime, _y) in the history, _ydot the derivatives\n");
+  fprintf(pfile, "   there or NULL. Called by the integrator at the start, at each accepted\n");
+  fprintf(pfile, "   step, and after each dose at the same time as the step. Returns\n");
+  fprintf(pfile, "   nonzero once a delay time has fallen before the points kept. */\n");
+  fprintf(pfile, "int hist_store_ctx (MODEL_CTX *_pctx, double _dTime, double *_y, double *_ydot)\n{\n");
+  fprintf(pfile, "  int _i;\n\n");
+  fprintf(pfile, "  if (!_pctx->nHist)\n");
+  fprintf(pfile, "    hist_start(_pctx, _dTime, _y);\n");
+  fprintf(pfile, "  _i = HIST_PT(_pctx, _pctx->nHist - 1);\n");
+  fprintf(pfile, "  if (_pctx->nHist == 1 && _pctx->rgdHistT[_i] == _dTime) {\n");
+  fprintf(pfile, "    /* The start, whose delayed variables are its own: twice */\n");
+  fprintf(pfile, "    hist_set(_pctx, _i, _dTime, _y, NULL);\n");
+  fprintf(pfile, "    hist_set(_pctx, _i, _dTime, _y, NULL);\n");
+  fprintf(pfile, "    return (_pctx->bHistLost);\n");
+  fprintf(pfile, "  }\n\n");
+  fprintf(pfile, "  if (_pctx->nHist == HIST_LEN) { /* Full: drops the oldest */\n");
+  fprintf(pfile, "    _pctx->iHistFirst = HIST_PT(_pctx, 1);\n");
+  fprintf(pfile, "    _pctx->nHist--;\n");
+  fprintf(pfile, "  }\n");
+  fprintf(pfile, "  hist_set(_pctx, HIST_PT(_pctx, _pctx->nHist++), _dTime, _y, _ydot);\n\n");
+  fprintf(pfile, "  /* The oldest point is needed while the next is past the longest delay,\n");
+  fprintf(pfile, "     once hist_set has read the delays a little before _dTime */\n");
+  fprintf(pfile, "  while (_pctx->nHist > 1 && _pctx->rgdHistT[HIST_PT(_pctx, 1)] <= _dTime - _pctx->dMaxDelay) {\n");
+  fprintf(pfile, "    _pctx->iHistFirst = HIST_PT(_pctx, 1);\n");
+  fprintf(pfile, "    _pctx->nHist--;\n");
+  fprintf(pfile, "  }\n");
+  fprintf(pfile, "  return (_pctx->bHistLost);\n");
+  fprintf(pfile, "} /* hist_store_ctx */\n\n");
+
+  fprintf(pfile, "/* Reads the delayed variables at _dT into _rgd. Past the last point,\n");
+  fprintf(pfile, "   they go on along their slopes; before the oldest point kept, but\n");
+  fprintf(pfile, "   after the first, the history is lost. */\n");
+  fprintf(pfile, "static void hist_lag (MODEL_CTX *_pctx, double _dT, double *_rgd)\n{\n");
+  fprintf(pfile, "  int _lo = 0, _hi = _pctx->nHist - 1, _mid, _j;\n");
+  fprintf(pfile, "  double *_p0, *_p1, _h, _s, _h00, _h10, _h01, _h11;\n\n");
+  fprintf(pfile, "  if (_dT > _pctx->dHistStart && _dT < _pctx->rgdHistT[HIST_PT(_pctx, 0)])\n");
+  fprintf(pfile, "    _pctx->bHistLost = 1;\n");
+  fprintf(pfile, "  while (_lo < _hi) { /* The last point at or before _dT, or the first */\n");
+  fprintf(pfile, "    _mid = (_lo + _hi + 1) / 2;\n");
+  fprintf(pfile, "    if (_pctx->rgdHistT[HIST_PT(_pctx, _mid)] <= _dT)\n");
+  fprintf(pfile, "      _lo = _mid;\n");
+  fprintf(pfile, "    else\n");
+  fprintf(pfile, "      _hi = _mid - 1;\n");
+  fprintf(pfile, "  }\n");
+  fprintf(pfile, "  _p0 = _pctx->rgdHist[HIST_PT(_pctx, _lo)];\n");
+  fprintf(pfile, "  _h = _dT - _pctx->rgdHistT[HIST_PT(_pctx, _lo)];\n\n");
+  fprintf(pfile, "  if (_h <= 0 || _lo == _pctx->nHist - 1) {\n");
+  fprintf(pfile, "    for (_j = 0; _j < HIST_VARS; _j++)\n");
+  fprintf(pfile, "      _rgd[_j] = _p0[_j] + (_h > 0 ? _h * _p0[HIST_VARS + _j] : 0);\n");
+  fprintf(pfile, "    return;\n");
+  fprintf(pfile, "  }\n\n");
+  fprintf(pfile, "  _p1 = _pctx->rgdHist[HIST_PT(_pctx, _lo + 1)];\n");
+  fprintf(pfile, "  _h = _pctx->rgdHistT[HIST_PT(_pctx, _lo + 1)] - _pctx->rgdHistT[HIST_PT(_pctx, _lo)];\n");
+  fprintf(pfile, "  _s = (_dT - _pctx->rgdHistT[HIST_PT(_pctx, _lo)]) / _h;\n");
+  fprintf(pfile, "  _h00 = (1 + 2 * _s) * (1 - _s) * (1 - _s);\n");
+  fprintf(pfile, "  _h10 = _s * (1 - _s) * (1 - _s) * _h;\n");
+  fprintf(pfile, "  _h01 = _s * _s * (3 - 2 * _s);\n");
+  fprintf(pfile, "  _h11 = _s * _s * (_s - 1) * _h;\n");
+  fprintf(pfile, "  for (_j = 0; _j < HIST_VARS; _j++)\n");
+  fprintf(pfile, "    _rgd[_j] = _h00 * _p0[_j] + _h10 * _p0[HIST_VARS + _j] + _h01 * _p1[_j] + _h11 * _p1[HIST_VARS + _j];\n");
+  fprintf(pfile, "} /* hist_lag */\n\n");
+
+  if (vptrans->nHistStates > 0) {
+    fprintf(pfile, "/* Reads the delayed states, the first variables of the history, at _dT\n");
+    fprintf(pfile, "   into _rgd from the history of deSolve's dede */\n");
+    fprintf(pfile, "static void hist_desolve (double _dT, double *_rgd)\n{\n");
+    fprintf(pfile, "  static void (*_pfnLagvalue)(double, int *, int, double *) = NULL;\n");
+    fprintf(pfile, "  static int _rgiStates[%d] = {", vptrans->nHistStates);
+    for (i = 0; i < vptrans->nHistStates; i++) {
+      fprintf(pfile, "%sID_%s", (i ? ", " : ""), vptrans->rgpvmHist[i]->szName);
+    }
+    fprintf(pfile, "};\n\n");
+    fprintf(pfile, "  if (!_pfnLagvalue)\n");
+    fprintf(pfile, "    _pfnLagvalue = (void (*)(double, int *, int, double *))R_GetCCallable(\"deSolve\", \"lagvalue\");\n");
+    fprintf(pfile, "  _pfnLagvalue(_dT, _rgiStates, %d, _rgd);\n", vptrans->nHistStates);
+    fprintf(pfile, "} /* hist_desolve */\n\n");
+  }
+
+  fprintf(pfile, "double CalcDelay (MODEL_CTX *_pctx, int _iLag, double _dTime, double _dDelay)\n{\n");
+  fprintf(pfile, "  double _dT = _dTime - _dDelay;\n");
+  fprintf(pfile, "  int _i;\n\n");
+  fprintf(pfile, "  if (_dDelay > _pctx->dMaxDelay)\n");
+  fprintf(pfile, "    _pctx->dMaxDelay = _dDelay;\n");
+  fprintf(pfile, "  for (_i = 0; _i < _pctx->nLags && _pctx->rgdLagT[_i] != _dT; _i++)\n");
+  fprintf(pfile, "    ;\n");
+  fprintf(pfile, "  if (_i == _pctx->nLags) { /* A new delay time: read all the delayed variables there */\n");
+  fprintf(pfile, "    if (_i < HIST_LAGS)\n");
+  fprintf(pfile, "      _pctx->nLags++;\n");
+  fprintf(pfile, "    else /* Array loops: reuse the last */\n");
+  fprintf(pfile, "      _i--;\n");
+  fprintf(pfile, "    _pctx->rgdLagT[_i] = _dT;\n");
+  if (vptrans->nHistStates > 0) {
+    fprintf(pfile, "    if (_pctx->bDeSolveHist && _dT > _pctx->dHistStart)\n");
+    fprintf(pfile, "      hist_desolve(_dT, _pctx->rgdLag[_i]);\n");
+    fprintf(pfile, "    else\n  ");
+  }
+  fprintf(pfile, "    hist_lag(_pctx, _dT, _pctx->rgdLag[_i]);\n");
+  fprintf(pfile, "  }\n");
+  fprintf(pfile, "  return _pctx->rgdLag[_i][_iLag];\n");
+  fprintf(pfile, "} /* CalcDelay */\n\n");
+
+} /* Write_R_History */
+
 /* ----------------------------------------------------------------------------
    Write_R_Decls
 */
 int Write_R_Decls(PFILE pfile, PVMMAPSTRCT pvmGlo) {
   fprintf(pfile, "\n/* Model variables: States */\n");
-  // need to clear state when we are handling a new model in ".so" mode
-  // as the 'static' variables are not reset from model to model
-  INPUTINFO info;
-  info.bClearState = TRUE;
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOne_R_SODefine, ID_STATE, &info));
+  vptrans->iStates = vptrans->iOutputs = 0;
+  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOne_R_SODefine, ID_STATE, NULL));
 
   fprintf(pfile, "\n/* Model variables: Outputs */\n");
   PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOne_R_SODefine, ID_OUTPUT, NULL));
 
-  fprintf(pfile, "\n/* Parameters */\n");
-  fprintf(pfile, "static double parms[%d];\n\n", vnParms);
-  info.bClearState = TRUE;
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOne_R_PIDefine, ID_PARM, &info));
-
-  fprintf(pfile, "\n/* Forcing (Input) functions */\n");
-  fprintf(pfile, "static double forc[%d];\n\n", vnInputs);
-  PROPAGATE_EXIT(ForAllVar(pfile, pvmGlo, &WriteOne_R_PIDefine, ID_INPUT, NULL));
-  fprintf(pfile, "\n");
+  if (vptrans->bDelay) {
+    Write_R_HistDefines(pfile);
+  }
 
-  if (bDelay) {
-    fprintf(pfile, "/* Function definitions for delay differential "
-                   "equations */\n\n");
-    fprintf(pfile, "int Nout=1;\n");
-    fprintf(pfile, "int nr[1]={0};\n");
-    fprintf(pfile, "double ytau[1] = {0.0};\n\n");
-    fprintf(pfile, "static double yini[%d] = {", vnStates);
-    int i;
-    for (i = 1; i <= vnStates; i++) {
-      if (i == vnStates) {
-        fprintf(pfile, "0.0");
-      } else {
-        fprintf(pfile, "0.0, ");
-      }
-    }
-    fprintf(pfile, "}; /*Array of initial state variables*/\n\n");
-    fprintf(pfile, "void lagvalue(double T, int *nr, int N, double *ytau) "
-                   "{\n");
-    fprintf(pfile, "  static void(*fun)(double, int*, int, double*) = NULL;"
-                   "\n");
-    fprintf(pfile, "  if (fun == NULL)\n");
-    fprintf(pfile, "    fun = (void(*)(double, int*, int, double*))"
-                   "R_GetCCallable(\"deSolve\", \"lagvalue\");\n");
-    fprintf(pfile, "  return fun(T, nr, N, ytau);\n}\n\n");
-    fprintf(pfile, "double CalcDelay(int hvar, double dTime, double delay) {"
-                   "\n");
-    fprintf(pfile, "  double T = dTime-delay;\n");
-    fprintf(pfile, "  if (dTime > delay){\n");
-    fprintf(pfile, "    nr[0] = hvar;\n");
-    fprintf(pfile, "    lagvalue( T, nr, Nout, ytau );\n}\n");
-    fprintf(pfile, "  else{\n");
-    fprintf(pfile, "    ytau[0] = yini[hvar];\n}\n");
-    fprintf(pfile, "  return(ytau[0]);\n}\n\n");
+  fprintf(pfile, "\n/* Parameters and inputs, in the model context */\n");
+  fprintf(pfile, "#define CTX_PARM(i) (%spctx->parms[i])\n", vptrans->szGen);
+  fprintf(pfile, "#define CTX_FORC(i) (%spctx->forc[i])\n", vptrans->szGen);
+  fprintf(pfile, "#define CTX_HOIST(i) (%spctx->hoist[i])\n", vptrans->szGen);
+
+  /* Everything the model functions read or write between calls lives in
+     one context, so that several instances can run side by side. If a
+     count is zero put a dummy 1 for array size. */
+  fprintf(pfile, "\n/* Model context: one per running instance */\n");
+  fprintf(pfile, "typedef struct tagMODEL_CTX {\n");
+  fprintf(pfile, "  double parms[%d]; /* Parameters */\n", (vptrans->nParms > 0 ? vptrans->nParms : 1));
+  fprintf(pfile, "  double forc[%d]; /* Forcing (Input) functions */\n", (vptrans->nInputs > 0 ? vptrans->nInputs : 1));
+  fprintf(pfile, "  double yout[%d]; /* Scratch outputs, used if none are passed */\n",
+          (vptrans->nOutputs > 0 ? vptrans->nOutputs : 1));
+  fprintf(pfile, "  double hoist[%d]; /* Parameter-only subexpressions, see hoist_ctx */\n",
+          (vptrans->hoist.nSlots > 0 ? vptrans->hoist.nSlots : 1));
+  if (vptrans->bDelay) {
+    fprintf(pfile, "  /* History of the delayed variables, see hist_store_ctx: a ring of\n");
+    fprintf(pfile, "     nHist points from iHistFirst, each the values of the variables,\n");
+    fprintf(pfile, "     then their slopes */\n");
+    fprintf(pfile, "  int iHistFirst, nHist;\n");
+    fprintf(pfile, "  double dMaxDelay; /* Longest delay read so far */\n");
+    fprintf(pfile, "  double dHistStart; /* Time of the first point */\n");
+    fprintf(pfile, "  int bHistLost; /* A delay time fell before the oldest point kept */\n");
+    fprintf(pfile, "  int bDeSolveHist; /* The states are delayed by deSolve's dede, see initmod_dede */\n");
+    fprintf(pfile, "  double rgdHistT[HIST_LEN];\n");
+    fprintf(pfile, "  double rgdHist[HIST_LEN][2 * HIST_VARS];\n");
+    fprintf(pfile, "  int nLags; /* Delay times read by this call of a model function */\n");
+    fprintf(pfile, "  double rgdLagT[HIST_LAGS];\n");
+    fprintf(pfile, "  double rgdLag[HIST_LAGS][HIST_VARS]; /* Delayed variables at rgdLagT */\n");
+  }
+  fprintf(pfile, "} MODEL_CTX;\n\n");
+
+  fprintf(pfile, "/* Context used by the deSolve entry points */\n");
+  fprintf(pfile, "static MODEL_CTX vctxDefault;\n\n");
+
+  fprintf(pfile, "void initCtx (MODEL_CTX *_pctx)\n{\n");
+  fprintf(pfile, "  static const MODEL_CTX _ctxZero;\n\n");
+  fprintf(pfile, "  *_pctx = _ctxZero;\n");
+  fprintf(pfile, "} /* initCtx */\n\n");
+
+  if (vptrans->bBatchKernel) {
+    /* Struct-of-arrays context for derivs_batch: element [i][w] is
+       parameter or input i of lane w */
+    fprintf(pfile, "/* Lane-batched model context, for derivs_batch */\n");
+    fprintf(pfile, "#define BATCH_W %d\n\n", BATCH_LANES);
+    fprintf(pfile, "typedef struct tagMODEL_BATCH_CTX {\n");
+    fprintf(pfile, "  double parms[%d][BATCH_W];\n", (vptrans->nParms > 0 ? vptrans->nParms : 1));
+    fprintf(pfile, "  double forc[%d][BATCH_W];\n", (vptrans->nInputs > 0 ? vptrans->nInputs : 1));
+    fprintf(pfile, "  double hoist[%d][BATCH_W];\n", (vptrans->hoist.nSlots > 0 ? vptrans->hoist.nSlots : 1));
+    fprintf(pfile, "  double ydot[%d][BATCH_W]; /* Scratch derivatives of outputs_batch */\n",
+            (vptrans->nStates > 0 ? vptrans->nStates : 1));
+    fprintf(pfile, "} MODEL_BATCH_CTX;\n\n");
+  }
 
-  } /* end if */
+  if (vptrans->bDelay) {
+    Write_R_History(pfile);
+  }
   return 0;
 } /* Write_R_Decls */
 
 /* ----------------------------------------------------------------------------
  */
 void Write_R_Includes(PFILE pfile) {
+  fprintf(pfile, "#include <string.h>\n");
   fprintf(pfile, "#include <R.h>\n");
-
-  if (bDelay) {
-    fprintf(pfile, "#include <Rinternals.h>\n");
-    fprintf(pfile, "#include <Rdefines.h>\n");
+  if (vptrans->bDelay) { /* R_GetCCallable, for the history of deSolve's dede */
     fprintf(pfile, "#include <R_ext/Rdynload.h>\n");
   }
 
 } /* Write_R_Includes */
 
 /* ----------------------------------------------------------------------------
-   Write_R_Model
+   Write_R_Streams
 
-   Writes a deSolve (R package) compatible C file "szOutFilename"
-   corresponding to equations given.
+   Writes the deSolve compatible C code of the model to pfileC and the R
+   code initializing its parameters, states and outputs to pfileR. szTitle
+   names the C code in its header. Leaves the allocations of the analyses
+   to Free_R_Model().
 */
-int Write_R_Model(PINPUTINFO pinfo, PSTR szFileOut) {
-  static PSTRLEX vszModified_Title;
-  PFILE pfile;
-  PSTR Rfile;
-  PSTR Rappend = "_inits.R";
-  size_t nRout, nbase;
-  char *lastdot;
+int Write_R_Streams(PINPUTINFO pinfo, PFILE pfileC, PFILE pfileR, PSTR szTitle) {
+  PSTRLEX szModifiedTitle, szArgs;
 
   /* set global flag ! */
-  bForR = TRUE;
+  vptrans->bForR = TRUE;
 
   if (!pinfo->pvmGloVars || (!pinfo->pvmDynEqns && !pinfo->pvmCalcOutEqns)) {
-    Rprintf("Error: No Dynamics, outputs or global variables defined\n");
-    return 1;
+    return ReportError(NULL, RE_NOMODEL | RE_FATAL, NULL, NULL);
   }
 
   ReversePointers(&pinfo->pvmGloVars);
@@ -1667,69 +4748,183 @@ int Write_R_Model(PINPUTINFO pinfo, PSTR szFileOut) {
   ReversePointers(&pinfo->pvmJacobEqns);
   ReversePointers(&pinfo->pvmEventEqns);
   ReversePointers(&pinfo->pvmRootEqns);
-  vpvmGloVarList = pinfo->pvmGloVars;
+  ReversePointers(&pinfo->pvmDoseEqns);
+  vptrans->pvmGloVarList = pinfo->pvmGloVars;
+  vptrans->bDelay = pinfo->bDelays;
+  vptrans->bOptimize = pinfo->bOptimize;
 
   PROPAGATE_EXIT(IndexVariables(pinfo->pvmGloVars));
+  PROPAGATE_EXIT(Index_R_Inputs(pinfo->pvmGloVars));
+  PROPAGATE_EXIT(ChooseGenPrefix(pinfo));
   PROPAGATE_EXIT(AdjustVarHandles(pinfo->pvmGloVars));
+  PROPAGATE_EXIT(AdjustDoseHandles(pinfo->pvmDoseEqns));
+  PROPAGATE_EXIT(CountRoots(pinfo->pvmRootEqns));
+  PROPAGATE_EXIT(CollectDelays(pinfo));
   PROPAGATE_EXIT(VerifyEqns(pinfo->pvmGloVars, pinfo->pvmDynEqns));
 
   PROPAGATE_EXIT(VerifyOutputEqns(pinfo));
 
-  pfile = fopen(szFileOut, "w");
-  if (pfile) {
+  /* Delays read deSolve's history and Inlines are opaque C: neither can go
+     in the lane-batched kernel */
+  vptrans->bBatchKernel = (!pinfo->bDelays && !HasInline(pinfo->pvmDynEqns) && !HasInline(pinfo->pvmCalcOutEqns));
+
+  /* Outputs are computed after integration unless delays need deSolve's
+     history, or there is nothing to take out of derivs */
+  {
+    int nOutOnly;
+    PROPAGATE_EXIT(MarkDerivEqns(pinfo->pvmDynEqns, &nOutOnly));
+    PROPAGATE_EXIT(MarkOutputEqns(pinfo->pvmDynEqns, pinfo->pvmCalcOutEqns));
+    vptrans->bLeanDerivs = (!pinfo->bDelays && vptrans->nOutputs > 0 && (nOutOnly > 0 || pinfo->pvmCalcOutEqns));
+  }
 
-    /* Keep track of the model description file and generator name */
-    vszModelFilename = pinfo->szInputFilename;
-    vszModGenName = pinfo->szModGenName;
+  /* Use the Jacobian section, or derive one; the sparsity pattern saves
+     differentiating structural zeros */
+  PROPAGATE_EXIT(BuildJacobPattern(pinfo));
+  if (!pinfo->pvmJacobEqns) {
+    PROPAGATE_EXIT(BuildSymJacob(pinfo));
+  }
 
-    snprintf(vszModified_Title, MAX_LEX, "%s %s", szFileOut, "for R deSolve package");
-    PROPAGATE_EXIT(WriteHeader(pfile, vszModified_Title, pinfo->pvmGloVars));
+  PROPAGATE_EXIT(PlanArrayLoops(pinfo));
+  PROPAGATE_EXIT(PlanJacobLoops(pinfo));
+  PROPAGATE_EXIT(OptimizeDynamics(pinfo));
+
+  /* Keep track of the model description file and generator name */
+  vptrans->szModelFilename = pinfo->szInputFilename;
+  vptrans->szModGenName = pinfo->szModGenName;
+
+  snprintf(szModifiedTitle, MAX_LEX, "%s %s", szTitle, "for R deSolve package");
+  PROPAGATE_EXIT(WriteHeader(pfileC, szModifiedTitle, pinfo->pvmGloVars));
+
+  Write_R_Includes(pfileC);
+  PROPAGATE_EXIT(Write_R_Decls(pfileC, pinfo->pvmGloVars));
+
+  fprintf(pfileC, "/*----- Parameter-only subexpressions of the Dynamics */\n");
+  snprintf(szArgs, MAX_LEX, "MODEL_CTX *%spctx", vptrans->szGen);
+  Write_R_Hoist(pfileC, "hoist_ctx", szArgs);
+  PROPAGATE_EXIT(Write_R_InputFns(pfileC, pinfo->pvmGloVars));
+  PROPAGATE_EXIT(Write_R_InputTimes(pfileC, pinfo->pvmGloVars, pinfo->pvmDoseEqns));
+  Write_R_InitModel(pfileC, pinfo->pvmGloVars);
+  Write_R_ModelInfo(pfileC, pinfo);
+  PROPAGATE_EXIT(Write_R_Scale(pfileC, pinfo->pvmGloVars, pinfo->pvmScaleEqns));
+  PROPAGATE_EXIT(Write_R_CalcDeriv(pfileC, pinfo->pvmGloVars, pinfo->pvmDynEqns, pinfo->pvmCalcOutEqns));
+  PROPAGATE_EXIT(Write_R_CalcOutputs(pfileC, pinfo->pvmGloVars, pinfo->pvmDynEqns, pinfo->pvmCalcOutEqns));
+  PROPAGATE_EXIT(Write_R_CalcDerivBatch(pfileC, pinfo->pvmGloVars, pinfo->pvmDynEqns, pinfo->pvmCalcOutEqns));
+  PROPAGATE_EXIT(Write_R_JacobPattern(pfileC));
+  PROPAGATE_EXIT(Write_R_CalcJacob(pfileC, pinfo->pvmGloVars, pinfo->pvmJacobEqns));
+  PROPAGATE_EXIT(Write_R_Events(pfileC, pinfo->pvmGloVars, pinfo->pvmEventEqns));
+  PROPAGATE_EXIT(Write_R_Roots(pfileC, pinfo->pvmGloVars, pinfo->pvmRootEqns));
+  PROPAGATE_EXIT(Write_R_Doses(pfileC, pinfo->pvmDoseEqns));
+
+  PROPAGATE_EXIT(Write_R_InitPOS(pfileR, pinfo->pvmGloVars, pinfo->pvmScaleEqns));
+  return 0;
+} /* Write_R_Streams */
 
-    Write_R_Includes(pfile);
-    PROPAGATE_EXIT(Write_R_Decls(pfile, pinfo->pvmGloVars));
+/* ----------------------------------------------------------------------------
+   Free_R_Model
 
-    Write_R_InitModel(pfile, pinfo->pvmGloVars);
-    PROPAGATE_EXIT(Write_R_Scale(pfile, pinfo->pvmGloVars, pinfo->pvmScaleEqns));
-    PROPAGATE_EXIT(
-        Write_R_CalcDeriv(pfile, pinfo->pvmGloVars, pinfo->pvmDynEqns, pinfo->pvmCalcOutEqns)); /* fold in CaclOutput */
-    PROPAGATE_EXIT(Write_R_CalcJacob(pfile, pinfo->pvmGloVars, pinfo->pvmJacobEqns));
-    PROPAGATE_EXIT(Write_R_Events(pfile, pinfo->pvmGloVars, pinfo->pvmEventEqns));
-    PROPAGATE_EXIT(Write_R_Roots(pfile, pinfo->pvmGloVars, pinfo->pvmRootEqns));
+   Frees what Write_R_Streams() allocated, also after an error.
+*/
+void Free_R_Model(void) {
+  free(vptrans->rglInputSlot);
+  vptrans->rglInputSlot = NULL;
+  free(vptrans->rgbDerivEqn);
+  vptrans->rgbDerivEqn = NULL;
+  free(vptrans->rgbOutputEqn);
+  vptrans->rgbOutputEqn = NULL;
+  free(vptrans->rgpexJacob);
+  vptrans->rgpexJacob = NULL;
+  FreeExprPool(&vptrans->poolJacob);
+  free(vptrans->rglJacobRow);
+  free(vptrans->rgiJacobCol);
+  vptrans->rglJacobRow = NULL;
+  vptrans->rgiJacobCol = NULL;
+  free(vptrans->rglJacobRun);
+  free(vptrans->rglJacobColStride);
+  free(vptrans->rgplJacobStride); /* Their strides are in the model arena */
+  vptrans->rglJacobRun = NULL;
+  vptrans->rglJacobColStride = NULL;
+  vptrans->rgplJacobStride = NULL;
+  free(vptrans->rgpexDyn);
+  vptrans->rgpexDyn = NULL;
+  free(vptrans->rgbDynRewritten);
+  vptrans->rgbDynRewritten = NULL;
+  free(vptrans->rgbDynUnused);
+  vptrans->rgbDynUnused = NULL;
+  free(vptrans->rgbDynCalcOut);
+  vptrans->rgbDynCalcOut = NULL;
+  FreeExprCse(&vptrans->cse);
+  vptrans->bCse = FALSE;
+  free(vptrans->hoist.rgpex);
+  vptrans->hoist.rgpex = NULL;
+  vptrans->hoist.nSlots = 0;
+  FreeExprPool(&vptrans->poolHoist);
+} /* Free_R_Model */
 
-    fclose(pfile);
+/* ----------------------------------------------------------------------------
+   Write_R_ModelStreams
 
-    Rprintf("\n* Created C model file '%s'.\n\n", szFileOut);
+   Writes the model for R to the open streams pfileC and pfileR, see
+   Write_R_Streams().
+*/
+int Write_R_ModelStreams(PINPUTINFO pinfo, PFILE pfileC, PFILE pfileR, PSTR szTitle) {
+  int ret = Write_R_Streams(pinfo, pfileC, pfileR, szTitle);
 
-  } /* if */
-  else {
-    PROPAGATE_EXIT(ReportError(NULL, RE_CANNOTOPEN | RE_FATAL, szFileOut, "in Write_R_Model ()"));
-  }
+  Free_R_Model();
+  return ret;
+} /* Write_R_ModelStreams */
+
+/* ----------------------------------------------------------------------------
+   Write_R_Model
+
+   Writes a deSolve (R package) compatible C file "szOutFilename"
+   corresponding to equations given, and the R file initializing it.
+*/
+int Write_R_Model(PINPUTINFO pinfo, PSTR szFileOut) {
+  PFILE pfileC, pfileR;
+  PSTR Rfile;
+  PSTR Rappend = "_inits.R";
+  size_t nRout, nbase;
+  char *lastdot;
+  int ret;
 
-  /* Write a function to initialize everything */
   /* Construct the name of the R file.  If szFileOut is
      fu.c, R file is fu_inits.R
   */
   lastdot = strrchr(szFileOut, '.');
-  if (lastdot != NULL) {
-    *lastdot = '\0';
-  }
-  nbase = strlen(szFileOut);
+  nbase = (lastdot ? (size_t)(lastdot - szFileOut) : strlen(szFileOut));
 
   /* Length of buffer for new file name: includes terminating null */
   nRout = nbase + strlen(Rappend) + 1;
   Rfile = (PSTR)malloc(nRout);
-  Rfile = strncpy(Rfile, szFileOut, nbase + 1);
+  if (!Rfile) {
+    return ReportError(NULL, RE_OUTOFMEM | RE_FATAL, "Write_R_Model", NULL);
+  }
+  strncpy(Rfile, szFileOut, nbase);
   Rfile[nbase] = '\0';
-  Rfile = strcat(Rfile, Rappend);
-  pfile = fopen(Rfile, "w");
-  if (pfile) {
-    PROPAGATE_EXIT(Write_R_InitPOS(pfile, pinfo->pvmGloVars, pinfo->pvmScaleEqns));
-    fclose(pfile);
-    Rprintf("\n* Created R parameter initialization file '%s'.\n\n", Rfile);
-  } else {
-    PROPAGATE_EXIT(ReportError(NULL, RE_CANNOTOPEN | RE_FATAL, Rfile, "in Write_R_Model ()"));
+  strcat(Rfile, Rappend);
+
+  pfileC = fopen(szFileOut, "w");
+  if (!pfileC) {
+    free(Rfile);
+    return ReportError(NULL, RE_CANNOTOPEN | RE_FATAL, szFileOut, "in Write_R_Model ()");
+  }
+  pfileR = fopen(Rfile, "w");
+  if (!pfileR) {
+    fclose(pfileC);
+    ret = ReportError(NULL, RE_CANNOTOPEN | RE_FATAL, Rfile, "in Write_R_Model ()");
+    free(Rfile);
+    return ret;
+  }
+
+  ret = Write_R_ModelStreams(pinfo, pfileC, pfileR, szFileOut);
+  fclose(pfileC);
+  fclose(pfileR);
+
+  if (ret != EXIT_ERROR && ret != EXIT_NOERROR) {
+    ConsolePrintf("\n* Created C model file '%s'.\n\n", szFileOut);
+    ConsolePrintf("\n* Created R parameter initialization file '%s'.\n\n", Rfile);
   }
 
   free(Rfile);
-  return 0;
+  return ret;
 } /* Write_R_Model */
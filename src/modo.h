@@ -40,27 +40,49 @@ typedef int (*PFI_CALLBACK)(PFILE, PVMMAPSTRCT, PVOID);
 /* ---------------------------------------------------------------------------
    Prototypes */
 
+__attribute__((warn_unused_result)) int AdjustDoseHandles(PVMMAPSTRCT pvmDoses);
+__attribute__((warn_unused_result)) int AdjustOneDose(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
 __attribute__((warn_unused_result)) int AdjustOneVar(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
 __attribute__((warn_unused_result)) int AdjustVarHandles(PVMMAPSTRCT pvmGlo);
 __attribute__((warn_unused_result)) int AssertExistsEqn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
+__attribute__((warn_unused_result)) int BuildJacobPattern(PINPUTINFO pinfo);
+__attribute__((warn_unused_result)) int BuildSymJacob(PINPUTINFO pinfo);
+__attribute__((warn_unused_result)) int CollectDelays(PINPUTINFO pinfo);
+__attribute__((warn_unused_result)) int CollectOneDelay(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
 __attribute__((warn_unused_result)) int CountOneDecl(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
+__attribute__((warn_unused_result)) int CountOneInputFn(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
+__attribute__((warn_unused_result)) int CountRoots(PVMMAPSTRCT pvmRoots);
+__attribute__((warn_unused_result)) int EqnReads(PVMMAPSTRCT pvm, PSTR szName, BOOL *pbReads);
 __attribute__((warn_unused_result)) int ForAllVar(PFILE pfile, PVMMAPSTRCT pvm, PFI_CALLBACK pfiFunc, HANDLE hType,
                                                   PVOID pinfo);
 __attribute__((warn_unused_result)) int ForAllVarwSep(PFILE pfile, PVMMAPSTRCT pvm, PFI_CALLBACK pfiFunc, HANDLE htype,
                                                       PVOID pinfo);
+void Free_R_Model(void);
+int HasInline(PVMMAPSTRCT pvm);
+BOOL HasInputJumps(PVMMAPSTRCT pvmGlo);
+__attribute__((warn_unused_result)) int OptimizeDynamics(PINPUTINFO pinfo);
+__attribute__((warn_unused_result)) int PlanArrayLoops(PINPUTINFO pinfo);
 PSTR GetName(PVMMAPSTRCT pvm, PSTR szModelVarName, PSTR szDerivName, HANDLE hType);
 __attribute__((warn_unused_result)) int IndexOneVar(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
 __attribute__((warn_unused_result)) int IndexVariables(PVMMAPSTRCT pvmGlo);
+__attribute__((warn_unused_result)) int MarkDerivEqns(PVMMAPSTRCT pvmDyn, int *pnOutOnly);
+__attribute__((warn_unused_result)) int MarkOutputEqns(PVMMAPSTRCT pvmDyn, PVMMAPSTRCT pvmCalcOut);
 void ReversePointers(PVMMAPSTRCT *ppvm);
-__attribute__((warn_unused_result)) int TranslateEquation(PFILE pfile, PSTR szEqn, long iEqType);
+__attribute__((warn_unused_result)) int TranslateEquation(PFILE pfile, PVMMAPSTRCT pvm, long iEqType);
 __attribute__((warn_unused_result)) int TranslateID(PINPUTBUF pibDum, PFILE pfile, PSTR szLex, int iEqType);
 __attribute__((warn_unused_result)) int VerifyEqns(PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn);
+__attribute__((warn_unused_result)) int WriteArrayLoop(PFILE pfile, PARRAYEQN parr, long iEqType);
+__attribute__((warn_unused_result)) int WriteBatchLoop(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn,
+                                                       PVMMAPSTRCT pvmCalcOut, BOOL bOutputs);
 __attribute__((warn_unused_result)) int WriteCalcDeriv(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn);
 __attribute__((warn_unused_result)) int WriteCalcJacob(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmJacob);
 __attribute__((warn_unused_result)) int WriteCalcOutputs(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmCalcOut);
 __attribute__((warn_unused_result)) int WriteDecls(PFILE pfile, PVMMAPSTRCT pvmGlo);
+__attribute__((warn_unused_result)) int WriteDerivEqns(PFILE pfile, PVMMAPSTRCT pvmDyn, BOOL *rgbEqn);
 __attribute__((warn_unused_result)) int WriteHeader(PFILE pfile, PSTR szName, PVMMAPSTRCT pvmGlo);
+void WriteHistVars(PFILE pfile, HANDLE hType, PSTR szFmt);
 void WriteIncludes(PFILE pfile);
+void WriteLoopRef(PFILE pfile, PSTR szName, long lStride);
 __attribute__((warn_unused_result)) int WriteInitModel(PFILE pfile, PVMMAPSTRCT pvmGlo);
 __attribute__((warn_unused_result)) int WriteModel(PINPUTINFO pinfo, PSTR szFileOut);
 __attribute__((warn_unused_result)) int WriteOneDecl(PFILE pfile, PVMMAPSTRCT pvm, PVOID pInfo);
@@ -78,16 +100,33 @@ __attribute__((warn_unused_result)) int WriteScale(PFILE pfile, PVMMAPSTRCT pvmG
 __attribute__((warn_unused_result)) int WriteVarMap(PFILE pfile, PVMMAPSTRCT pvmGlo);
 __attribute__((warn_unused_result)) int Write_R_CalcDeriv(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn,
                                                           PVMMAPSTRCT pvmCalcOut);
+__attribute__((warn_unused_result)) int Write_R_CalcDerivBatch(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn,
+                                                               PVMMAPSTRCT pvmCalcOut);
+__attribute__((warn_unused_result)) int Write_R_CalcOutputs(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDyn,
+                                                            PVMMAPSTRCT pvmCalcOut);
 __attribute__((warn_unused_result)) int Write_R_CalcJacob(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmJacob);
 __attribute__((warn_unused_result)) int Write_R_Decls(PFILE pfile, PVMMAPSTRCT pvmGlo);
+__attribute__((warn_unused_result)) int Write_R_Doses(PFILE pfile, PVMMAPSTRCT pvmDoses);
 __attribute__((warn_unused_result)) int Write_R_Events(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmEvents);
+void Write_R_HistDefines(PFILE pfile);
+void Write_R_History(PFILE pfile);
+void Write_R_Hoist(PFILE pfile, PSTR szFunc, PSTR szArgs);
 void Write_R_Includes(PFILE pfile);
+__attribute__((warn_unused_result)) int Write_R_InputFns(PFILE pfile, PVMMAPSTRCT pvmGlo);
+void Write_R_InputsCall(PFILE pfile, PSTR szTime);
+__attribute__((warn_unused_result)) int Write_R_InputTimes(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmDoses);
+__attribute__((warn_unused_result)) int Write_R_InputsBody(PFILE pfile, PVMMAPSTRCT pvmGlo);
+__attribute__((warn_unused_result)) int Write_R_JacobPattern(PFILE pfile);
 void Write_R_InitModel(PFILE pfile, PVMMAPSTRCT pvmGlo);
+void Write_R_ModelInfo(PFILE pfile, PINPUTINFO pinfo);
 __attribute__((warn_unused_result)) int Write_R_InitPOS(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmScale);
 __attribute__((warn_unused_result)) int Write_R_Model(PINPUTINFO pinfo, PSTR szFileOut);
+__attribute__((warn_unused_result)) int Write_R_ModelStreams(PINPUTINFO pinfo, PFILE pfileC, PFILE pfileR,
+                                                             PSTR szTitle);
 __attribute__((warn_unused_result)) int Write_R_Roots(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmRoots);
 __attribute__((warn_unused_result)) int Write_R_Scale(PFILE pfile, PVMMAPSTRCT pvmGlo, PVMMAPSTRCT pvmScale);
 __attribute__((warn_unused_result)) int Write_R_State_Scale(PFILE pfile, PVMMAPSTRCT pvmScale);
+__attribute__((warn_unused_result)) int Write_R_Streams(PINPUTINFO pinfo, PFILE pfileC, PFILE pfileR, PSTR szTitle);
 
 #define MODO_H_DEFINED
 #endif
@@ -0,0 +1,820 @@
+/* odesolve.c
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   A small native ODE integrator for the drivers that cannot go through
+   deSolve (which keeps its state in globals and calls back into R).
+
+   Dormand-Prince 5(4) explicit Runge-Kutta with adaptive step size
+   (Hairer, Norsett & Wanner, Solving ODEs I, II.5), with Hairer's test
+   of stiffness, and for stiff problems the Rosenbrock method ROS3, which
+   is linearly implicit: each step solves linear systems with the
+   Jacobian instead of iterating. The solver never calls the R API, so
+   several may run at once on different threads, each with its own
+   ODESOLVER.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "odesolve.h"
+
+/* Dormand-Prince tableau */
+#define C2 (1.0 / 5.0)
+#define C3 (3.0 / 10.0)
+#define C4 (4.0 / 5.0)
+#define C5 (8.0 / 9.0)
+
+#define A21 (1.0 / 5.0)
+#define A31 (3.0 / 40.0)
+#define A32 (9.0 / 40.0)
+#define A41 (44.0 / 45.0)
+#define A42 (-56.0 / 15.0)
+#define A43 (32.0 / 9.0)
+#define A51 (19372.0 / 6561.0)
+#define A52 (-25360.0 / 2187.0)
+#define A53 (64448.0 / 6561.0)
+#define A54 (-212.0 / 729.0)
+#define A61 (9017.0 / 3168.0)
+#define A62 (-355.0 / 33.0)
+#define A63 (46732.0 / 5247.0)
+#define A64 (49.0 / 176.0)
+#define A65 (-5103.0 / 18656.0)
+#define A71 (35.0 / 384.0)
+#define A73 (500.0 / 1113.0)
+#define A74 (125.0 / 192.0)
+#define A75 (-2187.0 / 6784.0)
+#define A76 (11.0 / 84.0)
+
+/* Error estimate: difference of the 5th and 4th order solutions */
+#define E1 (71.0 / 57600.0)
+#define E3 (-71.0 / 16695.0)
+#define E4 (71.0 / 1920.0)
+#define E5 (-17253.0 / 339200.0)
+#define E6 (22.0 / 525.0)
+#define E7 (-1.0 / 40.0)
+
+#define SAFETY 0.9
+#define FAC_MIN 0.2
+#define FAC_MAX 10.0
+
+/* Stiffness test (Hairer's DOPRI5): h * lambda beyond the stability
+   boundary of the method in STIFF_STEPS accepted steps, NONSTIFF_STEPS in
+   a row within it starting the count afresh */
+#define STIFF_HLAMB 3.25
+#define STIFF_STEPS 15
+#define NONSTIFF_STEPS 6
+
+/* ROS3 tableau (Sandu et al., Atmos. Environ. 31:3459, 1997): L-stable,
+   order 3(2), 3 stages and 2 evaluations of f per step. Stage i solves
+   (I / (h gamma) - J) k_i = f(t + alpha_i h, y + sum_j a_ij k_j)
+                             + sum_j c_ij / h k_j + gamma_i h df/dt,
+   the third reusing f of the second. */
+#define ROS_GAMMA 0.43586652150845899941601945119356
+#define ROS_ALPHA2 0.43586652150845899941601945119356
+#define ROS_A21 1.0
+#define ROS_A31 1.0
+#define ROS_C21 (-1.0156171083877702091975600115545)
+#define ROS_C31 4.0759956452537699824805835358067
+#define ROS_C32 9.2076794298330791242156818474003
+#define ROS_GAMMA1 0.43586652150845899941601945119356
+#define ROS_GAMMA2 0.24291996454816804366592249683314
+#define ROS_GAMMA3 2.1851380027664058511513169485832
+#define ROS_M1 1.0
+#define ROS_M2 6.1697947043828245592553615689730
+#define ROS_M3 (-0.42772256543218573326238373806514)
+#define ROS_E1 0.5
+#define ROS_E2 (-2.9079558716805469821718236208017)
+#define ROS_E3 0.22354069897811569627360909276199
+
+/* ----------------------------------------------------------------------------
+   InitOdeSolver
+
+   Allocates the work space for nEq equations and sets default
+   tolerances. Returns 0 on success, 1 if out of memory.
+*/
+int InitOdeSolver(PODESOLVER psolv, int nEq, PFN_ODERHS pfnRhs, PVOID pData) {
+  psolv->nEq = nEq;
+  psolv->dRtol = 1e-6;
+  psolv->dAtol = 1e-6;
+  psolv->dHmax = 0.0;
+  psolv->dH = 0.0;
+  psolv->nMaxSteps = 5000;
+  psolv->pfnRhs = pfnRhs;
+  psolv->pData = pData;
+  psolv->bStiffTest = FALSE;
+  psolv->nStiff = psolv->nNonStiff = 0;
+  psolv->pfnJac = NULL;
+  psolv->rgdJac = NULL;
+  psolv->rgiPivot = NULL;
+  psolv->pfnStep = NULL;
+  psolv->rgdWork = (PDOUBLE)malloc(9 * (nEq > 0 ? nEq : 1) * sizeof(double));
+
+  return (psolv->rgdWork ? 0 : 1);
+
+} /* InitOdeSolver */
+
+/* ----------------------------------------------------------------------------
+   InitRosenbrock
+
+   Allocates the work space of RosenbrockAdvance() on a solver set up by
+   InitOdeSolver(). pfnJac computes the Jacobian, or is NULL to compute it
+   by finite differences. Returns 0 on success, 1 if out of memory.
+*/
+int InitRosenbrock(PODESOLVER psolv, PFN_ODEJAC pfnJac) {
+  size_t n = (size_t)(psolv->nEq > 0 ? psolv->nEq : 1);
+
+  psolv->pfnJac = pfnJac;
+  psolv->rgdJac = (PDOUBLE)malloc(2 * n * n * sizeof(double));
+  psolv->rgiPivot = (PINT)malloc(n * sizeof(int));
+
+  return (psolv->rgdJac && psolv->rgiPivot ? 0 : 1);
+
+} /* InitRosenbrock */
+
+/* ----------------------------------------------------------------------------
+   FreeOdeSolver
+*/
+void FreeOdeSolver(PODESOLVER psolv) {
+  free(psolv->rgdWork);
+  free(psolv->rgdJac);
+  free(psolv->rgiPivot);
+  psolv->rgdWork = NULL;
+  psolv->rgdJac = NULL;
+  psolv->rgiPivot = NULL;
+
+} /* FreeOdeSolver */
+
+/* ----------------------------------------------------------------------------
+   ErrorNorm
+
+   Weighted RMS norm of rgdErr, scaled by the tolerances.
+*/
+static double ErrorNorm(PODESOLVER psolv, PDOUBLE rgdErr, PDOUBLE rgdY0, PDOUBLE rgdY1) {
+  int i;
+  double dSum = 0.0, dSc, dE;
+
+  for (i = 0; i < psolv->nEq; i++) {
+    dSc = psolv->dAtol + psolv->dRtol * fmax(fabs(rgdY0[i]), (rgdY1 ? fabs(rgdY1[i]) : 0.0));
+    dE = rgdErr[i] / dSc;
+    dSum += dE * dE;
+  }
+
+  return (psolv->nEq > 0 ? sqrt(dSum / psolv->nEq) : 0.0);
+
+} /* ErrorNorm */
+
+/* ----------------------------------------------------------------------------
+   InitialStep
+
+   Picks a starting step size from the scale of the solution and its
+   derivatives (Hairer's HINIT). rgdF0 holds f(dT, rgdY); rgdY1 and rgdF1
+   are scratch.
+*/
+static double InitialStep(PODESOLVER psolv, double dT, double dSpan, PDOUBLE rgdY, PDOUBLE rgdF0, PDOUBLE rgdY1,
+                          PDOUBLE rgdF1) {
+  int i;
+  double d0, d1, d2, dH0, dH1;
+
+  d0 = ErrorNorm(psolv, rgdY, rgdY, NULL);
+  d1 = ErrorNorm(psolv, rgdF0, rgdY, NULL);
+  dH0 = (d0 < 1e-5 || d1 < 1e-5 ? 1e-6 : 0.01 * d0 / d1);
+  dH0 = fmin(dH0, dSpan);
+
+  for (i = 0; i < psolv->nEq; i++) {
+    rgdY1[i] = rgdY[i] + dH0 * rgdF0[i];
+  }
+  (*psolv->pfnRhs)(psolv->pData, dT + dH0, rgdY1, rgdF1);
+
+  for (i = 0; i < psolv->nEq; i++) {
+    rgdF1[i] -= rgdF0[i];
+  }
+  d2 = ErrorNorm(psolv, rgdF1, rgdY, NULL) / dH0;
+
+  if (fmax(d1, d2) <= 1e-15) {
+    dH1 = fmax(1e-6, dH0 * 1e-3);
+  } else {
+    dH1 = pow(0.01 / fmax(d1, d2), 1.0 / 5.0);
+  }
+
+  return (fmin(100.0 * dH0, dH1));
+
+} /* InitialStep */
+
+/* ----------------------------------------------------------------------------
+   StiffTest
+
+   Hairer's test of stiffness, after an accepted Dormand-Prince step of
+   size dH: h * lambda is estimated from the last two stages, rgdK6 at
+   rgdYs and rgdK7 at rgdYnew. Element i of these is at i * iStride.
+   Updates the counters and returns TRUE if the problem is stiff.
+*/
+static BOOL StiffTest(int n, size_t iStride, double dH, PDOUBLE rgdK6, PDOUBLE rgdK7, PDOUBLE rgdYs, PDOUBLE rgdYnew,
+                      PINT pnStiff, PINT pnNonStiff) {
+  int i;
+  double dNum = 0.0, dDen = 0.0, d;
+
+  for (i = 0; i < n; i++) {
+    d = rgdK7[i * iStride] - rgdK6[i * iStride];
+    dNum += d * d;
+    d = rgdYnew[i * iStride] - rgdYs[i * iStride];
+    dDen += d * d;
+  }
+
+  if (dDen > 0.0 && dH * sqrt(dNum / dDen) > STIFF_HLAMB) {
+    *pnNonStiff = 0;
+    return (++*pnStiff >= STIFF_STEPS);
+  }
+
+  if (++*pnNonStiff >= NONSTIFF_STEPS) {
+    *pnStiff = 0;
+  }
+
+  return (FALSE);
+
+} /* StiffTest */
+
+/* ----------------------------------------------------------------------------
+   Dopri5Advance
+
+   Integrates rgdY from *pdT to dTout (> *pdT), landing exactly on dTout.
+   On return *pdT is the time reached and psolv->dH the step size to try
+   next, so successive calls continue smoothly over an output grid.
+
+   Returns ODE_SUCCESS, or ODE_TOOMANYSTEPS / ODE_STEPTOOSMALL, in which
+   case rgdY and *pdT hold the last accepted point. With bStiffTest set,
+   returns ODE_STIFF at the accepted point where the problem is found
+   stiff; the counters of the test carry over from call to call.
+*/
+int Dopri5Advance(PODESOLVER psolv, PDOUBLE pdT, double dTout, PDOUBLE rgdY) {
+  int i, n = psolv->nEq;
+  long nSteps = 0;
+  double dT = *pdT, dH, dHnext, dErr, dFac;
+  BOOL bLast, bStiff;
+  PDOUBLE k1 = psolv->rgdWork;
+  PDOUBLE k2 = k1 + n, k3 = k2 + n, k4 = k3 + n, k5 = k4 + n, k6 = k5 + n, k7 = k6 + n;
+  PDOUBLE rgdYtmp = k7 + n, rgdYnew = rgdYtmp + n;
+
+  if (dTout <= dT) {
+    return (ODE_SUCCESS);
+  }
+
+  (*psolv->pfnRhs)(psolv->pData, dT, rgdY, k1);
+
+  dH = psolv->dH;
+  if (dH <= 0.0) {
+    dH = InitialStep(psolv, dT, dTout - dT, rgdY, k1, rgdYtmp, k2);
+  }
+
+  do {
+    if (psolv->dHmax > 0.0 && dH > psolv->dHmax) {
+      dH = psolv->dHmax;
+    }
+
+    /* Shorten the last step to land on dTout, but remember the step size
+       the controller wanted so the next interval does not restart small */
+    dHnext = dH;
+    bLast = (dT + dH >= dTout);
+    if (bLast) {
+      dH = dTout - dT;
+    }
+
+    if (dT + dH == dT) {
+      *pdT = dT;
+      return (ODE_STEPTOOSMALL);
+    }
+
+    for (i = 0; i < n; i++) {
+      rgdYtmp[i] = rgdY[i] + dH * A21 * k1[i];
+    }
+    (*psolv->pfnRhs)(psolv->pData, dT + C2 * dH, rgdYtmp, k2);
+
+    for (i = 0; i < n; i++) {
+      rgdYtmp[i] = rgdY[i] + dH * (A31 * k1[i] + A32 * k2[i]);
+    }
+    (*psolv->pfnRhs)(psolv->pData, dT + C3 * dH, rgdYtmp, k3);
+
+    for (i = 0; i < n; i++) {
+      rgdYtmp[i] = rgdY[i] + dH * (A41 * k1[i] + A42 * k2[i] + A43 * k3[i]);
+    }
+    (*psolv->pfnRhs)(psolv->pData, dT + C4 * dH, rgdYtmp, k4);
+
+    for (i = 0; i < n; i++) {
+      rgdYtmp[i] = rgdY[i] + dH * (A51 * k1[i] + A52 * k2[i] + A53 * k3[i] + A54 * k4[i]);
+    }
+    (*psolv->pfnRhs)(psolv->pData, dT + C5 * dH, rgdYtmp, k5);
+
+    for (i = 0; i < n; i++) {
+      rgdYtmp[i] = rgdY[i] + dH * (A61 * k1[i] + A62 * k2[i] + A63 * k3[i] + A64 * k4[i] + A65 * k5[i]);
+    }
+    (*psolv->pfnRhs)(psolv->pData, dT + dH, rgdYtmp, k6);
+
+    for (i = 0; i < n; i++) {
+      rgdYnew[i] = rgdY[i] + dH * (A71 * k1[i] + A73 * k3[i] + A74 * k4[i] + A75 * k5[i] + A76 * k6[i]);
+    }
+    (*psolv->pfnRhs)(psolv->pData, dT + dH, rgdYnew, k7);
+
+    /* The error goes into k2, which is not used past here; rgdYtmp still
+       holds the argument of k6, for the stiffness test */
+    for (i = 0; i < n; i++) {
+      k2[i] = dH * (E1 * k1[i] + E3 * k3[i] + E4 * k4[i] + E5 * k5[i] + E6 * k6[i] + E7 * k7[i]);
+    }
+    dErr = ErrorNorm(psolv, k2, rgdY, rgdYnew);
+
+    if (dErr <= 1.0) { /* Accept */
+      bStiff = (psolv->bStiffTest &&
+                StiffTest(n, 1, dH, k6, k7, rgdYtmp, rgdYnew, &psolv->nStiff, &psolv->nNonStiff));
+      dT = (bLast ? dTout : dT + dH);
+      memcpy(rgdY, rgdYnew, n * sizeof(double));
+      memcpy(k1, k7, n * sizeof(double)); /* First same as last */
+      if (psolv->pfnStep) {
+        (*psolv->pfnStep)(psolv->pData, dT, rgdY, k1);
+      }
+
+      dFac = (dErr > 0.0 ? SAFETY * pow(dErr, -1.0 / 5.0) : FAC_MAX);
+      dH = (bLast ? dHnext : dH) * fmin(FAC_MAX, fmax(FAC_MIN, dFac));
+      if (bLast) {
+        break;
+      }
+      if (bStiff) {
+        *pdT = dT;
+        psolv->dH = dH;
+        return (ODE_STIFF);
+      }
+    } else { /* Reject and retry with a smaller step, also if f overflowed */
+      dFac = (isfinite(dErr) ? SAFETY * pow(dErr, -1.0 / 5.0) : FAC_MIN);
+      dH *= fmax(FAC_MIN, dFac);
+    }
+
+  } while (++nSteps < psolv->nMaxSteps);
+
+  *pdT = dT;
+  psolv->dH = dH;
+
+  return (dT < dTout ? ODE_TOOMANYSTEPS : ODE_SUCCESS);
+
+} /* Dopri5Advance */
+
+/* ----------------------------------------------------------------------------
+   LuDecomp
+
+   LU factorization with partial pivoting of the n x n column-major matrix
+   rgdA, in place, as LAPACK's dgetrf. Returns 0, or 1 if rgdA is
+   singular.
+*/
+static int LuDecomp(int n, PDOUBLE rgdA, PINT rgiPivot) {
+  int i, j, k, p;
+  double dMax, d;
+
+  for (k = 0; k < n; k++) {
+    p = k;
+    dMax = fabs(rgdA[k + (size_t)n * k]);
+    for (i = k + 1; i < n; i++) {
+      if (fabs(rgdA[i + (size_t)n * k]) > dMax) {
+        dMax = fabs(rgdA[i + (size_t)n * k]);
+        p = i;
+      }
+    }
+    rgiPivot[k] = p;
+    if (dMax == 0.0 || !isfinite(dMax)) {
+      return (1);
+    }
+
+    if (p != k) {
+      for (j = 0; j < n; j++) {
+        d = rgdA[k + (size_t)n * j];
+        rgdA[k + (size_t)n * j] = rgdA[p + (size_t)n * j];
+        rgdA[p + (size_t)n * j] = d;
+      }
+    }
+
+    for (i = k + 1; i < n; i++) {
+      rgdA[i + (size_t)n * k] /= rgdA[k + (size_t)n * k];
+    }
+    for (j = k + 1; j < n; j++) {
+      d = rgdA[k + (size_t)n * j];
+      if (d != 0.0) { /* Jacobians of compartment models are sparse */
+        for (i = k + 1; i < n; i++) {
+          rgdA[i + (size_t)n * j] -= rgdA[i + (size_t)n * k] * d;
+        }
+      }
+    }
+  } /* for k */
+
+  return (0);
+
+} /* LuDecomp */
+
+/* ----------------------------------------------------------------------------
+   LuSolve
+
+   Solves A x = b in place of rgdB, with the factors of LuDecomp().
+*/
+static void LuSolve(int n, PDOUBLE rgdA, PINT rgiPivot, PDOUBLE rgdB) {
+  int i, k;
+  double d;
+
+  for (k = 0; k < n; k++) {
+    if (rgiPivot[k] != k) {
+      d = rgdB[k];
+      rgdB[k] = rgdB[rgiPivot[k]];
+      rgdB[rgiPivot[k]] = d;
+    }
+  }
+
+  for (k = 0; k < n; k++) {
+    if (rgdB[k] != 0.0) {
+      for (i = k + 1; i < n; i++) {
+        rgdB[i] -= rgdA[i + (size_t)n * k] * rgdB[k];
+      }
+    }
+  }
+
+  for (k = n - 1; k >= 0; k--) {
+    rgdB[k] /= rgdA[k + (size_t)n * k];
+    if (rgdB[k] != 0.0) {
+      for (i = 0; i < k; i++) {
+        rgdB[i] -= rgdA[i + (size_t)n * k] * rgdB[k];
+      }
+    }
+  }
+
+} /* LuSolve */
+
+/* ----------------------------------------------------------------------------
+   Jacobian
+
+   Computes the Jacobian at (dT, rgdY) into psolv->rgdJac, with pfnJac or
+   else by forward differences, with the increments of Hairer's RADAU5.
+   rgdF0 holds f(dT, rgdY); rgdF is scratch. rgdY is left unchanged.
+*/
+static void Jacobian(PODESOLVER psolv, double dT, PDOUBLE rgdY, PDOUBLE rgdF0, PDOUBLE rgdF) {
+  int i, j, n = psolv->nEq;
+  double dY, dDelta;
+  PDOUBLE rgdCol;
+
+  if (psolv->pfnJac) {
+    (*psolv->pfnJac)(psolv->pData, dT, rgdY, psolv->rgdJac);
+    return;
+  }
+
+  for (j = 0; j < n; j++) {
+    dY = rgdY[j];
+    rgdY[j] = dY + sqrt(DBL_EPSILON * fmax(1e-5, fabs(dY)));
+    dDelta = rgdY[j] - dY; /* Exactly representable */
+    (*psolv->pfnRhs)(psolv->pData, dT, rgdY, rgdF);
+    rgdY[j] = dY;
+
+    rgdCol = psolv->rgdJac + (size_t)n * j;
+    for (i = 0; i < n; i++) {
+      rgdCol[i] = (rgdF[i] - rgdF0[i]) / dDelta;
+    }
+  }
+
+} /* Jacobian */
+
+/* ----------------------------------------------------------------------------
+   RosenbrockAdvance
+
+   Integrates rgdY from *pdT to dTout (> *pdT) with the Rosenbrock method
+   ROS3, for stiff problems; InitRosenbrock() must have been called. Same
+   contract as Dopri5Advance(), without the stiffness test; the solver may
+   switch over from one to the other. The Jacobian and df/dt (by a
+   forward difference) are computed once per accepted step.
+*/
+int RosenbrockAdvance(PODESOLVER psolv, PDOUBLE pdT, double dTout, PDOUBLE rgdY) {
+  int i, n = psolv->nEq;
+  long nSteps = 0;
+  size_t nn = (size_t)n * n, ij;
+  double dT = *pdT, dH, dHnext, dErr, dFac, dDelta;
+  BOOL bLast, bNewJac = TRUE, bRejected = FALSE;
+  PDOUBLE rgdF0 = psolv->rgdWork;
+  PDOUBLE rgdFt = rgdF0 + n, k1 = rgdFt + n, k2 = k1 + n, k3 = k2 + n, rgdF = k3 + n;
+  PDOUBLE rgdYtmp = rgdF + n, rgdYnew = rgdYtmp + n, rgdErr = rgdYnew + n;
+  PDOUBLE rgdJac = psolv->rgdJac, rgdLU = rgdJac + nn;
+
+  if (dTout <= dT) {
+    return (ODE_SUCCESS);
+  }
+
+  (*psolv->pfnRhs)(psolv->pData, dT, rgdY, rgdF0);
+
+  dH = psolv->dH;
+  if (dH <= 0.0) {
+    dH = InitialStep(psolv, dT, dTout - dT, rgdY, rgdF0, rgdYtmp, rgdF);
+  }
+
+  do {
+    if (psolv->dHmax > 0.0 && dH > psolv->dHmax) {
+      dH = psolv->dHmax;
+    }
+
+    dHnext = dH;
+    bLast = (dT + dH >= dTout);
+    if (bLast) {
+      dH = dTout - dT;
+    }
+
+    if (dT + dH == dT) {
+      *pdT = dT;
+      return (ODE_STEPTOOSMALL);
+    }
+
+    if (bNewJac) { /* Kept when a step is rejected */
+      Jacobian(psolv, dT, rgdY, rgdF0, rgdF);
+      dDelta = sqrt(DBL_EPSILON) * fmax(1e-5, fabs(dT));
+      (*psolv->pfnRhs)(psolv->pData, dT + dDelta, rgdY, rgdF);
+      for (i = 0; i < n; i++) {
+        rgdFt[i] = (rgdF[i] - rgdF0[i]) / dDelta;
+      }
+      bNewJac = FALSE;
+    }
+
+    /* I / (h gamma) - J */
+    for (ij = 0; ij < nn; ij++) {
+      rgdLU[ij] = -rgdJac[ij];
+    }
+    for (i = 0; i < n; i++) {
+      rgdLU[i + (size_t)n * i] += 1.0 / (dH * ROS_GAMMA);
+    }
+    if (LuDecomp(n, rgdLU, psolv->rgiPivot)) { /* Retry with a smaller step */
+      dH *= 0.5;
+      bRejected = TRUE;
+      continue;
+    }
+
+    for (i = 0; i < n; i++) {
+      k1[i] = rgdF0[i] + dH * ROS_GAMMA1 * rgdFt[i];
+    }
+    LuSolve(n, rgdLU, psolv->rgiPivot, k1);
+
+    for (i = 0; i < n; i++) {
+      rgdYtmp[i] = rgdY[i] + ROS_A21 * k1[i];
+    }
+    (*psolv->pfnRhs)(psolv->pData, dT + ROS_ALPHA2 * dH, rgdYtmp, rgdF);
+    for (i = 0; i < n; i++) {
+      k2[i] = rgdF[i] + ROS_C21 / dH * k1[i] + dH * ROS_GAMMA2 * rgdFt[i];
+    }
+    LuSolve(n, rgdLU, psolv->rgiPivot, k2);
+
+    for (i = 0; i < n; i++) {
+      k3[i] = rgdF[i] + (ROS_C31 * k1[i] + ROS_C32 * k2[i]) / dH + dH * ROS_GAMMA3 * rgdFt[i];
+    }
+    LuSolve(n, rgdLU, psolv->rgiPivot, k3);
+
+    for (i = 0; i < n; i++) {
+      rgdYnew[i] = rgdY[i] + ROS_M1 * k1[i] + ROS_M2 * k2[i] + ROS_M3 * k3[i];
+      rgdErr[i] = ROS_E1 * k1[i] + ROS_E2 * k2[i] + ROS_E3 * k3[i];
+    }
+    dErr = ErrorNorm(psolv, rgdErr, rgdY, rgdYnew);
+
+    if (dErr <= 1.0) { /* Accept */
+      dT = (bLast ? dTout : dT + dH);
+      memcpy(rgdY, rgdYnew, n * sizeof(double));
+
+      /* No growth right after a rejection */
+      dFac = (dErr > 0.0 ? SAFETY * pow(dErr, -1.0 / 3.0) : FAC_MAX);
+      dH = (bLast ? dHnext : dH) * fmin(bRejected ? 1.0 : FAC_MAX, fmax(FAC_MIN, dFac));
+      bRejected = FALSE;
+      if (bLast && !psolv->pfnStep) {
+        break;
+      }
+
+      (*psolv->pfnRhs)(psolv->pData, dT, rgdY, rgdF0);
+      bNewJac = TRUE;
+      if (psolv->pfnStep) {
+        (*psolv->pfnStep)(psolv->pData, dT, rgdY, rgdF0);
+      }
+      if (bLast) {
+        break;
+      }
+    } else { /* Reject, also if f overflowed */
+      dFac = (isfinite(dErr) ? SAFETY * pow(dErr, -1.0 / 3.0) : FAC_MIN);
+      dH *= fmax(FAC_MIN, dFac);
+      bRejected = TRUE;
+    }
+
+  } while (++nSteps < psolv->nMaxSteps);
+
+  *pdT = dT;
+  psolv->dH = dH;
+
+  return (dT < dTout ? ODE_TOOMANYSTEPS : ODE_SUCCESS);
+
+} /* RosenbrockAdvance */
+
+/* ----------------------------------------------------------------------------
+   InitOdeBatch
+
+   Allocates a lane-batched solver for nLanes problems of nEq equations.
+   All lanes start idle (rgdT == rgdTout == 0); the caller sets rgdY, rgdT,
+   rgdTout, and sets rgbFresh for a lane whenever it resets the lane's
+   state. Returns 0 on success, 1 if out of memory.
+*/
+int InitOdeBatch(PODEBATCH pob, int nEq, int nLanes, PFN_ODERHS_BATCH pfnRhs, PVOID pData) {
+  size_t nVec = (size_t)(nEq > 0 ? nEq : 1) * nLanes;
+
+  pob->nEq = nEq;
+  pob->nLanes = nLanes;
+  pob->dRtol = 1e-6;
+  pob->dAtol = 1e-6;
+  pob->dHmax = 0.0;
+  pob->nMaxSteps = 5000;
+  pob->pfnRhs = pfnRhs;
+  pob->pData = pData;
+
+  /* States, 7 stages and 2 scratch vectors; then per lane T, Tout, H,
+     stage times, step sizes and error sums */
+  pob->rgdWork = (PDOUBLE)calloc(10 * nVec + 6 * nLanes, sizeof(double));
+  pob->rgnSteps = (PLONG)calloc(nLanes, sizeof(long));
+  pob->rgbFresh = (PINT)calloc(3 * nLanes, sizeof(int)); /* And the stiffness test counters */
+  if (!pob->rgdWork || !pob->rgnSteps || !pob->rgbFresh) {
+    FreeOdeBatch(pob);
+    return (1);
+  }
+
+  pob->rgdY = pob->rgdWork;
+  pob->rgdT = pob->rgdWork + 10 * nVec;
+  pob->rgdTout = pob->rgdT + nLanes;
+  pob->rgdH = pob->rgdTout + nLanes;
+  pob->bStiffTest = FALSE;
+  pob->rgnStiff = pob->rgbFresh + nLanes;
+  pob->rgnNonStiff = pob->rgnStiff + nLanes;
+
+  return (0);
+
+} /* InitOdeBatch */
+
+/* ----------------------------------------------------------------------------
+   FreeOdeBatch
+*/
+void FreeOdeBatch(PODEBATCH pob) {
+  free(pob->rgdWork);
+  free(pob->rgnSteps);
+  free(pob->rgbFresh);
+  pob->rgdWork = NULL;
+  pob->rgnSteps = NULL;
+  pob->rgbFresh = NULL;
+  pob->rgnStiff = NULL;
+  pob->rgnNonStiff = NULL;
+
+} /* FreeOdeBatch */
+
+/* ----------------------------------------------------------------------------
+   Dopri5BatchStep
+
+   Attempts one Dormand-Prince step on every lane that has not reached its
+   target time, with the same formulas as Dopri5Advance(). Lanes at their
+   target take a zero step, so their state is unchanged.
+
+   rgiStatus[w] is set to ODE_SUCCESS if lane w has just reached rgdTout[w],
+   ODE_CONTINUE if it has not, ODE_IDLE if it was already there, or an
+   error code (the lane then keeps its last accepted state). With
+   bStiffTest set, a lane found stiff stops with ODE_STIFF at the step it
+   has just accepted.
+*/
+void Dopri5BatchStep(PODEBATCH pob, PINT rgiStatus) {
+  int i, w, n = pob->nEq, W = pob->nLanes;
+  size_t nVec = (size_t)(n > 0 ? n : 1) * W, iw;
+  BOOL bFresh = FALSE;
+  double dSc, dE, dFac;
+  PDOUBLE y = pob->rgdY;
+  PDOUBLE k1 = y + nVec, k2 = k1 + nVec, k3 = k2 + nVec, k4 = k3 + nVec, k5 = k4 + nVec, k6 = k5 + nVec,
+          k7 = k6 + nVec;
+  PDOUBLE rgdYtmp = k7 + nVec, rgdYnew = rgdYtmp + nVec;
+  PDOUBLE rgdT = pob->rgdT, rgdTout = pob->rgdTout, rgdHprop = pob->rgdH;
+  PDOUBLE rgdTs = rgdHprop + W, rgdH = rgdTs + W, rgdErr = rgdH + W;
+
+  for (w = 0; w < W; w++) {
+    bFresh = bFresh || pob->rgbFresh[w];
+  }
+  if (bFresh) { /* k1 = f(t, y) is only carried over for unchanged lanes */
+    (*pob->pfnRhs)(pob->pData, rgdT, y, k1);
+    memset(pob->rgbFresh, 0, W * sizeof(int));
+  }
+
+  /* Step sizes: zero for idle lanes, shortened to land on targets */
+  for (w = 0; w < W; w++) {
+    rgdH[w] = 0.0;
+    rgdErr[w] = 0.0;
+    if (rgdT[w] >= rgdTout[w]) {
+      rgiStatus[w] = ODE_IDLE;
+      continue;
+    }
+
+    rgiStatus[w] = ODE_CONTINUE;
+    if (rgdHprop[w] <= 0.0) { /* Crude start, the controller adapts it */
+      double d0 = 0.0, d1 = 0.0;
+      for (i = 0; i < n; i++) {
+        iw = (size_t)i * W + w;
+        dSc = pob->dAtol + pob->dRtol * fabs(y[iw]);
+        d0 += (y[iw] / dSc) * (y[iw] / dSc);
+        d1 += (k1[iw] / dSc) * (k1[iw] / dSc);
+      }
+      rgdHprop[w] = (d0 < 1e-10 || d1 < 1e-10 ? 1e-6 : 0.01 * sqrt(d0 / d1));
+    }
+    if (pob->dHmax > 0.0 && rgdHprop[w] > pob->dHmax) {
+      rgdHprop[w] = pob->dHmax;
+    }
+    rgdH[w] = fmin(rgdHprop[w], rgdTout[w] - rgdT[w]);
+    if (rgdT[w] + rgdH[w] == rgdT[w]) {
+      rgiStatus[w] = ODE_STEPTOOSMALL;
+      rgdH[w] = 0.0;
+    }
+  }
+
+#define STAGE(kOut, dC, EXPR)                                                                                          \
+  for (i = 0; i < n; i++) {                                                                                            \
+    for (w = 0; w < W; w++) {                                                                                          \
+      iw = (size_t)i * W + w;                                                                                          \
+      rgdYtmp[iw] = y[iw] + rgdH[w] * (EXPR);                                                                          \
+    }                                                                                                                  \
+  }                                                                                                                    \
+  for (w = 0; w < W; w++) {                                                                                            \
+    rgdTs[w] = rgdT[w] + (dC)*rgdH[w];                                                                                 \
+  }                                                                                                                    \
+  (*pob->pfnRhs)(pob->pData, rgdTs, rgdYtmp, kOut);
+
+  STAGE(k2, C2, A21 * k1[iw])
+  STAGE(k3, C3, A31 * k1[iw] + A32 * k2[iw])
+  STAGE(k4, C4, A41 * k1[iw] + A42 * k2[iw] + A43 * k3[iw])
+  STAGE(k5, C5, A51 * k1[iw] + A52 * k2[iw] + A53 * k3[iw] + A54 * k4[iw])
+  STAGE(k6, 1.0, A61 * k1[iw] + A62 * k2[iw] + A63 * k3[iw] + A64 * k4[iw] + A65 * k5[iw])
+#undef STAGE
+
+  for (i = 0; i < n; i++) {
+    for (w = 0; w < W; w++) {
+      iw = (size_t)i * W + w;
+      rgdYnew[iw] = y[iw] + rgdH[w] * (A71 * k1[iw] + A73 * k3[iw] + A74 * k4[iw] + A75 * k5[iw] + A76 * k6[iw]);
+    }
+  }
+  for (w = 0; w < W; w++) {
+    rgdTs[w] = rgdT[w] + rgdH[w];
+  }
+  (*pob->pfnRhs)(pob->pData, rgdTs, rgdYnew, k7);
+
+  for (i = 0; i < n; i++) {
+    for (w = 0; w < W; w++) {
+      iw = (size_t)i * W + w;
+      dSc = pob->dAtol + pob->dRtol * fmax(fabs(y[iw]), fabs(rgdYnew[iw]));
+      dE = rgdH[w] * (E1 * k1[iw] + E3 * k3[iw] + E4 * k4[iw] + E5 * k5[iw] + E6 * k6[iw] + E7 * k7[iw]) / dSc;
+      rgdErr[w] += dE * dE;
+    }
+  }
+
+  /* Accept or reject per lane */
+  for (w = 0; w < W; w++) {
+    if (rgiStatus[w] != ODE_CONTINUE) {
+      continue;
+    }
+
+    rgdErr[w] = (n > 0 ? sqrt(rgdErr[w] / n) : 0.0);
+    if (rgdErr[w] <= 1.0) {
+      BOOL bLast = (rgdH[w] >= rgdTout[w] - rgdT[w]);
+      BOOL bStiff = (pob->bStiffTest && StiffTest(n, W, rgdH[w], k6 + w, k7 + w, rgdYtmp + w, rgdYnew + w,
+                                                  &pob->rgnStiff[w], &pob->rgnNonStiff[w]));
+
+      rgdT[w] = (bLast ? rgdTout[w] : rgdT[w] + rgdH[w]);
+      for (i = 0; i < n; i++) {
+        iw = (size_t)i * W + w;
+        y[iw] = rgdYnew[iw];
+        k1[iw] = k7[iw]; /* First same as last */
+      }
+
+      dFac = (rgdErr[w] > 0.0 ? SAFETY * pow(rgdErr[w], -1.0 / 5.0) : FAC_MAX);
+      rgdHprop[w] = (bLast ? fmax(rgdHprop[w], rgdH[w]) : rgdH[w]) * fmin(FAC_MAX, fmax(FAC_MIN, dFac));
+      if (bLast) {
+        rgiStatus[w] = ODE_SUCCESS;
+      } else if (bStiff) {
+        rgiStatus[w] = ODE_STIFF;
+      }
+    } else { /* Reject, also if f overflowed */
+      dFac = (isfinite(rgdErr[w]) ? SAFETY * pow(rgdErr[w], -1.0 / 5.0) : FAC_MIN);
+      rgdHprop[w] = rgdH[w] * fmax(FAC_MIN, dFac);
+    }
+
+    if (rgiStatus[w] == ODE_CONTINUE && ++pob->rgnSteps[w] >= pob->nMaxSteps) {
+      rgiStatus[w] = ODE_TOOMANYSTEPS;
+    }
+  } /* for w */
+
+} /* Dopri5BatchStep */
+
+/* End */
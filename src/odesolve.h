@@ -0,0 +1,121 @@
+/* odesolve.h
+
+   Copyright (c) 1993-2017. Free Software Foundation, Inc.
+
+   This file is part of GNU MCSim.
+
+   GNU MCSim  is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 3
+   of the License, or (at your option) any later version.
+
+   GNU MCSim is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GNU MCSim; if not, see <http://www.gnu.org/licenses/>
+
+   Header file for the native ODE integrator of odesolve.c
+*/
+
+#ifndef ODESOLVE_H_DEFINED
+
+/* ---------------------------------------------------------------------------
+   Inclusions  */
+
+#include "hungtype.h"
+
+/* ---------------------------------------------------------------------------
+   Constants  */
+
+/* Return codes of Dopri5Advance() and RosenbrockAdvance(), as in deSolve's
+   istate; ODE_STIFF as in Hairer's DOPRI5 */
+#define ODE_SUCCESS 0
+#define ODE_TOOMANYSTEPS (-1)
+#define ODE_STEPTOOSMALL (-2)
+#define ODE_STIFF (-4) /* Dopri5 only, with the stiffness test on */
+
+/* Additional lane states of Dopri5BatchStep() */
+#define ODE_CONTINUE 1 /* Lane has not reached its target time yet */
+#define ODE_IDLE 2     /* Lane was already at its target time */
+
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* Right hand side: computes rgdYdot = f(dT, rgdY) */
+typedef void (*PFN_ODERHS)(PVOID pData, double dT, PDOUBLE rgdY, PDOUBLE rgdYdot);
+
+/* Jacobian: computes rgdJac[i + nEq * j] = d f_i / d y_j at (dT, rgdY),
+   column-major as deSolve's */
+typedef void (*PFN_ODEJAC)(PVOID pData, double dT, PDOUBLE rgdY, PDOUBLE rgdJac);
+
+/* Accepted point: rgdYdot = f(dT, rgdY), just computed by pfnRhs */
+typedef void (*PFN_ODESTEP)(PVOID pData, double dT, PDOUBLE rgdY, PDOUBLE rgdYdot);
+
+typedef struct tagODESOLVER {
+  int nEq;
+  double dRtol;
+  double dAtol;
+  double dHmax;    /* Maximum step size, 0 for no limit */
+  double dH;       /* Proposed next step size, 0 to pick one */
+  long nMaxSteps;  /* Maximum steps per call to Dopri5Advance() */
+  PFN_ODERHS pfnRhs;
+  PVOID pData;     /* Passed through to pfnRhs, pfnJac and pfnStep */
+  PDOUBLE rgdWork; /* 9 * nEq doubles */
+  BOOL bStiffTest; /* Dopri5Advance() returns ODE_STIFF once the problem is stiff */
+  int nStiff;      /* Stiffness test counters, set to 0 to start it afresh */
+  int nNonStiff;
+  PFN_ODEJAC pfnJac; /* NULL for finite differences, see InitRosenbrock() */
+  PDOUBLE rgdJac;    /* 2 * nEq * nEq doubles, Jacobian and LU factors */
+  PINT rgiPivot;
+  PFN_ODESTEP pfnStep; /* Called at each accepted point, NULL for none */
+
+} ODESOLVER, *PODESOLVER; /* tagODESOLVER */
+
+/* Lane-batched right hand side. Arrays are [variable][lane]: element
+   i * nLanes + w belongs to lane w, which is at time rgdT[w]. */
+typedef void (*PFN_ODERHS_BATCH)(PVOID pData, PDOUBLE rgdT, PDOUBLE rgdY, PDOUBLE rgdYdot);
+
+/* nLanes independent problems integrated in lockstep: every stage is one
+   call of pfnRhs for all lanes, but each lane has its own time, target
+   time and step size control. */
+typedef struct tagODEBATCH {
+  int nEq;
+  int nLanes;
+  double dRtol;
+  double dAtol;
+  double dHmax;     /* Maximum step size, 0 for no limit */
+  long nMaxSteps;   /* Maximum steps per lane and target time */
+  PFN_ODERHS_BATCH pfnRhs;
+  PVOID pData;      /* Passed through to pfnRhs */
+  PDOUBLE rgdY;     /* [nEq][nLanes] states */
+  PDOUBLE rgdT;     /* [nLanes] current times */
+  PDOUBLE rgdTout;  /* [nLanes] target times */
+  PDOUBLE rgdH;     /* [nLanes] proposed step sizes, 0 to pick one */
+  PLONG rgnSteps;   /* [nLanes] steps taken toward rgdTout */
+  PINT rgbFresh;    /* [nLanes] lane was reset: its k1 is stale */
+  BOOL bStiffTest;  /* A lane that is stiff stops with ODE_STIFF */
+  PINT rgnStiff;    /* [nLanes] stiffness test counters, set to 0 when a */
+  PINT rgnNonStiff; /* lane takes a new problem */
+  PDOUBLE rgdWork;
+
+} ODEBATCH, *PODEBATCH; /* tagODEBATCH */
+
+/* ---------------------------------------------------------------------------
+   Prototypes */
+
+int InitOdeSolver(PODESOLVER psolv, int nEq, PFN_ODERHS pfnRhs, PVOID pData);
+void FreeOdeSolver(PODESOLVER psolv);
+int Dopri5Advance(PODESOLVER psolv, PDOUBLE pdT, double dTout, PDOUBLE rgdY);
+int InitRosenbrock(PODESOLVER psolv, PFN_ODEJAC pfnJac);
+int RosenbrockAdvance(PODESOLVER psolv, PDOUBLE pdT, double dTout, PDOUBLE rgdY);
+int InitOdeBatch(PODEBATCH pob, int nEq, int nLanes, PFN_ODERHS_BATCH pfnRhs, PVOID pData);
+void FreeOdeBatch(PODEBATCH pob);
+void Dopri5BatchStep(PODEBATCH pob, PINT rgiStatus);
+
+#define ODESOLVE_H_DEFINED
+#endif
+
+/* End */
@@ -27,6 +27,10 @@
    Currently supported are:
 
    MyStrlen(), MyStrcpy(), MyStrcmp(), MyStrchr(), MyStrtok()
+
+   LookupWord() finds words in the fixed tables of keywords and
+   function names with a perfect hash, whose slots are written along
+   with the tables (see WORDHASH in strutil.h).
 */
 #define R_NO_REMAP
 #include <R.h>
@@ -60,4 +64,41 @@ int MyStrcmp(const char *sz1, const char *sz2) {
 
 } /* MyStrcmp */
 
+/* ----------------------------------------------------------------------------
+   HashWord
+
+   FNV-1a hash of sz, varied by uSeed.
+*/
+unsigned int HashWord(const char *sz, unsigned int uSeed) {
+  unsigned int uHash = 2166136261u ^ uSeed;
+
+  while (*sz) {
+    uHash = (uHash ^ (unsigned char)*sz++) * 16777619u;
+  }
+  return (uHash ^ (uHash >> 15));
+
+} /* HashWord */
+
+#define WordOfRecord(pwh, i) (*(const char *const *)((const char *)(pwh)->pvTable + (long)(i) * (pwh)->cbRecord))
+
+/* ----------------------------------------------------------------------------
+   LookupWord
+
+   Returns the index of the record of sz in the table of pwh, or that of
+   the end record if sz is not in the table: one hash and one compare.
+   Nothing is written, so translations running in parallel can share
+   the tables.
+*/
+int LookupWord(const WORDHASH *pwh, const char *sz) {
+  int i;
+
+  if (!sz) {
+    return (pwh->iEnd);
+  }
+
+  i = pwh->rgiSlots[HashWord(sz, pwh->uSeed) & (pwh->nSlots - 1)] - 1;
+  return ((i >= 0 && !strcmp(sz, WordOfRecord(pwh, i))) ? i : pwh->iEnd);
+
+} /* LookupWord */
+
 /* End */
@@ -24,6 +24,8 @@
    ultimately call the standard library routines.
 */
 
+#ifndef STRUTIL_H_DEFINED
+
 #define MyStrcpy(szDest, szSource) ((szDest) && (szSource) ? strcpy((szDest), (szSource)) : NULL)
 
 #define MyStrlen(sz) ((sz) ? strlen((sz)) : (int)0)
@@ -32,9 +34,40 @@
 
 #define MyStrtok(sz, szToken) ((sz) && (szToken) ? strtok((sz), (szToken)) : NULL)
 
+/* Fails to compile unless table has nWords words and its end record, so
+   that a WORDHASH is not left behind when words are added or removed */
+#define WH_CHECK_WORDS(name, table, nWords)                                                                            \
+  typedef char name[(sizeof(table) / sizeof((table)[0]) == (nWords) + 1) ? 1 : -1]
+
+/* ---------------------------------------------------------------------------
+   Typedefs */
+
+/* Perfect hash of a fixed table of words, see LookupWord(). The table is
+   an array of records starting with their word (a char *), and ended by
+   a record with the empty word. WORDHASHes are constants, written along
+   with their table: record i goes in slot HashWord(word i, uSeed) &
+   (nSlots - 1), nSlots being the smallest power of 2 from 16 up that is
+   at least twice the number of words, and uSeed the first seed from 1
+   up that gives each word its own slot. They must be written again when
+   the words change. */
+typedef struct tagWORDHASH {
+  const void *pvTable;
+  int cbRecord;           /* Size of the records */
+  int iEnd;               /* Index of the end record: the number of words */
+  unsigned int uSeed;
+  int nSlots;             /* A power of 2 */
+  const short *rgiSlots;  /* Record index + 1, or 0 */
+
+} WORDHASH, *PWORDHASH; /* tagWORDHASH */
+
 /* ---------------------------------------------------------------------------
    Prototypes */
 
+unsigned int HashWord(const char *sz, unsigned int uSeed);
+int LookupWord(const WORDHASH *pwh, const char *sz);
 int MyStrcmp(const char *sz1, const char *sz2);
 
+#define STRUTIL_H_DEFINED
+#endif
+
 /* End */